@@ -0,0 +1,1180 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+// Benchmarks of the embedder, linked against the stub engine so only the
+// embedder's own cost is measured (see stub-engine.c). Built with
+// "make gtk_flutter_benchmark" and run as:
+//
+//   gtk_flutter_benchmark create-destroy [CYCLES]
+//     Creates a view, waits for its first frame and destroys it, reporting the
+//     latency of each cycle and how far RSS drifts from the first cycle.
+//
+//   gtk_flutter_benchmark replay LOG [--software]
+//     Replays an event log written by FlEventRecorder into an offscreen
+//     renderer, and prints a histogram of the time between frames.
+//
+//   gtk_flutter_benchmark cold-start [ASSETS_PATH [ARCHIVE_PATH]]
+//     Reads every asset and starts a view from the flutter_assets directory and
+//     from the packed archive, with the page cache dropped before each run.
+//
+//   gtk_flutter_benchmark semantics [NODES]
+//     Applies a semantics tree of 10000 nodes as the engine sends it, then
+//     batches changing 1% of the labels and batches moving every node.
+//
+//   gtk_flutter_benchmark keypress [PRESSES]
+//     Types into a view, reporting the time from each key press reaching the
+//     view to the next frame being presented.
+//
+//   gtk_flutter_benchmark typing [LENGTH...]
+//     Types into a text field holding 1 KB, 100 KB and 1 MB of text, reporting
+//     how long the view takes to handle each keystroke with and without
+//     editing deltas.
+//
+//   gtk_flutter_benchmark open [RUNS]
+//     Opens views without the engine pool and then with it, reporting the time
+//     from each view being created to its first frame.
+//
+//   gtk_flutter_benchmark topology [SECONDS]
+//     Runs a view with each thread topology, reporting how many threads the
+//     view and its engine add. The stub engine reports the embedder's time per
+//     frame as each view is destroyed.
+//
+//   gtk_flutter_benchmark idle-cpu [SECONDS]
+//     Hides a view and reports the CPU time the process uses while it is
+//     hidden, with the view pausing while hidden and with it rendering anyway.
+//
+//   gtk_flutter_benchmark present-thread [SECONDS]
+//     Runs a view on llvmpipe presenting from the raster thread and then from
+//     the present thread. The stub engine reports the percentiles of the
+//     embedder's time per frame as each view is destroyed.
+//
+//   gtk_flutter_benchmark renderer [FRAMES]
+//     Draws frames through the X11 EGL renderer and through the GDK GL
+//     renderer, reporting the CPU time the process uses per frame. The stub
+//     engine reports the time each present takes as each view is destroyed.
+//
+//   gtk_flutter_benchmark offscreen [RENDERERS [SECONDS]]
+//     Runs offscreen renderers side by side with EGL and then in software,
+//     reading every frame into memory. Reports frames per second and frames
+//     per second of CPU time, which is the throughput of one core.
+//
+//   gtk_flutter_benchmark record [SECONDS [PATH]]
+//     Runs a 1920x1080 view at 60 frames per second without recording and
+//     then recording to PATH, reporting the frames dropped and the CPU time
+//     recording adds.
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "fl-asset-archive.h"
+#include "fl-engine-pool.h"
+#include "fl-event-replayer.h"
+#include "fl-offscreen-renderer.h"
+#include "fl-semantics-tree.h"
+#include "fl-view.h"
+
+// Time to wait for a view's first frame, in microseconds.
+#define FIRST_FRAME_TIMEOUT 5000000
+
+#define DEFAULT_CYCLES 100
+
+#define DEFAULT_ASSETS_PATH "./build/flutter_assets"
+#define DEFAULT_ARCHIVE_PATH "./build/flutter_assets.pak"
+
+#define COLD_START_RUNS 10
+
+#define DEFAULT_SEMANTICS_NODES 10000
+
+// Children of each node in the semantics tree, and batches of each kind applied.
+#define SEMANTICS_FAN_OUT 100
+#define SEMANTICS_RUNS 100
+
+#define DEFAULT_PRESSES 200
+
+// Time given to each key press to reach a frame, in microseconds.
+#define KEYPRESS_INTERVAL 50000
+
+#define TYPING_KEYSTROKES 200
+
+#define DEFAULT_OPEN_RUNS 20
+
+// Time given to the engine pool to start an engine between views, in microseconds.
+#define POOL_REFILL_TIME 500000
+
+#define DEFAULT_TOPOLOGY_SECONDS 5
+
+#define DEFAULT_IDLE_CPU_SECONDS 10
+
+#define DEFAULT_PRESENT_THREAD_SECONDS 5
+
+#define DEFAULT_RENDERER_FRAMES 600
+
+#define DEFAULT_OFFSCREEN_RENDERERS 4
+#define DEFAULT_OFFSCREEN_SECONDS 5
+
+// Size of frames rendered offscreen.
+#define OFFSCREEN_WIDTH 1280
+#define OFFSCREEN_HEIGHT 720
+
+#define DEFAULT_RECORD_SECONDS 10
+#define DEFAULT_RECORD_PATH "benchmark.y4m"
+
+#define RECORD_WIDTH 1920
+#define RECORD_HEIGHT 1080
+
+// Time given to a destroyed view's engine to shut down, so the stub engine's
+// report comes before the next view starts, in microseconds.
+#define SHUTDOWN_TIME 500000
+
+// Time given to a view to stop rendering once hidden, in microseconds.
+#define HIDE_SETTLE_TIME 500000
+
+// Size offscreen renderers start at, before the log resizes them.
+#define REPLAY_WIDTH 800
+#define REPLAY_HEIGHT 600
+
+// Time to wait for each frame while replaying, in microseconds.
+#define REPLAY_FRAME_TIMEOUT 100000
+
+// Width of histogram buckets, in microseconds, and how many there are before
+// the last one takes everything longer.
+#define HISTOGRAM_BUCKET_WIDTH 2000
+#define HISTOGRAM_N_BUCKETS 25
+
+// Longest bar printed in a histogram.
+#define HISTOGRAM_BAR_LENGTH 50
+
+typedef struct
+{
+    const gchar *name;
+    const gchar *arguments;
+    int (*run) (int argc, char **argv);
+} Benchmark;
+
+typedef struct
+{
+    FlOffscreenRenderer *renderer;
+    gint stop;
+    GArray *frame_times;
+} ReplayFrames;
+
+typedef struct
+{
+    FlOffscreenRenderer *renderer;
+    gint *stop;
+    guint64 n_frames;
+} OffscreenFrames;
+
+// Resident set size of the process, in kB.
+static glong
+get_rss (void)
+{
+    g_autofree gchar *status = NULL;
+    if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+        return -1;
+
+    const gchar *rss = strstr (status, "\nVmRSS:");
+    return rss != NULL ? atol (rss + strlen ("\nVmRSS:")) : -1;
+}
+
+// Threads in the process.
+static gint
+get_thread_count (void)
+{
+    g_autofree gchar *status = NULL;
+    if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+        return -1;
+
+    const gchar *threads = strstr (status, "\nThreads:");
+    return threads != NULL ? atoi (threads + strlen ("\nThreads:")) : -1;
+}
+
+// User and system CPU time used by the process, in microseconds.
+static gint64
+get_cpu_time (void)
+{
+    struct rusage usage;
+    if (getrusage (RUSAGE_SELF, &usage) != 0)
+        return -1;
+
+    return ((gint64) usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static gint
+compare_times (gconstpointer a, gconstpointer b)
+{
+    gint64 time_a = *(const gint64 *) a, time_b = *(const gint64 *) b;
+    return time_a < time_b ? -1 : time_a > time_b;
+}
+
+// Print the mean and percentiles of @times, in microseconds. Sorts @times.
+static void
+print_summary (const gchar *name, GArray *times)
+{
+    if (times->len == 0) {
+        g_print ("%s: none\n", name);
+        return;
+    }
+
+    g_array_sort (times, compare_times);
+    gint64 *values = (gint64 *) times->data;
+    gint64 total = 0;
+    for (guint i = 0; i < times->len; i++)
+        total += values[i];
+    g_print ("%s: %u, mean %" G_GINT64_FORMAT "us p50 %" G_GINT64_FORMAT "us p90 %" G_GINT64_FORMAT "us p99 %" G_GINT64_FORMAT "us max %" G_GINT64_FORMAT "us\n",
+             name, times->len, total / times->len, values[times->len / 2], values[times->len * 9 / 10], values[times->len * 99 / 100], values[times->len - 1]);
+}
+
+static void
+print_histogram (GArray *times)
+{
+    gint64 *values = (gint64 *) times->data;
+    guint buckets[HISTOGRAM_N_BUCKETS + 1] = { 0 };
+    guint max_count = 0;
+    for (guint i = 0; i < times->len; i++) {
+        guint bucket = MIN (values[i] / HISTOGRAM_BUCKET_WIDTH, HISTOGRAM_N_BUCKETS);
+        buckets[bucket]++;
+        max_count = MAX (max_count, buckets[bucket]);
+    }
+
+    for (guint i = 0; i <= HISTOGRAM_N_BUCKETS; i++) {
+        if (buckets[i] == 0)
+            continue;
+        g_autofree gchar *bar = g_strnfill ((gsize) buckets[i] * HISTOGRAM_BAR_LENGTH / max_count, '#');
+        if (i < HISTOGRAM_N_BUCKETS)
+            g_print ("  %5.1f-%5.1fms %8u %s\n", i * HISTOGRAM_BUCKET_WIDTH / 1000.0, (i + 1) * HISTOGRAM_BUCKET_WIDTH / 1000.0, buckets[i], bar);
+        else
+            g_print ("  %5.1fms+      %8u %s\n", i * HISTOGRAM_BUCKET_WIDTH / 1000.0, buckets[i], bar);
+    }
+}
+
+// Drop a file from the page cache, which only needs its pages to be clean.
+static void
+evict_file (const gchar *path)
+{
+    int fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return;
+    posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+    close (fd);
+}
+
+// Add the paths of files under @path, relative to @base, to @names.
+static void
+list_files (const gchar *base, const gchar *path, GPtrArray *names)
+{
+    g_autofree gchar *dir_path = g_build_filename (base, path, NULL);
+    g_autoptr(GDir) dir = g_dir_open (dir_path, 0, NULL);
+    if (dir == NULL)
+        return;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        g_autofree gchar *child = path[0] != '\0' ? g_build_filename (path, name, NULL) : g_strdup (name);
+        g_autofree gchar *child_path = g_build_filename (base, child, NULL);
+        if (g_file_test (child_path, G_FILE_TEST_IS_DIR))
+            list_files (base, child, names);
+        else
+            g_ptr_array_add (names, g_steal_pointer (&child));
+    }
+}
+
+static FlView *
+create_view (GtkWidget *window)
+{
+    FlView *view = fl_view_new ();
+    fl_view_set_assets_path (view, DEFAULT_ASSETS_PATH);
+    gtk_widget_show (GTK_WIDGET (view));
+    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (view));
+
+    return view;
+}
+
+static gboolean
+wait_for_first_frame (FlView *view)
+{
+    gint64 end_time = g_get_monotonic_time () + FIRST_FRAME_TIMEOUT;
+    FlViewStartupStats stats;
+
+    do {
+        g_main_context_iteration (NULL, FALSE);
+        fl_view_get_startup_stats (view, &stats);
+    } while (stats.first_frame_time == 0 && g_get_monotonic_time () < end_time);
+
+    if (stats.first_frame_time == 0)
+        g_printerr ("Timed out waiting for the first frame\n");
+
+    return stats.first_frame_time != 0;
+}
+
+// Run the main loop for @time microseconds.
+static void
+iterate_for (gint64 time)
+{
+    gint64 end_time = g_get_monotonic_time () + time;
+    while (g_get_monotonic_time () < end_time)
+        g_main_context_iteration (NULL, FALSE);
+}
+
+// Deliver a key event to @view as if it came from the keyboard.
+static void
+send_key_event (FlView *view, GdkEventType type, guint keyval, guint16 hardware_keycode)
+{
+    GdkWindow *window = gtk_widget_get_window (GTK_WIDGET (view));
+    GdkSeat *seat = gdk_display_get_default_seat (gdk_window_get_display (window));
+
+    GdkEvent *event = gdk_event_new (type);
+    event->key.window = g_object_ref (window);
+    event->key.send_event = FALSE;
+    event->key.time = g_get_monotonic_time () / 1000;
+    event->key.keyval = keyval;
+    event->key.hardware_keycode = hardware_keycode;
+    gdk_event_set_device (event, gdk_seat_get_keyboard (seat));
+    gtk_widget_event (GTK_WIDGET (view), event);
+    gdk_event_free (event);
+}
+
+static int
+benchmark_create_destroy (int argc, char **argv)
+{
+    gint cycles = argc > 0 ? atoi (argv[0]) : DEFAULT_CYCLES;
+    gint64 total_time = 0, max_time = 0;
+    glong first_rss = 0, rss = 0;
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    for (gint i = 0; i < cycles; i++) {
+        gint64 start_time = g_get_monotonic_time ();
+        FlView *view = create_view (window);
+        if (!wait_for_first_frame (view))
+            return EXIT_FAILURE;
+        // Returns once the engine has shut down.
+        gtk_widget_destroy (GTK_WIDGET (view));
+        gint64 time = g_get_monotonic_time () - start_time;
+
+        // The first cycle loads libraries and fills caches, so drift is measured from after it.
+        rss = get_rss ();
+        if (i == 0)
+            first_rss = rss;
+        total_time += time;
+        max_time = MAX (max_time, time);
+        g_print ("cycle %d: %" G_GINT64_FORMAT "us, RSS %ld kB\n", i + 1, time, rss);
+    }
+
+    g_print ("create-destroy: %d cycles, mean %" G_GINT64_FORMAT "us max %" G_GINT64_FORMAT "us\n",
+             cycles, total_time / MAX (cycles, 1), max_time);
+    if (cycles > 1)
+        g_print ("create-destroy: RSS drift %ld kB, %.1f kB per cycle\n",
+                 rss - first_rss, (gdouble) (rss - first_rss) / (cycles - 1));
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+// Take frames as they are drawn, timing the gaps between them.
+static gpointer
+replay_frames_thread (gpointer user_data)
+{
+    ReplayFrames *frames = user_data;
+    gint64 last_frame = 0;
+
+    while (!g_atomic_int_get (&frames->stop)) {
+        if (!fl_offscreen_renderer_wait_for_frame (frames->renderer, NULL, 0, REPLAY_FRAME_TIMEOUT))
+            continue;
+
+        gint64 now = g_get_monotonic_time ();
+        if (last_frame != 0) {
+            gint64 time = now - last_frame;
+            g_array_append_val (frames->frame_times, time);
+        }
+        last_frame = now;
+    }
+
+    return NULL;
+}
+
+static int
+benchmark_replay (int argc, char **argv)
+{
+    g_autoptr(GError) error = NULL;
+
+    if (argc < 1) {
+        g_printerr ("No event log given\n");
+        return EXIT_FAILURE;
+    }
+
+    g_autoptr(FlEventReplayer) replayer = fl_event_replayer_new (argv[0], &error);
+    if (replayer == NULL) {
+        g_printerr ("Failed to load event log: %s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    g_autoptr(FlOffscreenRenderer) renderer = fl_offscreen_renderer_new (REPLAY_WIDTH, REPLAY_HEIGHT);
+    fl_offscreen_renderer_set_assets_path (renderer, DEFAULT_ASSETS_PATH);
+    fl_offscreen_renderer_set_use_software (renderer, argc > 1 && strcmp (argv[1], "--software") == 0);
+    if (!fl_offscreen_renderer_start (renderer))
+        return EXIT_FAILURE;
+
+    ReplayFrames frames = { renderer, FALSE, g_array_new (FALSE, FALSE, sizeof (gint64)) };
+    GThread *thread = g_thread_new ("benchmark-frames", replay_frames_thread, &frames);
+
+    gint64 start_time = g_get_monotonic_time ();
+    fl_event_replayer_start (replayer, renderer);
+    guint n_events = fl_event_replayer_wait (replayer);
+    gint64 replay_time = g_get_monotonic_time () - start_time;
+
+    g_atomic_int_set (&frames.stop, TRUE);
+    g_thread_join (thread);
+
+    g_print ("replay: %u events in %" G_GINT64_FORMAT "us\n", n_events, replay_time);
+    print_summary ("replay: frame time", frames.frame_times);
+    print_histogram (frames.frame_times);
+    g_array_unref (frames.frame_times);
+
+    return EXIT_SUCCESS;
+}
+
+// Start a view as a cold launch would, timing how long it takes to read every
+// asset and how long the view takes to draw its first frame.
+static gboolean
+cold_start (GtkWidget *window, const gchar *assets_path, const gchar *archive_path, gboolean use_archive, GPtrArray *names, gint64 *read_time, gint64 *first_frame_time)
+{
+    g_autoptr(GError) error = NULL;
+
+    for (guint i = 0; i < names->len; i++) {
+        g_autofree gchar *path = g_build_filename (assets_path, g_ptr_array_index (names, i), NULL);
+        evict_file (path);
+    }
+    evict_file (archive_path);
+
+    // The stub engine doesn't read assets, so they are read here as the engine would.
+    gint64 start_time = g_get_monotonic_time ();
+    g_autoptr(FlAssetArchive) archive = NULL;
+    if (use_archive) {
+        archive = fl_asset_archive_new (archive_path, &error);
+        if (archive == NULL) {
+            g_printerr ("Failed to open asset archive: %s\n", error->message);
+            return FALSE;
+        }
+    }
+    for (guint i = 0; i < names->len; i++) {
+        const gchar *name = g_ptr_array_index (names, i);
+        g_autoptr(GBytes) data = NULL;
+        if (archive != NULL) {
+            data = fl_asset_archive_lookup (archive, name, NULL);
+        } else {
+            g_autofree gchar *path = g_build_filename (assets_path, name, NULL);
+            gchar *contents;
+            gsize length;
+            if (g_file_get_contents (path, &contents, &length, NULL))
+                data = g_bytes_new_take (contents, length);
+        }
+        if (data == NULL)
+            continue;
+
+        // Fault in every page of mapped entries.
+        gsize size;
+        const volatile guint8 *contents = g_bytes_get_data (data, &size);
+        for (gsize offset = 0; offset < size; offset += FL_ASSET_ARCHIVE_ALIGNMENT)
+            (void) contents[offset];
+    }
+    *read_time = g_get_monotonic_time () - start_time;
+
+    start_time = g_get_monotonic_time ();
+    FlView *view = fl_view_new ();
+    fl_view_set_assets_path (view, assets_path);
+    fl_view_set_asset_archive (view, archive);
+    gtk_widget_show (GTK_WIDGET (view));
+    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (view));
+    gboolean drawn = wait_for_first_frame (view);
+    *first_frame_time = g_get_monotonic_time () - start_time;
+    gtk_widget_destroy (GTK_WIDGET (view));
+
+    return drawn;
+}
+
+static int
+benchmark_cold_start (int argc, char **argv)
+{
+    const gchar *assets_path = argc > 0 ? argv[0] : DEFAULT_ASSETS_PATH;
+    const gchar *archive_path = argc > 1 ? argv[1] : DEFAULT_ARCHIVE_PATH;
+
+    g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func (g_free);
+    list_files (assets_path, "", names);
+    if (names->len == 0) {
+        g_printerr ("No assets in %s\n", assets_path);
+        return EXIT_FAILURE;
+    }
+    if (!g_file_test (archive_path, G_FILE_TEST_EXISTS)) {
+        g_printerr ("No asset archive at %s, run \"make assets\"\n", archive_path);
+        return EXIT_FAILURE;
+    }
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    // Runs alternate between the two so they see the same conditions.
+    g_autoptr(GArray) directory_read = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_autoptr(GArray) directory_first_frame = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_autoptr(GArray) archive_read = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_autoptr(GArray) archive_first_frame = g_array_new (FALSE, FALSE, sizeof (gint64));
+    for (gint i = 0; i < COLD_START_RUNS; i++) {
+        gint64 read_time, first_frame_time;
+        if (!cold_start (window, assets_path, archive_path, FALSE, names, &read_time, &first_frame_time))
+            return EXIT_FAILURE;
+        g_array_append_val (directory_read, read_time);
+        g_array_append_val (directory_first_frame, first_frame_time);
+        if (!cold_start (window, assets_path, archive_path, TRUE, names, &read_time, &first_frame_time))
+            return EXIT_FAILURE;
+        g_array_append_val (archive_read, read_time);
+        g_array_append_val (archive_first_frame, first_frame_time);
+    }
+
+    g_print ("cold-start: %u assets\n", names->len);
+    print_summary ("cold-start: directory read", directory_read);
+    print_summary ("cold-start: directory first frame", directory_first_frame);
+    print_summary ("cold-start: archive read", archive_read);
+    print_summary ("cold-start: archive first frame", archive_first_frame);
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+static int
+benchmark_keypress (int argc, char **argv)
+{
+    gint presses = argc > 0 ? atoi (argv[0]) : DEFAULT_PRESSES;
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+    FlView *view = create_view (window);
+    if (!wait_for_first_frame (view))
+        return EXIT_FAILURE;
+    gtk_widget_grab_focus (GTK_WIDGET (view));
+
+    // Each press is released before the next, so none are dropped as auto-repeat.
+    g_autoptr(GArray) latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+    for (gint i = 0; i < presses; i++) {
+        guint keyval = GDK_KEY_a + i % 26;
+        guint16 hardware_keycode = 38 + i % 26;
+        send_key_event (view, GDK_KEY_PRESS, keyval, hardware_keycode);
+        iterate_for (KEYPRESS_INTERVAL);
+        send_key_event (view, GDK_KEY_RELEASE, keyval, hardware_keycode);
+
+        FlViewInputStats stats;
+        fl_view_get_input_stats (view, &stats);
+        g_array_append_val (latencies, stats.key_latency);
+    }
+
+    FlViewInputStats stats;
+    fl_view_get_input_stats (view, &stats);
+    g_print ("keypress: %" G_GUINT64_FORMAT " key events, %" G_GUINT64_FORMAT " coalesced\n", stats.key_events, stats.key_events_coalesced);
+    print_summary ("keypress: press to frame", latencies);
+    print_histogram (latencies);
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+// Time each keystroke typed into a text field the stub engine opens with @length bytes.
+static gboolean
+type_into_text_field (GtkWidget *window, gint length, gboolean deltas, GArray *times)
+{
+    g_autofree gchar *length_value = g_strdup_printf ("%d", length);
+    g_setenv ("FL_STUB_ENGINE_TEXT_LENGTH", length_value, TRUE);
+    g_setenv ("FL_STUB_ENGINE_TEXT_DELTAS", deltas ? "1" : "0", TRUE);
+    FlView *view = create_view (window);
+    gboolean drawn = wait_for_first_frame (view);
+    g_unsetenv ("FL_STUB_ENGINE_TEXT_LENGTH");
+    if (!drawn)
+        return FALSE;
+    gtk_widget_grab_focus (GTK_WIDGET (view));
+
+    // Let the engine's messages opening the field arrive.
+    iterate_for (KEYPRESS_INTERVAL);
+
+    for (gint i = 0; i < TYPING_KEYSTROKES; i++) {
+        gint64 start_time = g_get_monotonic_time ();
+        send_key_event (view, GDK_KEY_PRESS, GDK_KEY_a, 38);
+        gint64 time = g_get_monotonic_time () - start_time;
+        g_array_append_val (times, time);
+        send_key_event (view, GDK_KEY_RELEASE, GDK_KEY_a, 38);
+
+        // Keep the message queue from filling between keystrokes.
+        while (g_main_context_iteration (NULL, FALSE));
+    }
+    gtk_widget_destroy (GTK_WIDGET (view));
+
+    return TRUE;
+}
+
+static int
+benchmark_typing (int argc, char **argv)
+{
+    static const gint default_lengths[] = { 1024, 100 * 1024, 1024 * 1024 };
+
+    // Characters are only committed straight away by GTK's own input method.
+    g_setenv ("GTK_IM_MODULE", "gtk-im-context-simple", TRUE);
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    gint n_lengths = argc > 0 ? argc : (gint) G_N_ELEMENTS (default_lengths);
+    for (gint i = 0; i < n_lengths; i++) {
+        gint length = argc > 0 ? atoi (argv[i]) : default_lengths[i];
+        g_autoptr(GArray) full_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+        g_autoptr(GArray) delta_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+        if (!type_into_text_field (window, length, FALSE, full_times) ||
+            !type_into_text_field (window, length, TRUE, delta_times))
+            return EXIT_FAILURE;
+
+        g_autofree gchar *full_name = g_strdup_printf ("typing: %d bytes, full state", length);
+        g_autofree gchar *delta_name = g_strdup_printf ("typing: %d bytes, deltas", length);
+        print_summary (full_name, full_times);
+        print_summary (delta_name, delta_times);
+    }
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+// Time each of @runs views from being created to its first frame.
+static gboolean
+open_views (GtkWidget *window, gint runs, gboolean pooled, GArray *times, gint *n_pooled)
+{
+    for (gint i = 0; i < runs; i++) {
+        // The pool starts engines when the main loop is idle.
+        if (pooled)
+            iterate_for (POOL_REFILL_TIME);
+
+        FlView *view = create_view (window);
+        if (!wait_for_first_frame (view))
+            return FALSE;
+        FlViewStartupStats stats;
+        fl_view_get_startup_stats (view, &stats);
+        g_array_append_val (times, stats.first_frame_time);
+        if (stats.used_pooled_engine)
+            (*n_pooled)++;
+        gtk_widget_destroy (GTK_WIDGET (view));
+    }
+
+    return TRUE;
+}
+
+static int
+benchmark_open (int argc, char **argv)
+{
+    gint runs = argc > 0 ? atoi (argv[0]) : DEFAULT_OPEN_RUNS;
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    g_autoptr(GArray) unpooled_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_autoptr(GArray) pooled_times = g_array_new (FALSE, FALSE, sizeof (gint64));
+    gint n_unpooled = 0, n_pooled = 0;
+    if (!open_views (window, runs, FALSE, unpooled_times, &n_unpooled))
+        return EXIT_FAILURE;
+
+    FlEnginePool *pool = fl_engine_pool_get_default ();
+    fl_engine_pool_set_project (pool, DEFAULT_ASSETS_PATH, NULL, NULL);
+    fl_engine_pool_set_size (pool, 1);
+    if (!open_views (window, runs, TRUE, pooled_times, &n_pooled))
+        return EXIT_FAILURE;
+    fl_engine_pool_set_size (pool, 0);
+
+    print_summary ("open: without pool", unpooled_times);
+    print_summary ("open: with pool", pooled_times);
+    g_print ("open: %d of %d views took a pooled engine\n", n_pooled, runs);
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+static gboolean
+run_topology (GtkWidget *window, FlViewThreadTopology topology, const gchar *name, gint seconds)
+{
+    gint base_threads = get_thread_count ();
+
+    FlView *view = fl_view_new ();
+    fl_view_set_assets_path (view, DEFAULT_ASSETS_PATH);
+    fl_view_set_thread_topology (view, topology);
+    gtk_widget_show (GTK_WIDGET (view));
+    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (view));
+    if (!wait_for_first_frame (view))
+        return FALSE;
+
+    iterate_for ((gint64) seconds * G_USEC_PER_SEC);
+
+    // The engine's frame times follow from the stub engine as it shuts down.
+    g_print ("topology: %s, %d threads added\n", name, get_thread_count () - base_threads);
+    gtk_widget_destroy (GTK_WIDGET (view));
+
+    return TRUE;
+}
+
+static int
+benchmark_topology (int argc, char **argv)
+{
+    gint seconds = argc > 0 ? atoi (argv[0]) : DEFAULT_TOPOLOGY_SECONDS;
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    if (!run_topology (window, FL_VIEW_THREAD_TOPOLOGY_DEFAULT, "default", seconds) ||
+        !run_topology (window, FL_VIEW_THREAD_TOPOLOGY_RENDER_THREAD, "render thread", seconds) ||
+        !run_topology (window, FL_VIEW_THREAD_TOPOLOGY_SINGLE_THREAD, "single thread", seconds))
+        return EXIT_FAILURE;
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+static gboolean
+quit_loop_cb (gpointer user_data)
+{
+    g_main_loop_quit (user_data);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+run_idle_cpu (GtkWidget *window, gboolean pause_when_hidden, const gchar *name, gint seconds)
+{
+    FlView *view = create_view (window);
+    fl_view_set_pause_when_hidden (view, pause_when_hidden);
+    if (!wait_for_first_frame (view))
+        return FALSE;
+
+    gtk_widget_hide (GTK_WIDGET (view));
+    iterate_for (HIDE_SETTLE_TIME);
+
+    // Block in the main loop rather than polling it, so only the view's own work uses CPU.
+    g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+    g_timeout_add ((guint) seconds * 1000, quit_loop_cb, loop);
+    gint64 start_cpu_time = get_cpu_time ();
+    gint64 start_time = g_get_monotonic_time ();
+    g_main_loop_run (loop);
+    gint64 cpu_time = get_cpu_time () - start_cpu_time;
+    gint64 time = g_get_monotonic_time () - start_time;
+
+    g_print ("idle-cpu: %s, %" G_GINT64_FORMAT "ms CPU in %" G_GINT64_FORMAT "ms, %.1f%%\n",
+             name, cpu_time / 1000, time / 1000, 100.0 * cpu_time / MAX (time, 1));
+    gtk_widget_destroy (GTK_WIDGET (view));
+
+    return TRUE;
+}
+
+static int
+benchmark_idle_cpu (int argc, char **argv)
+{
+    gint seconds = argc > 0 ? atoi (argv[0]) : DEFAULT_IDLE_CPU_SECONDS;
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    if (!run_idle_cpu (window, TRUE, "paused when hidden", seconds) ||
+        !run_idle_cpu (window, FALSE, "rendering when hidden", seconds))
+        return EXIT_FAILURE;
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+static gboolean
+run_present_thread (GtkWidget *window, gboolean use_present_thread, const gchar *name, gint seconds)
+{
+    FlView *view = fl_view_new ();
+    fl_view_set_assets_path (view, DEFAULT_ASSETS_PATH);
+    // The present thread is only used with EGL on X11.
+    fl_view_set_backend (view, FL_VIEW_BACKEND_X11_EGL);
+    fl_view_set_use_present_thread (view, use_present_thread);
+    gtk_widget_show (GTK_WIDGET (view));
+    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (view));
+    if (!wait_for_first_frame (view))
+        return FALSE;
+
+    iterate_for ((gint64) seconds * G_USEC_PER_SEC);
+
+    // Swaps are only counted on the present thread, the frame times follow
+    // from the stub engine as it shuts down.
+    FlViewPresentStats stats;
+    fl_view_get_present_stats (view, &stats);
+    if (stats.frames_presented > 0)
+        g_print ("present-thread: %s, %" G_GUINT64_FORMAT " frames presented, mean swap %" G_GINT64_FORMAT "us, queue depth %u\n",
+                 name, stats.frames_presented, stats.swap_time / (gint64) stats.frames_presented, stats.queue_depth);
+    else
+        g_print ("present-thread: %s\n", name);
+    gtk_widget_destroy (GTK_WIDGET (view));
+    iterate_for (SHUTDOWN_TIME);
+
+    return TRUE;
+}
+
+static int
+benchmark_present_thread (int argc, char **argv)
+{
+    gint seconds = argc > 0 ? atoi (argv[0]) : DEFAULT_PRESENT_THREAD_SECONDS;
+
+    // Mesa's software rasterizer, whose swaps are slow enough to stall the raster thread.
+    g_setenv ("LIBGL_ALWAYS_SOFTWARE", "1", TRUE);
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    if (!run_present_thread (window, FALSE, "raster thread", seconds) ||
+        !run_present_thread (window, TRUE, "present thread", seconds))
+        return EXIT_FAILURE;
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+static gboolean
+run_renderer (GtkWidget *window, FlViewBackend backend, const gchar *name, gint frames)
+{
+    FlView *view = fl_view_new ();
+    fl_view_set_assets_path (view, DEFAULT_ASSETS_PATH);
+    fl_view_set_backend (view, backend);
+    gtk_widget_show (GTK_WIDGET (view));
+    gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (view));
+    if (!wait_for_first_frame (view))
+        return FALSE;
+
+    // GTK composites the GDK GL renderer's frames on the main thread, so the
+    // main loop blocks between frames rather than polling.
+    FlViewPresentStats stats;
+    fl_view_get_present_stats (view, &stats);
+    guint64 start_frames = stats.frames_drawn;
+    gint64 start_cpu_time = get_cpu_time ();
+    gint64 start_time = g_get_monotonic_time ();
+    // Given up on if the frames stop coming.
+    guint64 last_frames = start_frames;
+    gint64 last_frame_time = start_time;
+    while (stats.frames_drawn - start_frames < (guint64) frames && g_get_monotonic_time () - last_frame_time < FIRST_FRAME_TIMEOUT) {
+        g_main_context_iteration (NULL, TRUE);
+        fl_view_get_present_stats (view, &stats);
+        if (stats.frames_drawn != last_frames) {
+            last_frames = stats.frames_drawn;
+            last_frame_time = g_get_monotonic_time ();
+        }
+    }
+    gint64 cpu_time = get_cpu_time () - start_cpu_time;
+    gint64 time = g_get_monotonic_time () - start_time;
+
+    // The X server and compositor's share of each frame isn't included.
+    guint64 n_frames = stats.frames_drawn - start_frames;
+    g_print ("renderer: %s, %" G_GUINT64_FORMAT " frames in %" G_GINT64_FORMAT "ms, %" G_GINT64_FORMAT "us CPU per frame\n",
+             name, n_frames, time / 1000, cpu_time / (gint64) MAX (n_frames, 1));
+    gtk_widget_destroy (GTK_WIDGET (view));
+    iterate_for (SHUTDOWN_TIME);
+
+    return TRUE;
+}
+
+static int
+benchmark_renderer (int argc, char **argv)
+{
+    gint frames = argc > 0 ? atoi (argv[0]) : DEFAULT_RENDERER_FRAMES;
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    if (!run_renderer (window, FL_VIEW_BACKEND_X11_EGL, "x11 egl", frames) ||
+        !run_renderer (window, FL_VIEW_BACKEND_GDK_GL, "gdk gl", frames))
+        return EXIT_FAILURE;
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+// Read frames into memory as they are drawn, counting them.
+static gpointer
+offscreen_frames_thread (gpointer user_data)
+{
+    OffscreenFrames *frames = user_data;
+    gint stride = OFFSCREEN_WIDTH * 4;
+    g_autofree guint8 *buffer = g_malloc ((gsize) stride * OFFSCREEN_HEIGHT);
+
+    while (!g_atomic_int_get (frames->stop)) {
+        if (fl_offscreen_renderer_wait_for_frame (frames->renderer, buffer, stride, REPLAY_FRAME_TIMEOUT))
+            frames->n_frames++;
+    }
+
+    return NULL;
+}
+
+static gboolean
+run_offscreen (gint n_renderers, gboolean use_software, const gchar *name, gint seconds)
+{
+    g_autofree OffscreenFrames *frames = g_new0 (OffscreenFrames, n_renderers);
+    g_autofree GThread **threads = g_new0 (GThread *, n_renderers);
+    gint stop = FALSE;
+
+    gint64 start_cpu_time = get_cpu_time ();
+    gint64 start_time = g_get_monotonic_time ();
+    gboolean started = TRUE;
+    for (gint i = 0; i < n_renderers && started; i++) {
+        frames[i].renderer = fl_offscreen_renderer_new (OFFSCREEN_WIDTH, OFFSCREEN_HEIGHT);
+        fl_offscreen_renderer_set_assets_path (frames[i].renderer, DEFAULT_ASSETS_PATH);
+        fl_offscreen_renderer_set_use_software (frames[i].renderer, use_software);
+        frames[i].stop = &stop;
+        started = fl_offscreen_renderer_start (frames[i].renderer);
+        if (started)
+            threads[i] = g_thread_new ("benchmark-offscreen", offscreen_frames_thread, &frames[i]);
+    }
+
+    if (started)
+        g_usleep ((gulong) seconds * G_USEC_PER_SEC);
+    g_atomic_int_set (&stop, TRUE);
+
+    guint64 n_frames = 0;
+    for (gint i = 0; i < n_renderers; i++) {
+        if (threads[i] != NULL)
+            g_thread_join (threads[i]);
+        n_frames += frames[i].n_frames;
+    }
+    // Startup and shutdown are part of the cost, as they would be for a thumbnail.
+    for (gint i = 0; i < n_renderers; i++)
+        g_clear_object (&frames[i].renderer);
+    gint64 cpu_time = get_cpu_time () - start_cpu_time;
+    gint64 time = g_get_monotonic_time () - start_time;
+
+    if (!started) {
+        g_printerr ("Failed to start offscreen renderer\n");
+        return FALSE;
+    }
+
+    g_print ("offscreen: %s, %d renderers, %" G_GUINT64_FORMAT " frames, %.1f frames/s, %.1f frames per CPU second\n",
+             name, n_renderers, n_frames, (gdouble) n_frames * G_USEC_PER_SEC / MAX (time, 1), (gdouble) n_frames * G_USEC_PER_SEC / MAX (cpu_time, 1));
+
+    return TRUE;
+}
+
+static int
+benchmark_offscreen (int argc, char **argv)
+{
+    gint n_renderers = argc > 0 ? atoi (argv[0]) : DEFAULT_OFFSCREEN_RENDERERS;
+    gint seconds = argc > 1 ? atoi (argv[1]) : DEFAULT_OFFSCREEN_SECONDS;
+    if (n_renderers < 1) {
+        g_printerr ("Invalid number of renderers\n");
+        return EXIT_FAILURE;
+    }
+
+    // Frames are drawn as fast as the renderers take them, unless a rate is given.
+    g_setenv ("FL_STUB_ENGINE_FRAME_RATE", "1000", FALSE);
+
+    if (!run_offscreen (n_renderers, FALSE, "egl", seconds) ||
+        !run_offscreen (n_renderers, TRUE, "software", seconds))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+// Run a view for @seconds, recording to @path if not NULL, and return the CPU time used.
+static gint64
+run_record (GtkWidget *window, const gchar *path, gint seconds)
+{
+    g_autoptr(GError) error = NULL;
+
+    FlView *view = create_view (window);
+    gtk_widget_set_size_request (GTK_WIDGET (view), RECORD_WIDTH, RECORD_HEIGHT);
+    if (!wait_for_first_frame (view))
+        return -1;
+    if (path != NULL && !fl_view_start_recording (view, path, &error)) {
+        g_printerr ("Failed to start recording: %s\n", error->message);
+        return -1;
+    }
+
+    g_autoptr(GMainLoop) loop = g_main_loop_new (NULL, FALSE);
+    g_timeout_add ((guint) seconds * 1000, quit_loop_cb, loop);
+    gint64 start_cpu_time = get_cpu_time ();
+    g_main_loop_run (loop);
+    gint64 cpu_time = get_cpu_time () - start_cpu_time;
+    FlViewPresentStats stats;
+    fl_view_get_present_stats (view, &stats);
+    if (path != NULL)
+        fl_view_stop_recording (view);
+
+    if (path != NULL)
+        g_print ("record: %" G_GUINT64_FORMAT " frames recorded, %" G_GUINT64_FORMAT " dropped, mean %" G_GINT64_FORMAT "us per frame read back\n",
+                 stats.frames_recorded, stats.frames_dropped, stats.record_time);
+    gtk_widget_destroy (GTK_WIDGET (view));
+    iterate_for (SHUTDOWN_TIME);
+
+    return cpu_time;
+}
+
+static int
+benchmark_record (int argc, char **argv)
+{
+    gint seconds = argc > 0 ? atoi (argv[0]) : DEFAULT_RECORD_SECONDS;
+    const gchar *path = argc > 1 ? argv[1] : DEFAULT_RECORD_PATH;
+
+    g_setenv ("FL_STUB_ENGINE_FRAME_RATE", "60", TRUE);
+
+    GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_widget_show (window);
+
+    gint64 base_cpu_time = run_record (window, NULL, seconds);
+    gint64 record_cpu_time = base_cpu_time >= 0 ? run_record (window, path, seconds) : -1;
+    g_unlink (path);
+    if (record_cpu_time < 0)
+        return EXIT_FAILURE;
+
+    g_print ("record: %" G_GINT64_FORMAT "ms CPU without recording, %" G_GINT64_FORMAT "ms with, %.1f%% of a core added\n",
+             base_cpu_time / 1000, record_cpu_time / 1000, 100.0 * (record_cpu_time - base_cpu_time) / ((gint64) seconds * G_USEC_PER_SEC));
+
+    gtk_widget_destroy (window);
+
+    return EXIT_SUCCESS;
+}
+
+// Apply @n_updates of @nodes starting at @first as one batch, taking the changes as a view would.
+static gint64
+apply_semantics_batch (FlSemanticsTree *tree, const FlutterSemanticsNode *nodes, gint first, gint n_updates, gint n_nodes)
+{
+    gint64 start_time = g_get_monotonic_time ();
+    for (gint i = 0; i < n_updates; i++)
+        fl_semantics_tree_update_node (tree, &nodes[(first + i) % n_nodes]);
+    fl_semantics_tree_end_batch (tree);
+    g_autoptr(GArray) changes = fl_semantics_tree_take_changes (tree);
+    return g_get_monotonic_time () - start_time;
+}
+
+static int
+benchmark_semantics (int argc, char **argv)
+{
+    gint n_nodes = argc > 0 ? atoi (argv[0]) : DEFAULT_SEMANTICS_NODES;
+    if (n_nodes < 1) {
+        g_printerr ("Invalid number of nodes\n");
+        return EXIT_FAILURE;
+    }
+
+    // Each node's children follow on from the previous node's, breadth first.
+    g_autofree FlutterSemanticsNode *nodes = g_new0 (FlutterSemanticsNode, n_nodes);
+    g_autofree int32_t *children = g_new (int32_t, n_nodes);
+    g_autoptr(GPtrArray) labels = g_ptr_array_new_with_free_func (g_free);
+    for (gint i = 0; i < n_nodes; i++)
+        children[i] = i + 1;
+    for (gint i = 0; i < n_nodes; i++) {
+        FlutterSemanticsNode *node = &nodes[i];
+        node->struct_size = sizeof (FlutterSemanticsNode);
+        node->id = i;
+        node->flags = kFlutterSemanticsFlagIsButton;
+        node->actions = kFlutterSemanticsActionTap;
+        node->rect = (FlutterRect) { 0, i * 20.0, 400, i * 20.0 + 20 };
+        node->transform = (FlutterTransformation) { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+        gchar *label = g_strdup_printf ("Item %d", i);
+        g_ptr_array_add (labels, label);
+        node->label = label;
+        node->value = "";
+        node->hint = "";
+        gint first_child = i * SEMANTICS_FAN_OUT;
+        if (first_child < n_nodes - 1) {
+            node->child_count = MIN (SEMANTICS_FAN_OUT, n_nodes - 1 - first_child);
+            node->children_in_traversal_order = &children[first_child];
+            node->children_in_hit_test_order = &children[first_child];
+        }
+    }
+
+    g_autoptr(FlSemanticsTree) tree = fl_semantics_tree_new ();
+    g_autoptr(GArray) build = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_autoptr(GArray) relabel = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_autoptr(GArray) move = g_array_new (FALSE, FALSE, sizeof (gint64));
+    gint n_relabel = MAX (n_nodes / 100, 1);
+    for (gint run = 0; run < SEMANTICS_RUNS; run++) {
+        fl_semantics_tree_clear (tree);
+        gint64 time = apply_semantics_batch (tree, nodes, 0, n_nodes, n_nodes);
+        g_array_append_val (build, time);
+
+        // A different 1% of the nodes each time, with labels that differ from the last run's.
+        for (gint i = 0; i < n_relabel; i++) {
+            gint id = (run * n_relabel + i) % n_nodes;
+            gchar *label = g_strdup_printf ("Item %d run %d", id, run);
+            g_free (g_ptr_array_index (labels, id));
+            g_ptr_array_index (labels, id) = label;
+            nodes[id].label = label;
+        }
+        time = apply_semantics_batch (tree, nodes, run * n_relabel, n_relabel, n_nodes);
+        g_array_append_val (relabel, time);
+
+        // Scrolling moves every node.
+        for (gint i = 0; i < n_nodes; i++) {
+            nodes[i].rect.top += 1;
+            nodes[i].rect.bottom += 1;
+        }
+        time = apply_semantics_batch (tree, nodes, 0, n_nodes, n_nodes);
+        g_array_append_val (move, time);
+    }
+
+    g_print ("semantics: %d nodes\n", n_nodes);
+    print_summary ("semantics: build", build);
+    print_summary ("semantics: relabel 1%", relabel);
+    print_summary ("semantics: move all", move);
+
+    return EXIT_SUCCESS;
+}
+
+static const Benchmark benchmarks[] = {
+    { "create-destroy", "[CYCLES]", benchmark_create_destroy },
+    { "replay", "LOG [--software]", benchmark_replay },
+    { "cold-start", "[ASSETS_PATH [ARCHIVE_PATH]]", benchmark_cold_start },
+    { "semantics", "[NODES]", benchmark_semantics },
+    { "keypress", "[PRESSES]", benchmark_keypress },
+    { "typing", "[LENGTH...]", benchmark_typing },
+    { "open", "[RUNS]", benchmark_open },
+    { "topology", "[SECONDS]", benchmark_topology },
+    { "idle-cpu", "[SECONDS]", benchmark_idle_cpu },
+    { "present-thread", "[SECONDS]", benchmark_present_thread },
+    { "renderer", "[FRAMES]", benchmark_renderer },
+    { "offscreen", "[RENDERERS [SECONDS]]", benchmark_offscreen },
+    { "record", "[SECONDS [PATH]]", benchmark_record },
+};
+
+static void
+print_usage (void)
+{
+    g_printerr ("Usage: gtk_flutter_benchmark BENCHMARK [ARGUMENTS]\n\nBenchmarks:\n");
+    for (gsize i = 0; i < G_N_ELEMENTS (benchmarks); i++)
+        g_printerr ("  %s %s\n", benchmarks[i].name, benchmarks[i].arguments);
+}
+
+int
+main (int argc, char **argv)
+{
+    gtk_init (&argc, &argv);
+
+    if (argc < 2) {
+        print_usage ();
+        return EXIT_FAILURE;
+    }
+
+    for (gsize i = 0; i < G_N_ELEMENTS (benchmarks); i++) {
+        if (strcmp (argv[1], benchmarks[i].name) == 0)
+            return benchmarks[i].run (argc - 2, argv + 2);
+    }
+
+    print_usage ();
+    return EXIT_FAILURE;
+}
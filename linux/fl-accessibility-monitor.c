@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <gio/gio.h>
+
+#include "fl-accessibility-monitor.h"
+
+struct _FlAccessibilityMonitor
+{
+    GObject parent_instance;
+
+    GCancellable *cancellable;
+    GDBusProxy *status_proxy;
+
+    gboolean enabled;
+};
+
+enum
+{
+    SIGNAL_ENABLED_CHANGED,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (FlAccessibilityMonitor, fl_accessibility_monitor, G_TYPE_OBJECT)
+
+static gboolean
+get_status_property (FlAccessibilityMonitor *self, const gchar *name)
+{
+    g_autoptr(GVariant) value = g_dbus_proxy_get_cached_property (self->status_proxy, name);
+
+    return value != NULL && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN) && g_variant_get_boolean (value);
+}
+
+static void
+update_enabled (FlAccessibilityMonitor *self)
+{
+    // Set when a screen reader or other assistive technology starts.
+    gboolean enabled = get_status_property (self, "IsEnabled") || get_status_property (self, "ScreenReaderEnabled");
+    if (enabled == self->enabled)
+        return;
+
+    self->enabled = enabled;
+    g_debug ("Assistive technologies %s", enabled ? "enabled" : "disabled");
+    g_signal_emit (self, signals[SIGNAL_ENABLED_CHANGED], 0);
+}
+
+static void
+fl_accessibility_monitor_properties_changed_cb (GDBusProxy *proxy, GVariant *changed_properties, GStrv invalidated_properties, FlAccessibilityMonitor *self)
+{
+    update_enabled (self);
+}
+
+static void
+fl_accessibility_monitor_proxy_ready_cb (GObject *object, GAsyncResult *result, gpointer user_data)
+{
+    g_autoptr(GError) error = NULL;
+
+    GDBusProxy *proxy = g_dbus_proxy_new_for_bus_finish (result, &error);
+    if (proxy == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_debug ("No accessibility bus: %s", error->message);
+        return;
+    }
+
+    FlAccessibilityMonitor *self = user_data;
+    self->status_proxy = proxy;
+    g_signal_connect_object (proxy, "g-properties-changed",
+                             G_CALLBACK (fl_accessibility_monitor_properties_changed_cb), self, 0);
+    update_enabled (self);
+}
+
+static void
+fl_accessibility_monitor_dispose (GObject *object)
+{
+    FlAccessibilityMonitor *self = FL_ACCESSIBILITY_MONITOR (object);
+
+    if (self->cancellable != NULL)
+        g_cancellable_cancel (self->cancellable);
+    g_clear_object (&self->cancellable);
+    g_clear_object (&self->status_proxy);
+
+    G_OBJECT_CLASS (fl_accessibility_monitor_parent_class)->dispose (object);
+}
+
+static void
+fl_accessibility_monitor_class_init (FlAccessibilityMonitorClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_accessibility_monitor_dispose;
+
+    signals[SIGNAL_ENABLED_CHANGED] = g_signal_new ("enabled-changed",
+                                                    G_TYPE_FROM_CLASS (klass),
+                                                    G_SIGNAL_RUN_LAST,
+                                                    0,
+                                                    NULL, NULL,
+                                                    NULL,
+                                                    G_TYPE_NONE, 0);
+}
+
+static void
+fl_accessibility_monitor_init (FlAccessibilityMonitor *self)
+{
+    // The same switch GTK uses to not load the AT-SPI bridge.
+    if (g_strcmp0 (g_getenv ("NO_AT_BRIDGE"), "1") == 0)
+        return;
+
+    self->cancellable = g_cancellable_new ();
+    g_dbus_proxy_new_for_bus (G_BUS_TYPE_SESSION,
+                              G_DBUS_PROXY_FLAGS_GET_INVALIDATED_PROPERTIES,
+                              NULL,
+                              "org.a11y.Bus",
+                              "/org/a11y/bus",
+                              "org.a11y.Status",
+                              self->cancellable,
+                              fl_accessibility_monitor_proxy_ready_cb,
+                              self);
+}
+
+FlAccessibilityMonitor *
+fl_accessibility_monitor_get_default (void)
+{
+    static FlAccessibilityMonitor *monitor = NULL;
+
+    if (monitor == NULL)
+        monitor = g_object_new (fl_accessibility_monitor_get_type (), NULL);
+
+    return monitor;
+}
+
+gboolean
+fl_accessibility_monitor_get_enabled (FlAccessibilityMonitor *self)
+{
+    g_return_val_if_fail (FL_IS_ACCESSIBILITY_MONITOR (self), FALSE);
+
+    return self->enabled;
+}
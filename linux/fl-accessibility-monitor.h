@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlAccessibilityMonitor, fl_accessibility_monitor, FL, ACCESSIBILITY_MONITOR, GObject)
+
+/* Tracks whether assistive technologies are using AT-SPI, from the status the
+ * accessibility bus reports. The "enabled-changed" signal is emitted when that
+ * changes. */
+
+FlAccessibilityMonitor *fl_accessibility_monitor_get_default (void);
+
+gboolean                fl_accessibility_monitor_get_enabled (FlAccessibilityMonitor *monitor);
+
+G_END_DECLS
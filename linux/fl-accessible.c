@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include "fl-accessible.h"
+#include "fl-view-private.h"
+
+struct _FlViewAccessible
+{
+    GtkWidgetAccessible parent_instance;
+
+    // FlAccessibleNode for each node ID, or NULL if not asked for yet.
+    GPtrArray *nodes;
+};
+
+typedef struct
+{
+    AtkObject parent_instance;
+
+    // NULL once the view has gone.
+    FlViewAccessible *view_accessible;
+    gint32 id;
+
+    // Parent and state last reported to assistive technologies.
+    gint32 parent;
+    FlutterSemanticsFlag flags;
+} FlAccessibleNode;
+
+typedef struct
+{
+    AtkObjectClass parent_class;
+} FlAccessibleNodeClass;
+
+typedef struct
+{
+    FlutterSemanticsAction action;
+    const gchar *name;
+} ActionName;
+
+// Actions offered through AtkAction, in order.
+static const ActionName action_names[] = {
+    { kFlutterSemanticsActionTap, "click" },
+    { kFlutterSemanticsActionLongPress, "press" },
+    { kFlutterSemanticsActionIncrease, "increase" },
+    { kFlutterSemanticsActionDecrease, "decrease" },
+    { kFlutterSemanticsActionDismiss, "dismiss" }
+};
+
+static void fl_accessible_node_component_init (AtkComponentIface *iface);
+static void fl_accessible_node_action_init (AtkActionIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (FlAccessibleNode, fl_accessible_node, ATK_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (ATK_TYPE_COMPONENT, fl_accessible_node_component_init)
+                         G_IMPLEMENT_INTERFACE (ATK_TYPE_ACTION, fl_accessible_node_action_init))
+
+G_DEFINE_TYPE (FlViewAccessible, fl_view_accessible, GTK_TYPE_WIDGET_ACCESSIBLE)
+
+static FlView *
+get_view (FlViewAccessible *self)
+{
+    GtkWidget *widget = gtk_accessible_get_widget (GTK_ACCESSIBLE (self));
+    return widget != NULL ? FL_VIEW (widget) : NULL;
+}
+
+static FlSemanticsTree *
+get_tree (FlViewAccessible *self)
+{
+    FlView *view = get_view (self);
+    return view != NULL ? fl_view_get_semantics_tree (view) : NULL;
+}
+
+// Node the accessible is for, or NULL if it has gone.
+static const FlSemanticsNode *
+get_node (FlAccessibleNode *self)
+{
+    if (self->view_accessible == NULL)
+        return NULL;
+
+    FlSemanticsTree *tree = get_tree (self->view_accessible);
+    return tree != NULL ? fl_semantics_tree_lookup (tree, self->id) : NULL;
+}
+
+static AtkObject *
+lookup_node_accessible (FlViewAccessible *self, gint32 id)
+{
+    if (id < 0 || (guint) id >= self->nodes->len)
+        return NULL;
+    return g_ptr_array_index (self->nodes, id);
+}
+
+// Returns the accessible for a node, making it the first time it is asked for.
+static AtkObject *
+get_node_accessible (FlViewAccessible *self, gint32 id)
+{
+    FlSemanticsTree *tree = get_tree (self);
+    const FlSemanticsNode *node = tree != NULL ? fl_semantics_tree_lookup (tree, id) : NULL;
+    if (node == NULL)
+        return NULL;
+
+    AtkObject *object = lookup_node_accessible (self, id);
+    if (object != NULL)
+        return object;
+
+    FlAccessibleNode *node_accessible = g_object_new (fl_accessible_node_get_type (), NULL);
+    node_accessible->view_accessible = self;
+    node_accessible->id = id;
+    node_accessible->parent = node->parent;
+    node_accessible->flags = node->flags;
+    if ((guint) id >= self->nodes->len)
+        g_ptr_array_set_size (self->nodes, id + 1);
+    g_ptr_array_index (self->nodes, id) = node_accessible;
+
+    return ATK_OBJECT (node_accessible);
+}
+
+static AtkObject *
+get_parent_accessible (FlViewAccessible *self, gint32 id, gint32 parent)
+{
+    if (id == FL_SEMANTICS_TREE_ROOT_ID)
+        return ATK_OBJECT (self);
+    return lookup_node_accessible (self, parent);
+}
+
+static gboolean
+has_flag (const FlSemanticsNode *node, FlutterSemanticsFlag flag)
+{
+    return (node->flags & flag) != 0;
+}
+
+static const gchar *
+fl_accessible_node_get_name (AtkObject *object)
+{
+    const FlSemanticsNode *node = get_node ((FlAccessibleNode *) object);
+    return node != NULL ? node->label : NULL;
+}
+
+static const gchar *
+fl_accessible_node_get_description (AtkObject *object)
+{
+    const FlSemanticsNode *node = get_node ((FlAccessibleNode *) object);
+    return node != NULL ? node->hint : NULL;
+}
+
+static AtkRole
+fl_accessible_node_get_role (AtkObject *object)
+{
+    const FlSemanticsNode *node = get_node ((FlAccessibleNode *) object);
+
+    if (node == NULL)
+        return ATK_ROLE_INVALID;
+    if (has_flag (node, kFlutterSemanticsFlagIsButton))
+        return ATK_ROLE_PUSH_BUTTON;
+    if (has_flag (node, kFlutterSemanticsFlagIsTextField))
+        return has_flag (node, kFlutterSemanticsFlagIsObscured) ? ATK_ROLE_PASSWORD_TEXT : ATK_ROLE_ENTRY;
+    if (has_flag (node, kFlutterSemanticsFlagHasCheckedState))
+        return has_flag (node, kFlutterSemanticsFlagIsInMutuallyExclusiveGroup) ? ATK_ROLE_RADIO_BUTTON : ATK_ROLE_CHECK_BOX;
+    if (has_flag (node, kFlutterSemanticsFlagHasToggledState))
+        return ATK_ROLE_TOGGLE_BUTTON;
+    if (has_flag (node, kFlutterSemanticsFlagIsLink))
+        return ATK_ROLE_LINK;
+    if (has_flag (node, kFlutterSemanticsFlagIsHeader))
+        return ATK_ROLE_HEADING;
+    if (has_flag (node, kFlutterSemanticsFlagIsImage))
+        return ATK_ROLE_IMAGE;
+    if (node->label != NULL && node->label[0] != '\0' && node->n_children == 0)
+        return ATK_ROLE_LABEL;
+
+    return ATK_ROLE_PANEL;
+}
+
+static AtkObject *
+fl_accessible_node_get_parent (AtkObject *object)
+{
+    FlAccessibleNode *self = (FlAccessibleNode *) object;
+    const FlSemanticsNode *node = get_node (self);
+
+    if (node == NULL)
+        return NULL;
+    if (self->id == FL_SEMANTICS_TREE_ROOT_ID)
+        return ATK_OBJECT (self->view_accessible);
+    return get_node_accessible (self->view_accessible, node->parent);
+}
+
+static gint
+fl_accessible_node_get_n_children (AtkObject *object)
+{
+    const FlSemanticsNode *node = get_node ((FlAccessibleNode *) object);
+    return node != NULL ? node->n_children : 0;
+}
+
+static AtkObject *
+fl_accessible_node_ref_child (AtkObject *object, gint index)
+{
+    FlAccessibleNode *self = (FlAccessibleNode *) object;
+    const FlSemanticsNode *node = get_node (self);
+
+    if (node == NULL || index < 0 || (guint) index >= node->n_children)
+        return NULL;
+
+    gint32 child_id = fl_semantics_tree_get_child (get_tree (self->view_accessible), node, index);
+    AtkObject *child = get_node_accessible (self->view_accessible, child_id);
+    return child != NULL ? g_object_ref (child) : NULL;
+}
+
+static gint
+fl_accessible_node_get_index_in_parent (AtkObject *object)
+{
+    FlAccessibleNode *self = (FlAccessibleNode *) object;
+
+    if (get_node (self) == NULL)
+        return -1;
+    if (self->id == FL_SEMANTICS_TREE_ROOT_ID)
+        return 0;
+    return fl_semantics_tree_get_index_in_parent (get_tree (self->view_accessible), self->id);
+}
+
+static AtkStateSet *
+fl_accessible_node_ref_state_set (AtkObject *object)
+{
+    const FlSemanticsNode *node = get_node ((FlAccessibleNode *) object);
+    AtkStateSet *states = atk_state_set_new ();
+
+    if (node == NULL) {
+        atk_state_set_add_state (states, ATK_STATE_DEFUNCT);
+        return states;
+    }
+
+    if (!has_flag (node, kFlutterSemanticsFlagIsHidden)) {
+        atk_state_set_add_state (states, ATK_STATE_VISIBLE);
+        atk_state_set_add_state (states, ATK_STATE_SHOWING);
+    }
+    if (!has_flag (node, kFlutterSemanticsFlagHasEnabledState) || has_flag (node, kFlutterSemanticsFlagIsEnabled)) {
+        atk_state_set_add_state (states, ATK_STATE_ENABLED);
+        atk_state_set_add_state (states, ATK_STATE_SENSITIVE);
+    }
+    if (has_flag (node, kFlutterSemanticsFlagHasCheckedState) || has_flag (node, kFlutterSemanticsFlagHasToggledState))
+        atk_state_set_add_state (states, ATK_STATE_CHECKABLE);
+    if (has_flag (node, kFlutterSemanticsFlagIsChecked) || has_flag (node, kFlutterSemanticsFlagIsToggled))
+        atk_state_set_add_state (states, ATK_STATE_CHECKED);
+    if (has_flag (node, kFlutterSemanticsFlagIsSelected))
+        atk_state_set_add_state (states, ATK_STATE_SELECTED);
+    if (has_flag (node, kFlutterSemanticsFlagIsFocusable) || has_flag (node, kFlutterSemanticsFlagIsTextField))
+        atk_state_set_add_state (states, ATK_STATE_FOCUSABLE);
+    if (has_flag (node, kFlutterSemanticsFlagIsFocused))
+        atk_state_set_add_state (states, ATK_STATE_FOCUSED);
+    if (has_flag (node, kFlutterSemanticsFlagIsTextField) && !has_flag (node, kFlutterSemanticsFlagIsReadOnly))
+        atk_state_set_add_state (states, ATK_STATE_EDITABLE);
+
+    return states;
+}
+
+static void
+transform_point (const FlutterTransformation *transform, gdouble *x, gdouble *y)
+{
+    gdouble tx = transform->scaleX * *x + transform->skewX * *y + transform->transX;
+    gdouble ty = transform->skewY * *x + transform->scaleY * *y + transform->transY;
+    gdouble w = transform->pers0 * *x + transform->pers1 * *y + transform->pers2;
+
+    if (w != 0) {
+        tx /= w;
+        ty /= w;
+    }
+    *x = tx;
+    *y = ty;
+}
+
+static void
+fl_accessible_node_get_extents (AtkComponent *component, gint *x, gint *y, gint *width, gint *height, AtkCoordType coord_type)
+{
+    FlAccessibleNode *self = (FlAccessibleNode *) component;
+    const FlSemanticsNode *node = get_node (self);
+
+    *x = *y = *width = *height = 0;
+    if (node == NULL)
+        return;
+
+    // Corners of the node, moved through each coordinate system up to the root's.
+    gdouble corners[4][2] = {
+        { node->rect.left, node->rect.top },
+        { node->rect.right, node->rect.top },
+        { node->rect.left, node->rect.bottom },
+        { node->rect.right, node->rect.bottom }
+    };
+    FlSemanticsTree *tree = get_tree (self->view_accessible);
+    for (const FlSemanticsNode *n = node; n != NULL; n = fl_semantics_tree_lookup (tree, n->parent)) {
+        for (gint i = 0; i < 4; i++)
+            transform_point (&n->transform, &corners[i][0], &corners[i][1]);
+    }
+
+    gdouble left = corners[0][0], right = corners[0][0], top = corners[0][1], bottom = corners[0][1];
+    for (gint i = 1; i < 4; i++) {
+        left = MIN (left, corners[i][0]);
+        right = MAX (right, corners[i][0]);
+        top = MIN (top, corners[i][1]);
+        bottom = MAX (bottom, corners[i][1]);
+    }
+
+    // The root is in the view's coordinates.
+    GtkWidget *widget = GTK_WIDGET (get_view (self->view_accessible));
+    gint origin_x = 0, origin_y = 0;
+    if (coord_type == ATK_XY_SCREEN && gtk_widget_get_window (widget) != NULL)
+        gdk_window_get_origin (gtk_widget_get_window (widget), &origin_x, &origin_y);
+    else if (coord_type == ATK_XY_WINDOW)
+        gtk_widget_translate_coordinates (widget, gtk_widget_get_toplevel (widget), 0, 0, &origin_x, &origin_y);
+
+    *x = origin_x + (gint) left;
+    *y = origin_y + (gint) top;
+    *width = (gint) (right - left);
+    *height = (gint) (bottom - top);
+}
+
+static gboolean
+fl_accessible_node_grab_focus (AtkComponent *component)
+{
+    FlAccessibleNode *self = (FlAccessibleNode *) component;
+    const FlSemanticsNode *node = get_node (self);
+
+    if (node == NULL || !(node->actions & kFlutterSemanticsActionDidGainAccessibilityFocus))
+        return FALSE;
+
+    fl_view_dispatch_semantics_action (get_view (self->view_accessible), self->id, kFlutterSemanticsActionDidGainAccessibilityFocus);
+    return TRUE;
+}
+
+static void
+fl_accessible_node_component_init (AtkComponentIface *iface)
+{
+    iface->get_extents = fl_accessible_node_get_extents;
+    iface->grab_focus = fl_accessible_node_grab_focus;
+}
+
+// Returns the entry in action_names for the @index'th action the node has, or NULL.
+static const ActionName *
+get_action (FlAccessibleNode *self, gint index)
+{
+    const FlSemanticsNode *node = get_node (self);
+
+    if (node == NULL || index < 0)
+        return NULL;
+    for (gsize i = 0; i < G_N_ELEMENTS (action_names); i++) {
+        if ((node->actions & action_names[i].action) && index-- == 0)
+            return &action_names[i];
+    }
+
+    return NULL;
+}
+
+static gint
+fl_accessible_node_get_n_actions (AtkAction *action)
+{
+    gint n_actions = 0;
+    while (get_action ((FlAccessibleNode *) action, n_actions) != NULL)
+        n_actions++;
+    return n_actions;
+}
+
+static const gchar *
+fl_accessible_node_get_action_name (AtkAction *action, gint index)
+{
+    const ActionName *action_name = get_action ((FlAccessibleNode *) action, index);
+    return action_name != NULL ? action_name->name : NULL;
+}
+
+static gboolean
+fl_accessible_node_do_action (AtkAction *action, gint index)
+{
+    FlAccessibleNode *self = (FlAccessibleNode *) action;
+    const ActionName *action_name = get_action (self, index);
+
+    if (action_name == NULL)
+        return FALSE;
+
+    fl_view_dispatch_semantics_action (get_view (self->view_accessible), self->id, action_name->action);
+    return TRUE;
+}
+
+static void
+fl_accessible_node_action_init (AtkActionIface *iface)
+{
+    iface->get_n_actions = fl_accessible_node_get_n_actions;
+    iface->get_name = fl_accessible_node_get_action_name;
+    iface->do_action = fl_accessible_node_do_action;
+}
+
+static void
+fl_accessible_node_class_init (FlAccessibleNodeClass *klass)
+{
+    ATK_OBJECT_CLASS (klass)->get_name = fl_accessible_node_get_name;
+    ATK_OBJECT_CLASS (klass)->get_description = fl_accessible_node_get_description;
+    ATK_OBJECT_CLASS (klass)->get_role = fl_accessible_node_get_role;
+    ATK_OBJECT_CLASS (klass)->get_parent = fl_accessible_node_get_parent;
+    ATK_OBJECT_CLASS (klass)->get_n_children = fl_accessible_node_get_n_children;
+    ATK_OBJECT_CLASS (klass)->ref_child = fl_accessible_node_ref_child;
+    ATK_OBJECT_CLASS (klass)->get_index_in_parent = fl_accessible_node_get_index_in_parent;
+    ATK_OBJECT_CLASS (klass)->ref_state_set = fl_accessible_node_ref_state_set;
+}
+
+static void
+fl_accessible_node_init (FlAccessibleNode *self)
+{
+}
+
+// Reports a node as gone and drops it.
+static void
+remove_node_accessible (FlViewAccessible *self, gint32 id)
+{
+    FlAccessibleNode *node_accessible = (FlAccessibleNode *) lookup_node_accessible (self, id);
+    if (node_accessible == NULL)
+        return;
+
+    AtkObject *parent = get_parent_accessible (self, id, node_accessible->parent);
+    node_accessible->view_accessible = NULL;
+    atk_object_notify_state_change (ATK_OBJECT (node_accessible), ATK_STATE_DEFUNCT, TRUE);
+    if (parent != NULL)
+        g_signal_emit_by_name (parent, "children-changed::remove", -1, node_accessible);
+
+    // Drops the reference held here, assistive technologies may still hold theirs.
+    g_ptr_array_index (self->nodes, id) = NULL;
+    g_object_unref (node_accessible);
+}
+
+static void
+notify_states (FlAccessibleNode *self, const FlSemanticsNode *node)
+{
+    static const struct
+    {
+        FlutterSemanticsFlag flag;
+        AtkStateType state;
+    } flag_states[] = {
+        { kFlutterSemanticsFlagIsChecked, ATK_STATE_CHECKED },
+        { kFlutterSemanticsFlagIsToggled, ATK_STATE_CHECKED },
+        { kFlutterSemanticsFlagIsSelected, ATK_STATE_SELECTED },
+        { kFlutterSemanticsFlagIsFocused, ATK_STATE_FOCUSED },
+        { kFlutterSemanticsFlagIsEnabled, ATK_STATE_ENABLED },
+        { kFlutterSemanticsFlagIsHidden, ATK_STATE_SHOWING }
+    };
+
+    FlutterSemanticsFlag changed = self->flags ^ node->flags;
+    for (gsize i = 0; i < G_N_ELEMENTS (flag_states); i++) {
+        if (!(changed & flag_states[i].flag))
+            continue;
+        gboolean set = (node->flags & flag_states[i].flag) != 0;
+        if (flag_states[i].flag == kFlutterSemanticsFlagIsHidden)
+            set = !set;
+        atk_object_notify_state_change (ATK_OBJECT (self), flag_states[i].state, set);
+    }
+    self->flags = node->flags;
+}
+
+static void
+fl_view_accessible_dispose (GObject *object)
+{
+    FlViewAccessible *self = FL_VIEW_ACCESSIBLE (object);
+
+    if (self->nodes != NULL) {
+        for (guint i = 0; i < self->nodes->len; i++) {
+            FlAccessibleNode *node_accessible = g_ptr_array_index (self->nodes, i);
+            if (node_accessible != NULL)
+                node_accessible->view_accessible = NULL;
+        }
+    }
+    g_clear_pointer (&self->nodes, g_ptr_array_unref);
+
+    G_OBJECT_CLASS (fl_view_accessible_parent_class)->dispose (object);
+}
+
+static gint
+fl_view_accessible_get_n_children (AtkObject *object)
+{
+    FlSemanticsTree *tree = get_tree (FL_VIEW_ACCESSIBLE (object));
+    return tree != NULL && fl_semantics_tree_lookup (tree, FL_SEMANTICS_TREE_ROOT_ID) != NULL ? 1 : 0;
+}
+
+static AtkObject *
+fl_view_accessible_ref_child (AtkObject *object, gint index)
+{
+    if (index != 0)
+        return NULL;
+
+    AtkObject *root = get_node_accessible (FL_VIEW_ACCESSIBLE (object), FL_SEMANTICS_TREE_ROOT_ID);
+    return root != NULL ? g_object_ref (root) : NULL;
+}
+
+static void
+fl_view_accessible_class_init (FlViewAccessibleClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_view_accessible_dispose;
+    ATK_OBJECT_CLASS (klass)->get_n_children = fl_view_accessible_get_n_children;
+    ATK_OBJECT_CLASS (klass)->ref_child = fl_view_accessible_ref_child;
+}
+
+static void
+fl_view_accessible_init (FlViewAccessible *self)
+{
+    self->nodes = g_ptr_array_new_with_free_func (g_object_unref);
+}
+
+void
+fl_view_accessible_apply_changes (FlViewAccessible *self, GArray *changes)
+{
+    g_return_if_fail (FL_IS_VIEW_ACCESSIBLE (self));
+
+    FlSemanticsTree *tree = get_tree (self);
+    if (tree == NULL)
+        return;
+
+    for (guint i = 0; i < changes->len; i++) {
+        FlSemanticsNodeChange *change = &g_array_index (changes, FlSemanticsNodeChange, i);
+
+        if (change->changes & FL_SEMANTICS_CHANGE_REMOVED) {
+            remove_node_accessible (self, change->id);
+            continue;
+        }
+
+        const FlSemanticsNode *node = fl_semantics_tree_lookup (tree, change->id);
+        if (node == NULL)
+            continue;
+
+        // Only announce nodes where something may be listening, their parent has been asked for.
+        if (change->changes & FL_SEMANTICS_CHANGE_ADDED) {
+            AtkObject *parent = get_parent_accessible (self, change->id, node->parent);
+            if (parent != NULL) {
+                gint index = change->id == FL_SEMANTICS_TREE_ROOT_ID ? 0 : fl_semantics_tree_get_index_in_parent (tree, change->id);
+                g_signal_emit_by_name (parent, "children-changed::add", index, get_node_accessible (self, change->id));
+            }
+            continue;
+        }
+
+        FlAccessibleNode *node_accessible = (FlAccessibleNode *) lookup_node_accessible (self, change->id);
+        if (node_accessible == NULL)
+            continue;
+
+        if (node_accessible->parent != node->parent) {
+            AtkObject *old_parent = get_parent_accessible (self, change->id, node_accessible->parent);
+            if (old_parent != NULL)
+                g_signal_emit_by_name (old_parent, "children-changed::remove", -1, node_accessible);
+            node_accessible->parent = node->parent;
+            AtkObject *parent = get_parent_accessible (self, change->id, node->parent);
+            if (parent != NULL)
+                g_signal_emit_by_name (parent, "children-changed::add", fl_semantics_tree_get_index_in_parent (tree, change->id), node_accessible);
+        }
+        if (change->changes & FL_SEMANTICS_CHANGE_TEXT) {
+            g_object_notify (G_OBJECT (node_accessible), "accessible-name");
+            g_object_notify (G_OBJECT (node_accessible), "accessible-description");
+        }
+        if (change->changes & FL_SEMANTICS_CHANGE_STATE)
+            notify_states (node_accessible, node);
+        if (change->changes & FL_SEMANTICS_CHANGE_BOUNDS)
+            g_signal_emit_by_name (node_accessible, "visible-data-changed");
+    }
+}
+
+void
+fl_view_accessible_reset (FlViewAccessible *self)
+{
+    g_return_if_fail (FL_IS_VIEW_ACCESSIBLE (self));
+
+    for (guint i = 0; i < self->nodes->len; i++)
+        remove_node_accessible (self, i);
+}
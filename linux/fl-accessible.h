@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+#include <gtk/gtk-a11y.h>
+
+G_BEGIN_DECLS
+
+// Declared by hand as GTK 3 has no autoptr cleanup for GtkWidgetAccessible.
+#define FL_TYPE_VIEW_ACCESSIBLE  (fl_view_accessible_get_type ())
+#define FL_VIEW_ACCESSIBLE(obj)  (G_TYPE_CHECK_INSTANCE_CAST ((obj), FL_TYPE_VIEW_ACCESSIBLE, FlViewAccessible))
+#define FL_IS_VIEW_ACCESSIBLE(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), FL_TYPE_VIEW_ACCESSIBLE))
+
+typedef struct _FlViewAccessible FlViewAccessible;
+
+typedef struct
+{
+    GtkWidgetAccessibleClass parent_class;
+} FlViewAccessibleClass;
+
+/* Accessible for FlView, with its semantics tree as children. Objects for the
+ * nodes are only made when an assistive technology asks for them, and only
+ * those get events for changes. */
+
+GType fl_view_accessible_get_type      (void);
+
+/* @changes is an array of FlSemanticsNodeChange */
+
+void  fl_view_accessible_apply_changes (FlViewAccessible *accessible, GArray *changes);
+
+/* Called when the semantics tree is cleared */
+
+void  fl_view_accessible_reset         (FlViewAccessible *accessible);
+
+G_END_DECLS
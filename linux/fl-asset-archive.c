@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "fl-asset-archive.h"
+
+struct _FlAssetArchive
+{
+    GObject parent_instance;
+
+    // Archive file, or -1 and NULL if it is in a resource.
+    gint fd;
+    gchar *path;
+
+    GBytes *data;
+    const FlAssetArchiveEntry *entries;
+    guint n_entries;
+};
+
+G_DEFINE_TYPE (FlAssetArchive, fl_asset_archive, G_TYPE_OBJECT)
+
+typedef struct
+{
+    gpointer address;
+    gsize length;
+} Mapping;
+
+static void
+mapping_free (gpointer user_data)
+{
+    Mapping *mapping = user_data;
+
+    munmap (mapping->address, mapping->length);
+    g_free (mapping);
+}
+
+static GBytes *
+map_file (gint fd, gsize length, gsize offset, gint protection, GError **error)
+{
+    // mmap doesn't allow empty mappings.
+    if (length == 0)
+        return g_bytes_new_static ("", 0);
+
+    gpointer address = mmap (NULL, length, protection, MAP_PRIVATE, fd, offset);
+    if (address == MAP_FAILED) {
+        int code = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to map asset archive: %s", strerror (code));
+        return NULL;
+    }
+
+    Mapping *mapping = g_new0 (Mapping, 1);
+    mapping->address = address;
+    mapping->length = length;
+
+    return g_bytes_new_with_free_func (address, length, mapping_free, mapping);
+}
+
+static const gchar *
+get_entry_name (FlAssetArchive *self, const FlAssetArchiveEntry *entry)
+{
+    return (const gchar *) g_bytes_get_data (self->data, NULL) + entry->name_offset;
+}
+
+// Checks every offset in the archive so lookups don't need to.
+static gboolean
+load_index (FlAssetArchive *self, const gchar *name, GError **error)
+{
+    gsize length;
+    const guint8 *data = g_bytes_get_data (self->data, &length);
+
+    const FlAssetArchiveHeader *header = (const FlAssetArchiveHeader *) data;
+    if (length < sizeof (FlAssetArchiveHeader) || header->magic != FL_ASSET_ARCHIVE_MAGIC) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s is not an asset archive", name);
+        return FALSE;
+    }
+    if (header->version != FL_ASSET_ARCHIVE_VERSION) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Asset archive version %u not supported", header->version);
+        return FALSE;
+    }
+    if ((length - sizeof (FlAssetArchiveHeader)) / sizeof (FlAssetArchiveEntry) < header->n_entries) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Asset archive %s is truncated", name);
+        return FALSE;
+    }
+
+    self->entries = (const FlAssetArchiveEntry *) (data + sizeof (FlAssetArchiveHeader));
+    self->n_entries = header->n_entries;
+    for (guint i = 0; i < self->n_entries; i++) {
+        const FlAssetArchiveEntry *entry = &self->entries[i];
+        if (entry->name_offset > length || length - entry->name_offset < entry->name_length ||
+            entry->offset > length || length - entry->offset < entry->size) {
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Asset archive %s is truncated", name);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static gint
+compare_name (FlAssetArchive *self, const FlAssetArchiveEntry *entry, const gchar *name, gsize name_length)
+{
+    gint result = memcmp (get_entry_name (self, entry), name, MIN (entry->name_length, name_length));
+    if (result != 0)
+        return result;
+    return entry->name_length < name_length ? -1 : entry->name_length > name_length ? 1 : 0;
+}
+
+static const FlAssetArchiveEntry *
+find_entry (FlAssetArchive *self, const gchar *name)
+{
+    gsize name_length = strlen (name);
+    guint low = 0, high = self->n_entries;
+
+    while (low < high) {
+        guint middle = low + (high - low) / 2;
+        gint result = compare_name (self, &self->entries[middle], name, name_length);
+        if (result == 0)
+            return &self->entries[middle];
+        if (result < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return NULL;
+}
+
+static GBytes *
+decompress_entry (FlAssetArchive *self, const FlAssetArchiveEntry *entry, const gchar *name, GError **error)
+{
+    g_autoptr(GZlibDecompressor) decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
+    const guint8 *data = (const guint8 *) g_bytes_get_data (self->data, NULL) + entry->offset;
+    g_autofree guint8 *buffer = g_malloc (entry->uncompressed_size);
+    gsize bytes_read, bytes_written;
+
+    GConverterResult result = g_converter_convert (G_CONVERTER (decompressor),
+                                                   data, entry->size,
+                                                   buffer, entry->uncompressed_size,
+                                                   G_CONVERTER_INPUT_AT_END,
+                                                   &bytes_read, &bytes_written, error);
+    if (result == G_CONVERTER_ERROR)
+        return NULL;
+    if (result != G_CONVERTER_FINISHED || bytes_written != entry->uncompressed_size) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Asset %s is corrupt", name);
+        return NULL;
+    }
+
+    return g_bytes_new_take (g_steal_pointer (&buffer), bytes_written);
+}
+
+static void
+fl_asset_archive_dispose (GObject *object)
+{
+    FlAssetArchive *self = FL_ASSET_ARCHIVE (object);
+
+    if (self->fd >= 0) {
+        close (self->fd);
+        self->fd = -1;
+    }
+    self->entries = NULL;
+    self->n_entries = 0;
+    g_clear_pointer (&self->data, g_bytes_unref);
+
+    G_OBJECT_CLASS (fl_asset_archive_parent_class)->dispose (object);
+}
+
+static void
+fl_asset_archive_finalize (GObject *object)
+{
+    FlAssetArchive *self = FL_ASSET_ARCHIVE (object);
+
+    g_free (self->path);
+
+    G_OBJECT_CLASS (fl_asset_archive_parent_class)->finalize (object);
+}
+
+static void
+fl_asset_archive_class_init (FlAssetArchiveClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_asset_archive_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_asset_archive_finalize;
+}
+
+static void
+fl_asset_archive_init (FlAssetArchive *self)
+{
+    self->fd = -1;
+}
+
+FlAssetArchive *
+fl_asset_archive_new (const gchar *path, GError **error)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+
+    g_autoptr(FlAssetArchive) self = g_object_new (fl_asset_archive_get_type (), NULL);
+
+    self->path = g_strdup (path);
+    self->fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (self->fd < 0) {
+        int code = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to open %s: %s", path, strerror (code));
+        return NULL;
+    }
+
+    struct stat stat_buffer;
+    if (fstat (self->fd, &stat_buffer) < 0) {
+        int code = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to open %s: %s", path, strerror (code));
+        return NULL;
+    }
+
+    // One mapping for the whole archive, pages are read in as assets are used.
+    self->data = map_file (self->fd, stat_buffer.st_size, 0, PROT_READ, error);
+    if (self->data == NULL)
+        return NULL;
+    if (!load_index (self, path, error))
+        return NULL;
+
+    // The index is read straight away.
+    gsize index_length = sizeof (FlAssetArchiveHeader) + self->n_entries * sizeof (FlAssetArchiveEntry);
+    madvise ((gpointer) g_bytes_get_data (self->data, NULL), index_length, MADV_WILLNEED);
+
+    return g_steal_pointer (&self);
+}
+
+FlAssetArchive *
+fl_asset_archive_new_from_resource (const gchar *resource_path, GError **error)
+{
+    g_return_val_if_fail (resource_path != NULL, NULL);
+
+    g_autoptr(FlAssetArchive) self = g_object_new (fl_asset_archive_get_type (), NULL);
+
+    // Uncompressed resources point into the executable's data.
+    self->data = g_resources_lookup_data (resource_path, G_RESOURCE_LOOKUP_FLAGS_NONE, error);
+    if (self->data == NULL)
+        return NULL;
+    if (!load_index (self, resource_path, error))
+        return NULL;
+
+    return g_steal_pointer (&self);
+}
+
+const gchar *
+fl_asset_archive_get_path (FlAssetArchive *self)
+{
+    g_return_val_if_fail (FL_IS_ASSET_ARCHIVE (self), NULL);
+
+    return self->path;
+}
+
+gboolean
+fl_asset_archive_contains (FlAssetArchive *self, const gchar *name)
+{
+    g_return_val_if_fail (FL_IS_ASSET_ARCHIVE (self), FALSE);
+    g_return_val_if_fail (name != NULL, FALSE);
+
+    return find_entry (self, name) != NULL;
+}
+
+GBytes *
+fl_asset_archive_lookup (FlAssetArchive *self, const gchar *name, GError **error)
+{
+    g_return_val_if_fail (FL_IS_ASSET_ARCHIVE (self), NULL);
+    g_return_val_if_fail (name != NULL, NULL);
+
+    const FlAssetArchiveEntry *entry = find_entry (self, name);
+    if (entry == NULL) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No asset %s in archive", name);
+        return NULL;
+    }
+
+    if (entry->flags & FL_ASSET_ARCHIVE_FLAG_COMPRESSED)
+        return decompress_entry (self, entry, name, error);
+
+    return g_bytes_new_from_bytes (self->data, entry->offset, entry->size);
+}
+
+GBytes *
+fl_asset_archive_lookup_executable (FlAssetArchive *self, const gchar *name, GError **error)
+{
+    g_return_val_if_fail (FL_IS_ASSET_ARCHIVE (self), NULL);
+    g_return_val_if_fail (name != NULL, NULL);
+
+    const FlAssetArchiveEntry *entry = find_entry (self, name);
+    if (entry == NULL) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No asset %s in archive", name);
+        return NULL;
+    }
+
+    // Mapped on its own, which the alignment of entries allows for.
+    if (self->fd < 0 || entry->flags & FL_ASSET_ARCHIVE_FLAG_COMPRESSED || entry->offset % sysconf (_SC_PAGESIZE) != 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Asset %s can't be mapped executable", name);
+        return NULL;
+    }
+
+    return map_file (self->fd, entry->size, entry->offset, PROT_READ | PROT_EXEC, error);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlAssetArchive, fl_asset_archive, FL, ASSET_ARCHIVE, GObject)
+
+/* The contents of a flutter_assets directory packed into one file by
+ * fl-asset-pack, all in host byte order:
+ *
+ *   FlAssetArchiveHeader
+ *   FlAssetArchiveEntry for each file, sorted by name
+ *   File names, not nul-terminated
+ *   File data, each starting on a FL_ASSET_ARCHIVE_ALIGNMENT boundary
+ *
+ * Entries with FL_ASSET_ARCHIVE_FLAG_COMPRESSED set are stored as a zlib
+ * stream. The archive is mapped into memory when opened and uncompressed
+ * entries are returned without being copied. */
+
+#define FL_ASSET_ARCHIVE_MAGIC 0x4b504c46
+
+#define FL_ASSET_ARCHIVE_VERSION 1
+
+#define FL_ASSET_ARCHIVE_ALIGNMENT 4096
+
+#define FL_ASSET_ARCHIVE_FLAG_COMPRESSED 0x1
+
+typedef struct
+{
+    guint32 magic;
+    guint32 version;
+    guint32 n_entries;
+    guint32 alignment;
+} FlAssetArchiveHeader;
+
+typedef struct
+{
+    // Relative to the start of the archive.
+    guint32 name_offset;
+    guint32 name_length;
+    guint32 flags;
+    guint32 reserved;
+    guint64 offset;
+    guint64 size;
+    guint64 uncompressed_size;
+} FlAssetArchiveEntry;
+
+FlAssetArchive *fl_asset_archive_new               (const gchar *path, GError **error);
+
+FlAssetArchive *fl_asset_archive_new_from_resource (const gchar *resource_path, GError **error);
+
+/* Returns NULL if the archive is in a resource */
+
+const gchar    *fl_asset_archive_get_path          (FlAssetArchive *archive);
+
+gboolean        fl_asset_archive_contains          (FlAssetArchive *archive, const gchar *name);
+
+GBytes         *fl_asset_archive_lookup            (FlAssetArchive *archive, const gchar *name, GError **error);
+
+/* Maps an uncompressed entry readable and executable, for AOT snapshot
+ * instructions. Only supported by archives opened from a file. */
+
+GBytes         *fl_asset_archive_lookup_executable (FlAssetArchive *archive, const gchar *name, GError **error);
+
+G_END_DECLS
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+// Packs a flutter_assets directory into an archive read by FlAssetArchive.
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "fl-asset-archive.h"
+
+// Entries are only stored compressed if that saves at least a quarter of their size.
+#define MIN_COMPRESSION_SAVING 4
+
+typedef struct
+{
+    gchar *name;
+    GBytes *data;
+    gsize uncompressed_size;
+    guint32 flags;
+} Asset;
+
+static void
+asset_free (Asset *asset)
+{
+    g_free (asset->name);
+    g_bytes_unref (asset->data);
+    g_free (asset);
+}
+
+static gint
+compare_assets (gconstpointer a, gconstpointer b)
+{
+    const Asset *asset_a = *(const Asset **) a;
+    const Asset *asset_b = *(const Asset **) b;
+
+    // Byte order, the same as the lookups.
+    return strcmp (asset_a->name, asset_b->name);
+}
+
+static GBytes *
+compress (GBytes *data, GError **error)
+{
+    g_autoptr(GZlibCompressor) compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB, 9);
+    g_autoptr(GOutputStream) memory_stream = g_memory_output_stream_new_resizable ();
+    g_autoptr(GOutputStream) stream = g_converter_output_stream_new (memory_stream, G_CONVERTER (compressor));
+
+    gsize length;
+    gconstpointer buffer = g_bytes_get_data (data, &length);
+    if (!g_output_stream_write_all (stream, buffer, length, NULL, NULL, error) ||
+        !g_output_stream_close (stream, NULL, error))
+        return NULL;
+
+    return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (memory_stream));
+}
+
+static gboolean
+add_directory (GPtrArray *assets, const gchar *root, const gchar *prefix, gboolean use_compression, GError **error)
+{
+    g_autofree gchar *path = g_build_filename (root, prefix, NULL);
+    g_autoptr(GDir) dir = g_dir_open (path, 0, error);
+    if (dir == NULL)
+        return FALSE;
+
+    const gchar *file_name;
+    while ((file_name = g_dir_read_name (dir)) != NULL) {
+        g_autofree gchar *name = prefix[0] != '\0' ? g_strdup_printf ("%s/%s", prefix, file_name) : g_strdup (file_name);
+        g_autofree gchar *file_path = g_build_filename (root, name, NULL);
+
+        if (g_file_test (file_path, G_FILE_TEST_IS_DIR)) {
+            if (!add_directory (assets, root, name, use_compression, error))
+                return FALSE;
+            continue;
+        }
+
+        gchar *contents;
+        gsize length;
+        if (!g_file_get_contents (file_path, &contents, &length, error))
+            return FALSE;
+
+        Asset *asset = g_new0 (Asset, 1);
+        asset->name = g_steal_pointer (&name);
+        asset->data = g_bytes_new_take (contents, length);
+        asset->uncompressed_size = length;
+        g_ptr_array_add (assets, asset);
+
+        if (use_compression && length > 0) {
+            g_autoptr(GBytes) compressed = compress (asset->data, error);
+            if (compressed == NULL)
+                return FALSE;
+            if (g_bytes_get_size (compressed) <= length - length / MIN_COMPRESSION_SAVING) {
+                g_bytes_unref (asset->data);
+                asset->data = g_steal_pointer (&compressed);
+                asset->flags |= FL_ASSET_ARCHIVE_FLAG_COMPRESSED;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+static gsize
+align (gsize offset)
+{
+    return (offset + FL_ASSET_ARCHIVE_ALIGNMENT - 1) / FL_ASSET_ARCHIVE_ALIGNMENT * FL_ASSET_ARCHIVE_ALIGNMENT;
+}
+
+static gboolean
+write_archive (GPtrArray *assets, const gchar *path, GError **error)
+{
+    g_autoptr(GByteArray) index = g_byte_array_new ();
+    g_autoptr(GByteArray) names = g_byte_array_new ();
+
+    gsize names_offset = sizeof (FlAssetArchiveHeader) + assets->len * sizeof (FlAssetArchiveEntry);
+    for (guint i = 0; i < assets->len; i++) {
+        Asset *asset = g_ptr_array_index (assets, i);
+        g_byte_array_append (names, (const guint8 *) asset->name, strlen (asset->name));
+    }
+
+    FlAssetArchiveHeader header = { 0 };
+    header.magic = FL_ASSET_ARCHIVE_MAGIC;
+    header.version = FL_ASSET_ARCHIVE_VERSION;
+    header.n_entries = assets->len;
+    header.alignment = FL_ASSET_ARCHIVE_ALIGNMENT;
+    g_byte_array_append (index, (const guint8 *) &header, sizeof (header));
+
+    gsize name_offset = names_offset;
+    gsize offset = align (names_offset + names->len);
+    for (guint i = 0; i < assets->len; i++) {
+        Asset *asset = g_ptr_array_index (assets, i);
+        FlAssetArchiveEntry entry = { 0 };
+        entry.name_offset = name_offset;
+        entry.name_length = strlen (asset->name);
+        entry.flags = asset->flags;
+        entry.offset = offset;
+        entry.size = g_bytes_get_size (asset->data);
+        entry.uncompressed_size = asset->uncompressed_size;
+        g_byte_array_append (index, (const guint8 *) &entry, sizeof (entry));
+
+        name_offset += entry.name_length;
+        offset = align (offset + entry.size);
+    }
+    g_byte_array_append (index, names->data, names->len);
+
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    g_autoptr(GFileOutputStream) stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+    if (stream == NULL)
+        return FALSE;
+
+    static const guint8 padding[FL_ASSET_ARCHIVE_ALIGNMENT] = { 0 };
+    gsize written = index->len;
+    if (!g_output_stream_write_all (G_OUTPUT_STREAM (stream), index->data, index->len, NULL, NULL, error))
+        return FALSE;
+    for (guint i = 0; i < assets->len; i++) {
+        Asset *asset = g_ptr_array_index (assets, i);
+        gsize length;
+        gconstpointer data = g_bytes_get_data (asset->data, &length);
+
+        if (!g_output_stream_write_all (G_OUTPUT_STREAM (stream), padding, align (written) - written, NULL, NULL, error) ||
+            !g_output_stream_write_all (G_OUTPUT_STREAM (stream), data, length, NULL, NULL, error))
+            return FALSE;
+        written = align (written) + length;
+    }
+
+    return g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, error);
+}
+
+int
+main (int argc, char **argv)
+{
+    gboolean use_compression = FALSE;
+    GOptionEntry entries[] = {
+        { "compress", 'z', 0, G_OPTION_ARG_NONE, &use_compression, "Compress entries where it saves space", NULL },
+        { NULL }
+    };
+    g_autoptr(GOptionContext) context = g_option_context_new ("ASSETS-DIRECTORY ARCHIVE");
+    g_autoptr(GError) error = NULL;
+
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 1;
+    }
+    if (argc != 3) {
+        g_printerr ("Usage: %s [--compress] ASSETS-DIRECTORY ARCHIVE\n", g_get_prgname ());
+        return 1;
+    }
+
+    g_autoptr(GPtrArray) assets = g_ptr_array_new_with_free_func ((GDestroyNotify) asset_free);
+    if (!add_directory (assets, argv[1], "", use_compression, &error)) {
+        g_printerr ("Failed to read assets: %s\n", error->message);
+        return 1;
+    }
+    g_ptr_array_sort (assets, compare_assets);
+
+    if (!write_archive (assets, argv[2], &error)) {
+        g_printerr ("Failed to write %s: %s\n", argv[2], error->message);
+        return 1;
+    }
+
+    return 0;
+}
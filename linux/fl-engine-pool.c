@@ -0,0 +1,661 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <gdk/gdkwayland.h>
+
+#include "fl-engine-pool.h"
+#include "fl-engine-result.h"
+#include "fl-memory-monitor.h"
+#include "fl-renderer-egl.h"
+#include "fl-renderer-wayland.h"
+#include "fl-renderer-x11.h"
+#include "fl-view-private.h"
+
+// Time from a view taking an engine to starting its replacement, in milliseconds, so the view draws first.
+#define REFILL_DELAY 500
+
+// Frame interval used while an engine has no view, in nanoseconds.
+#define DEFAULT_FRAME_INTERVAL (G_GUINT64_CONSTANT (1000000000) / 60)
+
+typedef struct
+{
+    gchar *channel;
+    GBytes *message;
+    const FlutterPlatformMessageResponseHandle *response_handle;
+} HeldMessage;
+
+struct _FlPooledEngine
+{
+    gint ref_count;
+
+    // Settings the engine was started with.
+    GType renderer_type;
+    gboolean use_present_thread;
+    gchar *assets_path;
+    gchar *icu_data_path;
+    gchar *entrypoint;
+    gsize memory_budget;
+
+    FlRenderer *renderer;
+
+    // Set to NULL once shut down, only used from the main thread.
+    FlutterEngine engine;
+
+    // Callbacks of the view the engine is attached to, set before the view is.
+    FlutterOpenGLRendererConfig open_gl;
+    VsyncCallback vsync_callback;
+    FlutterPlatformMessageCallback platform_message_callback;
+    FlutterUpdateSemanticsNodeCallback update_semantics_node_callback;
+    FlutterUpdateSemanticsCustomActionCallback update_semantics_custom_action_callback;
+
+    // View the engine is attached to, read from the engine threads.
+    gpointer view;
+
+    // Protects the fields below, used until the view is attached.
+    GMutex mutex;
+    GPtrArray *held_messages;
+    gboolean vsync_answered;
+    gboolean have_pending_vsync;
+    intptr_t pending_vsync_baton;
+};
+
+struct _FlEnginePool
+{
+    GObject parent_instance;
+
+    // Project the engines are started with.
+    gchar *assets_path;
+    gchar *icu_data_path;
+    gchar *entrypoint;
+    gsize memory_budget;
+    gboolean use_present_thread;
+
+    // Number of engines to keep, and the memory they can use, 0 if unlimited.
+    guint size;
+    gsize max_memory;
+
+    // Engines ready to be taken, oldest first.
+    GQueue engines;
+
+    guint refill_source;
+
+    // Set when an engine failed to start, so it isn't retried until the settings change.
+    gboolean failed;
+};
+
+G_DEFINE_TYPE (FlEnginePool, fl_engine_pool, G_TYPE_OBJECT)
+
+static void
+held_message_free (HeldMessage *message)
+{
+    g_free (message->channel);
+    g_bytes_unref (message->message);
+    g_free (message);
+}
+
+static FlPooledEngine *
+pooled_engine_ref (FlPooledEngine *self)
+{
+    g_atomic_int_inc (&self->ref_count);
+    return self;
+}
+
+static void
+pooled_engine_unref (FlPooledEngine *self)
+{
+    if (!g_atomic_int_dec_and_test (&self->ref_count))
+        return;
+
+    g_clear_object (&self->renderer);
+    g_free (self->assets_path);
+    g_free (self->icu_data_path);
+    g_free (self->entrypoint);
+    g_ptr_array_unref (self->held_messages);
+    g_mutex_clear (&self->mutex);
+    g_free (self);
+}
+
+static void
+pooled_engine_send_vsync (FlPooledEngine *self, intptr_t baton)
+{
+    uint64_t now = FlutterEngineGetCurrentTime ();
+    FlutterEngineOnVsync (self->engine, baton, now, now + DEFAULT_FRAME_INTERVAL);
+}
+
+// FIXME: Called from Flutter thread
+static bool
+pooled_engine_make_current (void *user_data)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    if (view != NULL)
+        return self->open_gl.make_current (view);
+
+    // Without a surface until attached.
+    return fl_renderer_make_current (self->renderer);
+}
+
+// FIXME: Called from Flutter thread
+static bool
+pooled_engine_clear_current (void *user_data)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    if (view != NULL)
+        return self->open_gl.clear_current (view);
+
+    return fl_renderer_clear_current (self->renderer);
+}
+
+// FIXME: Called from Flutter thread
+static bool
+pooled_engine_present (void *user_data)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    if (view != NULL)
+        return self->open_gl.present (view);
+
+    // Nothing to show a frame on yet.
+    fl_renderer_discard_frame (self->renderer);
+    return true;
+}
+
+// FIXME: Called from Flutter thread
+static uint32_t
+pooled_engine_fbo_callback (void *user_data)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    if (view != NULL)
+        return self->open_gl.fbo_callback (view);
+
+    return 0;
+}
+
+static void *
+pooled_engine_proc_resolver (void *user_data, const char *name)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    if (view != NULL)
+        return self->open_gl.gl_proc_resolver (view, name);
+
+    return fl_renderer_get_proc_address (self->renderer, name);
+}
+
+static gboolean
+pooled_engine_vsync_idle_cb (gpointer user_data)
+{
+    FlPooledEngine *self = user_data;
+
+    // Passed on to the view if it was attached in the meantime.
+    g_mutex_lock (&self->mutex);
+    gboolean have_pending_vsync = self->have_pending_vsync && self->engine != NULL;
+    intptr_t baton = self->pending_vsync_baton;
+    if (have_pending_vsync)
+        self->have_pending_vsync = FALSE;
+    g_mutex_unlock (&self->mutex);
+
+    if (have_pending_vsync)
+        pooled_engine_send_vsync (self, baton);
+
+    return G_SOURCE_REMOVE;
+}
+
+// FIXME: Called from Flutter thread
+static void
+pooled_engine_vsync_cb (void *user_data, intptr_t baton)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    if (view == NULL) {
+        g_mutex_lock (&self->mutex);
+        view = g_atomic_pointer_get (&self->view);
+        if (view == NULL) {
+            self->have_pending_vsync = TRUE;
+            self->pending_vsync_baton = baton;
+
+            // Let the first frame be built so the app is warmed up, then hold the
+            // baton so an animation doesn't run while nobody can see it.
+            if (!self->vsync_answered) {
+                self->vsync_answered = TRUE;
+                g_idle_add_full (G_PRIORITY_HIGH, pooled_engine_vsync_idle_cb, pooled_engine_ref (self), (GDestroyNotify) pooled_engine_unref);
+            }
+        }
+        g_mutex_unlock (&self->mutex);
+    }
+
+    if (view != NULL)
+        self->vsync_callback (view, baton);
+}
+
+// FIXME: Called from Flutter thread
+static void
+pooled_engine_platform_message_cb (const FlutterPlatformMessage *platform_message, void *user_data)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    // Messages are held until a view can handle them.
+    if (view == NULL) {
+        g_mutex_lock (&self->mutex);
+        view = g_atomic_pointer_get (&self->view);
+        if (view == NULL) {
+            HeldMessage *message = g_new0 (HeldMessage, 1);
+            message->channel = g_strdup (platform_message->channel);
+            message->message = g_bytes_new (platform_message->message, platform_message->message_size);
+            message->response_handle = platform_message->response_handle;
+            g_ptr_array_add (self->held_messages, message);
+        }
+        g_mutex_unlock (&self->mutex);
+    }
+
+    if (view != NULL)
+        self->platform_message_callback (platform_message, view);
+}
+
+// FIXME: Called from Flutter thread
+static void
+pooled_engine_update_semantics_node_cb (const FlutterSemanticsNode *node, void *user_data)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    // Semantics are only enabled by a view.
+    if (view != NULL)
+        self->update_semantics_node_callback (node, view);
+}
+
+// FIXME: Called from Flutter thread
+static void
+pooled_engine_update_semantics_custom_action_cb (const FlutterSemanticsCustomAction *action, void *user_data)
+{
+    FlPooledEngine *self = user_data;
+    gpointer view = g_atomic_pointer_get (&self->view);
+
+    if (view != NULL)
+        self->update_semantics_custom_action_callback (action, view);
+}
+
+static gsize
+get_engine_size (FlEnginePool *self)
+{
+    return self->memory_budget > 0 ? self->memory_budget : FL_VIEW_DEFAULT_ENGINE_SIZE;
+}
+
+static guint
+get_capacity (FlEnginePool *self)
+{
+    if (self->assets_path == NULL)
+        return 0;
+
+    guint capacity = self->size;
+    if (self->max_memory > 0)
+        capacity = MIN (capacity, self->max_memory / get_engine_size (self));
+
+    return capacity;
+}
+
+static FlPooledEngine *
+fl_engine_pool_start_engine (FlEnginePool *self)
+{
+    GdkDisplay *display = gdk_display_get_default ();
+    FlutterRendererConfig config = { 0 };
+    FlutterProjectArgs args = { 0 };
+
+    if (display == NULL)
+        return NULL;
+
+    FlPooledEngine *engine = g_new0 (FlPooledEngine, 1);
+    engine->ref_count = 1;
+    engine->assets_path = g_strdup (self->assets_path);
+    engine->icu_data_path = g_strdup (self->icu_data_path);
+    engine->entrypoint = g_strdup (self->entrypoint);
+    engine->memory_budget = self->memory_budget;
+    g_mutex_init (&engine->mutex);
+    engine->held_messages = g_ptr_array_new_with_free_func ((GDestroyNotify) held_message_free);
+
+    // The renderer FlView picks for the display, GDK GL views don't use the pool.
+    if (GDK_IS_WAYLAND_DISPLAY (display)) {
+        engine->renderer = FL_RENDERER (fl_renderer_wayland_new ());
+    } else {
+        engine->renderer = FL_RENDERER (fl_renderer_x11_new ());
+        engine->use_present_thread = self->use_present_thread;
+        fl_renderer_egl_set_use_present_thread (FL_RENDERER_EGL (engine->renderer), engine->use_present_thread);
+    }
+    engine->renderer_type = G_OBJECT_TYPE (engine->renderer);
+    if (!fl_renderer_egl_prepare (FL_RENDERER_EGL (engine->renderer), display)) {
+        pooled_engine_unref (engine);
+        return NULL;
+    }
+
+    config.type = kOpenGL;
+    config.open_gl.struct_size = sizeof (FlutterOpenGLRendererConfig);
+    config.open_gl.make_current = pooled_engine_make_current;
+    config.open_gl.clear_current = pooled_engine_clear_current;
+    config.open_gl.present = pooled_engine_present;
+    config.open_gl.fbo_callback = pooled_engine_fbo_callback;
+    // The present thread is only started with the view's widget, so this is set up front.
+    config.open_gl.fbo_reset_after_present = engine->use_present_thread;
+    config.open_gl.gl_proc_resolver = pooled_engine_proc_resolver;
+    args.struct_size = sizeof (FlutterProjectArgs);
+    args.assets_path = engine->assets_path;
+    args.icu_data_path = engine->icu_data_path;
+    args.custom_dart_entrypoint = engine->entrypoint;
+    args.vsync_callback = pooled_engine_vsync_cb;
+    args.platform_message_callback = pooled_engine_platform_message_cb;
+    args.update_semantics_node_callback = pooled_engine_update_semantics_node_cb;
+    args.update_semantics_custom_action_callback = pooled_engine_update_semantics_custom_action_cb;
+    args.shutdown_dart_vm_when_done = false;
+    const gchar *argv[2];
+    g_autofree gchar *cache_switch = fl_view_apply_memory_budget (&args, engine->memory_budget, argv);
+
+    gint64 start_time = g_get_monotonic_time ();
+    FlutterEngineResult result = FlutterEngineInitialize (FLUTTER_ENGINE_VERSION, &config, &args, engine, &engine->engine);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to initialize pooled Flutter engine: %s", error);
+        engine->engine = NULL;
+        pooled_engine_unref (engine);
+        return NULL;
+    }
+
+    result = FlutterEngineRunInitialized (engine->engine);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to run pooled Flutter engine: %s", error);
+        fl_pooled_engine_release (engine);
+        return NULL;
+    }
+    g_debug ("Started pooled engine in %" G_GINT64_FORMAT "us", g_get_monotonic_time () - start_time);
+
+    return engine;
+}
+
+static void
+fl_engine_pool_clear (FlEnginePool *self)
+{
+    FlPooledEngine *engine;
+
+    while ((engine = g_queue_pop_head (&self->engines)) != NULL)
+        fl_pooled_engine_release (engine);
+}
+
+static void fl_engine_pool_schedule_refill (FlEnginePool *self, guint delay);
+
+static gboolean
+refill_cb (gpointer user_data)
+{
+    FlEnginePool *self = user_data;
+
+    self->refill_source = 0;
+
+    if (self->engines.length >= get_capacity (self))
+        return G_SOURCE_REMOVE;
+
+    FlPooledEngine *engine = fl_engine_pool_start_engine (self);
+    if (engine == NULL) {
+        self->failed = TRUE;
+        return G_SOURCE_REMOVE;
+    }
+    g_queue_push_tail (&self->engines, engine);
+
+    // One engine at a time, so the main thread can handle events in between.
+    fl_engine_pool_schedule_refill (self, 0);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+fl_engine_pool_schedule_refill (FlEnginePool *self, guint delay)
+{
+    if (self->refill_source != 0 || self->failed || self->engines.length >= get_capacity (self))
+        return;
+
+    self->refill_source = g_timeout_add_full (G_PRIORITY_LOW, delay, refill_cb, self, NULL);
+}
+
+static void
+fl_engine_pool_update (FlEnginePool *self)
+{
+    while (self->engines.length > get_capacity (self))
+        fl_pooled_engine_release (g_queue_pop_tail (&self->engines));
+
+    self->failed = FALSE;
+    fl_engine_pool_schedule_refill (self, 0);
+}
+
+static guint64
+fl_engine_pool_low_memory_cb (FlMemoryMonitor *monitor, FlEnginePool *self)
+{
+    // Engines without a view are the first thing to go, the pool is refilled
+    // when the next view takes an engine.
+    guint64 reclaimed = (guint64) self->engines.length * get_engine_size (self);
+    fl_engine_pool_clear (self);
+    if (self->refill_source != 0) {
+        g_source_remove (self->refill_source);
+        self->refill_source = 0;
+    }
+
+    return reclaimed;
+}
+
+static void
+fl_engine_pool_dispose (GObject *object)
+{
+    FlEnginePool *self = FL_ENGINE_POOL (object);
+
+    if (self->refill_source != 0) {
+        g_source_remove (self->refill_source);
+        self->refill_source = 0;
+    }
+    fl_engine_pool_clear (self);
+    g_clear_pointer (&self->assets_path, g_free);
+    g_clear_pointer (&self->icu_data_path, g_free);
+    g_clear_pointer (&self->entrypoint, g_free);
+
+    G_OBJECT_CLASS (fl_engine_pool_parent_class)->dispose (object);
+}
+
+static void
+fl_engine_pool_class_init (FlEnginePoolClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_engine_pool_dispose;
+}
+
+static void
+fl_engine_pool_init (FlEnginePool *self)
+{
+    g_queue_init (&self->engines);
+    g_signal_connect_object (fl_memory_monitor_get_default (), "low-memory",
+                             G_CALLBACK (fl_engine_pool_low_memory_cb), self, 0);
+}
+
+FlEnginePool *
+fl_engine_pool_get_default (void)
+{
+    static FlEnginePool *pool = NULL;
+
+    if (pool == NULL)
+        pool = g_object_new (fl_engine_pool_get_type (), NULL);
+
+    return pool;
+}
+
+void
+fl_engine_pool_set_project (FlEnginePool *self, const gchar *assets_path, const gchar *icu_data_path, const gchar *entrypoint)
+{
+    g_return_if_fail (FL_IS_ENGINE_POOL (self));
+
+    // Engines already running are for the old project.
+    fl_engine_pool_clear (self);
+    g_free (self->assets_path);
+    self->assets_path = g_strdup (assets_path);
+    g_free (self->icu_data_path);
+    self->icu_data_path = g_strdup (icu_data_path);
+    g_free (self->entrypoint);
+    self->entrypoint = g_strdup (entrypoint);
+    fl_engine_pool_update (self);
+}
+
+void
+fl_engine_pool_set_memory_budget (FlEnginePool *self, gsize budget)
+{
+    g_return_if_fail (FL_IS_ENGINE_POOL (self));
+
+    if (budget == self->memory_budget)
+        return;
+
+    fl_engine_pool_clear (self);
+    self->memory_budget = budget;
+    fl_engine_pool_update (self);
+}
+
+void
+fl_engine_pool_set_use_present_thread (FlEnginePool *self, gboolean use_present_thread)
+{
+    g_return_if_fail (FL_IS_ENGINE_POOL (self));
+
+    if (use_present_thread == self->use_present_thread)
+        return;
+
+    fl_engine_pool_clear (self);
+    self->use_present_thread = use_present_thread;
+    fl_engine_pool_update (self);
+}
+
+void
+fl_engine_pool_set_size (FlEnginePool *self, guint size)
+{
+    g_return_if_fail (FL_IS_ENGINE_POOL (self));
+
+    self->size = size;
+    fl_engine_pool_update (self);
+}
+
+void
+fl_engine_pool_set_max_memory (FlEnginePool *self, gsize max_memory)
+{
+    g_return_if_fail (FL_IS_ENGINE_POOL (self));
+
+    self->max_memory = max_memory;
+    fl_engine_pool_update (self);
+}
+
+FlPooledEngine *
+fl_engine_pool_take (FlEnginePool *self, GType renderer_type, gboolean use_present_thread, const gchar *assets_path, const gchar *icu_data_path, const gchar *entrypoint, gsize memory_budget)
+{
+    FlPooledEngine *engine = NULL;
+
+    g_return_val_if_fail (FL_IS_ENGINE_POOL (self), NULL);
+
+    for (GList *link = self->engines.head; link != NULL; link = link->next) {
+        FlPooledEngine *e = link->data;
+        if (e->renderer_type == renderer_type &&
+            e->use_present_thread == use_present_thread &&
+            g_strcmp0 (e->assets_path, assets_path) == 0 &&
+            g_strcmp0 (e->icu_data_path, icu_data_path) == 0 &&
+            g_strcmp0 (e->entrypoint, entrypoint) == 0 &&
+            e->memory_budget == memory_budget) {
+            engine = e;
+            g_queue_delete_link (&self->engines, link);
+            break;
+        }
+    }
+
+    fl_engine_pool_schedule_refill (self, REFILL_DELAY);
+
+    return engine;
+}
+
+FlRenderer *
+fl_pooled_engine_get_renderer (FlPooledEngine *self)
+{
+    g_return_val_if_fail (self != NULL, NULL);
+
+    return self->renderer;
+}
+
+FlutterEngine
+fl_pooled_engine_get_engine (FlPooledEngine *self)
+{
+    g_return_val_if_fail (self != NULL, NULL);
+
+    return self->engine;
+}
+
+void
+fl_pooled_engine_attach (FlPooledEngine *self, const FlutterRendererConfig *config, const FlutterProjectArgs *args, void *user_data)
+{
+    g_return_if_fail (self != NULL);
+    g_return_if_fail (self->view == NULL);
+
+    self->open_gl = config->open_gl;
+    self->vsync_callback = args->vsync_callback;
+    self->platform_message_callback = args->platform_message_callback;
+    self->update_semantics_node_callback = args->update_semantics_node_callback;
+    self->update_semantics_custom_action_callback = args->update_semantics_custom_action_callback;
+
+    // Held messages go first, the view is only set after so later ones can't overtake them.
+    g_mutex_lock (&self->mutex);
+    for (guint i = 0; i < self->held_messages->len; i++) {
+        HeldMessage *message = g_ptr_array_index (self->held_messages, i);
+        FlutterPlatformMessage platform_message = { 0 };
+        platform_message.struct_size = sizeof (FlutterPlatformMessage);
+        platform_message.channel = message->channel;
+        platform_message.message = g_bytes_get_data (message->message, &platform_message.message_size);
+        platform_message.response_handle = message->response_handle;
+        self->platform_message_callback (&platform_message, user_data);
+    }
+    g_ptr_array_set_size (self->held_messages, 0);
+    if (self->have_pending_vsync) {
+        self->have_pending_vsync = FALSE;
+        self->vsync_callback (user_data, self->pending_vsync_baton);
+    }
+    g_atomic_pointer_set (&self->view, user_data);
+    g_mutex_unlock (&self->mutex);
+}
+
+void
+fl_pooled_engine_release (FlPooledEngine *self)
+{
+    g_return_if_fail (self != NULL);
+
+    // An attached engine has been shut down by its view.
+    if (g_atomic_pointer_get (&self->view) == NULL && self->engine != NULL) {
+        // The engine waits for every message to be responded to and every baton to be returned.
+        g_mutex_lock (&self->mutex);
+        for (guint i = 0; i < self->held_messages->len; i++) {
+            HeldMessage *message = g_ptr_array_index (self->held_messages, i);
+            FlutterEngineSendPlatformMessageResponse (self->engine, message->response_handle, NULL, 0);
+        }
+        g_ptr_array_set_size (self->held_messages, 0);
+        if (self->have_pending_vsync) {
+            self->have_pending_vsync = FALSE;
+            pooled_engine_send_vsync (self, self->pending_vsync_baton);
+        }
+        g_mutex_unlock (&self->mutex);
+
+        FlutterEngineResult result = FlutterEngineShutdown (self->engine);
+        if (result != kSuccess) {
+            g_autofree gchar *error = flutter_engine_result_to_string (result);
+            g_warning ("Failed to shutdown pooled Flutter engine: %s", error);
+        }
+    }
+    self->engine = NULL;
+
+    pooled_engine_unref (self);
+}
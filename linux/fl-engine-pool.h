@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "embedder.h"
+#include "fl-renderer.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlEnginePool, fl_engine_pool, FL, ENGINE_POOL, GObject)
+
+typedef struct _FlPooledEngine FlPooledEngine;
+
+/* Keeps engines running for views that haven't been opened yet, so a new view
+ * with the same project only has to attach its surface. Engines are started on
+ * the main thread, one at a time when it is idle. Nothing is pooled until a
+ * project and size are set. */
+
+FlEnginePool   *fl_engine_pool_get_default             (void);
+
+/* @entrypoint is the Dart function run by the engines, or NULL for main() */
+
+void            fl_engine_pool_set_project             (FlEnginePool *pool, const gchar *assets_path, const gchar *icu_data_path, const gchar *entrypoint);
+
+/* Memory budget of each engine, as given to fl_view_set_memory_budget() */
+
+void            fl_engine_pool_set_memory_budget       (FlEnginePool *pool, gsize budget);
+
+void            fl_engine_pool_set_use_present_thread  (FlEnginePool *pool, gboolean use_present_thread);
+
+/* Fewer than @size engines are kept if they wouldn't fit in @max_memory, 0 if unlimited */
+
+void            fl_engine_pool_set_size                (FlEnginePool *pool, guint size);
+
+void            fl_engine_pool_set_max_memory          (FlEnginePool *pool, gsize max_memory);
+
+/* Called by FlView. Returns an engine matching the view's settings, or NULL if
+ * there is none ready. */
+
+FlPooledEngine *fl_engine_pool_take                    (FlEnginePool *pool, GType renderer_type, gboolean use_present_thread, const gchar *assets_path, const gchar *icu_data_path, const gchar *entrypoint, gsize memory_budget);
+
+/* Renderer the engine is drawing with, to be started with the view's widget */
+
+FlRenderer     *fl_pooled_engine_get_renderer          (FlPooledEngine *engine);
+
+FlutterEngine   fl_pooled_engine_get_engine            (FlPooledEngine *engine);
+
+/* Passes the engine's callbacks on to @user_data with the view's @config and
+ * @args, along with any messages and vsync requests held for it. The view
+ * then owns the engine and must shut it down before releasing @engine. */
+
+void            fl_pooled_engine_attach                (FlPooledEngine *engine, const FlutterRendererConfig *config, const FlutterProjectArgs *args, void *user_data);
+
+/* Shuts down the engine if it was never attached */
+
+void            fl_pooled_engine_release               (FlPooledEngine *engine);
+
+G_END_DECLS
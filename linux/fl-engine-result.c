@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include "fl-engine-result.h"
+
+gchar *
+flutter_engine_result_to_string (FlutterEngineResult result)
+{
+    switch (result)
+    {
+    case kSuccess:
+        return g_strdup ("Success");
+    case kInvalidLibraryVersion:
+        return g_strdup ("Invalid library version");
+    case kInvalidArguments:
+        return g_strdup ("Invalid arguments");
+    case kInternalInconsistency:
+        return g_strdup ("Internal inconsistency");
+    default:
+        return g_strdup_printf ("Unknown Flutter error %d", result);
+    }
+}
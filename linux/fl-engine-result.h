@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "embedder.h"
+
+G_BEGIN_DECLS
+
+/* Used by other parts of the embedder, not for applications */
+
+/* Returns a description of @result for error messages, free with g_free() */
+
+gchar *flutter_engine_result_to_string (FlutterEngineResult result);
+
+G_END_DECLS
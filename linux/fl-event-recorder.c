@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "fl-event-recorder.h"
+
+struct _FlEventRecorder
+{
+    GObject parent_instance;
+
+    FILE *file;
+
+    // Engine time recording started, in nanoseconds.
+    uint64_t start_time;
+
+    // Record being built, reused between records.
+    GByteArray *record;
+
+    gboolean failed;
+};
+
+G_DEFINE_TYPE (FlEventRecorder, fl_event_recorder, G_TYPE_OBJECT)
+
+static void
+append (FlEventRecorder *self, gconstpointer data, gsize length)
+{
+    g_byte_array_append (self->record, data, length);
+}
+
+static void
+append_uint8 (FlEventRecorder *self, guint8 value)
+{
+    append (self, &value, sizeof (value));
+}
+
+static void
+append_uint32 (FlEventRecorder *self, guint32 value)
+{
+    append (self, &value, sizeof (value));
+}
+
+static void
+append_int64 (FlEventRecorder *self, gint64 value)
+{
+    append (self, &value, sizeof (value));
+}
+
+static void
+append_double (FlEventRecorder *self, gdouble value)
+{
+    append (self, &value, sizeof (value));
+}
+
+static void
+begin_record (FlEventRecorder *self, FlEventLogRecord type)
+{
+    g_byte_array_set_size (self->record, 0);
+    append_uint8 (self, type);
+    guint64 time = FlutterEngineGetCurrentTime () - self->start_time;
+    append (self, &time, sizeof (time));
+}
+
+static void
+end_record (FlEventRecorder *self)
+{
+    if (self->failed || self->file == NULL)
+        return;
+
+    if (fwrite (self->record->data, 1, self->record->len, self->file) != self->record->len) {
+        g_warning ("Failed to write event log: %s", strerror (errno));
+        self->failed = TRUE;
+    }
+}
+
+static void
+fl_event_recorder_dispose (GObject *object)
+{
+    FlEventRecorder *self = FL_EVENT_RECORDER (object);
+
+    fl_event_recorder_close (self, NULL);
+
+    G_OBJECT_CLASS (fl_event_recorder_parent_class)->dispose (object);
+}
+
+static void
+fl_event_recorder_finalize (GObject *object)
+{
+    FlEventRecorder *self = FL_EVENT_RECORDER (object);
+
+    g_byte_array_unref (self->record);
+
+    G_OBJECT_CLASS (fl_event_recorder_parent_class)->finalize (object);
+}
+
+static void
+fl_event_recorder_class_init (FlEventRecorderClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_event_recorder_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_event_recorder_finalize;
+}
+
+static void
+fl_event_recorder_init (FlEventRecorder *self)
+{
+    self->record = g_byte_array_new ();
+}
+
+FlEventRecorder *
+fl_event_recorder_new (const gchar *path, GError **error)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+
+    g_autoptr(FlEventRecorder) self = g_object_new (fl_event_recorder_get_type (), NULL);
+
+    self->file = fopen (path, "wbe");
+    if (self->file == NULL) {
+        int code = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to open %s: %s", path, strerror (code));
+        return NULL;
+    }
+
+    append_uint32 (self, FL_EVENT_LOG_MAGIC);
+    append_uint32 (self, FL_EVENT_LOG_VERSION);
+    end_record (self);
+    self->start_time = FlutterEngineGetCurrentTime ();
+
+    return g_steal_pointer (&self);
+}
+
+void
+fl_event_recorder_record_pointer_event (FlEventRecorder *self, const FlutterPointerEvent *event)
+{
+    g_return_if_fail (FL_IS_EVENT_RECORDER (self));
+
+    begin_record (self, FL_EVENT_LOG_RECORD_POINTER);
+    append_uint8 (self, event->phase);
+    append_uint8 (self, event->device_kind);
+    append_uint8 (self, event->signal_kind);
+    append_uint32 (self, event->device);
+    append_int64 (self, event->buttons);
+    append_double (self, event->x);
+    append_double (self, event->y);
+    append_double (self, event->scroll_delta_x);
+    append_double (self, event->scroll_delta_y);
+    end_record (self);
+}
+
+void
+fl_event_recorder_record_window_metrics (FlEventRecorder *self, const FlutterWindowMetricsEvent *event)
+{
+    g_return_if_fail (FL_IS_EVENT_RECORDER (self));
+
+    begin_record (self, FL_EVENT_LOG_RECORD_WINDOW_METRICS);
+    append_uint32 (self, event->width);
+    append_uint32 (self, event->height);
+    append_double (self, event->pixel_ratio);
+    end_record (self);
+}
+
+void
+fl_event_recorder_record_platform_message (FlEventRecorder *self, const FlutterPlatformMessage *message)
+{
+    g_return_if_fail (FL_IS_EVENT_RECORDER (self));
+
+    gsize channel_length = strlen (message->channel);
+    begin_record (self, FL_EVENT_LOG_RECORD_PLATFORM_MESSAGE);
+    append_uint32 (self, channel_length);
+    append_uint32 (self, message->message_size);
+    append (self, message->channel, channel_length);
+    append (self, message->message, message->message_size);
+    end_record (self);
+}
+
+gboolean
+fl_event_recorder_close (FlEventRecorder *self, GError **error)
+{
+    g_return_val_if_fail (FL_IS_EVENT_RECORDER (self), FALSE);
+
+    if (self->file == NULL)
+        return TRUE;
+
+    int code = fclose (self->file) != 0 ? errno : 0;
+    self->file = NULL;
+    if (code != 0) {
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to write event log: %s", strerror (code));
+        return FALSE;
+    }
+    if (self->failed) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to write event log");
+        return FALSE;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "embedder.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlEventRecorder, fl_event_recorder, FL, EVENT_RECORDER, GObject)
+
+/* Logs the events sent to an engine so they can be replayed with the same timing
+ * by FlEventReplayer. Logs start with FL_EVENT_LOG_MAGIC and FL_EVENT_LOG_VERSION
+ * as guint32s, followed by records of a guint8 type (FlEventLogRecord) and the
+ * guint64 time in nanoseconds since recording started, on the engine clock. All
+ * values are in host byte order.
+ *
+ *   POINTER: guint8 phase, guint8 device kind, guint8 signal kind, gint32 device,
+ *            gint64 buttons, then doubles x, y, scroll delta x, scroll delta y
+ *   WINDOW_METRICS: guint32 width, guint32 height, double pixel ratio
+ *   PLATFORM_MESSAGE: guint32 channel length, guint32 message length, the
+ *                     channel name then the message
+ *
+ * Recorders must only be used from the thread sending the events. */
+
+#define FL_EVENT_LOG_MAGIC 0x56454c46
+
+#define FL_EVENT_LOG_VERSION 1
+
+typedef enum
+{
+    FL_EVENT_LOG_RECORD_POINTER = 1,
+    FL_EVENT_LOG_RECORD_WINDOW_METRICS,
+    FL_EVENT_LOG_RECORD_PLATFORM_MESSAGE
+} FlEventLogRecord;
+
+FlEventRecorder *fl_event_recorder_new                     (const gchar *path, GError **error);
+
+void             fl_event_recorder_record_pointer_event    (FlEventRecorder *recorder, const FlutterPointerEvent *event);
+
+void             fl_event_recorder_record_window_metrics   (FlEventRecorder *recorder, const FlutterWindowMetricsEvent *event);
+
+void             fl_event_recorder_record_platform_message (FlEventRecorder *recorder, const FlutterPlatformMessage *message);
+
+gboolean         fl_event_recorder_close                   (FlEventRecorder *recorder, GError **error);
+
+G_END_DECLS
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "fl-event-recorder.h"
+#include "fl-event-replayer.h"
+#include "fl-offscreen-renderer-private.h"
+
+struct _FlEventReplayer
+{
+    GObject parent_instance;
+
+    gchar *log;
+    gsize log_length;
+
+    FlOffscreenRenderer *renderer;
+    GThread *thread;
+
+    // Wakes the replay thread early when cancelled.
+    GMutex mutex;
+    GCond cond;
+    gboolean cancelled;
+};
+
+G_DEFINE_TYPE (FlEventReplayer, fl_event_replayer, G_TYPE_OBJECT)
+
+typedef struct
+{
+    const guint8 *data;
+    gsize length;
+    gsize offset;
+    gboolean truncated;
+} Reader;
+
+static gconstpointer
+read_bytes (Reader *reader, gsize length)
+{
+    if (reader->truncated || reader->length - reader->offset < length) {
+        reader->truncated = TRUE;
+        return NULL;
+    }
+
+    gconstpointer data = reader->data + reader->offset;
+    reader->offset += length;
+    return data;
+}
+
+#define DEFINE_READ(name, type)                                   \
+    static type                                                   \
+    name (Reader *reader)                                         \
+    {                                                             \
+        type value = 0;                                           \
+        gconstpointer data = read_bytes (reader, sizeof (value)); \
+        if (data != NULL)                                         \
+            memcpy (&value, data, sizeof (value));                \
+        return value;                                             \
+    }
+
+DEFINE_READ (read_uint8, guint8)
+DEFINE_READ (read_uint32, guint32)
+DEFINE_READ (read_uint64, guint64)
+DEFINE_READ (read_int64, gint64)
+DEFINE_READ (read_double, gdouble)
+
+// Sleep until @time on the engine clock, returns FALSE if cancelled.
+static gboolean
+wait_until (FlEventReplayer *self, uint64_t time)
+{
+    gboolean cancelled;
+
+    g_mutex_lock (&self->mutex);
+    while (!self->cancelled) {
+        uint64_t now = FlutterEngineGetCurrentTime ();
+        if (now >= time)
+            break;
+        // The engine clock is monotonic, the same as GLib's.
+        g_cond_wait_until (&self->cond, &self->mutex, g_get_monotonic_time () + (gint64) ((time - now) / 1000) + 1);
+    }
+    cancelled = self->cancelled;
+    g_mutex_unlock (&self->mutex);
+
+    return !cancelled;
+}
+
+static gpointer
+replay_thread (gpointer user_data)
+{
+    FlEventReplayer *self = user_data;
+    Reader reader = { (const guint8 *) self->log, self->log_length, 0, FALSE };
+    guint n_sent = 0;
+
+    read_uint32 (&reader);
+    read_uint32 (&reader);
+
+    uint64_t start_time = FlutterEngineGetCurrentTime ();
+    while (reader.offset < reader.length) {
+        guint8 type = read_uint8 (&reader);
+        uint64_t time = start_time + read_uint64 (&reader);
+
+        switch (type)
+        {
+        case FL_EVENT_LOG_RECORD_POINTER:
+        {
+            FlutterPointerEvent event = { 0 };
+            event.struct_size = sizeof (FlutterPointerEvent);
+            event.phase = read_uint8 (&reader);
+            event.device_kind = read_uint8 (&reader);
+            event.signal_kind = read_uint8 (&reader);
+            event.device = (gint32) read_uint32 (&reader);
+            event.buttons = read_int64 (&reader);
+            event.x = read_double (&reader);
+            event.y = read_double (&reader);
+            event.scroll_delta_x = read_double (&reader);
+            event.scroll_delta_y = read_double (&reader);
+            event.timestamp = time / 1000;
+            if (reader.truncated || !wait_until (self, time))
+                break;
+            fl_offscreen_renderer_send_pointer_event (self->renderer, &event);
+            n_sent++;
+            break;
+        }
+        case FL_EVENT_LOG_RECORD_WINDOW_METRICS:
+        {
+            gint width = read_uint32 (&reader);
+            gint height = read_uint32 (&reader);
+            read_double (&reader);
+            if (reader.truncated || !wait_until (self, time))
+                break;
+            // Resize the renderer with the engine so frames match the size.
+            fl_offscreen_renderer_set_size (self->renderer, width, height);
+            n_sent++;
+            break;
+        }
+        case FL_EVENT_LOG_RECORD_PLATFORM_MESSAGE:
+        {
+            guint32 channel_length = read_uint32 (&reader);
+            guint32 message_length = read_uint32 (&reader);
+            const gchar *channel = read_bytes (&reader, channel_length);
+            const guint8 *message = read_bytes (&reader, message_length);
+            if (reader.truncated || !wait_until (self, time))
+                break;
+            g_autofree gchar *channel_name = g_strndup (channel, channel_length);
+            FlutterPlatformMessage platform_message = { 0 };
+            platform_message.struct_size = sizeof (FlutterPlatformMessage);
+            platform_message.channel = channel_name;
+            platform_message.message = message;
+            platform_message.message_size = message_length;
+            fl_offscreen_renderer_send_platform_message (self->renderer, &platform_message);
+            n_sent++;
+            break;
+        }
+        default:
+            g_warning ("Unknown record %d in event log, stopping replay", type);
+            reader.truncated = TRUE;
+            break;
+        }
+
+        if (reader.truncated || self->cancelled)
+            break;
+    }
+
+    if (reader.truncated && reader.offset < reader.length)
+        g_warning ("Event log truncated after %u events", n_sent);
+
+    return GUINT_TO_POINTER (n_sent);
+}
+
+static void
+fl_event_replayer_dispose (GObject *object)
+{
+    FlEventReplayer *self = FL_EVENT_REPLAYER (object);
+
+    if (self->thread != NULL) {
+        g_mutex_lock (&self->mutex);
+        self->cancelled = TRUE;
+        g_cond_signal (&self->cond);
+        g_mutex_unlock (&self->mutex);
+        fl_event_replayer_wait (self);
+    }
+    g_clear_object (&self->renderer);
+    g_clear_pointer (&self->log, g_free);
+
+    G_OBJECT_CLASS (fl_event_replayer_parent_class)->dispose (object);
+}
+
+static void
+fl_event_replayer_finalize (GObject *object)
+{
+    FlEventReplayer *self = FL_EVENT_REPLAYER (object);
+
+    g_mutex_clear (&self->mutex);
+    g_cond_clear (&self->cond);
+
+    G_OBJECT_CLASS (fl_event_replayer_parent_class)->finalize (object);
+}
+
+static void
+fl_event_replayer_class_init (FlEventReplayerClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_event_replayer_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_event_replayer_finalize;
+}
+
+static void
+fl_event_replayer_init (FlEventReplayer *self)
+{
+    g_mutex_init (&self->mutex);
+    g_cond_init (&self->cond);
+}
+
+FlEventReplayer *
+fl_event_replayer_new (const gchar *path, GError **error)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+
+    g_autoptr(FlEventReplayer) self = g_object_new (fl_event_replayer_get_type (), NULL);
+
+    if (!g_file_get_contents (path, &self->log, &self->log_length, error))
+        return NULL;
+
+    Reader reader = { (const guint8 *) self->log, self->log_length, 0, FALSE };
+    guint32 magic = read_uint32 (&reader);
+    guint32 version = read_uint32 (&reader);
+    if (reader.truncated || magic != FL_EVENT_LOG_MAGIC) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "%s is not an event log", path);
+        return NULL;
+    }
+    if (version != FL_EVENT_LOG_VERSION) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Event log version %u not supported", version);
+        return NULL;
+    }
+
+    return g_steal_pointer (&self);
+}
+
+void
+fl_event_replayer_start (FlEventReplayer *self, FlOffscreenRenderer *renderer)
+{
+    g_return_if_fail (FL_IS_EVENT_REPLAYER (self));
+    g_return_if_fail (FL_IS_OFFSCREEN_RENDERER (renderer));
+    g_return_if_fail (self->thread == NULL);
+
+    self->renderer = g_object_ref (renderer);
+    self->thread = g_thread_new ("fl-event-replayer", replay_thread, self);
+}
+
+guint
+fl_event_replayer_wait (FlEventReplayer *self)
+{
+    g_return_val_if_fail (FL_IS_EVENT_REPLAYER (self), 0);
+
+    if (self->thread == NULL)
+        return 0;
+
+    guint n_sent = GPOINTER_TO_UINT (g_thread_join (self->thread));
+    self->thread = NULL;
+
+    return n_sent;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "fl-offscreen-renderer.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlEventReplayer, fl_event_replayer, FL, EVENT_REPLAYER, GObject)
+
+/* Sends the events in a log written by FlEventRecorder to an offscreen renderer,
+ * at the same times relative to the start of the replay as they were recorded.
+ * Events are sent from a thread of the replayer's own so their timing doesn't
+ * depend on the caller's main loop. */
+
+FlEventReplayer *fl_event_replayer_new   (const gchar *path, GError **error);
+
+void             fl_event_replayer_start (FlEventReplayer *replayer, FlOffscreenRenderer *renderer);
+
+/* Blocks until every event has been sent, returns the number sent */
+
+guint            fl_event_replayer_wait  (FlEventReplayer *replayer);
+
+G_END_DECLS
@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include "fl-frame-capture.h"
+#include "fl-pixel-readback.h"
+#include "fl-renderer.h"
+
+// Readbacks that can be in flight at once.
+#define N_READBACKS 3
+
+typedef struct
+{
+    FlViewCaptureFormat format;
+    FlViewCaptureCallback callback;
+    gpointer user_data;
+} Request;
+
+typedef struct
+{
+    GList *requests;
+
+    // Bottom-up RGBA as read from GL, or NULL if the capture failed.
+    guint8 *pixels;
+    gint width;
+    gint height;
+} Job;
+
+struct _FlFrameCapture
+{
+    GObject parent_instance;
+
+    // Protects the fields below.
+    GMutex mutex;
+
+    // Requests waiting for the next frame.
+    GList *requests;
+
+    // Requests not yet delivered.
+    guint n_pending;
+
+    // Frames read back, and the time spent on it by the raster thread.
+    guint64 frames_captured;
+    gint64 capture_time;
+
+    // Only used from the raster thread, with a Job without pixels for each frame being read.
+    FlPixelReadback *readback;
+
+    // Converts, encodes and delivers frames in order.
+    GThreadPool *pool;
+};
+
+G_DEFINE_TYPE (FlFrameCapture, fl_frame_capture, G_TYPE_OBJECT)
+
+static cairo_status_t
+write_png_cb (void *closure, const unsigned char *data, unsigned int length)
+{
+    g_byte_array_append (closure, data, length);
+    return CAIRO_STATUS_SUCCESS;
+}
+
+static GBytes *
+encode_png (cairo_surface_t *surface)
+{
+    GByteArray *png = g_byte_array_new ();
+
+    if (cairo_surface_write_to_png_stream (surface, write_png_cb, png) != CAIRO_STATUS_SUCCESS) {
+        g_warning ("Failed to encode captured frame");
+        g_byte_array_unref (png);
+        return NULL;
+    }
+
+    return g_byte_array_free_to_bytes (png);
+}
+
+static void
+deliver_job (gpointer data, gpointer user_data)
+{
+    Job *job = data;
+    FlFrameCapture *self = user_data;
+    cairo_surface_t *surface = NULL;
+    g_autoptr(GBytes) argb = NULL;
+    g_autoptr(GBytes) png = NULL;
+
+    if (job->pixels != NULL) {
+        surface = fl_renderer_image_from_pixels (job->pixels, job->width, job->height);
+        cairo_surface_flush (surface);
+    }
+
+    for (GList *link = job->requests; link != NULL; link = link->next) {
+        Request *request = link->data;
+        GBytes *bytes = NULL;
+
+        if (surface != NULL && request->format == FL_VIEW_CAPTURE_FORMAT_PNG) {
+            if (png == NULL)
+                png = encode_png (surface);
+            bytes = png;
+        } else if (surface != NULL) {
+            if (argb == NULL)
+                argb = g_bytes_new (cairo_image_surface_get_data (surface),
+                                    (gsize) cairo_image_surface_get_stride (surface) * job->height);
+            bytes = argb;
+        }
+        request->callback (bytes, job->width, job->height, request->user_data);
+    }
+
+    g_mutex_lock (&self->mutex);
+    self->n_pending -= g_list_length (job->requests);
+    g_mutex_unlock (&self->mutex);
+
+    g_clear_pointer (&surface, cairo_surface_destroy);
+    g_list_free_full (job->requests, g_free);
+    g_free (job->pixels);
+    g_free (job);
+}
+
+static void
+push_job (FlFrameCapture *self, GList *requests, guint8 *pixels, gint width, gint height)
+{
+    Job *job = g_new0 (Job, 1);
+
+    job->requests = requests;
+    job->pixels = pixels;
+    job->width = width;
+    job->height = height;
+    g_thread_pool_push (self->pool, job, NULL);
+}
+
+// Pixels are copied out of the readback buffer and converted on the worker thread.
+static void
+readback_done_cb (const guint8 *pixels, gsize length, gpointer data, gpointer user_data)
+{
+    FlFrameCapture *self = user_data;
+    Job *job = data;
+
+    if (pixels != NULL) {
+        job->pixels = g_memdup (pixels, length);
+    } else {
+        job->width = 0;
+        job->height = 0;
+    }
+    g_thread_pool_push (self->pool, job, NULL);
+}
+
+static void
+fl_frame_capture_dispose (GObject *object)
+{
+    FlFrameCapture *self = FL_FRAME_CAPTURE (object);
+
+    fl_frame_capture_reset (self);
+    if (self->pool != NULL) {
+        g_thread_pool_free (self->pool, FALSE, TRUE);
+        self->pool = NULL;
+    }
+
+    G_OBJECT_CLASS (fl_frame_capture_parent_class)->dispose (object);
+}
+
+static void
+fl_frame_capture_finalize (GObject *object)
+{
+    FlFrameCapture *self = FL_FRAME_CAPTURE (object);
+
+    g_object_unref (self->readback);
+    g_mutex_clear (&self->mutex);
+
+    G_OBJECT_CLASS (fl_frame_capture_parent_class)->finalize (object);
+}
+
+static void
+fl_frame_capture_class_init (FlFrameCaptureClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_frame_capture_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_frame_capture_finalize;
+}
+
+static void
+fl_frame_capture_init (FlFrameCapture *self)
+{
+    g_mutex_init (&self->mutex);
+    self->readback = fl_pixel_readback_new (N_READBACKS);
+    self->pool = g_thread_pool_new (deliver_job, self, 1, FALSE, NULL);
+}
+
+FlFrameCapture *
+fl_frame_capture_new (void)
+{
+    return g_object_new (fl_frame_capture_get_type (), NULL);
+}
+
+void
+fl_frame_capture_request (FlFrameCapture *self, FlViewCaptureFormat format, FlViewCaptureCallback callback, gpointer user_data)
+{
+    g_return_if_fail (FL_IS_FRAME_CAPTURE (self));
+    g_return_if_fail (callback != NULL);
+
+    Request *request = g_new0 (Request, 1);
+    request->format = format;
+    request->callback = callback;
+    request->user_data = user_data;
+
+    g_mutex_lock (&self->mutex);
+    self->requests = g_list_append (self->requests, request);
+    self->n_pending++;
+    g_mutex_unlock (&self->mutex);
+}
+
+gboolean
+fl_frame_capture_is_pending (FlFrameCapture *self)
+{
+    g_return_val_if_fail (FL_IS_FRAME_CAPTURE (self), FALSE);
+
+    g_mutex_lock (&self->mutex);
+    gboolean pending = self->n_pending > 0;
+    g_mutex_unlock (&self->mutex);
+
+    return pending;
+}
+
+void
+fl_frame_capture_get_stats (FlFrameCapture *self, guint64 *frames_captured, gint64 *capture_time)
+{
+    g_return_if_fail (FL_IS_FRAME_CAPTURE (self));
+
+    g_mutex_lock (&self->mutex);
+    *frames_captured = self->frames_captured;
+    *capture_time = self->frames_captured > 0 ? self->capture_time / (gint64) self->frames_captured : 0;
+    g_mutex_unlock (&self->mutex);
+}
+
+void
+fl_frame_capture_read_framebuffer (FlFrameCapture *self, guint32 framebuffer, gint width, gint height)
+{
+    g_return_if_fail (FL_IS_FRAME_CAPTURE (self));
+
+    gint64 start_time = g_get_monotonic_time ();
+
+    g_mutex_lock (&self->mutex);
+    GList *requests = g_steal_pointer (&self->requests);
+    g_mutex_unlock (&self->mutex);
+    if (requests == NULL)
+        return;
+
+    Job *job = g_new0 (Job, 1);
+    job->requests = requests;
+    job->width = width;
+    job->height = height;
+
+    // Wait for the next frame if all the buffers are in flight.
+    cairo_rectangle_int_t rect = { 0, 0, width, height };
+    if (!fl_pixel_readback_read (self->readback, framebuffer, &rect, 1, job)) {
+        g_mutex_lock (&self->mutex);
+        self->requests = g_list_concat (g_steal_pointer (&job->requests), self->requests);
+        g_mutex_unlock (&self->mutex);
+        g_free (job);
+        return;
+    }
+
+    g_mutex_lock (&self->mutex);
+    self->frames_captured++;
+    self->capture_time += g_get_monotonic_time () - start_time;
+    g_mutex_unlock (&self->mutex);
+}
+
+void
+fl_frame_capture_poll (FlFrameCapture *self)
+{
+    g_return_if_fail (FL_IS_FRAME_CAPTURE (self));
+
+    if (!fl_pixel_readback_is_pending (self->readback))
+        return;
+
+    gint64 start_time = g_get_monotonic_time ();
+
+    // Never wait here, the fences are checked again on the next frame.
+    fl_pixel_readback_poll (self->readback, FALSE, readback_done_cb, self);
+
+    g_mutex_lock (&self->mutex);
+    self->capture_time += g_get_monotonic_time () - start_time;
+    g_mutex_unlock (&self->mutex);
+}
+
+void
+fl_frame_capture_reset (FlFrameCapture *self)
+{
+    g_return_if_fail (FL_IS_FRAME_CAPTURE (self));
+
+    fl_pixel_readback_reset (self->readback, readback_done_cb, self);
+
+    g_mutex_lock (&self->mutex);
+    GList *requests = g_steal_pointer (&self->requests);
+    g_mutex_unlock (&self->mutex);
+    if (requests != NULL)
+        push_job (self, requests, NULL, 0, 0);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include "fl-view.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlFrameCapture, fl_frame_capture, FL, FRAME_CAPTURE, GObject)
+
+/* Reads presented frames back without waiting for the GPU, and hands them to
+ * callbacks on a worker thread. */
+
+FlFrameCapture *fl_frame_capture_new              (void);
+
+void            fl_frame_capture_request          (FlFrameCapture *capture, FlViewCaptureFormat format, FlViewCaptureCallback callback, gpointer user_data);
+
+gboolean        fl_frame_capture_is_pending       (FlFrameCapture *capture);
+
+void            fl_frame_capture_get_stats        (FlFrameCapture *capture, guint64 *frames_captured, gint64 *capture_time);
+
+/* Called from the raster thread with the context current */
+
+void            fl_frame_capture_read_framebuffer (FlFrameCapture *capture, guint32 framebuffer, gint width, gint height);
+
+void            fl_frame_capture_poll             (FlFrameCapture *capture);
+
+/* Called once the context the frames were read with has been destroyed */
+
+void            fl_frame_capture_reset            (FlFrameCapture *capture);
+
+G_END_DECLS
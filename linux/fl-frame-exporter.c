@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "fl-frame-exporter.h"
+#include "fl-pixel-readback.h"
+
+// Width and height of tiles, in pixels.
+#define TILE_SIZE 64
+
+#define HEADER_SIZE 20
+
+// Frames that can be read back by the GPU at once.
+#define N_READBACKS 3
+
+typedef struct
+{
+    // Bottom-up RGBA as read from GL, only valid in @dirty.
+    guint8 *pixels;
+    gsize pixels_size;
+    gint width;
+    gint height;
+
+    // Area written since the sender last took the frame, top-down.
+    cairo_region_t *dirty;
+} Frame;
+
+typedef struct
+{
+    gint width;
+    gint height;
+
+    // Tile aligned area being read, top-down.
+    cairo_region_t *region;
+} Read;
+
+struct _FlFrameExporter
+{
+    GObject parent_instance;
+
+    int fd;
+
+    // Only used from the raster thread. Frames are read in the order of @reads.
+    FlPixelReadback *readback;
+    Read reads[N_READBACKS];
+    guint n_reads;
+    gint read_width;
+    gint read_height;
+
+    // Pixels read back are copied into @pending, which the sender swaps with
+    // @sending. Areas read back before the sender gets to them are merged.
+    GMutex mutex;
+    GCond cond;
+    Frame frames[2];
+    Frame *pending;
+    Frame *sending;
+    gboolean have_pending;
+    gboolean stopping;
+    GThread *sender;
+
+    // Only used from the sender thread.
+    guint64 *tile_hashes;
+    gint frame_width;
+    gint frame_height;
+    gboolean failed;
+    GByteArray *message;
+
+    // Protected by @mutex.
+    guint64 frames_exported;
+    guint64 bytes_exported;
+};
+
+G_DEFINE_TYPE (FlFrameExporter, fl_frame_exporter, G_TYPE_OBJECT)
+
+
+// Hash the rows of a tile. The four lanes are independent so the loop can be
+// vectorized, a tile row is at most TILE_SIZE * 4 bytes so fits whole words.
+static guint64
+hash_tile (const guint8 *pixels, gsize stride, gint row_length, gint n_rows)
+{
+    const guint64 prime = G_GUINT64_CONSTANT (0x100000001b3);
+    guint64 lanes[4] = { G_GUINT64_CONSTANT (0xcbf29ce484222325), 1, 2, 3 };
+    gint n_words = row_length / 8;
+
+    for (gint y = 0; y < n_rows; y++) {
+        const guint8 *row = pixels + y * stride;
+        gint x = 0;
+        for (; x + 4 <= n_words; x += 4) {
+            guint64 words[4];
+            memcpy (words, row + x * 8, sizeof (words));
+            for (gint i = 0; i < 4; i++)
+                lanes[i] = (lanes[i] ^ words[i]) * prime;
+        }
+        for (; x < n_words; x++) {
+            guint64 word;
+            memcpy (&word, row + x * 8, sizeof (word));
+            lanes[x % 4] = (lanes[x % 4] ^ word) * prime;
+        }
+        if (row_length % 8 != 0) {
+            guint32 word;
+            memcpy (&word, row + n_words * 8, sizeof (word));
+            lanes[0] = (lanes[0] ^ word) * prime;
+        }
+    }
+
+    return lanes[0] ^ (lanes[1] * 31) ^ (lanes[2] * 961) ^ (lanes[3] * 29791);
+}
+
+static void
+append_tile (FlFrameExporter *self, const Frame *frame, gint column, gint row, gint x, gint y, gint width, gint height)
+{
+    guint16 position[2] = { column, row };
+    g_byte_array_append (self->message, (const guint8 *) position, sizeof (position));
+
+    // GL is bottom-up RGBA, Cairo is top-down native-endian ARGB.
+    guint offset = self->message->len;
+    g_byte_array_set_size (self->message, offset + width * height * 4);
+    guint32 *dst = (guint32 *) (self->message->data + offset);
+    for (gint ty = 0; ty < height; ty++) {
+        const guint8 *src = frame->pixels + ((gsize) (frame->height - y - ty - 1) * frame->width + x) * 4;
+        for (gint tx = 0; tx < width; tx++, src += 4)
+            *dst++ = (guint32) src[3] << 24 | (guint32) src[0] << 16 | (guint32) src[1] << 8 | src[2];
+    }
+}
+
+static gboolean
+send_all (FlFrameExporter *self, const guint8 *data, gsize length)
+{
+    while (length > 0) {
+        ssize_t n_sent = send (self->fd, data, length, MSG_NOSIGNAL);
+        if (n_sent < 0 && errno == EINTR)
+            continue;
+        if (n_sent < 0) {
+            g_warning ("Failed to export frame: %s", strerror (errno));
+            return FALSE;
+        }
+        data += n_sent;
+        length -= n_sent;
+    }
+
+    return TRUE;
+}
+
+static void
+export_frame (FlFrameExporter *self, const Frame *frame)
+{
+    gint tiles_width = (frame->width + TILE_SIZE - 1) / TILE_SIZE;
+    gint tiles_height = (frame->height + TILE_SIZE - 1) / TILE_SIZE;
+    gboolean key_frame = FALSE;
+
+    if (self->tile_hashes == NULL || frame->width != self->frame_width || frame->height != self->frame_height) {
+        g_free (self->tile_hashes);
+        self->tile_hashes = g_new0 (guint64, tiles_width * tiles_height);
+        self->frame_width = frame->width;
+        self->frame_height = frame->height;
+        key_frame = TRUE;
+    }
+
+    g_byte_array_set_size (self->message, HEADER_SIZE);
+    guint32 n_tiles = 0;
+    for (gint row = 0; row < tiles_height; row++) {
+        for (gint column = 0; column < tiles_width; column++) {
+            cairo_rectangle_int_t rect;
+            rect.x = column * TILE_SIZE;
+            rect.y = row * TILE_SIZE;
+            rect.width = MIN (TILE_SIZE, frame->width - rect.x);
+            rect.height = MIN (TILE_SIZE, frame->height - rect.y);
+
+            // Only tiles read back since the last frame sent can have changed.
+            if (!key_frame && cairo_region_contains_rectangle (frame->dirty, &rect) == CAIRO_REGION_OVERLAP_OUT)
+                continue;
+
+            gsize stride = (gsize) frame->width * 4;
+            const guint8 *bottom_row = frame->pixels + (gsize) (frame->height - rect.y - rect.height) * stride + rect.x * 4;
+            guint64 hash = hash_tile (bottom_row, stride, rect.width * 4, rect.height);
+            guint64 *old_hash = &self->tile_hashes[row * tiles_width + column];
+            if (!key_frame && hash == *old_hash)
+                continue;
+            *old_hash = hash;
+
+            append_tile (self, frame, column, row, rect.x, rect.y, rect.width, rect.height);
+            n_tiles++;
+        }
+    }
+
+    // Nothing changed, the receiver still has the frame.
+    if (n_tiles == 0) {
+        g_mutex_lock (&self->mutex);
+        self->frames_exported++;
+        g_mutex_unlock (&self->mutex);
+        return;
+    }
+
+    guint32 *header = (guint32 *) self->message->data;
+    header[0] = FL_FRAME_EXPORTER_MAGIC;
+    header[1] = self->message->len - 8;
+    ((guint16 *) header)[4] = frame->width;
+    ((guint16 *) header)[5] = frame->height;
+    ((guint16 *) header)[6] = TILE_SIZE;
+    ((guint16 *) header)[7] = key_frame ? FL_FRAME_EXPORTER_FLAG_KEY_FRAME : 0;
+    header[4] = n_tiles;
+
+    if (!send_all (self, self->message->data, self->message->len)) {
+        self->failed = TRUE;
+        return;
+    }
+
+    g_mutex_lock (&self->mutex);
+    self->frames_exported++;
+    self->bytes_exported += self->message->len;
+    g_mutex_unlock (&self->mutex);
+}
+
+static gpointer
+sender_thread (gpointer user_data)
+{
+    FlFrameExporter *self = user_data;
+
+    g_mutex_lock (&self->mutex);
+    while (TRUE) {
+        while (!self->have_pending && !self->stopping)
+            g_cond_wait (&self->cond, &self->mutex);
+        if (!self->have_pending)
+            break;
+
+        Frame *frame = self->pending;
+        self->pending = self->sending;
+        self->sending = frame;
+        self->have_pending = FALSE;
+        g_mutex_unlock (&self->mutex);
+
+        if (!self->failed)
+            export_frame (self, frame);
+        cairo_region_subtract (frame->dirty, frame->dirty);
+
+        g_mutex_lock (&self->mutex);
+    }
+    g_mutex_unlock (&self->mutex);
+
+    return NULL;
+}
+
+// Called from the raster thread once the GPU has copied an area of a frame, to
+// hand it to the sender.
+static void
+readback_done_cb (const guint8 *pixels, gsize length, gpointer data, gpointer user_data)
+{
+    FlFrameExporter *self = user_data;
+    Read *read = data;
+
+    // The next frame is read in full, as what was lost can't be told apart.
+    if (pixels == NULL) {
+        self->read_width = 0;
+        self->read_height = 0;
+        g_clear_pointer (&read->region, cairo_region_destroy);
+        return;
+    }
+
+    g_mutex_lock (&self->mutex);
+
+    Frame *frame = self->pending;
+    gsize size = (gsize) read->width * read->height * 4;
+    if (frame->width != read->width || frame->height != read->height) {
+        if (frame->pixels_size < size) {
+            g_free (frame->pixels);
+            frame->pixels = g_malloc (size);
+            frame->pixels_size = size;
+        }
+        frame->width = read->width;
+        frame->height = read->height;
+        cairo_region_subtract (frame->dirty, frame->dirty);
+    }
+
+    // Rows of each rectangle in turn, as they were read.
+    gsize stride = (gsize) read->width * 4;
+    gint n_rects = cairo_region_num_rectangles (read->region);
+    for (gint i = 0; i < n_rects; i++) {
+        cairo_rectangle_int_t rect;
+        cairo_region_get_rectangle (read->region, i, &rect);
+        gsize row_length = (gsize) rect.width * 4;
+        gint bottom = read->height - rect.y - rect.height;
+        for (gint y = 0; y < rect.height; y++) {
+            memcpy (frame->pixels + (bottom + y) * stride + rect.x * 4, pixels, row_length);
+            pixels += row_length;
+        }
+    }
+    cairo_region_union (frame->dirty, read->region);
+    g_clear_pointer (&read->region, cairo_region_destroy);
+
+    self->have_pending = TRUE;
+    g_cond_signal (&self->cond);
+    g_mutex_unlock (&self->mutex);
+}
+
+static void
+fl_frame_exporter_dispose (GObject *object)
+{
+    FlFrameExporter *self = FL_FRAME_EXPORTER (object);
+
+    fl_frame_exporter_close (self);
+
+    G_OBJECT_CLASS (fl_frame_exporter_parent_class)->dispose (object);
+}
+
+static void
+fl_frame_exporter_finalize (GObject *object)
+{
+    FlFrameExporter *self = FL_FRAME_EXPORTER (object);
+
+    for (gint i = 0; i < 2; i++) {
+        g_free (self->frames[i].pixels);
+        cairo_region_destroy (self->frames[i].dirty);
+    }
+    for (gint i = 0; i < N_READBACKS; i++)
+        g_clear_pointer (&self->reads[i].region, cairo_region_destroy);
+    g_object_unref (self->readback);
+    g_free (self->tile_hashes);
+    g_byte_array_unref (self->message);
+    g_mutex_clear (&self->mutex);
+    g_cond_clear (&self->cond);
+
+    G_OBJECT_CLASS (fl_frame_exporter_parent_class)->finalize (object);
+}
+
+static void
+fl_frame_exporter_class_init (FlFrameExporterClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_frame_exporter_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_frame_exporter_finalize;
+}
+
+static void
+fl_frame_exporter_init (FlFrameExporter *self)
+{
+    self->fd = -1;
+    g_mutex_init (&self->mutex);
+    g_cond_init (&self->cond);
+    for (gint i = 0; i < 2; i++)
+        self->frames[i].dirty = cairo_region_create ();
+    self->pending = &self->frames[0];
+    self->sending = &self->frames[1];
+    self->readback = fl_pixel_readback_new (N_READBACKS);
+    self->message = g_byte_array_new ();
+}
+
+FlFrameExporter *
+fl_frame_exporter_new (const gchar *socket_path, GError **error)
+{
+    struct sockaddr_un address = { 0 };
+
+    g_return_val_if_fail (socket_path != NULL, NULL);
+
+    if (strlen (socket_path) >= sizeof (address.sun_path)) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Socket path %s too long", socket_path);
+        return NULL;
+    }
+
+    g_autoptr(FlFrameExporter) self = g_object_new (fl_frame_exporter_get_type (), NULL);
+
+    self->fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (self->fd < 0) {
+        int code = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to create socket: %s", strerror (code));
+        return NULL;
+    }
+
+    address.sun_family = AF_UNIX;
+    strcpy (address.sun_path, socket_path);
+    if (connect (self->fd, (struct sockaddr *) &address, sizeof (address)) < 0) {
+        int code = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to connect to %s: %s", socket_path, strerror (code));
+        return NULL;
+    }
+
+    self->sender = g_thread_new ("fl-frame-exporter", sender_thread, self);
+
+    return g_steal_pointer (&self);
+}
+
+void
+fl_frame_exporter_close (FlFrameExporter *self)
+{
+    g_return_if_fail (FL_IS_FRAME_EXPORTER (self));
+
+    if (self->sender != NULL) {
+        g_mutex_lock (&self->mutex);
+        self->stopping = TRUE;
+        g_cond_signal (&self->cond);
+        g_mutex_unlock (&self->mutex);
+        g_thread_join (self->sender);
+        self->sender = NULL;
+    }
+
+    if (self->fd >= 0) {
+        close (self->fd);
+        self->fd = -1;
+    }
+}
+
+void
+fl_frame_exporter_get_stats (FlFrameExporter *self, guint64 *frames_exported, gsize *bytes_per_frame)
+{
+    g_return_if_fail (FL_IS_FRAME_EXPORTER (self));
+
+    g_mutex_lock (&self->mutex);
+    *frames_exported = self->frames_exported;
+    *bytes_per_frame = self->frames_exported > 0 ? self->bytes_exported / self->frames_exported : 0;
+    g_mutex_unlock (&self->mutex);
+}
+
+gboolean
+fl_frame_exporter_is_pending (FlFrameExporter *self)
+{
+    g_return_val_if_fail (FL_IS_FRAME_EXPORTER (self), FALSE);
+
+    return fl_pixel_readback_is_pending (self->readback);
+}
+
+void
+fl_frame_exporter_read_framebuffer (FlFrameExporter *self, guint32 framebuffer, gint width, gint height, const cairo_region_t *damage)
+{
+    g_return_if_fail (FL_IS_FRAME_EXPORTER (self));
+
+    if (self->sender == NULL || width <= 0 || height <= 0)
+        return;
+
+    // Only the tiles touching the damage are read, everything after a resize.
+    cairo_rectangle_int_t frame_rect = { 0, 0, width, height };
+    cairo_region_t *region;
+    if (damage == NULL || width != self->read_width || height != self->read_height) {
+        region = cairo_region_create_rectangle (&frame_rect);
+    } else {
+        region = cairo_region_create ();
+        gint n_rects = cairo_region_num_rectangles (damage);
+        for (gint i = 0; i < n_rects; i++) {
+            cairo_rectangle_int_t rect;
+            cairo_region_get_rectangle (damage, i, &rect);
+            gint x1 = MAX (rect.x, 0) / TILE_SIZE * TILE_SIZE, y1 = MAX (rect.y, 0) / TILE_SIZE * TILE_SIZE;
+            gint x2 = (rect.x + rect.width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+            gint y2 = (rect.y + rect.height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+            cairo_rectangle_int_t tiles = { x1, y1, x2 - x1, y2 - y1 };
+            cairo_region_union_rectangle (region, &tiles);
+        }
+        cairo_region_intersect_rectangle (region, &frame_rect);
+    }
+
+    // Nothing changed, the sender still has the frame.
+    if (cairo_region_is_empty (region)) {
+        cairo_region_destroy (region);
+        return;
+    }
+
+    // Rectangles in GL's bottom-up coordinates.
+    gint n_rects = cairo_region_num_rectangles (region);
+    g_autofree cairo_rectangle_int_t *rects = g_new (cairo_rectangle_int_t, n_rects);
+    for (gint i = 0; i < n_rects; i++) {
+        cairo_region_get_rectangle (region, i, &rects[i]);
+        rects[i].y = height - rects[i].y - rects[i].height;
+    }
+
+    // Dropped rather than wait for the GPU when all the buffers are in flight,
+    // the area is read in full next time.
+    Read *read = &self->reads[self->n_reads % N_READBACKS];
+    read->width = width;
+    read->height = height;
+    read->region = region;
+    if (!fl_pixel_readback_read (self->readback, framebuffer, rects, n_rects, read)) {
+        g_clear_pointer (&read->region, cairo_region_destroy);
+        self->read_width = 0;
+        self->read_height = 0;
+        return;
+    }
+    self->n_reads++;
+    self->read_width = width;
+    self->read_height = height;
+}
+
+void
+fl_frame_exporter_poll (FlFrameExporter *self)
+{
+    g_return_if_fail (FL_IS_FRAME_EXPORTER (self));
+
+    fl_pixel_readback_poll (self->readback, FALSE, readback_done_cb, self);
+}
+
+void
+fl_frame_exporter_release_buffers (FlFrameExporter *self)
+{
+    g_return_if_fail (FL_IS_FRAME_EXPORTER (self));
+
+    fl_pixel_readback_release (self->readback, readback_done_cb, self);
+}
+
+void
+fl_frame_exporter_reset (FlFrameExporter *self)
+{
+    g_return_if_fail (FL_IS_FRAME_EXPORTER (self));
+
+    fl_pixel_readback_reset (self->readback, readback_done_cb, self);
+}
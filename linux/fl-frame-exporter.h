@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlFrameExporter, fl_frame_exporter, FL, FRAME_EXPORTER, GObject)
+
+/* Streams the tiles that changed in each presented frame to a process listening
+ * on a Unix socket. Frames are sent as a header followed by the changed tiles,
+ * all in host byte order:
+ *
+ *   guint32 magic (FL_FRAME_EXPORTER_MAGIC)
+ *   guint32 length of the rest of the message in bytes
+ *   guint16 frame width, guint16 frame height
+ *   guint16 tile size, guint16 flags (FL_FRAME_EXPORTER_FLAG_*)
+ *   guint32 number of tiles
+ *
+ * Each tile is a guint16 column and guint16 row followed by its pixels as Cairo
+ * ARGB32, top-down with no padding. Tiles on the right and bottom edges are
+ * clipped to the frame. The first frame and frames after a resize contain every
+ * tile and have FL_FRAME_EXPORTER_FLAG_KEY_FRAME set. */
+
+#define FL_FRAME_EXPORTER_MAGIC 0x44464c46
+
+#define FL_FRAME_EXPORTER_FLAG_KEY_FRAME 0x1
+
+FlFrameExporter *fl_frame_exporter_new              (const gchar *socket_path, GError **error);
+
+void             fl_frame_exporter_close            (FlFrameExporter *exporter);
+
+void             fl_frame_exporter_get_stats        (FlFrameExporter *exporter, guint64 *frames_exported, gsize *bytes_per_frame);
+
+gboolean         fl_frame_exporter_is_pending       (FlFrameExporter *exporter);
+
+/* Called from the raster thread with the context current, @damage is the area
+ * changed since the last frame or NULL if not known. Only the tiles it touches
+ * are read back. */
+
+void             fl_frame_exporter_read_framebuffer (FlFrameExporter *exporter, guint32 framebuffer, gint width, gint height, const cairo_region_t *damage);
+
+void             fl_frame_exporter_poll             (FlFrameExporter *exporter);
+
+/* Called once no more frames will be read, frames still being read back are
+ * sent */
+
+void             fl_frame_exporter_release_buffers  (FlFrameExporter *exporter);
+
+/* Called once the context the frames were read with has been destroyed */
+
+void             fl_frame_exporter_reset            (FlFrameExporter *exporter);
+
+G_END_DECLS
@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "fl-frame-recorder.h"
+#include "fl-pixel-readback.h"
+
+// Frames that can be waiting for the writer.
+#define N_SLOTS 4
+
+// Frames that can be read back by the GPU at once.
+#define N_READBACKS 3
+
+// Alignment and size of writes to the file, suitable for O_DIRECT.
+#define WRITE_ALIGNMENT 4096
+#define WRITE_BUFFER_SIZE (1024 * 1024)
+
+typedef struct
+{
+    // Bottom-up RGBA as read from GL.
+    guint8 *pixels;
+    gint width;
+    gint height;
+} Slot;
+
+typedef struct
+{
+    gint width;
+    gint height;
+} FrameSize;
+
+struct _FlFrameRecorder
+{
+    GObject parent_instance;
+
+    int fd;
+    gboolean direct;
+
+    // Size of the video, frames of other sizes are cropped or padded.
+    gint width;
+    gint height;
+
+    // Frames being read back by the GPU, with the size of each by the order they were read.
+    FlPixelReadback *readback;
+    FrameSize sizes[N_READBACKS];
+    guint n_reads;
+
+    // Ring of frames, written by the raster thread at @head and read by the
+    // writer at @tail. Each index is only advanced by its own thread.
+    Slot slots[N_SLOTS];
+    guint head;
+    guint tail;
+
+    // Wakes the writer when a frame is queued or recording stops.
+    int event_fd;
+    gint stopping;
+    GThread *writer;
+
+    // Only used from the writer thread.
+    guint8 *yuv;
+    gsize yuv_size;
+    guint8 *write_buffer;
+    gsize write_buffer_length;
+    gboolean failed;
+
+    // Protects the statistics.
+    GMutex stats_mutex;
+    guint64 frames_recorded;
+    guint64 frames_dropped;
+    guint64 frames_read;
+    gint64 record_time;
+};
+
+G_DEFINE_TYPE (FlFrameRecorder, fl_frame_recorder, G_TYPE_OBJECT)
+
+static gboolean
+write_all (FlFrameRecorder *self, const guint8 *data, gsize length)
+{
+    while (length > 0) {
+        ssize_t n_written = write (self->fd, data, length);
+        if (n_written < 0 && errno == EINTR)
+            continue;
+        if (n_written < 0) {
+            g_warning ("Failed to write recording: %s", strerror (errno));
+            self->failed = TRUE;
+            return FALSE;
+        }
+        data += n_written;
+        length -= n_written;
+    }
+
+    return TRUE;
+}
+
+// Buffer output so the file is only written in aligned blocks.
+static void
+append_bytes (FlFrameRecorder *self, const guint8 *data, gsize length)
+{
+    while (length > 0 && !self->failed) {
+        gsize n_copied = MIN (length, WRITE_BUFFER_SIZE - self->write_buffer_length);
+        memcpy (self->write_buffer + self->write_buffer_length, data, n_copied);
+        self->write_buffer_length += n_copied;
+        data += n_copied;
+        length -= n_copied;
+
+        if (self->write_buffer_length == WRITE_BUFFER_SIZE) {
+            write_all (self, self->write_buffer, WRITE_BUFFER_SIZE);
+            self->write_buffer_length = 0;
+        }
+    }
+}
+
+// Write what is left, which can't be done with O_DIRECT as the length isn't aligned.
+static void
+flush_bytes (FlFrameRecorder *self)
+{
+    if (self->direct && fcntl (self->fd, F_SETFL, fcntl (self->fd, F_GETFL) & ~O_DIRECT) < 0)
+        g_warning ("Failed to disable direct I/O: %s", strerror (errno));
+    if (!self->failed)
+        write_all (self, self->write_buffer, self->write_buffer_length);
+    self->write_buffer_length = 0;
+}
+
+static inline void
+get_pixel (const Slot *slot, gint x, gint y, gint *r, gint *g, gint *b)
+{
+    if (x >= slot->width || y >= slot->height) {
+        *r = *g = *b = 0;
+        return;
+    }
+
+    const guint8 *p = slot->pixels + ((gsize) (slot->height - y - 1) * slot->width + x) * 4;
+    *r = p[0];
+    *g = p[1];
+    *b = p[2];
+}
+
+// Convert to full range BT.601 4:2:0, the frame is premultiplied so it is taken as over black.
+static void
+convert_frame (FlFrameRecorder *self, const Slot *slot)
+{
+    gint chroma_width = (self->width + 1) / 2, chroma_height = (self->height + 1) / 2;
+    guint8 *y_plane = self->yuv;
+    guint8 *u_plane = y_plane + (gsize) self->width * self->height;
+    guint8 *v_plane = u_plane + (gsize) chroma_width * chroma_height;
+
+    for (gint y = 0; y < self->height; y++) {
+        guint8 *dst = y_plane + (gsize) y * self->width;
+        for (gint x = 0; x < self->width; x++) {
+            gint r, g, b;
+            get_pixel (slot, x, y, &r, &g, &b);
+            dst[x] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+        }
+    }
+
+    for (gint y = 0; y < chroma_height; y++) {
+        for (gint x = 0; x < chroma_width; x++) {
+            gint r = 0, g = 0, b = 0;
+            for (gint i = 0; i < 4; i++) {
+                gint pr, pg, pb;
+                get_pixel (slot, x * 2 + i % 2, y * 2 + i / 2, &pr, &pg, &pb);
+                r += pr;
+                g += pg;
+                b += pb;
+            }
+            gsize offset = (gsize) y * chroma_width + x;
+            u_plane[offset] = CLAMP (128 + ((-43 * r - 85 * g + 128 * b + 512) >> 10), 0, 255);
+            v_plane[offset] = CLAMP (128 + ((128 * r - 107 * g - 21 * b + 512) >> 10), 0, 255);
+        }
+    }
+}
+
+static gpointer
+writer_thread (gpointer user_data)
+{
+    FlFrameRecorder *self = user_data;
+    static const gchar frame_header[] = "FRAME\n";
+
+    while (TRUE) {
+        if (self->tail == g_atomic_int_get (&self->head)) {
+            if (g_atomic_int_get (&self->stopping))
+                break;
+
+            guint64 count;
+            if (read (self->event_fd, &count, sizeof (count)) < 0 && errno != EINTR) {
+                g_warning ("Failed to wait for frames: %s", strerror (errno));
+                break;
+            }
+            continue;
+        }
+
+        Slot *slot = &self->slots[self->tail % N_SLOTS];
+        if (!self->failed) {
+            convert_frame (self, slot);
+            append_bytes (self, (const guint8 *) frame_header, strlen (frame_header));
+            append_bytes (self, self->yuv, self->yuv_size);
+        }
+        g_atomic_int_set (&self->tail, self->tail + 1);
+
+        g_mutex_lock (&self->stats_mutex);
+        if (self->failed)
+            self->frames_dropped++;
+        else
+            self->frames_recorded++;
+        g_mutex_unlock (&self->stats_mutex);
+    }
+
+    flush_bytes (self);
+
+    return NULL;
+}
+
+static void
+fl_frame_recorder_dispose (GObject *object)
+{
+    FlFrameRecorder *self = FL_FRAME_RECORDER (object);
+
+    fl_frame_recorder_close (self);
+
+    G_OBJECT_CLASS (fl_frame_recorder_parent_class)->dispose (object);
+}
+
+static void
+fl_frame_recorder_finalize (GObject *object)
+{
+    FlFrameRecorder *self = FL_FRAME_RECORDER (object);
+
+    for (gint i = 0; i < N_SLOTS; i++)
+        g_free (self->slots[i].pixels);
+    g_free (self->yuv);
+    free (self->write_buffer);
+    g_object_unref (self->readback);
+    g_mutex_clear (&self->stats_mutex);
+
+    G_OBJECT_CLASS (fl_frame_recorder_parent_class)->finalize (object);
+}
+
+static void
+fl_frame_recorder_class_init (FlFrameRecorderClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_frame_recorder_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_frame_recorder_finalize;
+}
+
+static void
+fl_frame_recorder_init (FlFrameRecorder *self)
+{
+    self->fd = -1;
+    self->event_fd = -1;
+    self->readback = fl_pixel_readback_new (N_READBACKS);
+    g_mutex_init (&self->stats_mutex);
+}
+
+static void
+drop_frame (FlFrameRecorder *self)
+{
+    g_mutex_lock (&self->stats_mutex);
+    self->frames_dropped++;
+    g_mutex_unlock (&self->stats_mutex);
+}
+
+// Called from the raster thread once the GPU has copied a frame, to queue it for the writer.
+static void
+readback_done_cb (const guint8 *pixels, gsize length, gpointer data, gpointer user_data)
+{
+    FlFrameRecorder *self = user_data;
+    FrameSize *size = data;
+
+    // Drop the frame rather than wait for the writer.
+    if (pixels == NULL || self->writer == NULL || self->head - g_atomic_int_get (&self->tail) >= N_SLOTS) {
+        drop_frame (self);
+        return;
+    }
+
+    Slot *slot = &self->slots[self->head % N_SLOTS];
+    slot->width = size->width;
+    slot->height = size->height;
+    memcpy (slot->pixels, pixels, length);
+
+    g_atomic_int_set (&self->head, self->head + 1);
+    guint64 count = 1;
+    if (write (self->event_fd, &count, sizeof (count)) < 0)
+        g_warning ("Failed to queue recorded frame: %s", strerror (errno));
+}
+
+FlFrameRecorder *
+fl_frame_recorder_new (const gchar *path, gint width, gint height, gint refresh_rate, GError **error)
+{
+    g_return_val_if_fail (path != NULL, NULL);
+    g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+    g_autoptr(FlFrameRecorder) self = g_object_new (fl_frame_recorder_get_type (), NULL);
+
+    // Bypass the page cache, the file is never read back by us. Not all
+    // filesystems support this.
+    self->direct = TRUE;
+    self->fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0666);
+    if (self->fd < 0 && errno == EINVAL) {
+        self->direct = FALSE;
+        self->fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    }
+    if (self->fd < 0) {
+        int code = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to open %s: %s", path, strerror (code));
+        return NULL;
+    }
+
+    self->event_fd = eventfd (0, EFD_CLOEXEC);
+    if (self->event_fd < 0) {
+        int code = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (code), "Failed to create event: %s", strerror (code));
+        return NULL;
+    }
+
+    if (posix_memalign ((void **) &self->write_buffer, WRITE_ALIGNMENT, WRITE_BUFFER_SIZE) != 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to allocate write buffer");
+        return NULL;
+    }
+
+    // Everything is allocated up front, nothing is allocated per frame.
+    self->width = width;
+    self->height = height;
+    for (gint i = 0; i < N_SLOTS; i++)
+        self->slots[i].pixels = g_malloc ((gsize) width * height * 4);
+    self->yuv_size = (gsize) width * height + 2 * (gsize) ((width + 1) / 2) * ((height + 1) / 2);
+    self->yuv = g_malloc (self->yuv_size);
+
+    g_autofree gchar *header = g_strdup_printf ("YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420jpeg\n", width, height, refresh_rate);
+    append_bytes (self, (const guint8 *) header, strlen (header));
+
+    self->writer = g_thread_new ("fl-frame-recorder", writer_thread, self);
+
+    return g_steal_pointer (&self);
+}
+
+void
+fl_frame_recorder_close (FlFrameRecorder *self)
+{
+    g_return_if_fail (FL_IS_FRAME_RECORDER (self));
+
+    // Let the writer finish the frames already queued.
+    if (self->writer != NULL) {
+        guint64 count = 1;
+        g_atomic_int_set (&self->stopping, TRUE);
+        if (write (self->event_fd, &count, sizeof (count)) < 0)
+            g_warning ("Failed to stop recording: %s", strerror (errno));
+        g_thread_join (self->writer);
+        self->writer = NULL;
+    }
+
+    if (self->event_fd >= 0) {
+        close (self->event_fd);
+        self->event_fd = -1;
+    }
+    if (self->fd >= 0) {
+        if (close (self->fd) < 0)
+            g_warning ("Failed to close recording: %s", strerror (errno));
+        self->fd = -1;
+    }
+}
+
+void
+fl_frame_recorder_get_stats (FlFrameRecorder *self, guint64 *frames_recorded, guint64 *frames_dropped, gint64 *record_time)
+{
+    g_return_if_fail (FL_IS_FRAME_RECORDER (self));
+
+    g_mutex_lock (&self->stats_mutex);
+    *frames_recorded = self->frames_recorded;
+    *frames_dropped = self->frames_dropped;
+    *record_time = self->frames_read > 0 ? self->record_time / (gint64) self->frames_read : 0;
+    g_mutex_unlock (&self->stats_mutex);
+}
+
+gboolean
+fl_frame_recorder_is_pending (FlFrameRecorder *self)
+{
+    g_return_val_if_fail (FL_IS_FRAME_RECORDER (self), FALSE);
+
+    return fl_pixel_readback_is_pending (self->readback);
+}
+
+void
+fl_frame_recorder_read_framebuffer (FlFrameRecorder *self, guint32 framebuffer, gint width, gint height)
+{
+    g_return_if_fail (FL_IS_FRAME_RECORDER (self));
+
+    if (self->writer == NULL || g_atomic_int_get (&self->stopping))
+        return;
+
+    gint64 start_time = g_get_monotonic_time ();
+
+    // Crop to the video size, keeping the top left corner.
+    FrameSize *size = &self->sizes[self->n_reads % N_READBACKS];
+    size->width = MIN (width, self->width);
+    size->height = MIN (height, self->height);
+    cairo_rectangle_int_t rect = { 0, height - size->height, size->width, size->height };
+
+    // Dropped rather than wait for the GPU when all the buffers are in flight.
+    if (!fl_pixel_readback_read (self->readback, framebuffer, &rect, 1, size)) {
+        drop_frame (self);
+        return;
+    }
+    self->n_reads++;
+
+    g_mutex_lock (&self->stats_mutex);
+    self->frames_read++;
+    self->record_time += g_get_monotonic_time () - start_time;
+    g_mutex_unlock (&self->stats_mutex);
+}
+
+void
+fl_frame_recorder_poll (FlFrameRecorder *self)
+{
+    g_return_if_fail (FL_IS_FRAME_RECORDER (self));
+
+    if (!fl_pixel_readback_is_pending (self->readback))
+        return;
+
+    gint64 start_time = g_get_monotonic_time ();
+    fl_pixel_readback_poll (self->readback, FALSE, readback_done_cb, self);
+
+    g_mutex_lock (&self->stats_mutex);
+    self->record_time += g_get_monotonic_time () - start_time;
+    g_mutex_unlock (&self->stats_mutex);
+}
+
+void
+fl_frame_recorder_release_buffers (FlFrameRecorder *self)
+{
+    g_return_if_fail (FL_IS_FRAME_RECORDER (self));
+
+    fl_pixel_readback_release (self->readback, readback_done_cb, self);
+}
+
+void
+fl_frame_recorder_reset (FlFrameRecorder *self)
+{
+    g_return_if_fail (FL_IS_FRAME_RECORDER (self));
+
+    fl_pixel_readback_reset (self->readback, readback_done_cb, self);
+}
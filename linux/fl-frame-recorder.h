@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlFrameRecorder, fl_frame_recorder, FL, FRAME_RECORDER, GObject)
+
+/* Records presented frames to a YUV4MPEG2 file. Frames are read back through
+ * pixel buffers, copied into a fixed ring once the GPU is done and written out
+ * by a thread of its own. Frames that don't fit are dropped rather than holding
+ * up rendering. */
+
+FlFrameRecorder *fl_frame_recorder_new              (const gchar *path, gint width, gint height, gint refresh_rate, GError **error);
+
+void             fl_frame_recorder_close            (FlFrameRecorder *recorder);
+
+void             fl_frame_recorder_get_stats        (FlFrameRecorder *recorder, guint64 *frames_recorded, guint64 *frames_dropped, gint64 *record_time);
+
+gboolean         fl_frame_recorder_is_pending       (FlFrameRecorder *recorder);
+
+/* Called from the raster thread with the context current */
+
+void             fl_frame_recorder_read_framebuffer (FlFrameRecorder *recorder, guint32 framebuffer, gint width, gint height);
+
+void             fl_frame_recorder_poll             (FlFrameRecorder *recorder);
+
+/* Called once no more frames will be read, frames still being read back are
+ * recorded */
+
+void             fl_frame_recorder_release_buffers  (FlFrameRecorder *recorder);
+
+/* Called once the context the frames were read with has been destroyed */
+
+void             fl_frame_recorder_reset            (FlFrameRecorder *recorder);
+
+G_END_DECLS
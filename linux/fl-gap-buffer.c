@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include "fl-gap-buffer.h"
+#include "fl-json.h"
+
+// Smallest gap left when the buffer grows, in code units.
+#define MIN_GAP 256
+
+struct _FlGapBuffer
+{
+    GObject parent_instance;
+
+    gunichar2 *data;
+    gsize size;
+
+    // Unused units between the text before and after the gap.
+    gsize gap_start;
+    gsize gap_end;
+};
+
+G_DEFINE_TYPE (FlGapBuffer, fl_gap_buffer, G_TYPE_OBJECT)
+
+static gsize
+get_length (FlGapBuffer *self)
+{
+    return self->size - (self->gap_end - self->gap_start);
+}
+
+static gunichar2
+get_unit (FlGapBuffer *self, gsize offset)
+{
+    return self->data[offset < self->gap_start ? offset : offset + self->gap_end - self->gap_start];
+}
+
+static gboolean
+is_high_surrogate (gunichar2 unit)
+{
+    return unit >= 0xd800 && unit < 0xdc00;
+}
+
+static gboolean
+is_low_surrogate (gunichar2 unit)
+{
+    return unit >= 0xdc00 && unit < 0xe000;
+}
+
+static void
+move_gap (FlGapBuffer *self, gsize offset)
+{
+    if (offset < self->gap_start) {
+        gsize n = self->gap_start - offset;
+        memmove (self->data + self->gap_end - n, self->data + offset, n * sizeof (gunichar2));
+        self->gap_start -= n;
+        self->gap_end -= n;
+    } else if (offset > self->gap_start) {
+        gsize n = offset - self->gap_start;
+        memmove (self->data + self->gap_start, self->data + self->gap_end, n * sizeof (gunichar2));
+        self->gap_start += n;
+        self->gap_end += n;
+    }
+}
+
+// Makes room for @n_units more in the gap, which is kept where it is.
+static void
+reserve_gap (FlGapBuffer *self, gsize n_units)
+{
+    if (self->gap_end - self->gap_start >= n_units)
+        return;
+
+    gsize length = get_length (self);
+    gsize size = MAX (self->size * 2, length + n_units + MIN_GAP);
+    gsize n_after = self->size - self->gap_end;
+    self->data = g_renew (gunichar2, self->data, size);
+    memmove (self->data + size - n_after, self->data + self->gap_end, n_after * sizeof (gunichar2));
+    self->gap_end = size - n_after;
+    self->size = size;
+}
+
+static void
+fl_gap_buffer_finalize (GObject *object)
+{
+    FlGapBuffer *self = FL_GAP_BUFFER (object);
+
+    g_free (self->data);
+
+    G_OBJECT_CLASS (fl_gap_buffer_parent_class)->finalize (object);
+}
+
+static void
+fl_gap_buffer_class_init (FlGapBufferClass *klass)
+{
+    G_OBJECT_CLASS (klass)->finalize = fl_gap_buffer_finalize;
+}
+
+static void
+fl_gap_buffer_init (FlGapBuffer *self)
+{
+}
+
+FlGapBuffer *
+fl_gap_buffer_new (void)
+{
+    return g_object_new (fl_gap_buffer_get_type (), NULL);
+}
+
+void
+fl_gap_buffer_set_text (FlGapBuffer *self, const gchar *text)
+{
+    g_return_if_fail (FL_IS_GAP_BUFFER (self));
+
+    self->gap_start = 0;
+    self->gap_end = self->size;
+    fl_gap_buffer_replace (self, 0, 0, text);
+}
+
+gsize
+fl_gap_buffer_get_length (FlGapBuffer *self)
+{
+    g_return_val_if_fail (FL_IS_GAP_BUFFER (self), 0);
+
+    return get_length (self);
+}
+
+gunichar2
+fl_gap_buffer_get_unit (FlGapBuffer *self, gsize offset)
+{
+    g_return_val_if_fail (FL_IS_GAP_BUFFER (self), 0);
+    g_return_val_if_fail (offset < get_length (self), 0);
+
+    return get_unit (self, offset);
+}
+
+void
+fl_gap_buffer_replace (FlGapBuffer *self, gsize start, gsize end, const gchar *text)
+{
+    g_return_if_fail (FL_IS_GAP_BUFFER (self));
+    g_return_if_fail (start <= end && end <= get_length (self));
+
+    glong n_units = 0;
+    g_autofree gunichar2 *units = text != NULL ? g_utf8_to_utf16 (text, -1, NULL, &n_units, NULL) : NULL;
+    if (units == NULL)
+        n_units = 0;
+
+    // Removed text is dropped by growing the gap over it.
+    move_gap (self, end);
+    self->gap_start = start;
+    reserve_gap (self, n_units);
+    memcpy (self->data + self->gap_start, units, n_units * sizeof (gunichar2));
+    self->gap_start += n_units;
+}
+
+gsize
+fl_gap_buffer_move_by_chars (FlGapBuffer *self, gsize offset, gint n_chars)
+{
+    g_return_val_if_fail (FL_IS_GAP_BUFFER (self), offset);
+
+    gsize length = get_length (self);
+    offset = MIN (offset, length);
+    for (; n_chars > 0 && offset < length; n_chars--) {
+        if (offset + 1 < length && is_high_surrogate (get_unit (self, offset)) && is_low_surrogate (get_unit (self, offset + 1)))
+            offset += 2;
+        else
+            offset++;
+    }
+    for (; n_chars < 0 && offset > 0; n_chars++) {
+        if (offset >= 2 && is_low_surrogate (get_unit (self, offset - 1)) && is_high_surrogate (get_unit (self, offset - 2)))
+            offset -= 2;
+        else
+            offset--;
+    }
+
+    return offset;
+}
+
+gchar *
+fl_gap_buffer_get_text (FlGapBuffer *self, gsize start, gsize end)
+{
+    g_return_val_if_fail (FL_IS_GAP_BUFFER (self), NULL);
+    g_return_val_if_fail (start <= end && end <= get_length (self), NULL);
+
+    // Convert from one run of units.
+    if (start < self->gap_start && end > self->gap_start)
+        move_gap (self, end);
+    const gunichar2 *units = self->data + (start < self->gap_start ? start : start + self->gap_end - self->gap_start);
+    gchar *text = g_utf16_to_utf8 (units, end - start, NULL, NULL, NULL);
+
+    return text != NULL ? text : g_strdup ("");
+}
+
+void
+fl_gap_buffer_append_json (FlGapBuffer *self, gsize start, gsize end, GString *json)
+{
+    g_return_if_fail (FL_IS_GAP_BUFFER (self));
+    g_return_if_fail (start <= end && end <= get_length (self));
+
+    for (gsize i = start; i < end; i++) {
+        gunichar c = get_unit (self, i);
+        if (i + 1 < end && is_high_surrogate (c) && is_low_surrogate (get_unit (self, i + 1))) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (get_unit (self, i + 1) - 0xdc00);
+            i++;
+        } else if (is_high_surrogate (c) || is_low_surrogate (c)) {
+            // Lone surrogates can't be written as UTF-8.
+            c = 0xfffd;
+        }
+        fl_json_append_unichar (json, c);
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlGapBuffer, fl_gap_buffer, FL, GAP_BUFFER, GObject)
+
+/* Text held as UTF-16, the units the framework gives offsets in, with the free
+ * space kept at the last edit. Edits near the previous one only move the text
+ * between them, so typing costs the same however long the text is.
+ *
+ * Offsets are in UTF-16 code units. */
+
+FlGapBuffer *fl_gap_buffer_new           (void);
+
+void         fl_gap_buffer_set_text      (FlGapBuffer *buffer, const gchar *text);
+
+gsize        fl_gap_buffer_get_length    (FlGapBuffer *buffer);
+
+gunichar2    fl_gap_buffer_get_unit      (FlGapBuffer *buffer, gsize offset);
+
+/* Replaces the text from @start to @end with @text */
+
+void         fl_gap_buffer_replace       (FlGapBuffer *buffer, gsize start, gsize end, const gchar *text);
+
+/* Returns the offset @n_chars characters from @offset, not splitting surrogate pairs */
+
+gsize        fl_gap_buffer_move_by_chars (FlGapBuffer *buffer, gsize offset, gint n_chars);
+
+gchar       *fl_gap_buffer_get_text      (FlGapBuffer *buffer, gsize start, gsize end);
+
+/* Appends the text from @start to @end escaped for a JSON string */
+
+void         fl_gap_buffer_append_json   (FlGapBuffer *buffer, gsize start, gsize end, GString *json);
+
+G_END_DECLS
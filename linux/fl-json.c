@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "fl-json.h"
+
+// Deepest nesting of objects and arrays accepted.
+#define MAX_DEPTH 64
+
+typedef struct
+{
+    const gchar *data;
+    gsize length;
+    gsize offset;
+    guint depth;
+} Parser;
+
+static GVariant *parse_value (Parser *parser, GError **error);
+
+static gboolean
+set_error (Parser *parser, GError **error, const gchar *message)
+{
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid JSON at offset %" G_GSIZE_FORMAT ": %s", parser->offset, message);
+    return FALSE;
+}
+
+static gchar
+peek (Parser *parser)
+{
+    return parser->offset < parser->length ? parser->data[parser->offset] : '\0';
+}
+
+static void
+skip_whitespace (Parser *parser)
+{
+    gchar c;
+    while ((c = peek (parser)) == ' ' || c == '\t' || c == '\r' || c == '\n')
+        parser->offset++;
+}
+
+static gboolean
+is_number_char (gchar c)
+{
+    return g_ascii_isdigit (c) || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-';
+}
+
+static gboolean
+expect (Parser *parser, const gchar *token, GError **error)
+{
+    gsize length = strlen (token);
+    if (parser->length - parser->offset < length || memcmp (parser->data + parser->offset, token, length) != 0)
+        return set_error (parser, error, "unexpected token");
+    parser->offset += length;
+    return TRUE;
+}
+
+static gboolean
+parse_hex4 (Parser *parser, gunichar *value, GError **error)
+{
+    if (parser->length - parser->offset < 4)
+        return set_error (parser, error, "truncated escape");
+
+    *value = 0;
+    for (gint i = 0; i < 4; i++) {
+        gint digit = g_ascii_xdigit_value (parser->data[parser->offset++]);
+        if (digit < 0)
+            return set_error (parser, error, "invalid escape");
+        *value = *value << 4 | digit;
+    }
+
+    return TRUE;
+}
+
+static gchar *
+parse_string (Parser *parser, GError **error)
+{
+    // Skip the opening quote.
+    parser->offset++;
+
+    GString *value = g_string_new (NULL);
+    while (TRUE) {
+        // Copy runs without escapes in one go.
+        gsize start = parser->offset;
+        while (parser->offset < parser->length && parser->data[parser->offset] != '"' && parser->data[parser->offset] != '\\')
+            parser->offset++;
+        g_string_append_len (value, parser->data + start, parser->offset - start);
+
+        gchar c = peek (parser);
+        if (c == '"') {
+            parser->offset++;
+            break;
+        }
+        if (c != '\\' || ++parser->offset >= parser->length) {
+            set_error (parser, error, "unterminated string");
+            return g_string_free (value, TRUE);
+        }
+
+        c = parser->data[parser->offset++];
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            g_string_append_c (value, c);
+            break;
+        case 'b':
+            g_string_append_c (value, '\b');
+            break;
+        case 'f':
+            g_string_append_c (value, '\f');
+            break;
+        case 'n':
+            g_string_append_c (value, '\n');
+            break;
+        case 'r':
+            g_string_append_c (value, '\r');
+            break;
+        case 't':
+            g_string_append_c (value, '\t');
+            break;
+        case 'u': {
+            gunichar code_point;
+            if (!parse_hex4 (parser, &code_point, error))
+                return g_string_free (value, TRUE);
+            // Characters outside the BMP are escaped as a surrogate pair.
+            if (code_point >= 0xd800 && code_point < 0xdc00 && parser->length - parser->offset >= 6 &&
+                parser->data[parser->offset] == '\\' && parser->data[parser->offset + 1] == 'u') {
+                parser->offset += 2;
+                gunichar low;
+                if (!parse_hex4 (parser, &low, error))
+                    return g_string_free (value, TRUE);
+                if (low >= 0xdc00 && low < 0xe000)
+                    code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                else
+                    code_point = 0xfffd;
+            } else if (code_point >= 0xd800 && code_point < 0xe000) {
+                code_point = 0xfffd;
+            }
+            g_string_append_unichar (value, code_point);
+            break;
+        }
+        default:
+            set_error (parser, error, "invalid escape");
+            return g_string_free (value, TRUE);
+        }
+    }
+
+    if (!g_utf8_validate (value->str, value->len, NULL)) {
+        set_error (parser, error, "invalid UTF-8");
+        return g_string_free (value, TRUE);
+    }
+
+    return g_string_free (value, FALSE);
+}
+
+static GVariant *
+parse_number (Parser *parser, GError **error)
+{
+    gsize start = parser->offset;
+    gboolean integer = TRUE;
+
+    if (peek (parser) == '-')
+        parser->offset++;
+    while (is_number_char (peek (parser))) {
+        if (!g_ascii_isdigit (peek (parser)))
+            integer = FALSE;
+        parser->offset++;
+    }
+
+    // Copied so the number is terminated.
+    gchar text[G_ASCII_DTOSTR_BUF_SIZE];
+    gsize length = parser->offset - start;
+    if (length == 0 || length >= sizeof (text)) {
+        set_error (parser, error, "invalid number");
+        return NULL;
+    }
+    memcpy (text, parser->data + start, length);
+    text[length] = '\0';
+
+    gchar *end = NULL;
+    if (integer) {
+        gint64 value = g_ascii_strtoll (text, &end, 10);
+        if (*end == '\0')
+            return g_variant_new_int64 (value);
+    } else {
+        gdouble value = g_ascii_strtod (text, &end);
+        if (*end == '\0')
+            return g_variant_new_double (value);
+    }
+
+    set_error (parser, error, "invalid number");
+    return NULL;
+}
+
+static GVariant *
+parse_object (Parser *parser, GError **error)
+{
+    GVariantBuilder builder;
+
+    parser->offset++;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+    skip_whitespace (parser);
+    if (peek (parser) == '}') {
+        parser->offset++;
+        return g_variant_builder_end (&builder);
+    }
+
+    while (TRUE) {
+        skip_whitespace (parser);
+        if (peek (parser) != '"') {
+            set_error (parser, error, "expected member name");
+            g_variant_builder_clear (&builder);
+            return NULL;
+        }
+        g_autofree gchar *name = parse_string (parser, error);
+        if (name == NULL) {
+            g_variant_builder_clear (&builder);
+            return NULL;
+        }
+
+        skip_whitespace (parser);
+        if (!expect (parser, ":", error)) {
+            g_variant_builder_clear (&builder);
+            return NULL;
+        }
+        GVariant *value = parse_value (parser, error);
+        if (value == NULL) {
+            g_variant_builder_clear (&builder);
+            return NULL;
+        }
+        g_variant_builder_add (&builder, "{sv}", name, value);
+
+        skip_whitespace (parser);
+        gchar c = peek (parser);
+        parser->offset++;
+        if (c == '}')
+            return g_variant_builder_end (&builder);
+        if (c != ',') {
+            set_error (parser, error, "expected , or }");
+            g_variant_builder_clear (&builder);
+            return NULL;
+        }
+    }
+}
+
+static GVariant *
+parse_array (Parser *parser, GError **error)
+{
+    GVariantBuilder builder;
+
+    parser->offset++;
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+    skip_whitespace (parser);
+    if (peek (parser) == ']') {
+        parser->offset++;
+        return g_variant_builder_end (&builder);
+    }
+
+    while (TRUE) {
+        GVariant *value = parse_value (parser, error);
+        if (value == NULL) {
+            g_variant_builder_clear (&builder);
+            return NULL;
+        }
+        g_variant_builder_add (&builder, "v", value);
+
+        skip_whitespace (parser);
+        gchar c = peek (parser);
+        parser->offset++;
+        if (c == ']')
+            return g_variant_builder_end (&builder);
+        if (c != ',') {
+            set_error (parser, error, "expected , or ]");
+            g_variant_builder_clear (&builder);
+            return NULL;
+        }
+    }
+}
+
+static GVariant *
+parse_value (Parser *parser, GError **error)
+{
+    skip_whitespace (parser);
+
+    gchar c = peek (parser);
+    switch (c)
+    {
+    case '{':
+    case '[': {
+        if (parser->depth >= MAX_DEPTH) {
+            set_error (parser, error, "nested too deeply");
+            return NULL;
+        }
+        parser->depth++;
+        GVariant *value = c == '{' ? parse_object (parser, error) : parse_array (parser, error);
+        parser->depth--;
+        return value;
+    }
+    case '"': {
+        gchar *value = parse_string (parser, error);
+        return value != NULL ? g_variant_new_take_string (value) : NULL;
+    }
+    case 't':
+        return expect (parser, "true", error) ? g_variant_new_boolean (TRUE) : NULL;
+    case 'f':
+        return expect (parser, "false", error) ? g_variant_new_boolean (FALSE) : NULL;
+    case 'n':
+        return expect (parser, "null", error) ? g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL) : NULL;
+    default:
+        return parse_number (parser, error);
+    }
+}
+
+GVariant *
+fl_json_parse (const gchar *json, gsize length, GError **error)
+{
+    Parser parser = { json, length, 0, 0 };
+
+    g_return_val_if_fail (json != NULL || length == 0, NULL);
+
+    GVariant *value = parse_value (&parser, error);
+    if (value == NULL)
+        return NULL;
+    g_variant_ref_sink (value);
+
+    skip_whitespace (&parser);
+    if (parser.offset != parser.length) {
+        set_error (&parser, error, "trailing data");
+        g_variant_unref (value);
+        return NULL;
+    }
+
+    return value;
+}
+
+gint64
+fl_json_get_int (GVariant *value, gint64 default_value)
+{
+    if (value != NULL && g_variant_is_of_type (value, G_VARIANT_TYPE_INT64))
+        return g_variant_get_int64 (value);
+    if (value != NULL && g_variant_is_of_type (value, G_VARIANT_TYPE_DOUBLE))
+        return g_variant_get_double (value);
+    return default_value;
+}
+
+gdouble
+fl_json_get_double (GVariant *value, gdouble default_value)
+{
+    if (value != NULL && g_variant_is_of_type (value, G_VARIANT_TYPE_DOUBLE))
+        return g_variant_get_double (value);
+    if (value != NULL && g_variant_is_of_type (value, G_VARIANT_TYPE_INT64))
+        return g_variant_get_int64 (value);
+    return default_value;
+}
+
+void
+fl_json_append_unichar (GString *json, gunichar value)
+{
+    switch (value)
+    {
+    case '"':
+        g_string_append (json, "\\\"");
+        break;
+    case '\\':
+        g_string_append (json, "\\\\");
+        break;
+    case '\n':
+        g_string_append (json, "\\n");
+        break;
+    case '\r':
+        g_string_append (json, "\\r");
+        break;
+    case '\t':
+        g_string_append (json, "\\t");
+        break;
+    default:
+        if (value < 0x20)
+            g_string_append_printf (json, "\\u%04x", value);
+        else if (value < 0x80)
+            g_string_append_c (json, value);
+        else
+            g_string_append_unichar (json, value);
+        break;
+    }
+}
+
+void
+fl_json_append_string (GString *json, const gchar *value)
+{
+    g_string_append_c (json, '"');
+    for (const gchar *c = value; *c != '\0'; c = g_utf8_next_char (c))
+        fl_json_append_unichar (json, g_utf8_get_char (c));
+    g_string_append_c (json, '"');
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* JSON as used by the framework's JSON method codec. Values are read into
+ * GVariants: objects as a{sv}, arrays as av, strings as s, integers as x, other
+ * numbers as d, booleans as b and null as an empty mv. */
+
+GVariant *fl_json_parse          (const gchar *json, gsize length, GError **error);
+
+/* Returns the number in @value, or @default_value if it isn't one */
+
+gint64    fl_json_get_int        (GVariant *value, gint64 default_value);
+
+gdouble   fl_json_get_double     (GVariant *value, gdouble default_value);
+
+/* Appends @value escaped, without quotes */
+
+void      fl_json_append_unichar (GString *json, gunichar value);
+
+/* Appends @value as a quoted string */
+
+void      fl_json_append_string  (GString *json, const gchar *value);
+
+G_END_DECLS
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <gdk/gdkkeysyms.h>
+
+#include "fl-key-event.h"
+
+// Keysyms in this page are function and modifier keys.
+#define FUNCTION_KEY_PAGE 0xff00
+
+// Keysyms in this range are a Unicode code point plus this offset.
+#define UNICODE_KEYSYM_OFFSET 0x01000000
+
+// Modifier mask of each key in the function key page, indexed by the low byte of its keysym.
+// Lock keys are left out as pressing them toggles their mask.
+static const guint32 function_key_modifiers[256] = {
+    [GDK_KEY_Shift_L & 0xff] = GDK_SHIFT_MASK,
+    [GDK_KEY_Shift_R & 0xff] = GDK_SHIFT_MASK,
+    [GDK_KEY_Control_L & 0xff] = GDK_CONTROL_MASK,
+    [GDK_KEY_Control_R & 0xff] = GDK_CONTROL_MASK,
+    [GDK_KEY_Meta_L & 0xff] = GDK_META_MASK,
+    [GDK_KEY_Meta_R & 0xff] = GDK_META_MASK,
+    [GDK_KEY_Alt_L & 0xff] = GDK_MOD1_MASK,
+    [GDK_KEY_Alt_R & 0xff] = GDK_MOD1_MASK,
+    [GDK_KEY_Super_L & 0xff] = GDK_SUPER_MASK | GDK_MOD4_MASK,
+    [GDK_KEY_Super_R & 0xff] = GDK_SUPER_MASK | GDK_MOD4_MASK,
+    [GDK_KEY_Hyper_L & 0xff] = GDK_HYPER_MASK,
+    [GDK_KEY_Hyper_R & 0xff] = GDK_HYPER_MASK
+};
+
+static guint32
+get_modifier_mask (guint keyval)
+{
+    if ((keyval & ~0xff) != FUNCTION_KEY_PAGE)
+        return 0;
+    return function_key_modifiers[keyval & 0xff];
+}
+
+static gunichar
+get_unicode (guint keyval)
+{
+    // Latin-1 keysyms are their own code points.
+    if ((keyval >= 0x20 && keyval <= 0x7e) || (keyval >= 0xa0 && keyval <= 0xff))
+        return keyval;
+    if (keyval >= UNICODE_KEYSYM_OFFSET + 0x100 && keyval <= UNICODE_KEYSYM_OFFSET + 0x10ffff)
+        return keyval - UNICODE_KEYSYM_OFFSET;
+    if ((keyval & ~0xff) == FUNCTION_KEY_PAGE && keyval < GDK_KEY_KP_Space)
+        return 0;
+
+    return gdk_keyval_to_unicode (keyval);
+}
+
+guint
+fl_key_event_get_modifiers (const GdkEventKey *event)
+{
+    guint32 mask = get_modifier_mask (event->keyval);
+
+    if (event->type == GDK_KEY_PRESS)
+        return event->state | mask;
+    else
+        return event->state & ~mask;
+}
+
+gsize
+fl_key_event_encode (const GdkEventKey *event, gchar *buffer, gsize buffer_size)
+{
+    gint length = g_snprintf (buffer, buffer_size,
+                              "{\"type\":\"%s\",\"keymap\":\"linux\",\"toolkit\":\"gtk\",\"scanCode\":%u,\"keyCode\":%u,\"modifiers\":%u,\"unicodeScalarValues\":%u}",
+                              event->type == GDK_KEY_PRESS ? "keydown" : "keyup",
+                              event->hardware_keycode,
+                              event->keyval,
+                              fl_key_event_get_modifiers (event),
+                              get_unicode (event->keyval));
+    g_return_val_if_fail (length > 0 && (gsize) length < buffer_size, 0);
+
+    return length;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <gdk/gdk.h>
+
+G_BEGIN_DECLS
+
+/* Key events as sent to the framework on the flutter/keyevent channel, in the
+ * GTK keymap. The framework maps keyvals and hardware keycodes to logical and
+ * physical keys, the embedder only needs to track modifiers and text. */
+
+// Longest message fl_key_event_encode() writes, including the terminating nul.
+#define FL_KEY_EVENT_MAX_LENGTH 192
+
+/* Returns the modifier mask for the state after @event, which GDK reports from before it */
+
+guint fl_key_event_get_modifiers (const GdkEventKey *event);
+
+/* Writes the JSON message for @event into @buffer and returns its length.
+ * Nothing is allocated, so it can be used for every event. */
+
+gsize fl_key_event_encode        (const GdkEventKey *event, gchar *buffer, gsize buffer_size);
+
+G_END_DECLS
@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#include "fl-memory-monitor.h"
+
+// Report when tasks were stalled on memory for 150ms within a 2s window.
+// Unprivileged processes may only use windows that are a multiple of 2s.
+#define PSI_TRIGGER "some 150000 2000000"
+
+// Minimum time between two notifications from memory.events.
+#define EVENTS_RATE_LIMIT_USEC (G_USEC_PER_SEC)
+
+struct _FlMemoryMonitor
+{
+    GObject parent_instance;
+
+    // PSI trigger file and its main loop source.
+    gint psi_fd;
+    guint psi_source;
+
+    // Fallback when PSI is not available: cgroup v2 memory.events.
+    GFileMonitor *events_monitor;
+    gchar *events_path;
+    guint64 events_count;
+    gint64 last_event_time;
+
+    guint64 total_reclaimed;
+};
+
+enum
+{
+    SIGNAL_LOW_MEMORY,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (FlMemoryMonitor, fl_memory_monitor, G_TYPE_OBJECT)
+
+static gboolean
+fl_memory_monitor_sum_accumulator (GSignalInvocationHint *hint,
+                                   GValue *return_accu,
+                                   const GValue *handler_return,
+                                   gpointer user_data)
+{
+    g_value_set_uint64 (return_accu, g_value_get_uint64 (return_accu) + g_value_get_uint64 (handler_return));
+    return TRUE;
+}
+
+static gsize
+get_resident_size (void)
+{
+    g_autofree gchar *contents = NULL;
+    unsigned long size, resident;
+
+    if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+        return 0;
+    if (sscanf (contents, "%lu %lu", &size, &resident) != 2)
+        return 0;
+
+    return resident * sysconf (_SC_PAGESIZE);
+}
+
+// Returns the directory of the cgroup v2 hierarchy this process is in, or NULL.
+static gchar *
+get_cgroup_path (void)
+{
+    g_autofree gchar *contents = NULL;
+    g_auto(GStrv) lines = NULL;
+
+    if (!g_file_get_contents ("/proc/self/cgroup", &contents, NULL, NULL))
+        return NULL;
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (int i = 0; lines[i] != NULL; i++)
+        if (g_str_has_prefix (lines[i], "0::"))
+            return g_build_filename ("/sys/fs/cgroup", lines[i] + 3, NULL);
+
+    return NULL;
+}
+
+// Sum the counters in memory.events that indicate the cgroup is being throttled or reclaimed.
+static guint64
+read_memory_events (const gchar *path)
+{
+    g_autofree gchar *contents = NULL;
+    g_auto(GStrv) lines = NULL;
+    guint64 count = 0;
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return 0;
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (int i = 0; lines[i] != NULL; i++) {
+        g_auto(GStrv) fields = g_strsplit (lines[i], " ", 2);
+        if (fields[0] == NULL || fields[1] == NULL)
+            continue;
+        if (strcmp (fields[0], "high") == 0 || strcmp (fields[0], "max") == 0 || strcmp (fields[0], "oom") == 0)
+            count += g_ascii_strtoull (fields[1], NULL, 10);
+    }
+
+    return count;
+}
+
+static gboolean
+psi_cb (gint fd, GIOCondition condition, gpointer user_data)
+{
+    FlMemoryMonitor *self = user_data;
+
+    if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+        g_warning ("Memory pressure trigger closed");
+        self->psi_source = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    fl_memory_monitor_trigger (self);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+memory_events_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data)
+{
+    FlMemoryMonitor *self = user_data;
+
+    if (event_type != G_FILE_MONITOR_EVENT_CHANGED)
+        return;
+
+    guint64 count = read_memory_events (self->events_path);
+    if (count <= self->events_count)
+        return;
+    self->events_count = count;
+
+    gint64 now = g_get_monotonic_time ();
+    if (now - self->last_event_time < EVENTS_RATE_LIMIT_USEC)
+        return;
+    self->last_event_time = now;
+
+    fl_memory_monitor_trigger (self);
+}
+
+static gboolean
+watch_psi (FlMemoryMonitor *self, const gchar *path)
+{
+    int fd = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return FALSE;
+
+    if (write (fd, PSI_TRIGGER, strlen (PSI_TRIGGER) + 1) < 0) {
+        g_debug ("Failed to set memory pressure trigger on %s: %s", path, strerror (errno));
+        close (fd);
+        return FALSE;
+    }
+
+    self->psi_fd = fd;
+    self->psi_source = g_unix_fd_add (fd, G_IO_PRI | G_IO_ERR, psi_cb, self);
+    g_debug ("Watching memory pressure using %s", path);
+
+    return TRUE;
+}
+
+static gboolean
+watch_memory_events (FlMemoryMonitor *self, const gchar *path)
+{
+    g_autoptr(GFile) file = g_file_new_for_path (path);
+    g_autoptr(GError) error = NULL;
+
+    if (!g_file_test (path, G_FILE_TEST_EXISTS))
+        return FALSE;
+
+    self->events_monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error);
+    if (self->events_monitor == NULL) {
+        g_debug ("Failed to monitor %s: %s", path, error->message);
+        return FALSE;
+    }
+
+    self->events_path = g_strdup (path);
+    self->events_count = read_memory_events (path);
+    g_signal_connect (self->events_monitor, "changed", G_CALLBACK (memory_events_changed_cb), self);
+    g_debug ("Watching memory events using %s", path);
+
+    return TRUE;
+}
+
+static void
+fl_memory_monitor_dispose (GObject *object)
+{
+    FlMemoryMonitor *self = FL_MEMORY_MONITOR (object);
+
+    if (self->psi_source != 0) {
+        g_source_remove (self->psi_source);
+        self->psi_source = 0;
+    }
+    if (self->psi_fd >= 0) {
+        close (self->psi_fd);
+        self->psi_fd = -1;
+    }
+    g_clear_object (&self->events_monitor);
+    g_clear_pointer (&self->events_path, g_free);
+
+    G_OBJECT_CLASS (fl_memory_monitor_parent_class)->dispose (object);
+}
+
+static void
+fl_memory_monitor_class_init (FlMemoryMonitorClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_memory_monitor_dispose;
+
+    signals[SIGNAL_LOW_MEMORY] = g_signal_new ("low-memory",
+                                               G_TYPE_FROM_CLASS (klass),
+                                               G_SIGNAL_RUN_LAST,
+                                               0,
+                                               fl_memory_monitor_sum_accumulator, NULL,
+                                               NULL,
+                                               G_TYPE_UINT64, 0);
+}
+
+static void
+fl_memory_monitor_init (FlMemoryMonitor *self)
+{
+    g_autofree gchar *cgroup_path = get_cgroup_path ();
+
+    self->psi_fd = -1;
+
+    // Prefer the pressure of our own cgroup, as that is where the limit is enforced.
+    if (cgroup_path != NULL) {
+        g_autofree gchar *pressure_path = g_build_filename (cgroup_path, "memory.pressure", NULL);
+        if (watch_psi (self, pressure_path))
+            return;
+    }
+    if (watch_psi (self, "/proc/pressure/memory"))
+        return;
+    if (cgroup_path != NULL) {
+        g_autofree gchar *events_path = g_build_filename (cgroup_path, "memory.events", NULL);
+        if (watch_memory_events (self, events_path))
+            return;
+    }
+
+    g_debug ("No memory pressure source available");
+}
+
+FlMemoryMonitor *
+fl_memory_monitor_get_default (void)
+{
+    static FlMemoryMonitor *monitor = NULL;
+
+    if (monitor == NULL)
+        monitor = g_object_new (fl_memory_monitor_get_type (), NULL);
+
+    return monitor;
+}
+
+void
+fl_memory_monitor_trigger (FlMemoryMonitor *self)
+{
+    guint64 reclaimed = 0;
+
+    g_return_if_fail (FL_IS_MEMORY_MONITOR (self));
+
+    gsize resident_before = get_resident_size ();
+    g_signal_emit (self, signals[SIGNAL_LOW_MEMORY], 0, &reclaimed);
+    malloc_trim (0);
+    gsize resident_after = get_resident_size ();
+
+    self->total_reclaimed += reclaimed;
+    g_message ("Memory pressure: caches released %" G_GUINT64_FORMAT " bytes, resident size %" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT " bytes",
+               reclaimed, resident_before, resident_after);
+}
+
+guint64
+fl_memory_monitor_get_total_reclaimed (FlMemoryMonitor *self)
+{
+    g_return_val_if_fail (FL_IS_MEMORY_MONITOR (self), 0);
+    return self->total_reclaimed;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlMemoryMonitor, fl_memory_monitor, FL, MEMORY_MONITOR, GObject)
+
+/* Handlers of the "low-memory" signal free what they can and return the number
+ * of bytes they released; the results of all handlers are summed. */
+
+FlMemoryMonitor *fl_memory_monitor_get_default         (void);
+
+void             fl_memory_monitor_trigger             (FlMemoryMonitor *monitor);
+
+guint64          fl_memory_monitor_get_total_reclaimed (FlMemoryMonitor *monitor);
+
+G_END_DECLS
@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include "fl-engine-result.h"
+#include "fl-message-queue.h"
+
+#define N_PRIORITIES (FL_VIEW_MESSAGE_PRIORITY_LOW + 1)
+
+// Bytes of normal and low priority messages sent each frame, high priority messages are not limited.
+#define FRAME_BUDGET (256 * 1024)
+
+#define DEFAULT_MAX_BYTES    (4 * 1024 * 1024)
+#define DEFAULT_MAX_MESSAGES 1024
+
+typedef struct _Response Response;
+
+typedef struct
+{
+    gchar *channel;
+
+    // Data of an unbatched message, or the merged messages of a batched one.
+    GBytes *message;
+    GByteArray *batch;
+    guint n_messages;
+
+    FlViewResponseCallback callback;
+    gpointer user_data;
+} QueuedMessage;
+
+struct _Response
+{
+    FlViewResponseCallback callback;
+    gpointer user_data;
+    Response *next;
+};
+
+struct _FlMessageQueue
+{
+    GObject parent_instance;
+
+    // Protects the fields below.
+    GMutex mutex;
+
+    GQueue queues[N_PRIORITIES];
+
+    // Batched messages not sent yet, by channel, for each priority.
+    GHashTable *batches[N_PRIORITIES];
+    GHashTable *batched_channels;
+
+    gsize queued_bytes;
+    guint queued_messages;
+    gsize max_bytes;
+    guint max_messages;
+
+    // TRUE if the queue went over its limits and hasn't drained since.
+    gboolean congested;
+
+    guint send_source;
+    gint64 last_send_time;
+
+    // Only used from the main thread.
+    FlutterEngine engine;
+    gint64 frame_interval;
+};
+
+enum
+{
+    SIGNAL_DRAINED,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE (FlMessageQueue, fl_message_queue, G_TYPE_OBJECT)
+
+// Responses waiting for the engine, and ones recycled for later messages.
+static GMutex response_mutex;
+static Response *free_responses = NULL;
+
+static gboolean fl_message_queue_send_cb (gpointer user_data);
+
+static Response *
+response_new (FlViewResponseCallback callback, gpointer user_data)
+{
+    g_mutex_lock (&response_mutex);
+    Response *response = free_responses;
+    if (response != NULL)
+        free_responses = response->next;
+    g_mutex_unlock (&response_mutex);
+
+    if (response == NULL)
+        response = g_new0 (Response, 1);
+    response->callback = callback;
+    response->user_data = user_data;
+
+    return response;
+}
+
+static void
+response_free (Response *response)
+{
+    g_mutex_lock (&response_mutex);
+    response->next = free_responses;
+    free_responses = response;
+    g_mutex_unlock (&response_mutex);
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_message_queue_response_cb (const uint8_t *data, size_t data_length, void *user_data)
+{
+    Response *response = user_data;
+
+    g_autoptr(GBytes) bytes = g_bytes_new (data, data_length);
+    response->callback (bytes, response->user_data);
+    response_free (response);
+}
+
+static gsize
+queued_message_get_size (QueuedMessage *message)
+{
+    return message->batch != NULL ? message->batch->len : g_bytes_get_size (message->message);
+}
+
+static void
+queued_message_free (QueuedMessage *message)
+{
+    g_free (message->channel);
+    g_clear_pointer (&message->message, g_bytes_unref);
+    if (message->batch != NULL)
+        g_byte_array_unref (message->batch);
+    g_free (message);
+}
+
+// Called with the mutex held.
+static void
+schedule_send (FlMessageQueue *self)
+{
+    if (self->send_source != 0 || self->engine == NULL)
+        return;
+
+    // One send per frame, so messages in a burst are batched together.
+    gint64 delay = self->last_send_time + self->frame_interval - g_get_monotonic_time ();
+    if (delay <= 0)
+        self->send_source = g_idle_add (fl_message_queue_send_cb, self);
+    else
+        self->send_source = g_timeout_add ((delay + 999) / 1000, fl_message_queue_send_cb, self);
+}
+
+static void
+send_message (FlMessageQueue *self, QueuedMessage *message)
+{
+    FlutterPlatformMessage platform_message = { 0 };
+    FlutterPlatformMessageResponseHandle *handle = NULL;
+    Response *response = NULL;
+
+    platform_message.struct_size = sizeof (FlutterPlatformMessage);
+    platform_message.channel = message->channel;
+    if (message->batch != NULL) {
+        platform_message.message = message->batch->data;
+        platform_message.message_size = message->batch->len;
+    } else {
+        platform_message.message = g_bytes_get_data (message->message, &platform_message.message_size);
+    }
+
+    if (message->callback != NULL) {
+        response = response_new (message->callback, message->user_data);
+        FlutterEngineResult result = FlutterPlatformMessageCreateResponseHandle (self->engine, fl_message_queue_response_cb, response, &handle);
+        if (result != kSuccess) {
+            g_autofree gchar *error = flutter_engine_result_to_string (result);
+            g_warning ("Failed to create response handle: %s", error);
+            response_free (response);
+            return;
+        }
+        platform_message.response_handle = handle;
+    }
+
+    FlutterEngineResult result = FlutterEngineSendPlatformMessage (self->engine, &platform_message);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to send message on %s: %s", message->channel, error);
+        if (response != NULL)
+            response_free (response);
+    }
+
+    // The engine keeps what it needs from the handle once the message is sent.
+    if (handle != NULL)
+        FlutterPlatformMessageReleaseResponseHandle (self->engine, handle);
+}
+
+static gboolean
+fl_message_queue_send_cb (gpointer user_data)
+{
+    FlMessageQueue *self = user_data;
+    GQueue messages = G_QUEUE_INIT;
+    gsize budget_used = 0;
+    gboolean drained = FALSE;
+
+    g_mutex_lock (&self->mutex);
+    self->send_source = 0;
+    self->last_send_time = g_get_monotonic_time ();
+
+    for (gint priority = 0; priority < N_PRIORITIES; priority++) {
+        QueuedMessage *message;
+        gboolean over_budget = FALSE;
+
+        while ((message = g_queue_peek_head (&self->queues[priority])) != NULL) {
+            gsize size = queued_message_get_size (message);
+
+            // At least one message goes each frame, however large it is.
+            if (priority != FL_VIEW_MESSAGE_PRIORITY_HIGH && budget_used > 0 && budget_used + size > FRAME_BUDGET) {
+                over_budget = TRUE;
+                break;
+            }
+            if (priority != FL_VIEW_MESSAGE_PRIORITY_HIGH)
+                budget_used += size;
+
+            g_queue_pop_head (&self->queues[priority]);
+            if (message->batch != NULL)
+                g_hash_table_remove (self->batches[priority], message->channel);
+            self->queued_bytes -= size;
+            self->queued_messages -= message->n_messages;
+            g_queue_push_tail (&messages, message);
+        }
+
+        // Lower priorities wait for these.
+        if (over_budget)
+            break;
+    }
+
+    if (self->congested && self->queued_bytes <= self->max_bytes / 2 && self->queued_messages <= self->max_messages / 2) {
+        self->congested = FALSE;
+        drained = TRUE;
+    }
+    if (self->queued_messages > 0)
+        schedule_send (self);
+    g_mutex_unlock (&self->mutex);
+
+    QueuedMessage *message;
+    while ((message = g_queue_pop_head (&messages)) != NULL) {
+        send_message (self, message);
+        queued_message_free (message);
+    }
+
+    if (drained)
+        g_signal_emit (self, signals[SIGNAL_DRAINED], 0);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+fl_message_queue_dispose (GObject *object)
+{
+    FlMessageQueue *self = FL_MESSAGE_QUEUE (object);
+
+    if (self->send_source != 0) {
+        g_source_remove (self->send_source);
+        self->send_source = 0;
+    }
+    for (gint priority = 0; priority < N_PRIORITIES; priority++) {
+        g_clear_pointer (&self->batches[priority], g_hash_table_unref);
+        g_queue_clear_full (&self->queues[priority], (GDestroyNotify) queued_message_free);
+    }
+    g_clear_pointer (&self->batched_channels, g_hash_table_unref);
+    self->queued_bytes = 0;
+    self->queued_messages = 0;
+
+    G_OBJECT_CLASS (fl_message_queue_parent_class)->dispose (object);
+}
+
+static void
+fl_message_queue_finalize (GObject *object)
+{
+    FlMessageQueue *self = FL_MESSAGE_QUEUE (object);
+
+    g_mutex_clear (&self->mutex);
+
+    G_OBJECT_CLASS (fl_message_queue_parent_class)->finalize (object);
+}
+
+static void
+fl_message_queue_class_init (FlMessageQueueClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_message_queue_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_message_queue_finalize;
+
+    signals[SIGNAL_DRAINED] = g_signal_new ("drained",
+                                            G_TYPE_FROM_CLASS (klass),
+                                            G_SIGNAL_RUN_LAST,
+                                            0,
+                                            NULL, NULL,
+                                            NULL,
+                                            G_TYPE_NONE, 0);
+}
+
+static void
+fl_message_queue_init (FlMessageQueue *self)
+{
+    g_mutex_init (&self->mutex);
+    for (gint priority = 0; priority < N_PRIORITIES; priority++) {
+        g_queue_init (&self->queues[priority]);
+        self->batches[priority] = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+    self->batched_channels = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    self->max_bytes = DEFAULT_MAX_BYTES;
+    self->max_messages = DEFAULT_MAX_MESSAGES;
+}
+
+FlMessageQueue *
+fl_message_queue_new (void)
+{
+    return g_object_new (fl_message_queue_get_type (), NULL);
+}
+
+void
+fl_message_queue_set_limits (FlMessageQueue *self, gsize max_bytes, guint max_messages)
+{
+    g_return_if_fail (FL_IS_MESSAGE_QUEUE (self));
+    g_return_if_fail (max_bytes > 0 && max_messages > 0);
+
+    g_mutex_lock (&self->mutex);
+    self->max_bytes = max_bytes;
+    self->max_messages = max_messages;
+    g_mutex_unlock (&self->mutex);
+}
+
+void
+fl_message_queue_set_batched (FlMessageQueue *self, const gchar *channel, gboolean batched)
+{
+    g_return_if_fail (FL_IS_MESSAGE_QUEUE (self));
+    g_return_if_fail (channel != NULL);
+
+    // Messages already merged are still sent together.
+    g_mutex_lock (&self->mutex);
+    if (batched)
+        g_hash_table_add (self->batched_channels, g_strdup (channel));
+    else
+        g_hash_table_remove (self->batched_channels, channel);
+    g_mutex_unlock (&self->mutex);
+}
+
+gboolean
+fl_message_queue_push (FlMessageQueue *self, const gchar *channel, GBytes *message, FlViewMessagePriority priority, FlViewResponseCallback callback, gpointer user_data)
+{
+    g_return_val_if_fail (FL_IS_MESSAGE_QUEUE (self), FALSE);
+    g_return_val_if_fail (channel != NULL, FALSE);
+    g_return_val_if_fail (message != NULL, FALSE);
+    g_return_val_if_fail (priority < N_PRIORITIES, FALSE);
+
+    gsize size;
+    gconstpointer data = g_bytes_get_data (message, &size);
+
+    g_mutex_lock (&self->mutex);
+
+    gboolean batched = g_hash_table_contains (self->batched_channels, channel);
+    if (batched && callback != NULL) {
+        g_mutex_unlock (&self->mutex);
+        g_warning ("Messages on batched channel %s can't have a response", channel);
+        return FALSE;
+    }
+
+    QueuedMessage *queued = batched ? g_hash_table_lookup (self->batches[priority], channel) : NULL;
+    if (queued == NULL) {
+        queued = g_new0 (QueuedMessage, 1);
+        queued->channel = g_strdup (channel);
+        queued->callback = callback;
+        queued->user_data = user_data;
+        if (batched) {
+            queued->batch = g_byte_array_new ();
+            g_hash_table_insert (self->batches[priority], queued->channel, queued);
+        } else {
+            queued->message = g_bytes_ref (message);
+        }
+        g_queue_push_tail (&self->queues[priority], queued);
+    }
+
+    if (queued->batch != NULL) {
+        guint32 length = size;
+        g_byte_array_append (queued->batch, (const guint8 *) &length, sizeof (length));
+        g_byte_array_append (queued->batch, data, size);
+        self->queued_bytes += sizeof (length) + size;
+    } else {
+        self->queued_bytes += size;
+    }
+    queued->n_messages++;
+    self->queued_messages++;
+
+    if (self->queued_bytes > self->max_bytes || self->queued_messages > self->max_messages)
+        self->congested = TRUE;
+    gboolean accepting = !self->congested;
+
+    schedule_send (self);
+    g_mutex_unlock (&self->mutex);
+
+    return accepting;
+}
+
+void
+fl_message_queue_set_engine (FlMessageQueue *self, FlutterEngine engine, guint64 frame_interval)
+{
+    g_return_if_fail (FL_IS_MESSAGE_QUEUE (self));
+
+    g_mutex_lock (&self->mutex);
+    self->engine = engine;
+    self->frame_interval = frame_interval / 1000;
+    if (engine == NULL && self->send_source != 0) {
+        g_source_remove (self->send_source);
+        self->send_source = 0;
+    } else if (self->queued_messages > 0) {
+        schedule_send (self);
+    }
+    g_mutex_unlock (&self->mutex);
+}
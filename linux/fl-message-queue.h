@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include "embedder.h"
+#include "fl-view.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlMessageQueue, fl_message_queue, FL, MESSAGE_QUEUE, GObject)
+
+/* Holds platform messages pushed from any thread and sends them to the engine
+ * from the main loop, at most once a frame. Higher priorities are sent first;
+ * normal and low priority messages are limited to a share of each frame so a
+ * burst of them doesn't hold up the UI isolate.
+ *
+ * Messages pushed to a batched channel before the next send are merged into one
+ * message, made of each message as a guint32 length in host byte order followed
+ * by its data.
+ *
+ * fl_message_queue_push() returns FALSE once the queue is over its limits, and
+ * the "drained" signal is emitted from the main loop when it has fallen back to
+ * half of them. */
+
+FlMessageQueue *fl_message_queue_new         (void);
+
+void            fl_message_queue_set_limits  (FlMessageQueue *queue, gsize max_bytes, guint max_messages);
+
+void            fl_message_queue_set_batched (FlMessageQueue *queue, const gchar *channel, gboolean batched);
+
+gboolean        fl_message_queue_push        (FlMessageQueue *queue, const gchar *channel, GBytes *message, FlViewMessagePriority priority, FlViewResponseCallback callback, gpointer user_data);
+
+/* Called from the main thread, messages are held while @engine is NULL */
+
+void            fl_message_queue_set_engine  (FlMessageQueue *queue, FlutterEngine engine, guint64 frame_interval);
+
+G_END_DECLS
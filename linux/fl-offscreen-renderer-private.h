@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include "embedder.h"
+#include "fl-offscreen-renderer.h"
+
+G_BEGIN_DECLS
+
+/* Functions used by other parts of the embedder, not for applications */
+
+void fl_offscreen_renderer_send_pointer_event    (FlOffscreenRenderer *renderer, const FlutterPointerEvent *event);
+
+void fl_offscreen_renderer_send_platform_message (FlOffscreenRenderer *renderer, const FlutterPlatformMessage *message);
+
+G_END_DECLS
@@ -0,0 +1,523 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include "embedder.h"
+#include "fl-engine-result.h"
+#include "fl-offscreen-renderer-private.h"
+#include "fl-renderer.h"
+
+struct _FlOffscreenRenderer
+{
+    GObject parent_instance;
+
+    gchar *assets_path;
+    gchar *icu_data_path;
+
+    // Render with the CPU rather than EGL.
+    gboolean use_software;
+
+    // Requested size, read from the raster thread.
+    gint width;
+    gint height;
+
+    EGLDisplay egl_display;
+    EGLContext egl_context;
+
+    // Only used when the context can't be made current without a surface.
+    EGLSurface egl_surface;
+
+    // Rendered into by the engine, only used from the raster thread.
+    GLuint texture;
+    GLuint framebuffer;
+    gint framebuffer_width;
+    gint framebuffer_height;
+
+    // Frame being filled by the raster thread.
+    guint8 *back_pixels;
+    gsize back_pixels_size;
+
+    // Protects the fields below.
+    GMutex mutex;
+    GCond cond;
+
+    // Last frame completed, bottom-up RGBA if read from GL, otherwise in Cairo's format.
+    guint8 *pixels;
+    gsize pixels_size;
+    gint pixels_width;
+    gint pixels_height;
+    gint pixels_stride;
+    gboolean pixels_from_gl;
+
+    // Frames completed, and the number completed when one was last copied out.
+    guint64 frame_count;
+    guint64 frames_taken;
+
+    FlutterEngine engine;
+};
+
+G_DEFINE_TYPE (FlOffscreenRenderer, fl_offscreen_renderer, G_TYPE_OBJECT)
+
+static gboolean
+has_extension (const gchar *extensions, const gchar *name)
+{
+    return extensions != NULL && strstr (extensions, name) != NULL;
+}
+
+// All renderers share one display, as terminating it would break the others.
+static gpointer
+create_display (gpointer data)
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLint major, minor;
+
+    // Avoid needing a window system where Mesa allows it.
+    const gchar *client_extensions = eglQueryString (EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (has_extension (client_extensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress ("eglGetPlatformDisplayEXT");
+        if (get_platform_display != NULL)
+            display = get_platform_display (EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay (EGL_DEFAULT_DISPLAY);
+
+    if (!eglInitialize (display, &major, &minor)) {
+        g_warning ("Failed to initialize EGL for offscreen rendering");
+        return EGL_NO_DISPLAY;
+    }
+    eglBindAPI (EGL_OPENGL_ES_API);
+
+    return display;
+}
+
+static EGLDisplay
+get_display (void)
+{
+    static GOnce once = G_ONCE_INIT;
+    return g_once (&once, create_display, NULL);
+}
+
+static gboolean
+fl_offscreen_renderer_create_context (FlOffscreenRenderer *self)
+{
+    EGLConfig config;
+    EGLint n_config;
+    EGLint attributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+                            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                            EGL_RED_SIZE, 8,
+                            EGL_GREEN_SIZE, 8,
+                            EGL_BLUE_SIZE, 8,
+                            EGL_ALPHA_SIZE, 8,
+                            EGL_NONE };
+    EGLint context_attributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2,
+                                    EGL_NONE };
+
+    self->egl_display = get_display ();
+    if (self->egl_display == EGL_NO_DISPLAY)
+        return FALSE;
+
+    if (!eglChooseConfig (self->egl_display, attributes, &config, 1, &n_config) || n_config == 0) {
+        g_warning ("Failed to find EGL config for offscreen rendering");
+        return FALSE;
+    }
+    self->egl_context = eglCreateContext (self->egl_display, config, EGL_NO_CONTEXT, context_attributes);
+    if (self->egl_context == EGL_NO_CONTEXT) {
+        g_warning ("Failed to create EGL context for offscreen rendering");
+        return FALSE;
+    }
+
+    // Frames are rendered into a framebuffer object, a surface is only needed
+    // to make the context current.
+    if (!has_extension (eglQueryString (self->egl_display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        EGLint pbuffer_attributes[] = { EGL_WIDTH, 1,
+                                        EGL_HEIGHT, 1,
+                                        EGL_NONE };
+        self->egl_surface = eglCreatePbufferSurface (self->egl_display, config, pbuffer_attributes);
+        if (self->egl_surface == EGL_NO_SURFACE) {
+            g_warning ("Failed to create EGL pbuffer for offscreen rendering");
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static void
+fl_offscreen_renderer_destroy_context (FlOffscreenRenderer *self)
+{
+    // The framebuffer and texture go with the context.
+    if (self->egl_context != EGL_NO_CONTEXT) {
+        eglDestroyContext (self->egl_display, self->egl_context);
+        self->egl_context = EGL_NO_CONTEXT;
+    }
+    if (self->egl_surface != EGL_NO_SURFACE) {
+        eglDestroySurface (self->egl_display, self->egl_surface);
+        self->egl_surface = EGL_NO_SURFACE;
+    }
+    self->texture = 0;
+    self->framebuffer = 0;
+}
+
+// Make the frame in @back_pixels the latest one and wake up waiters.
+static void
+fl_offscreen_renderer_complete_frame (FlOffscreenRenderer *self, gint width, gint height, gint stride, gboolean from_gl)
+{
+    g_mutex_lock (&self->mutex);
+    guint8 *pixels = self->pixels;
+    gsize pixels_size = self->pixels_size;
+    self->pixels = self->back_pixels;
+    self->pixels_size = self->back_pixels_size;
+    self->pixels_width = width;
+    self->pixels_height = height;
+    self->pixels_stride = stride;
+    self->pixels_from_gl = from_gl;
+    self->frame_count++;
+    g_cond_broadcast (&self->cond);
+    g_mutex_unlock (&self->mutex);
+
+    self->back_pixels = pixels;
+    self->back_pixels_size = pixels_size;
+}
+
+static void
+ensure_back_pixels (FlOffscreenRenderer *self, gsize size)
+{
+    if (self->back_pixels_size >= size)
+        return;
+    g_free (self->back_pixels);
+    self->back_pixels = g_malloc (size);
+    self->back_pixels_size = size;
+}
+
+// FIXME: Called from Flutter thread
+static bool
+fl_offscreen_renderer_gl_make_current (void *user_data)
+{
+    FlOffscreenRenderer *self = user_data;
+    return eglMakeCurrent (self->egl_display, self->egl_surface, self->egl_surface, self->egl_context);
+}
+
+// FIXME: Called from Flutter thread
+static bool
+fl_offscreen_renderer_gl_clear_current (void *user_data)
+{
+    FlOffscreenRenderer *self = user_data;
+    return eglMakeCurrent (self->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+// FIXME: Called from Flutter thread
+static uint32_t
+fl_offscreen_renderer_gl_fbo_callback (void *user_data)
+{
+    FlOffscreenRenderer *self = user_data;
+    gint width = g_atomic_int_get (&self->width);
+    gint height = g_atomic_int_get (&self->height);
+
+    if (self->framebuffer != 0 && self->framebuffer_width == width && self->framebuffer_height == height)
+        return self->framebuffer;
+
+    // Restore the bindings afterwards, the renderer tracks its GL state.
+    GLint old_texture, old_framebuffer;
+    glGetIntegerv (GL_TEXTURE_BINDING_2D, &old_texture);
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+
+    if (self->framebuffer == 0) {
+        glGenTextures (1, &self->texture);
+        glGenFramebuffers (1, &self->framebuffer);
+    }
+    glBindTexture (GL_TEXTURE_2D, self->texture);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindFramebuffer (GL_FRAMEBUFFER, self->framebuffer);
+    glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, self->texture, 0);
+
+    glBindTexture (GL_TEXTURE_2D, old_texture);
+    glBindFramebuffer (GL_FRAMEBUFFER, old_framebuffer);
+
+    self->framebuffer_width = width;
+    self->framebuffer_height = height;
+
+    return self->framebuffer;
+}
+
+// FIXME: Called from Flutter thread
+static bool
+fl_offscreen_renderer_gl_present (void *user_data)
+{
+    FlOffscreenRenderer *self = user_data;
+    gint width = self->framebuffer_width, height = self->framebuffer_height;
+
+    ensure_back_pixels (self, (gsize) width * height * 4);
+
+    GLint old_framebuffer;
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+    glBindFramebuffer (GL_FRAMEBUFFER, self->framebuffer);
+    glReadPixels (0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, self->back_pixels);
+    glBindFramebuffer (GL_FRAMEBUFFER, old_framebuffer);
+
+    fl_offscreen_renderer_complete_frame (self, width, height, width * 4, TRUE);
+
+    return true;
+}
+
+static void *
+fl_offscreen_renderer_gl_proc_resolver (void *user_data, const char *name)
+{
+    return eglGetProcAddress (name);
+}
+
+// FIXME: Called from Flutter thread
+static bool
+fl_offscreen_renderer_software_present (void *user_data, const void *allocation, size_t row_bytes, size_t height)
+{
+    FlOffscreenRenderer *self = user_data;
+
+    // Rows may be padded beyond the requested width.
+    gint width = MIN ((gint) (row_bytes / 4), g_atomic_int_get (&self->width));
+
+    // Skia's native format on little-endian matches Cairo's.
+    ensure_back_pixels (self, row_bytes * height);
+    memcpy (self->back_pixels, allocation, row_bytes * height);
+    fl_offscreen_renderer_complete_frame (self, width, height, row_bytes, FALSE);
+
+    return true;
+}
+
+static void
+fl_offscreen_renderer_send_window_metrics (FlOffscreenRenderer *self)
+{
+    FlutterWindowMetricsEvent event = {};
+    event.struct_size = sizeof (FlutterWindowMetricsEvent);
+    event.width = self->width;
+    event.height = self->height;
+    event.pixel_ratio = 1;
+    FlutterEngineSendWindowMetricsEvent (self->engine, &event);
+}
+
+static void
+fl_offscreen_renderer_dispose (GObject *object)
+{
+    FlOffscreenRenderer *self = FL_OFFSCREEN_RENDERER (object);
+
+    if (self->engine != NULL) {
+        FlutterEngineResult result = FlutterEngineShutdown (self->engine);
+        if (result != kSuccess) {
+            g_autofree gchar *error = flutter_engine_result_to_string (result);
+            g_warning ("Failed to shutdown Flutter: %s", error);
+        }
+        self->engine = NULL;
+    }
+    fl_offscreen_renderer_destroy_context (self);
+    g_clear_pointer (&self->assets_path, g_free);
+    g_clear_pointer (&self->icu_data_path, g_free);
+    g_clear_pointer (&self->pixels, g_free);
+    g_clear_pointer (&self->back_pixels, g_free);
+    self->pixels_size = 0;
+    self->back_pixels_size = 0;
+
+    G_OBJECT_CLASS (fl_offscreen_renderer_parent_class)->dispose (object);
+}
+
+static void
+fl_offscreen_renderer_finalize (GObject *object)
+{
+    FlOffscreenRenderer *self = FL_OFFSCREEN_RENDERER (object);
+
+    g_mutex_clear (&self->mutex);
+    g_cond_clear (&self->cond);
+
+    G_OBJECT_CLASS (fl_offscreen_renderer_parent_class)->finalize (object);
+}
+
+static void
+fl_offscreen_renderer_class_init (FlOffscreenRendererClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_offscreen_renderer_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_offscreen_renderer_finalize;
+}
+
+static void
+fl_offscreen_renderer_init (FlOffscreenRenderer *self)
+{
+    g_mutex_init (&self->mutex);
+    g_cond_init (&self->cond);
+    self->egl_display = EGL_NO_DISPLAY;
+    self->egl_context = EGL_NO_CONTEXT;
+    self->egl_surface = EGL_NO_SURFACE;
+}
+
+FlOffscreenRenderer *
+fl_offscreen_renderer_new (gint width, gint height)
+{
+    FlOffscreenRenderer *self = g_object_new (fl_offscreen_renderer_get_type (), NULL);
+
+    self->width = width;
+    self->height = height;
+
+    return self;
+}
+
+void
+fl_offscreen_renderer_set_assets_path (FlOffscreenRenderer *self, const gchar *assets_path)
+{
+    g_return_if_fail (FL_IS_OFFSCREEN_RENDERER (self));
+
+    g_free (self->assets_path);
+    self->assets_path = g_strdup (assets_path);
+}
+
+void
+fl_offscreen_renderer_set_icu_data_path (FlOffscreenRenderer *self, const gchar *icu_data_path)
+{
+    g_return_if_fail (FL_IS_OFFSCREEN_RENDERER (self));
+
+    g_free (self->icu_data_path);
+    self->icu_data_path = g_strdup (icu_data_path);
+}
+
+void
+fl_offscreen_renderer_set_use_software (FlOffscreenRenderer *self, gboolean use_software)
+{
+    g_return_if_fail (FL_IS_OFFSCREEN_RENDERER (self));
+    g_return_if_fail (self->engine == NULL);
+
+    self->use_software = use_software;
+}
+
+gboolean
+fl_offscreen_renderer_start (FlOffscreenRenderer *self)
+{
+    FlutterRendererConfig config = { 0 };
+    FlutterProjectArgs args = { 0 };
+
+    g_return_val_if_fail (FL_IS_OFFSCREEN_RENDERER (self), FALSE);
+    g_return_val_if_fail (self->engine == NULL, FALSE);
+
+    // Fall back to the CPU if there's no usable GL.
+    if (!self->use_software && !fl_offscreen_renderer_create_context (self)) {
+        g_warning ("Falling back to software rendering");
+        fl_offscreen_renderer_destroy_context (self);
+        self->use_software = TRUE;
+    }
+
+    if (self->use_software) {
+        config.type = kSoftware;
+        config.software.struct_size = sizeof (FlutterSoftwareRendererConfig);
+        config.software.surface_present_callback = fl_offscreen_renderer_software_present;
+    } else {
+        config.type = kOpenGL;
+        config.open_gl.struct_size = sizeof (FlutterOpenGLRendererConfig);
+        config.open_gl.make_current = fl_offscreen_renderer_gl_make_current;
+        config.open_gl.clear_current = fl_offscreen_renderer_gl_clear_current;
+        config.open_gl.present = fl_offscreen_renderer_gl_present;
+        config.open_gl.fbo_callback = fl_offscreen_renderer_gl_fbo_callback;
+        config.open_gl.gl_proc_resolver = fl_offscreen_renderer_gl_proc_resolver;
+    }
+    args.struct_size = sizeof (FlutterProjectArgs);
+    args.assets_path = self->assets_path;
+    args.icu_data_path = self->icu_data_path;
+
+    FlutterEngineResult result = FlutterEngineInitialize (FLUTTER_ENGINE_VERSION, &config, &args, self, &self->engine);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to initialize Flutter: %s", error);
+        return FALSE;
+    }
+
+    result = FlutterEngineRunInitialized (self->engine);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to run Flutter: %s", error);
+        return FALSE;
+    }
+
+    fl_offscreen_renderer_send_window_metrics (self);
+
+    return TRUE;
+}
+
+void
+fl_offscreen_renderer_set_size (FlOffscreenRenderer *self, gint width, gint height)
+{
+    g_return_if_fail (FL_IS_OFFSCREEN_RENDERER (self));
+
+    g_atomic_int_set (&self->width, width);
+    g_atomic_int_set (&self->height, height);
+    if (self->engine != NULL)
+        fl_offscreen_renderer_send_window_metrics (self);
+}
+
+gboolean
+fl_offscreen_renderer_wait_for_frame (FlOffscreenRenderer *self, guint8 *buffer, gint stride, gint64 timeout)
+{
+    g_return_val_if_fail (FL_IS_OFFSCREEN_RENDERER (self), FALSE);
+
+    gint64 end_time = timeout >= 0 ? g_get_monotonic_time () + timeout : G_MAXINT64;
+
+    g_mutex_lock (&self->mutex);
+
+    // Frames drawn before a resize don't fit the caller's buffer.
+    while (self->frame_count == self->frames_taken ||
+           self->pixels_width != g_atomic_int_get (&self->width) ||
+           self->pixels_height != g_atomic_int_get (&self->height)) {
+        self->frames_taken = self->frame_count;
+        if (!g_cond_wait_until (&self->cond, &self->mutex, end_time)) {
+            g_mutex_unlock (&self->mutex);
+            return FALSE;
+        }
+    }
+
+    if (buffer != NULL && self->pixels_from_gl) {
+        fl_renderer_convert_pixels (self->pixels, self->pixels_width, self->pixels_height, buffer, stride);
+    } else if (buffer != NULL) {
+        for (gint y = 0; y < self->pixels_height; y++)
+            memcpy (buffer + (gsize) y * stride, self->pixels + (gsize) y * self->pixels_stride, (gsize) self->pixels_width * 4);
+    }
+    self->frames_taken = self->frame_count;
+
+    g_mutex_unlock (&self->mutex);
+
+    return TRUE;
+}
+
+void
+fl_offscreen_renderer_send_pointer_event (FlOffscreenRenderer *self, const FlutterPointerEvent *event)
+{
+    g_return_if_fail (FL_IS_OFFSCREEN_RENDERER (self));
+
+    if (self->engine == NULL)
+        return;
+
+    FlutterEngineResult result = FlutterEngineSendPointerEvent (self->engine, event, 1);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to send pointer event: %s", error);
+    }
+}
+
+void
+fl_offscreen_renderer_send_platform_message (FlOffscreenRenderer *self, const FlutterPlatformMessage *message)
+{
+    g_return_if_fail (FL_IS_OFFSCREEN_RENDERER (self));
+
+    if (self->engine == NULL)
+        return;
+
+    FlutterEngineResult result = FlutterEngineSendPlatformMessage (self->engine, message);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to send message on %s: %s", message->channel, error);
+    }
+}
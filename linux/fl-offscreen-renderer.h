@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlOffscreenRenderer, fl_offscreen_renderer, FL, OFFSCREEN_RENDERER, GObject)
+
+/* Runs an engine without a window, rendering frames into memory. Frames are
+ * copied out in Cairo's ARGB32 format, top-down and premultiplied. Renderers
+ * are independent of each other and may be used from any thread. */
+
+FlOffscreenRenderer *fl_offscreen_renderer_new               (gint width, gint height);
+
+void                 fl_offscreen_renderer_set_assets_path   (FlOffscreenRenderer *renderer, const gchar *assets_path);
+
+void                 fl_offscreen_renderer_set_icu_data_path (FlOffscreenRenderer *renderer, const gchar *icu_data_path);
+
+void                 fl_offscreen_renderer_set_use_software  (FlOffscreenRenderer *renderer, gboolean use_software);
+
+gboolean             fl_offscreen_renderer_start             (FlOffscreenRenderer *renderer);
+
+void                 fl_offscreen_renderer_set_size          (FlOffscreenRenderer *renderer, gint width, gint height);
+
+/* Waits for the next frame at the current size and copies it into @buffer, or
+ * only waits if @buffer is NULL */
+
+gboolean             fl_offscreen_renderer_wait_for_frame    (FlOffscreenRenderer *renderer, guint8 *buffer, gint stride, gint64 timeout);
+
+G_END_DECLS
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <GLES3/gl3.h>
+
+#include "fl-pixel-readback.h"
+
+// Time to wait for a copy when asked to, in nanoseconds.
+#define WAIT_TIMEOUT G_GUINT64_CONSTANT (1000000000)
+
+typedef enum
+{
+    GL_SUPPORT_UNKNOWN,
+    GL_SUPPORT_SYNCHRONOUS,
+    GL_SUPPORT_PIXEL_BUFFERS
+} GLSupport;
+
+typedef struct
+{
+    // Pixel pack buffer the GPU copies into.
+    GLuint buffer;
+    gsize buffer_size;
+
+    // Signalled once the copy completes, NULL if read synchronously.
+    GLsync fence;
+
+    // Pixels read synchronously, without pixel buffer support.
+    guint8 *pixels;
+    gsize pixels_size;
+
+    gsize length;
+    gpointer data;
+} Readback;
+
+struct _FlPixelReadback
+{
+    GObject parent_instance;
+
+    GLSupport gl_support;
+    Readback *readbacks;
+    guint n_readbacks;
+
+    // Oldest copy in flight, and how many there are.
+    guint first;
+    guint n_in_flight;
+};
+
+G_DEFINE_TYPE (FlPixelReadback, fl_pixel_readback, G_TYPE_OBJECT)
+
+// Pixel pack buffers and sync objects need GLES 3 or GL 3.2.
+static GLSupport
+detect_gl_support (void)
+{
+    const gchar *version = (const gchar *) glGetString (GL_VERSION);
+    gint major = 0, minor = 0;
+
+    if (version == NULL)
+        return GL_SUPPORT_SYNCHRONOUS;
+
+    if (g_str_has_prefix (version, "OpenGL ES ")) {
+        sscanf (version + strlen ("OpenGL ES "), "%d.%d", &major, &minor);
+        return major >= 3 ? GL_SUPPORT_PIXEL_BUFFERS : GL_SUPPORT_SYNCHRONOUS;
+    }
+
+    sscanf (version, "%d.%d", &major, &minor);
+    return major > 3 || (major == 3 && minor >= 2) ? GL_SUPPORT_PIXEL_BUFFERS : GL_SUPPORT_SYNCHRONOUS;
+}
+
+static Readback *
+pop_readback (FlPixelReadback *self)
+{
+    Readback *readback = &self->readbacks[self->first];
+    self->first = (self->first + 1) % self->n_readbacks;
+    g_atomic_int_add (&self->n_in_flight, -1);
+    return readback;
+}
+
+static void
+fl_pixel_readback_finalize (GObject *object)
+{
+    FlPixelReadback *self = FL_PIXEL_READBACK (object);
+
+    for (guint i = 0; i < self->n_readbacks; i++)
+        g_free (self->readbacks[i].pixels);
+    g_free (self->readbacks);
+
+    G_OBJECT_CLASS (fl_pixel_readback_parent_class)->finalize (object);
+}
+
+static void
+fl_pixel_readback_class_init (FlPixelReadbackClass *klass)
+{
+    G_OBJECT_CLASS (klass)->finalize = fl_pixel_readback_finalize;
+}
+
+static void
+fl_pixel_readback_init (FlPixelReadback *self)
+{
+}
+
+FlPixelReadback *
+fl_pixel_readback_new (guint n_buffers)
+{
+    g_return_val_if_fail (n_buffers > 0, NULL);
+
+    FlPixelReadback *self = g_object_new (fl_pixel_readback_get_type (), NULL);
+
+    self->readbacks = g_new0 (Readback, n_buffers);
+    self->n_readbacks = n_buffers;
+
+    return self;
+}
+
+gboolean
+fl_pixel_readback_is_pending (FlPixelReadback *self)
+{
+    g_return_val_if_fail (FL_IS_PIXEL_READBACK (self), FALSE);
+
+    return g_atomic_int_get (&self->n_in_flight) > 0;
+}
+
+gboolean
+fl_pixel_readback_read (FlPixelReadback *self, guint32 framebuffer, const cairo_rectangle_int_t *rects, gint n_rects, gpointer data)
+{
+    g_return_val_if_fail (FL_IS_PIXEL_READBACK (self), FALSE);
+
+    if (self->gl_support == GL_SUPPORT_UNKNOWN) {
+        self->gl_support = detect_gl_support ();
+        if (self->gl_support == GL_SUPPORT_SYNCHRONOUS)
+            g_warning ("Pixel buffers not supported, frames will be read synchronously");
+    }
+
+    if (self->n_in_flight == self->n_readbacks)
+        return FALSE;
+    Readback *readback = &self->readbacks[(self->first + self->n_in_flight) % self->n_readbacks];
+
+    gsize length = 0;
+    for (gint i = 0; i < n_rects; i++)
+        length += (gsize) rects[i].width * rects[i].height * 4;
+
+    // Restore the bindings afterwards, the renderer tracks its GL state.
+    GLint old_framebuffer;
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+    glBindFramebuffer (GL_FRAMEBUFFER, framebuffer);
+
+    if (self->gl_support == GL_SUPPORT_PIXEL_BUFFERS) {
+        GLint old_buffer;
+        glGetIntegerv (GL_PIXEL_PACK_BUFFER_BINDING, &old_buffer);
+        if (readback->buffer == 0)
+            glGenBuffers (1, &readback->buffer);
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, readback->buffer);
+        if (readback->buffer_size < length) {
+            glBufferData (GL_PIXEL_PACK_BUFFER, length, NULL, GL_STREAM_READ);
+            readback->buffer_size = length;
+        }
+
+        // Queues the copies on the GPU, the pixels are picked up once the fence signals.
+        gsize offset = 0;
+        for (gint i = 0; i < n_rects; i++) {
+            glReadPixels (rects[i].x, rects[i].y, rects[i].width, rects[i].height, GL_RGBA, GL_UNSIGNED_BYTE, GSIZE_TO_POINTER (offset));
+            offset += (gsize) rects[i].width * rects[i].height * 4;
+        }
+        readback->fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, old_buffer);
+    } else {
+        if (readback->pixels_size < length) {
+            g_free (readback->pixels);
+            readback->pixels = g_malloc (length);
+            readback->pixels_size = length;
+        }
+
+        gsize offset = 0;
+        for (gint i = 0; i < n_rects; i++) {
+            glReadPixels (rects[i].x, rects[i].y, rects[i].width, rects[i].height, GL_RGBA, GL_UNSIGNED_BYTE, readback->pixels + offset);
+            offset += (gsize) rects[i].width * rects[i].height * 4;
+        }
+    }
+
+    glBindFramebuffer (GL_FRAMEBUFFER, old_framebuffer);
+
+    readback->length = length;
+    readback->data = data;
+    g_atomic_int_inc (&self->n_in_flight);
+
+    return TRUE;
+}
+
+void
+fl_pixel_readback_poll (FlPixelReadback *self, gboolean wait, FlPixelReadbackCallback callback, gpointer user_data)
+{
+    g_return_if_fail (FL_IS_PIXEL_READBACK (self));
+
+    while (self->n_in_flight > 0) {
+        Readback *readback = &self->readbacks[self->first];
+
+        if (readback->fence == NULL) {
+            pop_readback (self);
+            callback (readback->pixels, readback->length, readback->data, user_data);
+            continue;
+        }
+
+        // Copies finish in order, so the rest can't be ready either.
+        GLenum status = glClientWaitSync (readback->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? WAIT_TIMEOUT : 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            if (!wait)
+                return;
+            g_warning ("Timed out reading back pixels");
+        }
+        glDeleteSync (readback->fence);
+        readback->fence = NULL;
+
+        GLint old_buffer;
+        glGetIntegerv (GL_PIXEL_PACK_BUFFER_BINDING, &old_buffer);
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, readback->buffer);
+        const guint8 *pixels = glMapBufferRange (GL_PIXEL_PACK_BUFFER, 0, readback->length, GL_MAP_READ_BIT);
+        pop_readback (self);
+        callback (pixels, readback->length, readback->data, user_data);
+        if (pixels != NULL)
+            glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+        glBindBuffer (GL_PIXEL_PACK_BUFFER, old_buffer);
+    }
+}
+
+void
+fl_pixel_readback_release (FlPixelReadback *self, FlPixelReadbackCallback callback, gpointer user_data)
+{
+    g_return_if_fail (FL_IS_PIXEL_READBACK (self));
+
+    fl_pixel_readback_poll (self, TRUE, callback, user_data);
+
+    for (guint i = 0; i < self->n_readbacks; i++) {
+        Readback *readback = &self->readbacks[i];
+        if (readback->buffer != 0)
+            glDeleteBuffers (1, &readback->buffer);
+        readback->buffer = 0;
+        readback->buffer_size = 0;
+    }
+    self->gl_support = GL_SUPPORT_UNKNOWN;
+}
+
+void
+fl_pixel_readback_reset (FlPixelReadback *self, FlPixelReadbackCallback callback, gpointer user_data)
+{
+    g_return_if_fail (FL_IS_PIXEL_READBACK (self));
+
+    // The buffers and fences went with the context.
+    while (self->n_in_flight > 0) {
+        Readback *readback = pop_readback (self);
+        callback (NULL, 0, readback->data, user_data);
+    }
+    for (guint i = 0; i < self->n_readbacks; i++) {
+        Readback *readback = &self->readbacks[i];
+        readback->buffer = 0;
+        readback->buffer_size = 0;
+        readback->fence = NULL;
+    }
+    self->first = 0;
+    self->gl_support = GL_SUPPORT_UNKNOWN;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlPixelReadback, fl_pixel_readback, FL, PIXEL_READBACK, GObject)
+
+/* Called with the pixels of one fl_pixel_readback_read(), each rectangle in
+ * turn as bottom-up RGBA rows with no padding. @pixels is only valid for the
+ * call, and is NULL if the copy was lost with the context. */
+typedef void (*FlPixelReadbackCallback) (const guint8 *pixels, gsize length, gpointer data, gpointer user_data);
+
+/* Reads areas of framebuffers back through a ring of pixel pack buffers, so the
+ * raster thread doesn't wait for the GPU. Copies are handed back in the order
+ * they were queued. Without pixel buffer support (GLES 2, GL < 3.2) pixels are
+ * read straight away. */
+
+FlPixelReadback *fl_pixel_readback_new        (guint n_buffers);
+
+/* Called from any thread */
+
+gboolean         fl_pixel_readback_is_pending (FlPixelReadback *readback);
+
+/* Called from the raster thread with the context current. Rectangles are in
+ * GL's bottom-up coordinates. Returns FALSE if every buffer is in flight. */
+
+gboolean         fl_pixel_readback_read       (FlPixelReadback *readback, guint32 framebuffer, const cairo_rectangle_int_t *rects, gint n_rects, gpointer data);
+
+/* Hands finished copies to @callback, waiting for the GPU only if @wait */
+
+void             fl_pixel_readback_poll       (FlPixelReadback *readback, gboolean wait, FlPixelReadbackCallback callback, gpointer user_data);
+
+/* Called from the raster thread with the context current, once no more are
+ * read. Copies in flight are waited for and the buffers deleted. */
+
+void             fl_pixel_readback_release    (FlPixelReadback *readback, FlPixelReadbackCallback callback, gpointer user_data);
+
+/* Called once the context has been destroyed, copies in flight are handed back
+ * with no pixels */
+
+void             fl_pixel_readback_reset      (FlPixelReadback *readback, FlPixelReadbackCallback callback, gpointer user_data);
+
+G_END_DECLS
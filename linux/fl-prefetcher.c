@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fl-prefetcher.h"
+
+// First line of a manifest. Each line after it is a range of a file:
+// "<mtime in ns> <file size> <offset> <length> <path>"
+#define MANIFEST_HEADER "# fl-prefetch 1\n"
+
+struct _FlPrefetcher
+{
+    GObject parent_instance;
+
+    // Protects the fields below.
+    GMutex mutex;
+    GCond cond;
+
+    // Manifests being replayed.
+    guint n_replaying;
+
+    // Assets paths whose manifest was replayed in full this launch.
+    GHashTable *replayed;
+};
+
+G_DEFINE_TYPE (FlPrefetcher, fl_prefetcher, G_TYPE_OBJECT)
+
+typedef struct
+{
+    guint64 offset;
+    guint64 length;
+} Range;
+
+typedef struct
+{
+    gchar *path;
+    guint64 inode;
+    gint64 mtime;
+    guint64 size;
+    GArray *ranges;
+} FileRecord;
+
+typedef struct
+{
+    FlPrefetcher *prefetcher;
+    gchar *key;
+    GStrv paths;
+} Job;
+
+static void
+file_record_free (FileRecord *record)
+{
+    g_free (record->path);
+    g_array_unref (record->ranges);
+    g_free (record);
+}
+
+static void
+job_free (Job *job)
+{
+    g_object_unref (job->prefetcher);
+    g_free (job->key);
+    g_strfreev (job->paths);
+    g_free (job);
+}
+
+static gint64
+get_mtime (const struct stat *stat_buffer)
+{
+    return (gint64) stat_buffer->st_mtim.tv_sec * 1000000000 + stat_buffer->st_mtim.tv_nsec;
+}
+
+// Manifests are keyed by where the assets are, wherever the program is run from.
+static gchar *
+get_key (const gchar *assets_path)
+{
+    return g_canonicalize_filename (assets_path, NULL);
+}
+
+static gchar *
+get_manifest_path (const gchar *key)
+{
+    g_autofree gchar *checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+    g_autofree gchar *name = g_strdup_printf ("prefetch-%s", checksum);
+    return g_build_filename (g_get_user_cache_dir (), "flutter", name, NULL);
+}
+
+// Read a range into the page cache, waiting for it so reads are issued in manifest order.
+static void
+prefetch_range (gint fd, guint64 offset, guint64 length)
+{
+    if (readahead (fd, offset, length) == 0)
+        return;
+
+    // Not supported on this file system, ask for it without waiting.
+    posix_fadvise (fd, offset, length, POSIX_FADV_WILLNEED);
+}
+
+static gpointer
+replay_thread (gpointer user_data)
+{
+    Job *job = user_data;
+    FlPrefetcher *self = job->prefetcher;
+    g_autofree gchar *manifest_path = get_manifest_path (job->key);
+    g_autofree gchar *contents = NULL;
+    gboolean up_to_date = FALSE;
+
+    if (g_file_get_contents (manifest_path, &contents, NULL, NULL) && g_str_has_prefix (contents, MANIFEST_HEADER)) {
+        g_autofree gchar *current_path = NULL;
+        gint fd = -1;
+        gboolean file_matches = FALSE;
+        guint n_ranges = 0;
+
+        up_to_date = TRUE;
+        gchar *line = contents + strlen (MANIFEST_HEADER);
+        while (*line != '\0') {
+            gchar *end = strchr (line, '\n');
+            if (end == NULL)
+                break;
+            *end = '\0';
+
+            gint64 mtime;
+            guint64 size, offset, length;
+            int path_offset = 0;
+            if (sscanf (line, "%" G_GINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %n",
+                        &mtime, &size, &offset, &length, &path_offset) != 4 || path_offset == 0) {
+                up_to_date = FALSE;
+                break;
+            }
+            const gchar *path = line + path_offset;
+
+            if (g_strcmp0 (path, current_path) != 0) {
+                if (fd >= 0)
+                    close (fd);
+                g_free (current_path);
+                current_path = g_strdup (path);
+
+                struct stat stat_buffer;
+                fd = open (path, O_RDONLY | O_CLOEXEC);
+                file_matches = fd >= 0 && fstat (fd, &stat_buffer) == 0 &&
+                               get_mtime (&stat_buffer) == mtime && (guint64) stat_buffer.st_size == size;
+
+                // Changed since it was recorded, the ranges needed are likely to have moved.
+                if (!file_matches)
+                    up_to_date = FALSE;
+            }
+
+            if (file_matches) {
+                prefetch_range (fd, offset, length);
+                n_ranges++;
+            }
+            line = end + 1;
+        }
+        if (fd >= 0)
+            close (fd);
+
+        g_debug ("Prefetched %u ranges from %s", n_ranges, manifest_path);
+    }
+
+    g_mutex_lock (&self->mutex);
+    if (up_to_date)
+        g_hash_table_add (self->replayed, g_strdup (job->key));
+    self->n_replaying--;
+    g_cond_broadcast (&self->cond);
+    g_mutex_unlock (&self->mutex);
+
+    job_free (job);
+
+    return NULL;
+}
+
+static void
+record_file (GPtrArray *records, const gchar *path)
+{
+    gint fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    struct stat stat_buffer;
+    if (fstat (fd, &stat_buffer) < 0 || !S_ISREG (stat_buffer.st_mode) || stat_buffer.st_size == 0) {
+        close (fd);
+        return;
+    }
+
+    // Mapping the file doesn't read it, mincore() reports what is in the page cache.
+    gsize size = stat_buffer.st_size;
+    gpointer address = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (address == MAP_FAILED)
+        return;
+
+    gsize page_size = sysconf (_SC_PAGESIZE);
+    gsize n_pages = (size + page_size - 1) / page_size;
+    g_autofree unsigned char *resident = g_malloc (n_pages);
+    if (mincore (address, size, resident) < 0) {
+        munmap (address, size);
+        return;
+    }
+    munmap (address, size);
+
+    FileRecord *record = g_new0 (FileRecord, 1);
+    record->path = g_strdup (path);
+    record->inode = stat_buffer.st_ino;
+    record->mtime = get_mtime (&stat_buffer);
+    record->size = size;
+    record->ranges = g_array_new (FALSE, FALSE, sizeof (Range));
+    for (gsize i = 0; i < n_pages;) {
+        if (!(resident[i] & 1)) {
+            i++;
+            continue;
+        }
+
+        gsize start = i;
+        while (i < n_pages && (resident[i] & 1))
+            i++;
+        Range range = { start * page_size, MIN ((i - start) * page_size, size - start * page_size) };
+        g_array_append_val (record->ranges, range);
+    }
+
+    if (record->ranges->len > 0)
+        g_ptr_array_add (records, record);
+    else
+        file_record_free (record);
+}
+
+static void
+record_path (GPtrArray *records, const gchar *path)
+{
+    if (!g_file_test (path, G_FILE_TEST_IS_DIR)) {
+        record_file (records, path);
+        return;
+    }
+
+    g_autoptr(GDir) dir = g_dir_open (path, 0, NULL);
+    if (dir == NULL)
+        return;
+
+    const gchar *name;
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        g_autofree gchar *child_path = g_build_filename (path, name, NULL);
+        record_path (records, child_path);
+    }
+}
+
+// Files are read in inode order, which is roughly their order on disk.
+static gint
+compare_records (gconstpointer a, gconstpointer b)
+{
+    const FileRecord *record_a = *(const FileRecord **) a;
+    const FileRecord *record_b = *(const FileRecord **) b;
+
+    return record_a->inode < record_b->inode ? -1 : record_a->inode > record_b->inode ? 1 : 0;
+}
+
+static gpointer
+record_thread (gpointer user_data)
+{
+    Job *job = user_data;
+    FlPrefetcher *self = job->prefetcher;
+
+    // A manifest that was replayed would record what it prefetched rather than what was used.
+    g_mutex_lock (&self->mutex);
+    while (self->n_replaying > 0)
+        g_cond_wait (&self->cond, &self->mutex);
+    gboolean replayed = g_hash_table_contains (self->replayed, job->key);
+    g_mutex_unlock (&self->mutex);
+    if (replayed) {
+        job_free (job);
+        return NULL;
+    }
+
+    g_autoptr(GPtrArray) records = g_ptr_array_new_with_free_func ((GDestroyNotify) file_record_free);
+    for (gchar **path = job->paths; *path != NULL; path++) {
+        g_autofree gchar *absolute_path = g_canonicalize_filename (*path, NULL);
+        record_path (records, absolute_path);
+    }
+    g_ptr_array_sort (records, compare_records);
+
+    g_autoptr(GString) manifest = g_string_new (MANIFEST_HEADER);
+    for (guint i = 0; i < records->len; i++) {
+        FileRecord *record = g_ptr_array_index (records, i);
+        for (guint j = 0; j < record->ranges->len; j++) {
+            Range *range = &g_array_index (record->ranges, Range, j);
+            g_string_append_printf (manifest, "%" G_GINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %s\n",
+                                    record->mtime, record->size, range->offset, range->length, record->path);
+        }
+    }
+
+    g_autofree gchar *manifest_path = get_manifest_path (job->key);
+    g_autofree gchar *manifest_dir = g_path_get_dirname (manifest_path);
+    g_autoptr(GError) error = NULL;
+    if (g_mkdir_with_parents (manifest_dir, 0700) < 0)
+        g_warning ("Failed to create %s: %s", manifest_dir, strerror (errno));
+    else if (!g_file_set_contents (manifest_path, manifest->str, manifest->len, &error))
+        g_warning ("Failed to write prefetch manifest: %s", error->message);
+    else
+        g_debug ("Recorded %u files to %s", records->len, manifest_path);
+
+    job_free (job);
+
+    return NULL;
+}
+
+static void
+fl_prefetcher_finalize (GObject *object)
+{
+    FlPrefetcher *self = FL_PREFETCHER (object);
+
+    g_mutex_clear (&self->mutex);
+    g_cond_clear (&self->cond);
+    g_hash_table_unref (self->replayed);
+
+    G_OBJECT_CLASS (fl_prefetcher_parent_class)->finalize (object);
+}
+
+static void
+fl_prefetcher_class_init (FlPrefetcherClass *klass)
+{
+    G_OBJECT_CLASS (klass)->finalize = fl_prefetcher_finalize;
+}
+
+static void
+fl_prefetcher_init (FlPrefetcher *self)
+{
+    g_mutex_init (&self->mutex);
+    g_cond_init (&self->cond);
+    self->replayed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+FlPrefetcher *
+fl_prefetcher_get_default (void)
+{
+    static FlPrefetcher *prefetcher = NULL;
+
+    if (prefetcher == NULL)
+        prefetcher = g_object_new (fl_prefetcher_get_type (), NULL);
+
+    return prefetcher;
+}
+
+void
+fl_prefetcher_start (FlPrefetcher *self, const gchar *assets_path)
+{
+    g_return_if_fail (FL_IS_PREFETCHER (self));
+    g_return_if_fail (assets_path != NULL);
+
+    Job *job = g_new0 (Job, 1);
+    job->prefetcher = g_object_ref (self);
+    job->key = get_key (assets_path);
+
+    g_mutex_lock (&self->mutex);
+    self->n_replaying++;
+    g_mutex_unlock (&self->mutex);
+
+    g_thread_unref (g_thread_new ("fl-prefetcher", replay_thread, job));
+}
+
+void
+fl_prefetcher_record (FlPrefetcher *self, const gchar *assets_path, const gchar * const *paths)
+{
+    g_return_if_fail (FL_IS_PREFETCHER (self));
+    g_return_if_fail (assets_path != NULL);
+    g_return_if_fail (paths != NULL);
+
+    Job *job = g_new0 (Job, 1);
+    job->prefetcher = g_object_ref (self);
+    job->key = get_key (assets_path);
+    job->paths = g_strdupv ((gchar **) paths);
+
+    g_thread_unref (g_thread_new ("fl-prefetcher", record_thread, job));
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlPrefetcher, fl_prefetcher, FL, PREFETCHER, GObject)
+
+/* Reads the parts of the asset files that were needed for the first frame of
+ * the last launch before the engine asks for them. The parts are recorded in
+ * a manifest in the user's cache directory, one for each assets path. */
+
+FlPrefetcher *fl_prefetcher_get_default (void);
+
+/* Starts reading the files in the manifest for @assets_path on a background
+ * thread, call as early as possible */
+
+void          fl_prefetcher_start       (FlPrefetcher *prefetcher, const gchar *assets_path);
+
+/* Records the parts of the files in @paths that are in the page cache as the
+ * manifest for @assets_path, from a background thread. Directories in @paths
+ * are recorded with everything in them. Does nothing if the manifest was
+ * replayed this launch and still matches the files. */
+
+void          fl_prefetcher_record      (FlPrefetcher *prefetcher, const gchar *assets_path, const gchar * const *paths);
+
+G_END_DECLS
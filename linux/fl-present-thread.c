@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include "fl-present-thread.h"
+
+// One buffer on screen and up to two queued or being rendered.
+#define N_BUFFERS 3
+
+static const gchar *vertex_shader_source =
+    "attribute vec2 position;\n"
+    "varying vec2 texcoord;\n"
+    "void main() {\n"
+    "  gl_Position = vec4(position, 0.0, 1.0);\n"
+    "  texcoord = position * 0.5 + 0.5;\n"
+    "}\n";
+
+static const gchar *fragment_shader_source =
+    "precision mediump float;\n"
+    "uniform sampler2D source;\n"
+    "varying vec2 texcoord;\n"
+    "void main() {\n"
+    "  gl_FragColor = texture2D(source, texcoord);\n"
+    "}\n";
+
+static const GLfloat quad_vertices[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+
+typedef struct
+{
+    GLuint texture;
+
+    // Framebuffer object in the rendering context, these are not shared.
+    GLuint framebuffer;
+
+    gint width;
+    gint height;
+
+    // Signalled when rendering into this buffer completes.
+    EGLSyncKHR fence;
+} Buffer;
+
+typedef enum
+{
+    COMMAND_PRESENT,
+    COMMAND_REPAINT,
+    COMMAND_READ_PIXELS,
+    COMMAND_QUIT
+} CommandType;
+
+typedef struct
+{
+    CommandType type;
+
+    // Buffer to present.
+    Buffer *buffer;
+
+    // Area to repaint.
+    cairo_region_t *damage;
+
+    // Result of reading pixels.
+    guint8 *pixels;
+    gint width;
+    gint height;
+    gboolean done;
+} Command;
+
+struct _FlPresentThread
+{
+    GObject parent_instance;
+
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+
+    PFNEGLCREATESYNCKHRPROC create_sync;
+    PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+    PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+    PFNEGLWAITSYNCKHRPROC wait_sync;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_buffers_with_damage;
+
+    GThread *thread;
+    GAsyncQueue *commands;
+
+    Buffer buffers[N_BUFFERS];
+    GAsyncQueue *free_buffers;
+
+    // Buffer being rendered into, only used from the rendering thread.
+    Buffer *current_buffer;
+
+    // Buffer on screen, only used from the present thread.
+    Buffer *displayed_buffer;
+
+    GLuint program;
+    GLint position_location;
+
+    // Protects the following and signals completed reads.
+    GMutex mutex;
+    GCond cond;
+    guint queue_depth;
+    guint64 frames_presented;
+    gint64 swap_time;
+    gsize buffer_size;
+};
+
+G_DEFINE_TYPE (FlPresentThread, fl_present_thread, G_TYPE_OBJECT)
+
+static gboolean
+has_extension (EGLDisplay display, const gchar *name)
+{
+    const gchar *extensions = eglQueryString (display, EGL_EXTENSIONS);
+    return extensions != NULL && strstr (extensions, name) != NULL;
+}
+
+static GLuint
+compile_shader (GLenum type, const gchar *source)
+{
+    GLuint shader = glCreateShader (type);
+    GLint status;
+
+    glShaderSource (shader, 1, &source, NULL);
+    glCompileShader (shader);
+    glGetShaderiv (shader, GL_COMPILE_STATUS, &status);
+    if (!status)
+        g_critical ("Failed to compile present shader");
+
+    return shader;
+}
+
+static void
+create_program (FlPresentThread *self)
+{
+    GLuint vertex_shader = compile_shader (GL_VERTEX_SHADER, vertex_shader_source);
+    GLuint fragment_shader = compile_shader (GL_FRAGMENT_SHADER, fragment_shader_source);
+    GLint status;
+
+    self->program = glCreateProgram ();
+    glAttachShader (self->program, vertex_shader);
+    glAttachShader (self->program, fragment_shader);
+    glLinkProgram (self->program);
+    glGetProgramiv (self->program, GL_LINK_STATUS, &status);
+    if (!status)
+        g_critical ("Failed to link present shader");
+    glDeleteShader (vertex_shader);
+    glDeleteShader (fragment_shader);
+
+    self->position_location = glGetAttribLocation (self->program, "position");
+}
+
+// Wait for rendering into a buffer to complete, on the GPU if possible.
+static void
+wait_for_buffer (FlPresentThread *self, Buffer *buffer)
+{
+    if (buffer->fence == EGL_NO_SYNC_KHR)
+        return;
+
+    if (self->wait_sync != NULL)
+        self->wait_sync (self->display, buffer->fence, 0);
+    else
+        self->client_wait_sync (self->display, buffer->fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+    self->destroy_sync (self->display, buffer->fence);
+    buffer->fence = EGL_NO_SYNC_KHR;
+}
+
+static void
+draw_buffer (FlPresentThread *self, Buffer *buffer)
+{
+    EGLint width, height;
+
+    eglQuerySurface (self->display, self->surface, EGL_WIDTH, &width);
+    eglQuerySurface (self->display, self->surface, EGL_HEIGHT, &height);
+
+    glBindFramebuffer (GL_FRAMEBUFFER, 0);
+    glViewport (0, 0, width, height);
+    glUseProgram (self->program);
+    glActiveTexture (GL_TEXTURE0);
+    glBindTexture (GL_TEXTURE_2D, buffer->texture);
+    glVertexAttribPointer (self->position_location, 2, GL_FLOAT, GL_FALSE, 0, quad_vertices);
+    glEnableVertexAttribArray (self->position_location);
+    glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+}
+
+static void
+swap_buffers (FlPresentThread *self, cairo_region_t *damage)
+{
+    EGLint height;
+
+    gint64 start_time = g_get_monotonic_time ();
+    if (damage != NULL && self->swap_buffers_with_damage != NULL &&
+        eglQuerySurface (self->display, self->surface, EGL_HEIGHT, &height)) {
+        // EGL rectangles have their origin at the bottom left.
+        gint n_rects = cairo_region_num_rectangles (damage);
+        g_autofree EGLint *rects = g_new (EGLint, n_rects * 4);
+        for (gint i = 0; i < n_rects; i++) {
+            cairo_rectangle_int_t rect;
+            cairo_region_get_rectangle (damage, i, &rect);
+            rects[i * 4] = rect.x;
+            rects[i * 4 + 1] = height - rect.y - rect.height;
+            rects[i * 4 + 2] = rect.width;
+            rects[i * 4 + 3] = rect.height;
+        }
+        self->swap_buffers_with_damage (self->display, self->surface, rects, n_rects);
+    } else if (!eglSwapBuffers (self->display, self->surface)) {
+        g_critical ("Failed to swap EGL buffers");
+    }
+    gint64 swap_time = g_get_monotonic_time () - start_time;
+
+    g_mutex_lock (&self->mutex);
+    self->swap_time += swap_time;
+    g_mutex_unlock (&self->mutex);
+}
+
+static void
+present (FlPresentThread *self, Buffer *buffer)
+{
+    wait_for_buffer (self, buffer);
+    draw_buffer (self, buffer);
+    swap_buffers (self, NULL);
+
+    // The previous frame is off screen now, so it can be rendered into again.
+    if (self->displayed_buffer != NULL)
+        g_async_queue_push (self->free_buffers, self->displayed_buffer);
+    self->displayed_buffer = buffer;
+
+    g_mutex_lock (&self->mutex);
+    self->queue_depth--;
+    self->frames_presented++;
+    g_mutex_unlock (&self->mutex);
+}
+
+static void
+read_pixels (FlPresentThread *self, Command *command)
+{
+    Buffer *buffer = self->displayed_buffer;
+
+    if (buffer != NULL) {
+        GLuint framebuffer;
+
+        glGenFramebuffers (1, &framebuffer);
+        glBindFramebuffer (GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, buffer->texture, 0);
+        command->pixels = g_malloc ((gsize) buffer->width * buffer->height * 4);
+        command->width = buffer->width;
+        command->height = buffer->height;
+        glReadPixels (0, 0, buffer->width, buffer->height, GL_RGBA, GL_UNSIGNED_BYTE, command->pixels);
+        glBindFramebuffer (GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers (1, &framebuffer);
+    }
+
+    g_mutex_lock (&self->mutex);
+    command->done = TRUE;
+    g_cond_broadcast (&self->cond);
+    g_mutex_unlock (&self->mutex);
+}
+
+static gpointer
+present_thread_func (gpointer user_data)
+{
+    FlPresentThread *self = user_data;
+    gboolean running = TRUE;
+
+    if (!eglMakeCurrent (self->display, self->surface, self->surface, self->context))
+        g_critical ("Failed to make EGL present context current");
+    create_program (self);
+
+    while (running) {
+        Command *command = g_async_queue_pop (self->commands);
+
+        switch (command->type)
+        {
+        case COMMAND_PRESENT:
+            present (self, command->buffer);
+            g_free (command);
+            break;
+        case COMMAND_REPAINT:
+            if (self->displayed_buffer != NULL) {
+                draw_buffer (self, self->displayed_buffer);
+                swap_buffers (self, command->damage);
+            }
+            cairo_region_destroy (command->damage);
+            g_free (command);
+            break;
+        case COMMAND_READ_PIXELS:
+            // Owned by the waiting thread.
+            read_pixels (self, command);
+            break;
+        case COMMAND_QUIT:
+            running = FALSE;
+            g_free (command);
+            break;
+        }
+    }
+
+    for (int i = 0; i < N_BUFFERS; i++)
+        if (self->buffers[i].texture != 0)
+            glDeleteTextures (1, &self->buffers[i].texture);
+    glDeleteProgram (self->program);
+    eglMakeCurrent (self->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglReleaseThread ();
+
+    return NULL;
+}
+
+static void
+push_command (FlPresentThread *self, CommandType type)
+{
+    Command *command = g_new0 (Command, 1);
+    command->type = type;
+    g_async_queue_push (self->commands, command);
+}
+
+static void
+fl_present_thread_dispose (GObject *object)
+{
+    FlPresentThread *self = FL_PRESENT_THREAD (object);
+
+    if (self->thread != NULL) {
+        push_command (self, COMMAND_QUIT);
+        g_thread_join (self->thread);
+        self->thread = NULL;
+    }
+    if (self->context != EGL_NO_CONTEXT) {
+        eglDestroyContext (self->display, self->context);
+        self->context = EGL_NO_CONTEXT;
+    }
+    g_clear_pointer (&self->commands, g_async_queue_unref);
+    g_clear_pointer (&self->free_buffers, g_async_queue_unref);
+
+    G_OBJECT_CLASS (fl_present_thread_parent_class)->dispose (object);
+}
+
+static void
+fl_present_thread_finalize (GObject *object)
+{
+    FlPresentThread *self = FL_PRESENT_THREAD (object);
+
+    g_mutex_clear (&self->mutex);
+    g_cond_clear (&self->cond);
+
+    G_OBJECT_CLASS (fl_present_thread_parent_class)->finalize (object);
+}
+
+static void
+fl_present_thread_class_init (FlPresentThreadClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_present_thread_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_present_thread_finalize;
+}
+
+static void
+fl_present_thread_init (FlPresentThread *self)
+{
+    g_mutex_init (&self->mutex);
+    g_cond_init (&self->cond);
+    self->commands = g_async_queue_new ();
+    self->free_buffers = g_async_queue_new ();
+    for (int i = 0; i < N_BUFFERS; i++)
+        g_async_queue_push (self->free_buffers, &self->buffers[i]);
+}
+
+FlPresentThread *
+fl_present_thread_new (EGLDisplay display, EGLConfig config, EGLContext share_context, EGLSurface surface)
+{
+    FlPresentThread *self = g_object_new (fl_present_thread_get_type (), NULL);
+    EGLint context_attributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2,
+                                    EGL_NONE };
+
+    self->display = display;
+    self->surface = surface;
+    self->context = eglCreateContext (display, config, share_context, context_attributes);
+    if (self->context == EGL_NO_CONTEXT) {
+        g_critical ("Failed to create EGL present context");
+        g_object_unref (self);
+        return NULL;
+    }
+
+    if (has_extension (display, "EGL_KHR_fence_sync")) {
+        self->create_sync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress ("eglCreateSyncKHR");
+        self->destroy_sync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress ("eglDestroySyncKHR");
+        self->client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress ("eglClientWaitSyncKHR");
+    }
+    if (has_extension (display, "EGL_KHR_wait_sync"))
+        self->wait_sync = (PFNEGLWAITSYNCKHRPROC) eglGetProcAddress ("eglWaitSyncKHR");
+    if (has_extension (display, "EGL_KHR_swap_buffers_with_damage"))
+        self->swap_buffers_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC) eglGetProcAddress ("eglSwapBuffersWithDamageKHR");
+
+    self->thread = g_thread_new ("fl-present", present_thread_func, self);
+
+    return self;
+}
+
+guint32
+fl_present_thread_acquire_framebuffer (FlPresentThread *self, gint width, gint height)
+{
+    g_return_val_if_fail (FL_IS_PRESENT_THREAD (self), 0);
+
+    // Blocks if all the buffers are queued, which bounds the latency.
+    if (self->current_buffer == NULL)
+        self->current_buffer = g_async_queue_pop (self->free_buffers);
+    Buffer *buffer = self->current_buffer;
+
+    if (buffer->framebuffer != 0 && buffer->width == width && buffer->height == height)
+        return buffer->framebuffer;
+
+    // Restore the bindings afterwards, the renderer tracks its GL state.
+    GLint old_texture, old_framebuffer;
+    glGetIntegerv (GL_TEXTURE_BINDING_2D, &old_texture);
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+
+    if (buffer->texture == 0)
+        glGenTextures (1, &buffer->texture);
+    if (buffer->framebuffer == 0)
+        glGenFramebuffers (1, &buffer->framebuffer);
+    glBindTexture (GL_TEXTURE_2D, buffer->texture);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindFramebuffer (GL_FRAMEBUFFER, buffer->framebuffer);
+    glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, buffer->texture, 0);
+
+    glBindTexture (GL_TEXTURE_2D, old_texture);
+    glBindFramebuffer (GL_FRAMEBUFFER, old_framebuffer);
+
+    g_mutex_lock (&self->mutex);
+    self->buffer_size += (gsize) width * height * 4 - (gsize) buffer->width * buffer->height * 4;
+    g_mutex_unlock (&self->mutex);
+    buffer->width = width;
+    buffer->height = height;
+
+    return buffer->framebuffer;
+}
+
+void
+fl_present_thread_release_framebuffers (FlPresentThread *self)
+{
+    g_return_if_fail (FL_IS_PRESENT_THREAD (self));
+
+    // The textures are shared, and deleted by the present thread.
+    for (int i = 0; i < N_BUFFERS; i++) {
+        if (self->buffers[i].framebuffer != 0)
+            glDeleteFramebuffers (1, &self->buffers[i].framebuffer);
+        self->buffers[i].framebuffer = 0;
+    }
+}
+
+void
+fl_present_thread_queue_frame (FlPresentThread *self)
+{
+    g_return_if_fail (FL_IS_PRESENT_THREAD (self));
+
+    Buffer *buffer = g_steal_pointer (&self->current_buffer);
+    if (buffer == NULL)
+        return;
+
+    if (self->create_sync != NULL)
+        buffer->fence = self->create_sync (self->display, EGL_SYNC_FENCE_KHR, NULL);
+    if (buffer->fence != EGL_NO_SYNC_KHR)
+        glFlush ();
+    else
+        glFinish ();
+
+    g_mutex_lock (&self->mutex);
+    self->queue_depth++;
+    g_mutex_unlock (&self->mutex);
+
+    Command *command = g_new0 (Command, 1);
+    command->type = COMMAND_PRESENT;
+    command->buffer = buffer;
+    g_async_queue_push (self->commands, command);
+}
+
+void
+fl_present_thread_discard_frame (FlPresentThread *self)
+{
+    g_return_if_fail (FL_IS_PRESENT_THREAD (self));
+
+    Buffer *buffer = g_steal_pointer (&self->current_buffer);
+    if (buffer != NULL)
+        g_async_queue_push (self->free_buffers, buffer);
+}
+
+void
+fl_present_thread_repaint (FlPresentThread *self, cairo_region_t *damage)
+{
+    g_return_if_fail (FL_IS_PRESENT_THREAD (self));
+
+    Command *command = g_new0 (Command, 1);
+    command->type = COMMAND_REPAINT;
+    command->damage = damage;
+    g_async_queue_push (self->commands, command);
+}
+
+guint8 *
+fl_present_thread_read_pixels (FlPresentThread *self, gint *width, gint *height)
+{
+    Command command = { 0 };
+
+    g_return_val_if_fail (FL_IS_PRESENT_THREAD (self), NULL);
+
+    command.type = COMMAND_READ_PIXELS;
+    g_async_queue_push (self->commands, &command);
+    g_mutex_lock (&self->mutex);
+    while (!command.done)
+        g_cond_wait (&self->cond, &self->mutex);
+    g_mutex_unlock (&self->mutex);
+
+    *width = command.width;
+    *height = command.height;
+    return command.pixels;
+}
+
+void
+fl_present_thread_get_stats (FlPresentThread *self, guint *queue_depth, guint64 *frames_presented, gint64 *swap_time)
+{
+    g_return_if_fail (FL_IS_PRESENT_THREAD (self));
+
+    g_mutex_lock (&self->mutex);
+    *queue_depth = self->queue_depth;
+    *frames_presented = self->frames_presented;
+    *swap_time = self->swap_time;
+    g_mutex_unlock (&self->mutex);
+}
+
+gsize
+fl_present_thread_get_buffer_size (FlPresentThread *self)
+{
+    g_return_val_if_fail (FL_IS_PRESENT_THREAD (self), 0);
+
+    g_mutex_lock (&self->mutex);
+    gsize buffer_size = self->buffer_size;
+    g_mutex_unlock (&self->mutex);
+
+    return buffer_size;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <EGL/egl.h>
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlPresentThread, fl_present_thread, FL, PRESENT_THREAD, GObject)
+
+/* Presents frames rendered into offscreen buffers on a thread of its own, so a
+ * blocking swap doesn't hold up rendering of the next frame. */
+
+FlPresentThread *fl_present_thread_new                  (EGLDisplay display, EGLConfig config, EGLContext share_context, EGLSurface surface);
+
+/* Called from the thread rendering frames */
+
+guint32          fl_present_thread_acquire_framebuffer  (FlPresentThread *thread, gint width, gint height);
+
+void             fl_present_thread_queue_frame          (FlPresentThread *thread);
+
+void             fl_present_thread_discard_frame        (FlPresentThread *thread);
+
+/* Deletes the framebuffers made in the rendering context, before it goes */
+
+void             fl_present_thread_release_framebuffers (FlPresentThread *thread);
+
+/* Called from any other thread */
+
+void             fl_present_thread_repaint              (FlPresentThread *thread, cairo_region_t *damage);
+
+guint8          *fl_present_thread_read_pixels          (FlPresentThread *thread, gint *width, gint *height);
+
+void             fl_present_thread_get_stats            (FlPresentThread *thread, guint *queue_depth, guint64 *frames_presented, gint64 *swap_time);
+
+gsize            fl_present_thread_get_buffer_size      (FlPresentThread *thread);
+
+G_END_DECLS
@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include "fl-present-thread.h"
+#include "fl-renderer-egl.h"
+
+typedef struct
+{
+    EGLDisplay egl_display;
+    EGLConfig egl_config;
+    EGLSurface egl_surface;
+    EGLContext egl_context;
+
+    // TRUE if the back buffer keeps the last frame after a swap.
+    gboolean egl_buffer_preserved;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC egl_swap_buffers_with_damage;
+
+    // Presents frames when enabled, with rendering done without a surface.
+    gboolean use_present_thread;
+    FlPresentThread *present_thread;
+} FlRendererEglPrivate;
+
+G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (FlRendererEgl, fl_renderer_egl, fl_renderer_get_type ())
+
+static gboolean
+has_extension (EGLDisplay display, const gchar *name)
+{
+    const gchar *extensions = eglQueryString (display, EGL_EXTENSIONS);
+    return extensions != NULL && strstr (extensions, name) != NULL;
+}
+
+static gboolean
+fl_renderer_egl_initialize (FlRendererEgl *self, GdkDisplay *display)
+{
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+    EGLint egl_major, egl_minor;
+    EGLint n_config;
+    EGLint attributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+                            EGL_SURFACE_TYPE, EGL_WINDOW_BIT | EGL_SWAP_BEHAVIOR_PRESERVED_BIT,
+                            EGL_RED_SIZE, 8,
+                            EGL_GREEN_SIZE, 8,
+                            EGL_BLUE_SIZE, 8,
+                            EGL_ALPHA_SIZE, 8,
+                            EGL_NONE };
+
+    priv->egl_display = FL_RENDERER_EGL_GET_CLASS (self)->create_display (self, display);
+    if (!eglInitialize (priv->egl_display, &egl_major, &egl_minor)) {
+        g_critical ("Failed to initialze EGL");
+        priv->egl_display = EGL_NO_DISPLAY;
+        return FALSE;
+    }
+    g_printerr ("Initialized EGL version %d.%d\n", egl_major, egl_minor);
+
+    // Prefer a config that can keep the last frame, so it can be snapshotted.
+    priv->egl_buffer_preserved = TRUE;
+    if (!eglChooseConfig (priv->egl_display, attributes, &priv->egl_config, 1, &n_config) || n_config == 0) {
+        attributes[3] = EGL_WINDOW_BIT;
+        priv->egl_buffer_preserved = FALSE;
+        if (!eglChooseConfig (priv->egl_display, attributes, &priv->egl_config, 1, &n_config))
+            g_critical ("Failed to choose EGL config");
+    }
+    if (n_config == 0)
+        g_critical ("Failed to find appropriate EGL config");
+    if (!eglBindAPI (EGL_OPENGL_ES_API))
+        g_critical ("Failed to bind EGL OpenGL ES API");
+
+    if (has_extension (priv->egl_display, "EGL_KHR_swap_buffers_with_damage"))
+        priv->egl_swap_buffers_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC) eglGetProcAddress ("eglSwapBuffersWithDamageKHR");
+
+    return TRUE;
+}
+
+// Pass the surface and context on to the raster thread.
+static void
+fl_renderer_egl_publish_state (FlRendererEgl *self)
+{
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    FlRendererState state = *fl_renderer_get_state (FL_RENDERER (self));
+    state.surface = priv->egl_surface;
+    state.context = priv->egl_context;
+    state.present_thread = priv->present_thread;
+    fl_renderer_publish_state (FL_RENDERER (self), &state);
+}
+
+static gboolean
+fl_renderer_egl_create_context (FlRendererEgl *self)
+{
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+    EGLint context_attributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2,
+                                    EGL_NONE };
+
+    priv->egl_context = eglCreateContext (priv->egl_display, priv->egl_config, EGL_NO_CONTEXT, context_attributes);
+    if (priv->egl_context == EGL_NO_CONTEXT) {
+        g_critical ("Failed to create EGL context");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+fl_renderer_egl_start (FlRenderer *renderer, GtkWidget *widget)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    if (priv->egl_display == EGL_NO_DISPLAY && !fl_renderer_egl_initialize (self, gtk_widget_get_display (widget)))
+        return FALSE;
+
+    priv->egl_surface = FL_RENDERER_EGL_GET_CLASS (self)->create_surface (self, widget, priv->egl_display, priv->egl_config);
+    if (priv->egl_surface == EGL_NO_SURFACE) {
+        g_critical ("Failed to create EGL surface");
+        return FALSE;
+    }
+    if (priv->egl_buffer_preserved)
+        eglSurfaceAttrib (priv->egl_display, priv->egl_surface, EGL_SWAP_BEHAVIOR, EGL_BUFFER_PRESERVED);
+
+    // A prepared renderer keeps the context the engine is already using.
+    if (priv->egl_context == EGL_NO_CONTEXT && !fl_renderer_egl_create_context (self))
+        return FALSE;
+
+    if (priv->use_present_thread) {
+        if (has_extension (priv->egl_display, "EGL_KHR_surfaceless_context"))
+            priv->present_thread = fl_present_thread_new (priv->egl_display, priv->egl_config, priv->egl_context, priv->egl_surface);
+        else
+            g_warning ("EGL_KHR_surfaceless_context not supported, presenting from the raster thread");
+    }
+
+    fl_renderer_egl_publish_state (self);
+
+    return TRUE;
+}
+
+static void
+fl_renderer_egl_stop (FlRenderer *renderer)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    g_clear_object (&priv->present_thread);
+    if (priv->egl_context != EGL_NO_CONTEXT) {
+        eglDestroyContext (priv->egl_display, priv->egl_context);
+        priv->egl_context = EGL_NO_CONTEXT;
+    }
+    if (priv->egl_surface != EGL_NO_SURFACE) {
+        eglDestroySurface (priv->egl_display, priv->egl_surface);
+        priv->egl_surface = EGL_NO_SURFACE;
+    }
+
+    // Published once cleared, so no thread picks up the destroyed handles.
+    fl_renderer_egl_publish_state (self);
+}
+
+static FlRendererDrawResult
+fl_renderer_egl_draw (FlRenderer *renderer, cairo_t *cr)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    // The present thread keeps the frame on screen.
+    if (priv->present_thread != NULL) {
+        cairo_region_t *damage = cairo_region_create ();
+        fl_renderer_add_clip_to_region (cr, damage);
+        fl_present_thread_repaint (priv->present_thread, damage);
+        return FL_RENDERER_DRAW_DONE;
+    }
+
+    // The raster thread owns the surface, so the swap is done there.
+    return priv->egl_buffer_preserved ? FL_RENDERER_DRAW_NEEDS_RASTER_THREAD : FL_RENDERER_DRAW_NEEDS_FRAME;
+}
+
+static gsize
+fl_renderer_egl_get_buffer_size (FlRenderer *renderer)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    return priv->present_thread != NULL ? fl_present_thread_get_buffer_size (priv->present_thread) : 0;
+}
+
+static gboolean
+fl_renderer_egl_make_current (FlRenderer *renderer)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+
+    EGLSurface surface = state->present_thread != NULL ? EGL_NO_SURFACE : state->surface;
+    if (!eglMakeCurrent (priv->egl_display, surface, surface, state->context)) {
+        g_critical ("Failed to make EGL context current");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+fl_renderer_egl_clear_current (FlRenderer *renderer)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    return eglMakeCurrent (priv->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+static guint32
+fl_renderer_egl_get_fbo (FlRenderer *renderer)
+{
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+
+    if (state->present_thread == NULL)
+        return 0;
+
+    return fl_present_thread_acquire_framebuffer (state->present_thread, state->width, state->height);
+}
+
+static gboolean
+fl_renderer_egl_present (FlRenderer *renderer)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+
+    if (state->present_thread != NULL) {
+        fl_present_thread_queue_frame (state->present_thread);
+        return TRUE;
+    }
+
+    if (!eglSwapBuffers (priv->egl_display, state->surface)) {
+        g_critical ("Failed to swap EGL buffers");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+fl_renderer_egl_discard_frame (FlRenderer *renderer)
+{
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+
+    if (state->present_thread != NULL)
+        fl_present_thread_discard_frame (state->present_thread);
+}
+
+// Present the preserved back buffer again, only updating the damaged area.
+static void
+fl_renderer_egl_repaint (FlRenderer *renderer, cairo_region_t *damage)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+    EGLint height;
+
+    if (!eglMakeCurrent (priv->egl_display, state->surface, state->surface, state->context))
+        return;
+
+    if (priv->egl_swap_buffers_with_damage == NULL ||
+        !eglQuerySurface (priv->egl_display, state->surface, EGL_HEIGHT, &height)) {
+        eglSwapBuffers (priv->egl_display, state->surface);
+        return;
+    }
+
+    // EGL rectangles have their origin at the bottom left.
+    gint n_rects = cairo_region_num_rectangles (damage);
+    g_autofree EGLint *rects = g_new (EGLint, n_rects * 4);
+    for (gint i = 0; i < n_rects; i++) {
+        cairo_rectangle_int_t rect;
+        cairo_region_get_rectangle (damage, i, &rect);
+        rects[i * 4] = rect.x;
+        rects[i * 4 + 1] = height - rect.y - rect.height;
+        rects[i * 4 + 2] = rect.width;
+        rects[i * 4 + 3] = rect.height;
+    }
+    priv->egl_swap_buffers_with_damage (priv->egl_display, state->surface, rects, n_rects);
+}
+
+static cairo_surface_t *
+fl_renderer_egl_read_frame (FlRenderer *renderer)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+    EGLint width, height;
+
+    // The present thread keeps the last frame.
+    if (priv->present_thread != NULL) {
+        g_autofree guint8 *pixels = fl_present_thread_read_pixels (priv->present_thread, &width, &height);
+        return pixels != NULL ? fl_renderer_image_from_pixels (pixels, width, height) : NULL;
+    }
+
+    // The back buffer only holds the last frame if it is preserved across swaps.
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+    if (priv->egl_buffer_preserved &&
+        eglMakeCurrent (priv->egl_display, state->surface, state->surface, state->context) &&
+        eglQuerySurface (priv->egl_display, state->surface, EGL_WIDTH, &width) &&
+        eglQuerySurface (priv->egl_display, state->surface, EGL_HEIGHT, &height))
+        return fl_renderer_read_framebuffer (width, height);
+
+    return NULL;
+}
+
+static gboolean
+fl_renderer_egl_frame_needs_raster_thread (FlRenderer *renderer)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    return priv->present_thread == NULL;
+}
+
+static gboolean
+fl_renderer_egl_get_fbo_reset_after_present (FlRenderer *renderer)
+{
+    FlRendererEgl *self = FL_RENDERER_EGL (renderer);
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    return priv->present_thread != NULL;
+}
+
+static void
+fl_renderer_egl_dispose (GObject *object)
+{
+    fl_renderer_stop (FL_RENDERER (object));
+
+    G_OBJECT_CLASS (fl_renderer_egl_parent_class)->dispose (object);
+}
+
+static void
+fl_renderer_egl_class_init (FlRendererEglClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_renderer_egl_dispose;
+    FL_RENDERER_CLASS (klass)->start = fl_renderer_egl_start;
+    FL_RENDERER_CLASS (klass)->stop = fl_renderer_egl_stop;
+    FL_RENDERER_CLASS (klass)->draw = fl_renderer_egl_draw;
+    FL_RENDERER_CLASS (klass)->get_buffer_size = fl_renderer_egl_get_buffer_size;
+    FL_RENDERER_CLASS (klass)->make_current = fl_renderer_egl_make_current;
+    FL_RENDERER_CLASS (klass)->clear_current = fl_renderer_egl_clear_current;
+    FL_RENDERER_CLASS (klass)->get_fbo = fl_renderer_egl_get_fbo;
+    FL_RENDERER_CLASS (klass)->present = fl_renderer_egl_present;
+    FL_RENDERER_CLASS (klass)->discard_frame = fl_renderer_egl_discard_frame;
+    FL_RENDERER_CLASS (klass)->repaint = fl_renderer_egl_repaint;
+    FL_RENDERER_CLASS (klass)->read_frame = fl_renderer_egl_read_frame;
+    FL_RENDERER_CLASS (klass)->frame_needs_raster_thread = fl_renderer_egl_frame_needs_raster_thread;
+    FL_RENDERER_CLASS (klass)->get_fbo_reset_after_present = fl_renderer_egl_get_fbo_reset_after_present;
+}
+
+static void
+fl_renderer_egl_init (FlRendererEgl *self)
+{
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    priv->egl_display = EGL_NO_DISPLAY;
+    priv->egl_surface = EGL_NO_SURFACE;
+    priv->egl_context = EGL_NO_CONTEXT;
+}
+
+void
+fl_renderer_egl_set_use_present_thread (FlRendererEgl *self, gboolean use_present_thread)
+{
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_RENDERER_EGL (self));
+
+    priv->use_present_thread = use_present_thread;
+}
+
+gboolean
+fl_renderer_egl_prepare (FlRendererEgl *self, GdkDisplay *display)
+{
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_RENDERER_EGL (self), FALSE);
+    g_return_val_if_fail (priv->egl_context == EGL_NO_CONTEXT, FALSE);
+
+    if (priv->egl_display == EGL_NO_DISPLAY && !fl_renderer_egl_initialize (self, display))
+        return FALSE;
+
+    // Until started the engine renders with no surface.
+    if (!has_extension (priv->egl_display, "EGL_KHR_surfaceless_context")) {
+        g_debug ("EGL_KHR_surfaceless_context not supported, can't prepare renderer");
+        return FALSE;
+    }
+
+    if (!fl_renderer_egl_create_context (self))
+        return FALSE;
+    fl_renderer_egl_publish_state (self);
+
+    return TRUE;
+}
+
+void
+fl_renderer_egl_get_present_stats (FlRendererEgl *self, guint *queue_depth, guint64 *frames_presented, gint64 *swap_time)
+{
+    FlRendererEglPrivate *priv = fl_renderer_egl_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_RENDERER_EGL (self));
+
+    *queue_depth = 0;
+    *frames_presented = 0;
+    *swap_time = 0;
+    if (priv->present_thread != NULL)
+        fl_present_thread_get_stats (priv->present_thread, queue_depth, frames_presented, swap_time);
+}
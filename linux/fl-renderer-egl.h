@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <EGL/egl.h>
+
+#include "fl-renderer.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_DERIVABLE_TYPE (FlRendererEgl, fl_renderer_egl, FL, RENDERER_EGL, FlRenderer)
+
+struct _FlRendererEglClass
+{
+    FlRendererClass parent_class;
+
+    EGLDisplay (*create_display) (FlRendererEgl *renderer, GdkDisplay *display);
+    EGLSurface (*create_surface) (FlRendererEgl *renderer, GtkWidget *widget, EGLDisplay display, EGLConfig config);
+};
+
+/* Renders into an EGL window surface, implementations provide the native
+ * display and window. */
+
+void     fl_renderer_egl_set_use_present_thread (FlRendererEgl *renderer, gboolean use_present_thread);
+
+/* Creates the context before there is a widget to render to, so an engine can
+ * be run without a surface until fl_renderer_start() is called. Fails if
+ * @display can't make a context current without a surface. */
+
+gboolean fl_renderer_egl_prepare                (FlRendererEgl *renderer, GdkDisplay *display);
+
+void     fl_renderer_egl_get_present_stats      (FlRendererEgl *renderer, guint *queue_depth, guint64 *frames_presented, gint64 *swap_time);
+
+G_END_DECLS
@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+// GDK may create its contexts with GLX or EGL, libglvnd dispatches the GL
+// calls made here and those resolved by the engine to whichever is current.
+#include <GLES3/gl3.h>
+
+#include "fl-renderer-gdk.h"
+
+// One buffer shown by GTK, one waiting to be drawn and one being rendered.
+#define N_BUFFERS 3
+
+typedef struct
+{
+    GLuint texture;
+
+    // Framebuffer object in the raster context, these are not shared.
+    GLuint framebuffer;
+
+    gint width;
+    gint height;
+
+    // Signalled when rendering into this buffer completes.
+    GLsync fence;
+} Buffer;
+
+struct _FlRendererGdk
+{
+    FlRenderer parent_instance;
+
+    GtkWidget *widget;
+
+    // Contexts used by the raster thread and the main thread, both share
+    // textures with the context GDK draws the window with.
+    GdkGLContext *raster_context;
+    GdkGLContext *draw_context;
+
+    // TRUE if the contexts have sync objects, otherwise the raster thread waits
+    // for each frame to complete.
+    gboolean use_fences;
+
+    Buffer buffers[N_BUFFERS];
+
+    // Buffer being rendered into, only used from the raster thread.
+    gint rendering;
+
+    // Protects the fields below.
+    GMutex mutex;
+
+    // Buffer last drawn by GTK, and the newer one waiting to be drawn.
+    gint shown;
+    gint ready;
+    gboolean draw_queued;
+
+    // Total size of the buffers.
+    gsize buffer_size;
+};
+
+G_DEFINE_TYPE (FlRendererGdk, fl_renderer_gdk, fl_renderer_get_type ())
+
+static GdkGLContext *
+create_context (GdkWindow *window)
+{
+    g_autoptr(GError) error = NULL;
+
+    g_autoptr(GdkGLContext) context = gdk_window_create_gl_context (window, &error);
+    if (context == NULL || !gdk_gl_context_realize (context, &error)) {
+        g_critical ("Failed to create GDK GL context: %s", error->message);
+        return NULL;
+    }
+
+    return g_steal_pointer (&context);
+}
+
+static gboolean
+fl_renderer_gdk_queue_draw_cb (gpointer user_data)
+{
+    FlRendererGdk *self = user_data;
+
+    g_mutex_lock (&self->mutex);
+    self->draw_queued = FALSE;
+    g_mutex_unlock (&self->mutex);
+
+    if (self->widget != NULL)
+        gtk_widget_queue_draw (self->widget);
+
+    g_object_unref (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+fl_renderer_gdk_start (FlRenderer *renderer, GtkWidget *widget)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (renderer);
+    GdkWindow *window = gtk_widget_get_window (widget);
+    gint major, minor;
+
+    self->raster_context = create_context (window);
+    self->draw_context = create_context (window);
+    if (self->raster_context == NULL || self->draw_context == NULL)
+        return FALSE;
+
+    gdk_gl_context_get_version (self->draw_context, &major, &minor);
+    if (gdk_gl_context_get_use_es (self->draw_context))
+        self->use_fences = major >= 3;
+    else
+        self->use_fences = major > 3 || (major == 3 && minor >= 2);
+
+    self->widget = widget;
+    g_object_add_weak_pointer (G_OBJECT (widget), (gpointer *) &self->widget);
+
+    return TRUE;
+}
+
+static void
+fl_renderer_gdk_stop (FlRenderer *renderer)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (renderer);
+
+    if (self->widget != NULL) {
+        g_object_remove_weak_pointer (G_OBJECT (self->widget), (gpointer *) &self->widget);
+        self->widget = NULL;
+    }
+
+    // Textures are shared, the framebuffers go with the raster context.
+    if (self->draw_context != NULL) {
+        gdk_gl_context_make_current (self->draw_context);
+        for (gint i = 0; i < N_BUFFERS; i++) {
+            Buffer *buffer = &self->buffers[i];
+            if (buffer->texture != 0)
+                glDeleteTextures (1, &buffer->texture);
+            if (buffer->fence != NULL)
+                glDeleteSync (buffer->fence);
+            memset (buffer, 0, sizeof (Buffer));
+        }
+        gdk_gl_context_clear_current ();
+    }
+    g_clear_object (&self->raster_context);
+    g_clear_object (&self->draw_context);
+
+    self->rendering = -1;
+    self->shown = -1;
+    self->ready = -1;
+    g_mutex_lock (&self->mutex);
+    self->buffer_size = 0;
+    g_mutex_unlock (&self->mutex);
+}
+
+// Composite the newest frame as part of the window GTK is drawing.
+static FlRendererDrawResult
+fl_renderer_gdk_draw (FlRenderer *renderer, cairo_t *cr)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (renderer);
+    GLsync fence = NULL;
+
+    g_mutex_lock (&self->mutex);
+    if (self->ready >= 0) {
+        self->shown = self->ready;
+        self->ready = -1;
+        fence = g_steal_pointer (&self->buffers[self->shown].fence);
+    }
+    gint shown = self->shown;
+    g_mutex_unlock (&self->mutex);
+
+    if (shown < 0 || self->widget == NULL)
+        return FL_RENDERER_DRAW_NEEDS_FRAME;
+    Buffer *buffer = &self->buffers[shown];
+
+    if (fence != NULL) {
+        gdk_gl_context_make_current (self->draw_context);
+        glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync (fence);
+    }
+
+    gdk_cairo_draw_from_gl (cr, gtk_widget_get_window (self->widget), buffer->texture, GL_TEXTURE, 1,
+                            0, 0, buffer->width, buffer->height);
+
+    return FL_RENDERER_DRAW_DONE;
+}
+
+static gsize
+fl_renderer_gdk_get_buffer_size (FlRenderer *renderer)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (renderer);
+
+    g_mutex_lock (&self->mutex);
+    gsize buffer_size = self->buffer_size;
+    g_mutex_unlock (&self->mutex);
+
+    return buffer_size;
+}
+
+static gboolean
+fl_renderer_gdk_make_current (FlRenderer *renderer)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (renderer);
+
+    gdk_gl_context_make_current (self->raster_context);
+
+    return TRUE;
+}
+
+static gboolean
+fl_renderer_gdk_clear_current (FlRenderer *renderer)
+{
+    gdk_gl_context_clear_current ();
+
+    return TRUE;
+}
+
+static guint32
+fl_renderer_gdk_get_fbo (FlRenderer *renderer)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (renderer);
+    gint width, height;
+
+    // Use a buffer GTK isn't drawing from and which isn't waiting to be drawn.
+    if (self->rendering < 0) {
+        g_mutex_lock (&self->mutex);
+        for (gint i = 0; i < N_BUFFERS && self->rendering < 0; i++) {
+            if (i != self->shown && i != self->ready)
+                self->rendering = i;
+        }
+        g_mutex_unlock (&self->mutex);
+    }
+    Buffer *buffer = &self->buffers[self->rendering];
+
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+    width = state->width;
+    height = state->height;
+    if (buffer->framebuffer != 0 && buffer->width == width && buffer->height == height)
+        return buffer->framebuffer;
+
+    // Restore the bindings afterwards, the renderer tracks its GL state.
+    GLint old_texture, old_framebuffer;
+    glGetIntegerv (GL_TEXTURE_BINDING_2D, &old_texture);
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING, &old_framebuffer);
+
+    if (buffer->framebuffer == 0) {
+        glGenTextures (1, &buffer->texture);
+        glGenFramebuffers (1, &buffer->framebuffer);
+    }
+    glBindTexture (GL_TEXTURE_2D, buffer->texture);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindFramebuffer (GL_FRAMEBUFFER, buffer->framebuffer);
+    glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, buffer->texture, 0);
+
+    glBindTexture (GL_TEXTURE_2D, old_texture);
+    glBindFramebuffer (GL_FRAMEBUFFER, old_framebuffer);
+
+    g_mutex_lock (&self->mutex);
+    self->buffer_size += (gsize) width * height * 4 - (gsize) buffer->width * buffer->height * 4;
+    g_mutex_unlock (&self->mutex);
+    buffer->width = width;
+    buffer->height = height;
+
+    return buffer->framebuffer;
+}
+
+static gboolean
+fl_renderer_gdk_present (FlRenderer *renderer)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (renderer);
+    GLsync fence = NULL;
+
+    if (self->rendering < 0)
+        return FALSE;
+
+    // GTK waits for the fence before drawing, so this thread can carry on.
+    if (self->use_fences) {
+        fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush ();
+    } else {
+        glFinish ();
+    }
+
+    g_mutex_lock (&self->mutex);
+    // A frame GTK hasn't got to yet is dropped in favour of this one.
+    GLsync dropped_fence = NULL;
+    if (self->ready >= 0)
+        dropped_fence = g_steal_pointer (&self->buffers[self->ready].fence);
+    self->ready = self->rendering;
+    self->buffers[self->ready].fence = fence;
+    gboolean queue_draw = !self->draw_queued;
+    self->draw_queued = TRUE;
+    g_mutex_unlock (&self->mutex);
+    self->rendering = -1;
+
+    if (dropped_fence != NULL)
+        glDeleteSync (dropped_fence);
+    if (queue_draw)
+        g_idle_add (fl_renderer_gdk_queue_draw_cb, g_object_ref (self));
+
+    return TRUE;
+}
+
+static cairo_surface_t *
+fl_renderer_gdk_read_frame (FlRenderer *renderer)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (renderer);
+    cairo_surface_t *frame = NULL;
+
+    if (self->draw_context == NULL)
+        return NULL;
+
+    // Hold the lock so the raster thread doesn't reuse the buffer being read.
+    g_mutex_lock (&self->mutex);
+    gint index = self->ready >= 0 ? self->ready : self->shown;
+    if (index >= 0) {
+        Buffer *buffer = &self->buffers[index];
+        GLuint framebuffer;
+
+        gdk_gl_context_make_current (self->draw_context);
+        if (buffer->fence != NULL)
+            glClientWaitSync (buffer->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glGenFramebuffers (1, &framebuffer);
+        glBindFramebuffer (GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, buffer->texture, 0);
+        frame = fl_renderer_read_framebuffer (buffer->width, buffer->height);
+        glBindFramebuffer (GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers (1, &framebuffer);
+        gdk_gl_context_clear_current ();
+    }
+    g_mutex_unlock (&self->mutex);
+
+    return frame;
+}
+
+static gboolean
+fl_renderer_gdk_get_fbo_reset_after_present (FlRenderer *renderer)
+{
+    return TRUE;
+}
+
+static void
+fl_renderer_gdk_dispose (GObject *object)
+{
+    fl_renderer_gdk_stop (FL_RENDERER (object));
+
+    G_OBJECT_CLASS (fl_renderer_gdk_parent_class)->dispose (object);
+}
+
+static void
+fl_renderer_gdk_finalize (GObject *object)
+{
+    FlRendererGdk *self = FL_RENDERER_GDK (object);
+
+    g_mutex_clear (&self->mutex);
+
+    G_OBJECT_CLASS (fl_renderer_gdk_parent_class)->finalize (object);
+}
+
+static void
+fl_renderer_gdk_class_init (FlRendererGdkClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_renderer_gdk_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_renderer_gdk_finalize;
+    FL_RENDERER_CLASS (klass)->start = fl_renderer_gdk_start;
+    FL_RENDERER_CLASS (klass)->stop = fl_renderer_gdk_stop;
+    FL_RENDERER_CLASS (klass)->draw = fl_renderer_gdk_draw;
+    FL_RENDERER_CLASS (klass)->get_buffer_size = fl_renderer_gdk_get_buffer_size;
+    FL_RENDERER_CLASS (klass)->make_current = fl_renderer_gdk_make_current;
+    FL_RENDERER_CLASS (klass)->clear_current = fl_renderer_gdk_clear_current;
+    FL_RENDERER_CLASS (klass)->get_fbo = fl_renderer_gdk_get_fbo;
+    FL_RENDERER_CLASS (klass)->present = fl_renderer_gdk_present;
+    FL_RENDERER_CLASS (klass)->read_frame = fl_renderer_gdk_read_frame;
+    FL_RENDERER_CLASS (klass)->get_fbo_reset_after_present = fl_renderer_gdk_get_fbo_reset_after_present;
+}
+
+static void
+fl_renderer_gdk_init (FlRendererGdk *self)
+{
+    g_mutex_init (&self->mutex);
+    self->rendering = -1;
+    self->shown = -1;
+    self->ready = -1;
+}
+
+FlRendererGdk *
+fl_renderer_gdk_new (void)
+{
+    return g_object_new (fl_renderer_gdk_get_type (), NULL);
+}
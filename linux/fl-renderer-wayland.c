@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include <gdk/gdkwayland.h>
+#include <wayland-client.h>
+#include <wayland-egl.h>
+
+#include "fl-renderer-wayland.h"
+
+typedef enum
+{
+    // The subsurface is desynchronized, frames go straight to the compositor.
+    RESIZE_NONE,
+    // Synchronized with the window, waiting for a frame at the allocated size.
+    RESIZE_WAITING,
+    // A frame at the allocated size is cached until GTK next commits the window.
+    RESIZE_PRESENTED,
+    // GTK is painting the window, which is committed after the paint.
+    RESIZE_COMMITTING
+} ResizeState;
+
+struct _FlRendererWayland
+{
+    FlRendererEgl parent_instance;
+
+    GtkWidget *widget;
+
+    // Not exposed by GDK, bound on a queue of our own.
+    struct wl_subcompositor *subcompositor;
+
+    struct wl_surface *surface;
+    struct wl_subsurface *subsurface;
+    struct wl_egl_window *egl_window;
+
+    GdkFrameClock *frame_clock;
+    gulong before_paint_handler;
+    gulong after_paint_handler;
+
+    // Size of @egl_window, only used from the raster thread.
+    gint egl_window_width;
+    gint egl_window_height;
+
+    // The subsurface is synchronized with its parent while resizing, so a
+    // resized frame shows up in the same commit as the GTK window around it.
+    // Protects the fields below.
+    GMutex resize_mutex;
+    ResizeState resize_state;
+
+    // Last size allocated to the widget.
+    gint allocated_width;
+    gint allocated_height;
+};
+
+G_DEFINE_TYPE (FlRendererWayland, fl_renderer_wayland, fl_renderer_egl_get_type ())
+
+static void
+registry_global_cb (void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version)
+{
+    FlRendererWayland *self = data;
+
+    if (strcmp (interface, wl_subcompositor_interface.name) == 0)
+        self->subcompositor = wl_registry_bind (registry, name, &wl_subcompositor_interface, 1);
+}
+
+static void
+registry_global_remove_cb (void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+    registry_global_cb,
+    registry_global_remove_cb
+};
+
+// Bind the subcompositor without dispatching events from GDK's queue.
+static struct wl_subcompositor *
+get_subcompositor (FlRendererWayland *self, struct wl_display *display)
+{
+    if (self->subcompositor != NULL)
+        return self->subcompositor;
+
+    struct wl_event_queue *queue = wl_display_create_queue (display);
+    struct wl_registry *registry = wl_display_get_registry (display);
+    wl_proxy_set_queue ((struct wl_proxy *) registry, queue);
+    wl_registry_add_listener (registry, &registry_listener, self);
+    wl_display_roundtrip_queue (display, queue);
+    wl_registry_destroy (registry);
+    if (self->subcompositor != NULL)
+        wl_proxy_set_queue ((struct wl_proxy *) self->subcompositor, NULL);
+    wl_event_queue_destroy (queue);
+
+    return self->subcompositor;
+}
+
+// Place the subsurface over the widget, applied with the next commit of the window.
+static void
+update_position (FlRendererWayland *self)
+{
+    gint x, y;
+
+    if (self->subsurface == NULL ||
+        !gtk_widget_translate_coordinates (self->widget, gtk_widget_get_toplevel (self->widget), 0, 0, &x, &y))
+        return;
+
+    wl_subsurface_set_position (self->subsurface, x, y);
+}
+
+static void
+fl_renderer_wayland_size_allocate_cb (GtkWidget *widget, GtkAllocation *allocation, FlRendererWayland *self)
+{
+    update_position (self);
+
+    // Synchronize with the window until a frame at the new size has been committed with it.
+    g_mutex_lock (&self->resize_mutex);
+    if (allocation->width != self->allocated_width || allocation->height != self->allocated_height) {
+        self->allocated_width = allocation->width;
+        self->allocated_height = allocation->height;
+        if (self->resize_state == RESIZE_NONE)
+            wl_subsurface_set_sync (self->subsurface);
+        self->resize_state = RESIZE_WAITING;
+    }
+    g_mutex_unlock (&self->resize_mutex);
+}
+
+// Paint the window so GTK commits it, along with the resized frame cached in the subsurface.
+static gboolean
+fl_renderer_wayland_queue_draw_cb (gpointer user_data)
+{
+    FlRendererWayland *self = user_data;
+
+    if (self->widget != NULL)
+        gtk_widget_queue_draw (self->widget);
+
+    g_object_unref (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+fl_renderer_wayland_before_paint_cb (GdkFrameClock *clock, FlRendererWayland *self)
+{
+    g_mutex_lock (&self->resize_mutex);
+    if (self->resize_state == RESIZE_PRESENTED)
+        self->resize_state = RESIZE_COMMITTING;
+    g_mutex_unlock (&self->resize_mutex);
+}
+
+// Called after GDK has committed the window, which applied the cached frame.
+static void
+fl_renderer_wayland_after_paint_cb (GdkFrameClock *clock, FlRendererWayland *self)
+{
+    g_mutex_lock (&self->resize_mutex);
+    if (self->resize_state == RESIZE_COMMITTING) {
+        wl_subsurface_set_desync (self->subsurface);
+        self->resize_state = RESIZE_NONE;
+    }
+    g_mutex_unlock (&self->resize_mutex);
+}
+
+static void
+fl_renderer_wayland_unmap_cb (GtkWidget *widget, FlRendererWayland *self)
+{
+    // The subsurface would otherwise stay on screen without the widget.
+    wl_surface_attach (self->surface, NULL, 0, 0);
+    wl_surface_commit (self->surface);
+}
+
+static EGLDisplay
+fl_renderer_wayland_create_display (FlRendererEgl *renderer, GdkDisplay *display)
+{
+    return eglGetDisplay ((EGLNativeDisplayType) gdk_wayland_display_get_wl_display (display));
+}
+
+static EGLSurface
+fl_renderer_wayland_create_surface (FlRendererEgl *renderer, GtkWidget *widget, EGLDisplay display, EGLConfig config)
+{
+    FlRendererWayland *self = FL_RENDERER_WAYLAND (renderer);
+    GdkDisplay *gdk_display = gtk_widget_get_display (widget);
+
+    struct wl_subcompositor *subcompositor = get_subcompositor (self, gdk_wayland_display_get_wl_display (gdk_display));
+    if (subcompositor == NULL) {
+        g_critical ("Wayland compositor doesn't support subsurfaces");
+        return EGL_NO_SURFACE;
+    }
+
+    GdkWindow *toplevel = gdk_window_get_toplevel (gtk_widget_get_window (widget));
+    struct wl_compositor *compositor = gdk_wayland_display_get_wl_compositor (gdk_display);
+    self->surface = wl_compositor_create_surface (compositor);
+    self->subsurface = wl_subcompositor_get_subsurface (subcompositor, self->surface, gdk_wayland_window_get_wl_surface (toplevel));
+
+    // Frames are committed from the raster thread, independent of GTK's commits.
+    wl_subsurface_set_desync (self->subsurface);
+
+    // Leave input to the GDK window underneath.
+    struct wl_region *region = wl_compositor_create_region (compositor);
+    wl_surface_set_input_region (self->surface, region);
+    wl_region_destroy (region);
+
+    self->widget = widget;
+    g_object_add_weak_pointer (G_OBJECT (widget), (gpointer *) &self->widget);
+    g_signal_connect_object (widget, "size-allocate", G_CALLBACK (fl_renderer_wayland_size_allocate_cb), self, G_CONNECT_AFTER);
+    g_signal_connect_object (widget, "unmap", G_CALLBACK (fl_renderer_wayland_unmap_cb), self, 0);
+    update_position (self);
+
+    // GDK commits the window in its own after-paint handler, connected before this one.
+    self->frame_clock = gdk_window_get_frame_clock (toplevel);
+    if (self->frame_clock != NULL) {
+        g_object_ref (self->frame_clock);
+        self->before_paint_handler = g_signal_connect_object (self->frame_clock, "before-paint",
+                                                              G_CALLBACK (fl_renderer_wayland_before_paint_cb), self, 0);
+        self->after_paint_handler = g_signal_connect_object (self->frame_clock, "after-paint",
+                                                             G_CALLBACK (fl_renderer_wayland_after_paint_cb), self, G_CONNECT_AFTER);
+    }
+
+    FlRendererState state = *fl_renderer_get_state (FL_RENDERER (self));
+    g_mutex_lock (&self->resize_mutex);
+    self->allocated_width = state.width;
+    self->allocated_height = state.height;
+    g_mutex_unlock (&self->resize_mutex);
+    self->egl_window_width = MAX (state.width, 1);
+    self->egl_window_height = MAX (state.height, 1);
+    self->egl_window = wl_egl_window_create (self->surface, self->egl_window_width, self->egl_window_height);
+
+    // Published along with the surface made from it.
+    state.window = self->egl_window;
+    fl_renderer_publish_state (FL_RENDERER (self), &state);
+
+    return eglCreateWindowSurface (display, config, (EGLNativeWindowType) self->egl_window, NULL);
+}
+
+static void
+fl_renderer_wayland_stop (FlRenderer *renderer)
+{
+    FlRendererWayland *self = FL_RENDERER_WAYLAND (renderer);
+
+    // The EGL surface has to go before the window it was created on.
+    FL_RENDERER_CLASS (fl_renderer_wayland_parent_class)->stop (renderer);
+
+    if (self->widget != NULL) {
+        g_signal_handlers_disconnect_by_data (self->widget, self);
+        g_object_remove_weak_pointer (G_OBJECT (self->widget), (gpointer *) &self->widget);
+        self->widget = NULL;
+    }
+    if (self->frame_clock != NULL) {
+        g_clear_signal_handler (&self->before_paint_handler, self->frame_clock);
+        g_clear_signal_handler (&self->after_paint_handler, self->frame_clock);
+        g_clear_object (&self->frame_clock);
+    }
+    FlRendererState state = *fl_renderer_get_state (renderer);
+    state.window = NULL;
+    fl_renderer_publish_state (renderer, &state);
+    g_clear_pointer (&self->egl_window, wl_egl_window_destroy);
+    g_clear_pointer (&self->subsurface, wl_subsurface_destroy);
+    g_clear_pointer (&self->surface, wl_surface_destroy);
+    g_mutex_lock (&self->resize_mutex);
+    self->resize_state = RESIZE_NONE;
+    g_mutex_unlock (&self->resize_mutex);
+}
+
+// The compositor keeps the last buffer, there is nothing to repaint.
+static FlRendererDrawResult
+fl_renderer_wayland_draw (FlRenderer *renderer, cairo_t *cr)
+{
+    return FL_RENDERER_DRAW_DONE;
+}
+
+static gboolean
+fl_renderer_wayland_make_current (FlRenderer *renderer)
+{
+    FlRendererWayland *self = FL_RENDERER_WAYLAND (renderer);
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+
+    if (!FL_RENDERER_CLASS (fl_renderer_wayland_parent_class)->make_current (renderer))
+        return FALSE;
+
+    // Resize between frames, on the thread that swaps, to the size the frame is drawn at.
+    gint width = MAX (state->width, 1);
+    gint height = MAX (state->height, 1);
+    if (state->window != NULL && (width != self->egl_window_width || height != self->egl_window_height)) {
+        wl_egl_window_resize (state->window, width, height, 0, 0);
+        self->egl_window_width = width;
+        self->egl_window_height = height;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+fl_renderer_wayland_present (FlRenderer *renderer)
+{
+    FlRendererWayland *self = FL_RENDERER_WAYLAND (renderer);
+    const FlRendererState *state = fl_renderer_get_frame_state (renderer);
+
+    if (!FL_RENDERER_CLASS (fl_renderer_wayland_parent_class)->present (renderer))
+        return FALSE;
+
+    // The resized frame is cached until GTK next commits the window, which
+    // desynchronizes the subsurface again once it has.
+    g_mutex_lock (&self->resize_mutex);
+    gboolean queue_draw = self->resize_state == RESIZE_WAITING &&
+                          self->egl_window_width == MAX (state->width, 1) && self->egl_window_height == MAX (state->height, 1) &&
+                          self->egl_window_width == MAX (self->allocated_width, 1) && self->egl_window_height == MAX (self->allocated_height, 1);
+    if (queue_draw)
+        self->resize_state = RESIZE_PRESENTED;
+    g_mutex_unlock (&self->resize_mutex);
+    if (queue_draw)
+        g_idle_add (fl_renderer_wayland_queue_draw_cb, g_object_ref (self));
+
+    return TRUE;
+}
+
+static void
+fl_renderer_wayland_dispose (GObject *object)
+{
+    FlRendererWayland *self = FL_RENDERER_WAYLAND (object);
+
+    fl_renderer_stop (FL_RENDERER (self));
+    g_clear_pointer (&self->subcompositor, wl_subcompositor_destroy);
+
+    G_OBJECT_CLASS (fl_renderer_wayland_parent_class)->dispose (object);
+}
+
+static void
+fl_renderer_wayland_finalize (GObject *object)
+{
+    FlRendererWayland *self = FL_RENDERER_WAYLAND (object);
+
+    g_mutex_clear (&self->resize_mutex);
+
+    G_OBJECT_CLASS (fl_renderer_wayland_parent_class)->finalize (object);
+}
+
+static void
+fl_renderer_wayland_class_init (FlRendererWaylandClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_renderer_wayland_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_renderer_wayland_finalize;
+    FL_RENDERER_CLASS (klass)->stop = fl_renderer_wayland_stop;
+    FL_RENDERER_CLASS (klass)->draw = fl_renderer_wayland_draw;
+    FL_RENDERER_CLASS (klass)->make_current = fl_renderer_wayland_make_current;
+    FL_RENDERER_CLASS (klass)->present = fl_renderer_wayland_present;
+    FL_RENDERER_EGL_CLASS (klass)->create_display = fl_renderer_wayland_create_display;
+    FL_RENDERER_EGL_CLASS (klass)->create_surface = fl_renderer_wayland_create_surface;
+}
+
+static void
+fl_renderer_wayland_init (FlRendererWayland *self)
+{
+    g_mutex_init (&self->resize_mutex);
+}
+
+FlRendererWayland *
+fl_renderer_wayland_new (void)
+{
+    return g_object_new (fl_renderer_wayland_get_type (), NULL);
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include "fl-renderer-egl.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlRendererWayland, fl_renderer_wayland, FL, RENDERER_WAYLAND, FlRendererEgl)
+
+/* Renders into a Wayland subsurface placed over the widget, without going
+ * through XWayland. */
+
+FlRendererWayland *fl_renderer_wayland_new (void);
+
+G_END_DECLS
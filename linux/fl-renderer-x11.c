@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <gdk/gdkx.h>
+
+#include "fl-renderer-x11.h"
+
+struct _FlRendererX11
+{
+    FlRendererEgl parent_instance;
+};
+
+G_DEFINE_TYPE (FlRendererX11, fl_renderer_x11, fl_renderer_egl_get_type ())
+
+static EGLDisplay
+fl_renderer_x11_create_display (FlRendererEgl *renderer, GdkDisplay *display)
+{
+    return eglGetDisplay (EGL_DEFAULT_DISPLAY);//(EGLNativeDisplayType) gdk_x11_display_get_xdisplay (display));
+}
+
+static EGLSurface
+fl_renderer_x11_create_surface (FlRendererEgl *renderer, GtkWidget *widget, EGLDisplay display, EGLConfig config)
+{
+    return eglCreateWindowSurface (display, config, gdk_x11_window_get_xid (gtk_widget_get_window (widget)), NULL);
+}
+
+static void
+fl_renderer_x11_class_init (FlRendererX11Class *klass)
+{
+    FL_RENDERER_EGL_CLASS (klass)->create_display = fl_renderer_x11_create_display;
+    FL_RENDERER_EGL_CLASS (klass)->create_surface = fl_renderer_x11_create_surface;
+}
+
+static void
+fl_renderer_x11_init (FlRendererX11 *self)
+{
+}
+
+FlRendererX11 *
+fl_renderer_x11_new (void)
+{
+    return g_object_new (fl_renderer_x11_get_type (), NULL);
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include "fl-renderer-egl.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlRendererX11, fl_renderer_x11, FL, RENDERER_X11, FlRendererEgl)
+
+/* Renders into a native X window of the widget's own. */
+
+FlRendererX11 *fl_renderer_x11_new (void);
+
+G_END_DECLS
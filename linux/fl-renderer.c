@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <math.h>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include "fl-renderer.h"
+
+typedef struct
+{
+    // Last state published, only used from the main thread.
+    FlRendererState state;
+
+    // Copy of the last state published, until the raster thread picks it up.
+    FlRendererState *pending_state;
+
+    // Copy the raster thread is using, only used from the raster thread.
+    FlRendererState *frame_state;
+} FlRendererPrivate;
+
+G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE (FlRenderer, fl_renderer, G_TYPE_OBJECT)
+
+static void
+fl_renderer_real_stop (FlRenderer *self)
+{
+}
+
+static void
+fl_renderer_real_resize (FlRenderer *self, gint width, gint height)
+{
+}
+
+static FlRendererDrawResult
+fl_renderer_real_draw (FlRenderer *self, cairo_t *cr)
+{
+    return FL_RENDERER_DRAW_NEEDS_FRAME;
+}
+
+static gsize
+fl_renderer_real_get_buffer_size (FlRenderer *self)
+{
+    return 0;
+}
+
+static guint32
+fl_renderer_real_get_fbo (FlRenderer *self)
+{
+    return 0;
+}
+
+static void
+fl_renderer_real_discard_frame (FlRenderer *self)
+{
+}
+
+static void
+fl_renderer_real_repaint (FlRenderer *self, cairo_region_t *damage)
+{
+}
+
+static cairo_surface_t *
+fl_renderer_real_read_frame (FlRenderer *self)
+{
+    return NULL;
+}
+
+static gboolean
+fl_renderer_real_frame_needs_raster_thread (FlRenderer *self)
+{
+    return FALSE;
+}
+
+static gboolean
+fl_renderer_real_get_fbo_reset_after_present (FlRenderer *self)
+{
+    return FALSE;
+}
+
+static void *
+fl_renderer_real_get_proc_address (FlRenderer *self, const gchar *name)
+{
+    return eglGetProcAddress (name);
+}
+
+// Only the raster thread takes the pending state, so the copy it replaces is no longer in use.
+static void
+fl_renderer_update_frame_state (FlRenderer *self)
+{
+    FlRendererPrivate *priv = fl_renderer_get_instance_private (self);
+    FlRendererState *state;
+
+    do {
+        state = g_atomic_pointer_get (&priv->pending_state);
+    } while (state != NULL && !g_atomic_pointer_compare_and_exchange (&priv->pending_state, state, NULL));
+
+    if (state != NULL) {
+        g_free (priv->frame_state);
+        priv->frame_state = state;
+    }
+}
+
+static void
+fl_renderer_finalize (GObject *object)
+{
+    FlRendererPrivate *priv = fl_renderer_get_instance_private (FL_RENDERER (object));
+
+    g_free (priv->pending_state);
+    g_free (priv->frame_state);
+
+    G_OBJECT_CLASS (fl_renderer_parent_class)->finalize (object);
+}
+
+static void
+fl_renderer_class_init (FlRendererClass *klass)
+{
+    G_OBJECT_CLASS (klass)->finalize = fl_renderer_finalize;
+    klass->stop = fl_renderer_real_stop;
+    klass->resize = fl_renderer_real_resize;
+    klass->draw = fl_renderer_real_draw;
+    klass->get_buffer_size = fl_renderer_real_get_buffer_size;
+    klass->get_fbo = fl_renderer_real_get_fbo;
+    klass->discard_frame = fl_renderer_real_discard_frame;
+    klass->repaint = fl_renderer_real_repaint;
+    klass->read_frame = fl_renderer_real_read_frame;
+    klass->frame_needs_raster_thread = fl_renderer_real_frame_needs_raster_thread;
+    klass->get_fbo_reset_after_present = fl_renderer_real_get_fbo_reset_after_present;
+    klass->get_proc_address = fl_renderer_real_get_proc_address;
+}
+
+static void
+fl_renderer_init (FlRenderer *self)
+{
+    FlRendererPrivate *priv = fl_renderer_get_instance_private (self);
+
+    priv->frame_state = g_new0 (FlRendererState, 1);
+}
+
+gboolean
+fl_renderer_start (FlRenderer *self, GtkWidget *widget)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), FALSE);
+    g_return_val_if_fail (gtk_widget_get_realized (widget), FALSE);
+
+    return FL_RENDERER_GET_CLASS (self)->start (self, widget);
+}
+
+void
+fl_renderer_stop (FlRenderer *self)
+{
+    g_return_if_fail (FL_IS_RENDERER (self));
+
+    FL_RENDERER_GET_CLASS (self)->stop (self);
+}
+
+void
+fl_renderer_set_size (FlRenderer *self, gint width, gint height)
+{
+    FlRendererPrivate *priv = fl_renderer_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_RENDERER (self));
+
+    FlRendererState state = priv->state;
+    state.width = width;
+    state.height = height;
+    fl_renderer_publish_state (self, &state);
+    FL_RENDERER_GET_CLASS (self)->resize (self, width, height);
+}
+
+const FlRendererState *
+fl_renderer_get_state (FlRenderer *self)
+{
+    FlRendererPrivate *priv = fl_renderer_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_RENDERER (self), NULL);
+
+    return &priv->state;
+}
+
+const FlRendererState *
+fl_renderer_get_frame_state (FlRenderer *self)
+{
+    FlRendererPrivate *priv = fl_renderer_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_RENDERER (self), NULL);
+
+    return priv->frame_state;
+}
+
+FlRendererDrawResult
+fl_renderer_draw (FlRenderer *self, cairo_t *cr)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), FL_RENDERER_DRAW_NEEDS_FRAME);
+
+    return FL_RENDERER_GET_CLASS (self)->draw (self, cr);
+}
+
+gsize
+fl_renderer_get_buffer_size (FlRenderer *self)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), 0);
+
+    return FL_RENDERER_GET_CLASS (self)->get_buffer_size (self);
+}
+
+gboolean
+fl_renderer_make_current (FlRenderer *self)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), FALSE);
+
+    fl_renderer_update_frame_state (self);
+    return FL_RENDERER_GET_CLASS (self)->make_current (self);
+}
+
+gboolean
+fl_renderer_clear_current (FlRenderer *self)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), FALSE);
+
+    return FL_RENDERER_GET_CLASS (self)->clear_current (self);
+}
+
+guint32
+fl_renderer_get_fbo (FlRenderer *self)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), 0);
+
+    return FL_RENDERER_GET_CLASS (self)->get_fbo (self);
+}
+
+gboolean
+fl_renderer_present (FlRenderer *self)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), FALSE);
+
+    return FL_RENDERER_GET_CLASS (self)->present (self);
+}
+
+void
+fl_renderer_discard_frame (FlRenderer *self)
+{
+    g_return_if_fail (FL_IS_RENDERER (self));
+
+    FL_RENDERER_GET_CLASS (self)->discard_frame (self);
+}
+
+void
+fl_renderer_repaint (FlRenderer *self, cairo_region_t *damage)
+{
+    g_return_if_fail (FL_IS_RENDERER (self));
+
+    fl_renderer_update_frame_state (self);
+    FL_RENDERER_GET_CLASS (self)->repaint (self, damage);
+}
+
+cairo_surface_t *
+fl_renderer_read_frame (FlRenderer *self)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), NULL);
+
+    return FL_RENDERER_GET_CLASS (self)->read_frame (self);
+}
+
+gboolean
+fl_renderer_frame_needs_raster_thread (FlRenderer *self)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), FALSE);
+
+    return FL_RENDERER_GET_CLASS (self)->frame_needs_raster_thread (self);
+}
+
+gboolean
+fl_renderer_get_fbo_reset_after_present (FlRenderer *self)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), FALSE);
+
+    return FL_RENDERER_GET_CLASS (self)->get_fbo_reset_after_present (self);
+}
+
+void *
+fl_renderer_get_proc_address (FlRenderer *self, const gchar *name)
+{
+    g_return_val_if_fail (FL_IS_RENDERER (self), NULL);
+
+    return FL_RENDERER_GET_CLASS (self)->get_proc_address (self, name);
+}
+
+// Replace the state the raster thread picks up next. Copies it hasn't seen are freed here.
+void
+fl_renderer_publish_state (FlRenderer *self, const FlRendererState *state)
+{
+    FlRendererPrivate *priv = fl_renderer_get_instance_private (self);
+    FlRendererState *old_state;
+
+    g_return_if_fail (FL_IS_RENDERER (self));
+
+    priv->state = *state;
+    FlRendererState *new_state = g_new (FlRendererState, 1);
+    *new_state = *state;
+    do {
+        old_state = g_atomic_pointer_get (&priv->pending_state);
+    } while (!g_atomic_pointer_compare_and_exchange (&priv->pending_state, old_state, new_state));
+    g_free (old_state);
+}
+
+// Convert pixels read from GL into Cairo's format, in @data with @stride bytes per row.
+void
+fl_renderer_convert_pixels (const guint8 *pixels, gint width, gint height, guint8 *data, gint stride)
+{
+    // GL is bottom-up RGBA, Cairo is top-down native-endian ARGB. Both are premultiplied.
+    for (gint y = 0; y < height; y++) {
+        const guint8 *src = pixels + (gsize) (height - y - 1) * width * 4;
+        guint32 *dst = (guint32 *) (data + (gsize) y * stride);
+        for (gint x = 0; x < width; x++, src += 4)
+            dst[x] = (guint32) src[3] << 24 | (guint32) src[0] << 16 | (guint32) src[1] << 8 | src[2];
+    }
+}
+
+// Convert pixels read from GL into a Cairo image.
+cairo_surface_t *
+fl_renderer_image_from_pixels (const guint8 *pixels, gint width, gint height)
+{
+    cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+
+    fl_renderer_convert_pixels (pixels, width, height,
+                                cairo_image_surface_get_data (surface), cairo_image_surface_get_stride (surface));
+    cairo_surface_mark_dirty (surface);
+
+    return surface;
+}
+
+// Read the current GL framebuffer into a Cairo image.
+cairo_surface_t *
+fl_renderer_read_framebuffer (gint width, gint height)
+{
+    g_autofree guint8 *pixels = g_malloc ((gsize) width * height * 4);
+
+    glReadPixels (0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    return fl_renderer_image_from_pixels (pixels, width, height);
+}
+
+// Add the area being drawn by @cr to @region.
+void
+fl_renderer_add_clip_to_region (cairo_t *cr, cairo_region_t *region)
+{
+    cairo_rectangle_list_t *rects = cairo_copy_clip_rectangle_list (cr);
+    if (rects->status == CAIRO_STATUS_SUCCESS) {
+        for (gint i = 0; i < rects->num_rectangles; i++) {
+            cairo_rectangle_t *r = &rects->rectangles[i];
+            cairo_rectangle_int_t rect;
+            rect.x = floor (r->x);
+            rect.y = floor (r->y);
+            rect.width = ceil (r->x + r->width) - rect.x;
+            rect.height = ceil (r->y + r->height) - rect.y;
+            cairo_region_union_rectangle (region, &rect);
+        }
+    } else {
+        GdkRectangle clip;
+        if (gdk_cairo_get_clip_rectangle (cr, &clip))
+            cairo_region_union_rectangle (region, (cairo_rectangle_int_t *) &clip);
+    }
+    cairo_rectangle_list_destroy (rects);
+}
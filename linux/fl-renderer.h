@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_DERIVABLE_TYPE (FlRenderer, fl_renderer, FL, RENDERER, GObject)
+
+typedef enum
+{
+    // The exposed area has been repainted from the last frame.
+    FL_RENDERER_DRAW_DONE,
+    // fl_renderer_repaint() needs to be called from the raster thread.
+    FL_RENDERER_DRAW_NEEDS_RASTER_THREAD,
+    // Nothing was kept, the engine has to draw a new frame.
+    FL_RENDERER_DRAW_NEEDS_FRAME
+} FlRendererDrawResult;
+
+/* What the raster thread renders with. The main thread publishes a new copy
+ * whenever it changes and the raster thread picks it up in
+ * fl_renderer_make_current(), so a copy is never changed while in use and no
+ * lock is needed on the raster thread. */
+typedef struct
+{
+    // Size of the widget.
+    gint width;
+    gint height;
+
+    // Native window, EGL surface and context, and present thread of EGL
+    // renderers. Not owned, they are only destroyed with the engine stopped.
+    gpointer window;
+    gpointer surface;
+    gpointer context;
+    gpointer present_thread;
+} FlRendererState;
+
+struct _FlRendererClass
+{
+    GObjectClass parent_class;
+
+    // Called from the main thread
+    gboolean (*start) (FlRenderer *renderer, GtkWidget *widget);
+    void (*stop) (FlRenderer *renderer);
+    void (*resize) (FlRenderer *renderer, gint width, gint height);
+    FlRendererDrawResult (*draw) (FlRenderer *renderer, cairo_t *cr);
+    gsize (*get_buffer_size) (FlRenderer *renderer);
+
+    // Called from the raster thread
+    gboolean (*make_current) (FlRenderer *renderer);
+    gboolean (*clear_current) (FlRenderer *renderer);
+    guint32 (*get_fbo) (FlRenderer *renderer);
+    gboolean (*present) (FlRenderer *renderer);
+    void (*discard_frame) (FlRenderer *renderer);
+    void (*repaint) (FlRenderer *renderer, cairo_region_t *damage);
+
+    // Called from the raster thread if frame_needs_raster_thread returns TRUE,
+    // otherwise from the main thread
+    cairo_surface_t *(*read_frame) (FlRenderer *renderer);
+
+    // Called from any thread
+    gboolean (*frame_needs_raster_thread) (FlRenderer *renderer);
+    gboolean (*get_fbo_reset_after_present) (FlRenderer *renderer);
+    void *(*get_proc_address) (FlRenderer *renderer, const gchar *name);
+};
+
+/* Draws the frames of an engine into a widget. */
+
+gboolean               fl_renderer_start                       (FlRenderer *renderer, GtkWidget *widget);
+
+void                   fl_renderer_stop                        (FlRenderer *renderer);
+
+void                   fl_renderer_set_size                    (FlRenderer *renderer, gint width, gint height);
+
+/* Called from the main thread, returns the last state published */
+
+const FlRendererState *fl_renderer_get_state                   (FlRenderer *renderer);
+
+/* Called from the raster thread, returns the state picked up by the last
+ * fl_renderer_make_current() or fl_renderer_repaint() */
+
+const FlRendererState *fl_renderer_get_frame_state             (FlRenderer *renderer);
+
+FlRendererDrawResult   fl_renderer_draw                        (FlRenderer *renderer, cairo_t *cr);
+
+gsize                  fl_renderer_get_buffer_size             (FlRenderer *renderer);
+
+gboolean               fl_renderer_make_current                (FlRenderer *renderer);
+
+gboolean               fl_renderer_clear_current               (FlRenderer *renderer);
+
+guint32                fl_renderer_get_fbo                     (FlRenderer *renderer);
+
+gboolean               fl_renderer_present                     (FlRenderer *renderer);
+
+void                   fl_renderer_discard_frame               (FlRenderer *renderer);
+
+void                   fl_renderer_repaint                     (FlRenderer *renderer, cairo_region_t *damage);
+
+cairo_surface_t       *fl_renderer_read_frame                  (FlRenderer *renderer);
+
+gboolean               fl_renderer_frame_needs_raster_thread   (FlRenderer *renderer);
+
+gboolean               fl_renderer_get_fbo_reset_after_present (FlRenderer *renderer);
+
+void                  *fl_renderer_get_proc_address            (FlRenderer *renderer, const gchar *name);
+
+/* Helpers for renderer implementations */
+
+void                   fl_renderer_publish_state               (FlRenderer *renderer, const FlRendererState *state);
+
+void                   fl_renderer_convert_pixels              (const guint8 *pixels, gint width, gint height, guint8 *data, gint stride);
+
+cairo_surface_t       *fl_renderer_image_from_pixels           (const guint8 *pixels, gint width, gint height);
+
+cairo_surface_t       *fl_renderer_read_framebuffer            (gint width, gint height);
+
+void                   fl_renderer_add_clip_to_region          (cairo_t *cr, cairo_region_t *region);
+
+G_END_DECLS
@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <string.h>
+
+#include "fl-semantics-tree.h"
+
+// Children entries left unused before the array is compacted.
+#define MIN_UNUSED_CHILDREN 1024
+
+struct _FlSemanticsTree
+{
+    GObject parent_instance;
+
+    // FlSemanticsNode, indexed by ID.
+    GArray *nodes;
+
+    // Node IDs, in spans for each node.
+    GArray *children;
+    guint n_unused_children;
+
+    // Nodes taken out of their parent this batch, removed at the end of it unless added elsewhere.
+    GArray *detached;
+
+    // IDs of nodes with changes not taken yet.
+    GArray *changed;
+    gboolean batch_changed;
+
+    GHashTable *custom_actions;
+};
+
+G_DEFINE_TYPE (FlSemanticsTree, fl_semantics_tree, G_TYPE_OBJECT)
+
+static FlSemanticsNode *
+get_node (FlSemanticsTree *self, gint32 id)
+{
+    return &g_array_index (self->nodes, FlSemanticsNode, id);
+}
+
+// Grow the array to hold @id, which moves the nodes.
+static void
+reserve_node (FlSemanticsTree *self, gint32 id)
+{
+    guint old_length = self->nodes->len;
+    if ((guint) id < old_length)
+        return;
+
+    g_array_set_size (self->nodes, id + 1);
+    for (guint i = old_length; i < self->nodes->len; i++)
+        get_node (self, i)->parent = -1;
+}
+
+static void
+mark_changed (FlSemanticsTree *self, gint32 id, FlSemanticsChange change)
+{
+    FlSemanticsNode *node = get_node (self, id);
+
+    node->changes |= change;
+    if (!node->queued) {
+        node->queued = TRUE;
+        g_array_append_val (self->changed, id);
+    }
+    self->batch_changed = TRUE;
+}
+
+static gboolean
+update_string (gchar **value, const gchar *new_value)
+{
+    if (new_value == NULL)
+        new_value = "";
+    if (*value != NULL && strcmp (*value, new_value) == 0)
+        return FALSE;
+
+    g_free (*value);
+    *value = g_strdup (new_value);
+    return TRUE;
+}
+
+static void
+clear_node (FlSemanticsNode *node)
+{
+    g_clear_pointer (&node->label, g_free);
+    g_clear_pointer (&node->value, g_free);
+    g_clear_pointer (&node->hint, g_free);
+}
+
+static void
+compact_children (FlSemanticsTree *self)
+{
+    GArray *children = g_array_sized_new (FALSE, FALSE, sizeof (gint32), self->children->len - self->n_unused_children);
+
+    for (guint i = 0; i < self->nodes->len; i++) {
+        FlSemanticsNode *node = get_node (self, i);
+        if (!node->present || node->n_children == 0)
+            continue;
+        guint start = children->len;
+        g_array_append_vals (children, &g_array_index (self->children, gint32, node->children_start), node->n_children);
+        node->children_start = start;
+    }
+
+    g_array_unref (self->children);
+    self->children = children;
+    self->n_unused_children = 0;
+}
+
+static void
+set_children (FlSemanticsTree *self, gint32 id, const int32_t *children, guint n_children)
+{
+    FlSemanticsNode *node = get_node (self, id);
+
+    if (node->n_children == n_children &&
+        memcmp (&g_array_index (self->children, gint32, node->children_start), children, n_children * sizeof (gint32)) == 0)
+        return;
+
+    for (guint i = 0; i < node->n_children; i++) {
+        gint32 child_id = g_array_index (self->children, gint32, node->children_start + i);
+        FlSemanticsNode *child = get_node (self, child_id);
+        if (child->parent == id) {
+            child->parent = -1;
+            g_array_append_val (self->detached, child_id);
+        }
+    }
+
+    // Reuse the span if the children fit in it.
+    if (n_children <= node->n_children) {
+        self->n_unused_children += node->n_children - n_children;
+        memcpy (&g_array_index (self->children, gint32, node->children_start), children, n_children * sizeof (gint32));
+    } else {
+        self->n_unused_children += node->n_children;
+        node->children_start = self->children->len;
+        g_array_append_vals (self->children, children, n_children);
+    }
+    node->n_children = n_children;
+
+    for (guint i = 0; i < n_children; i++)
+        get_node (self, children[i])->parent = id;
+
+    mark_changed (self, id, FL_SEMANTICS_CHANGE_CHILDREN);
+}
+
+static void
+remove_subtree (FlSemanticsTree *self, gint32 id)
+{
+    g_autoptr(GArray) stack = g_array_new (FALSE, FALSE, sizeof (gint32));
+
+    g_array_append_val (stack, id);
+    while (stack->len > 0) {
+        gint32 node_id = g_array_index (stack, gint32, stack->len - 1);
+        g_array_set_size (stack, stack->len - 1);
+
+        FlSemanticsNode *node = get_node (self, node_id);
+        if (!node->present)
+            continue;
+        for (guint i = 0; i < node->n_children; i++) {
+            gint32 child_id = g_array_index (self->children, gint32, node->children_start + i);
+            if (get_node (self, child_id)->parent == node_id)
+                g_array_append_val (stack, child_id);
+        }
+
+        clear_node (node);
+        node->present = FALSE;
+        node->parent = -1;
+        self->n_unused_children += node->n_children;
+        node->n_children = 0;
+
+        // Never seen, so nothing needs to hear it went.
+        if (node->changes & FL_SEMANTICS_CHANGE_ADDED)
+            node->changes = 0;
+        else
+            mark_changed (self, node_id, FL_SEMANTICS_CHANGE_REMOVED);
+    }
+}
+
+static void
+fl_semantics_tree_dispose (GObject *object)
+{
+    FlSemanticsTree *self = FL_SEMANTICS_TREE (object);
+
+    if (self->nodes != NULL)
+        fl_semantics_tree_clear (self);
+    g_clear_pointer (&self->nodes, g_array_unref);
+    g_clear_pointer (&self->children, g_array_unref);
+    g_clear_pointer (&self->detached, g_array_unref);
+    g_clear_pointer (&self->changed, g_array_unref);
+    g_clear_pointer (&self->custom_actions, g_hash_table_unref);
+
+    G_OBJECT_CLASS (fl_semantics_tree_parent_class)->dispose (object);
+}
+
+static void
+fl_semantics_tree_class_init (FlSemanticsTreeClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_semantics_tree_dispose;
+}
+
+static void
+fl_semantics_tree_init (FlSemanticsTree *self)
+{
+    self->nodes = g_array_new (FALSE, TRUE, sizeof (FlSemanticsNode));
+    self->children = g_array_new (FALSE, FALSE, sizeof (gint32));
+    self->detached = g_array_new (FALSE, FALSE, sizeof (gint32));
+    self->changed = g_array_new (FALSE, FALSE, sizeof (gint32));
+    self->custom_actions = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+}
+
+FlSemanticsTree *
+fl_semantics_tree_new (void)
+{
+    return g_object_new (fl_semantics_tree_get_type (), NULL);
+}
+
+void
+fl_semantics_tree_update_node (FlSemanticsTree *self, const FlutterSemanticsNode *update)
+{
+    g_return_if_fail (FL_IS_SEMANTICS_TREE (self));
+    g_return_if_fail (update->id >= 0);
+
+    // Grow once for the node and its children, so node pointers stay valid below.
+    gint32 max_id = update->id;
+    for (size_t i = 0; i < update->child_count; i++) {
+        g_return_if_fail (update->children_in_traversal_order[i] >= 0);
+        max_id = MAX (max_id, update->children_in_traversal_order[i]);
+    }
+    reserve_node (self, max_id);
+
+    FlSemanticsNode *node = get_node (self, update->id);
+    if (!node->present) {
+        node->present = TRUE;
+        mark_changed (self, update->id, FL_SEMANTICS_CHANGE_ADDED);
+        node->changes &= ~FL_SEMANTICS_CHANGE_REMOVED;
+    }
+
+    if (node->flags != update->flags || node->actions != update->actions) {
+        node->flags = update->flags;
+        node->actions = update->actions;
+        mark_changed (self, update->id, FL_SEMANTICS_CHANGE_STATE);
+    }
+    if (memcmp (&node->rect, &update->rect, sizeof (FlutterRect)) != 0 ||
+        memcmp (&node->transform, &update->transform, sizeof (FlutterTransformation)) != 0) {
+        node->rect = update->rect;
+        node->transform = update->transform;
+        mark_changed (self, update->id, FL_SEMANTICS_CHANGE_BOUNDS);
+    }
+    gboolean text_changed = update_string (&node->label, update->label);
+    text_changed |= update_string (&node->value, update->value);
+    text_changed |= update_string (&node->hint, update->hint);
+    if (text_changed)
+        mark_changed (self, update->id, FL_SEMANTICS_CHANGE_TEXT);
+
+    set_children (self, update->id, update->children_in_traversal_order, update->child_count);
+
+    if (self->n_unused_children > MIN_UNUSED_CHILDREN && self->n_unused_children > self->children->len / 2)
+        compact_children (self);
+}
+
+void
+fl_semantics_tree_update_custom_action (FlSemanticsTree *self, const FlutterSemanticsCustomAction *action)
+{
+    g_return_if_fail (FL_IS_SEMANTICS_TREE (self));
+
+    g_hash_table_insert (self->custom_actions, GINT_TO_POINTER (action->id), g_strdup (action->label));
+}
+
+gboolean
+fl_semantics_tree_end_batch (FlSemanticsTree *self)
+{
+    g_return_val_if_fail (FL_IS_SEMANTICS_TREE (self), FALSE);
+
+    for (guint i = 0; i < self->detached->len; i++) {
+        gint32 id = g_array_index (self->detached, gint32, i);
+        FlSemanticsNode *node = get_node (self, id);
+        if (id != FL_SEMANTICS_TREE_ROOT_ID && node->present && node->parent == -1)
+            remove_subtree (self, id);
+    }
+    g_array_set_size (self->detached, 0);
+
+    gboolean changed = self->batch_changed;
+    self->batch_changed = FALSE;
+
+    return changed;
+}
+
+void
+fl_semantics_tree_clear (FlSemanticsTree *self)
+{
+    g_return_if_fail (FL_IS_SEMANTICS_TREE (self));
+
+    for (guint i = 0; i < self->nodes->len; i++)
+        clear_node (get_node (self, i));
+    g_array_set_size (self->nodes, 0);
+    g_array_set_size (self->children, 0);
+    g_array_set_size (self->detached, 0);
+    g_array_set_size (self->changed, 0);
+    self->n_unused_children = 0;
+    self->batch_changed = FALSE;
+    g_hash_table_remove_all (self->custom_actions);
+}
+
+const FlSemanticsNode *
+fl_semantics_tree_lookup (FlSemanticsTree *self, gint32 id)
+{
+    g_return_val_if_fail (FL_IS_SEMANTICS_TREE (self), NULL);
+
+    if (id < 0 || (guint) id >= self->nodes->len)
+        return NULL;
+
+    FlSemanticsNode *node = get_node (self, id);
+    return node->present ? node : NULL;
+}
+
+gint32
+fl_semantics_tree_get_child (FlSemanticsTree *self, const FlSemanticsNode *node, guint index)
+{
+    g_return_val_if_fail (FL_IS_SEMANTICS_TREE (self), -1);
+    g_return_val_if_fail (index < node->n_children, -1);
+
+    return g_array_index (self->children, gint32, node->children_start + index);
+}
+
+gint
+fl_semantics_tree_get_index_in_parent (FlSemanticsTree *self, gint32 id)
+{
+    g_return_val_if_fail (FL_IS_SEMANTICS_TREE (self), -1);
+
+    const FlSemanticsNode *node = fl_semantics_tree_lookup (self, id);
+    const FlSemanticsNode *parent = node != NULL ? fl_semantics_tree_lookup (self, node->parent) : NULL;
+    if (parent == NULL)
+        return -1;
+
+    for (guint i = 0; i < parent->n_children; i++) {
+        if (g_array_index (self->children, gint32, parent->children_start + i) == id)
+            return i;
+    }
+
+    return -1;
+}
+
+const gchar *
+fl_semantics_tree_get_custom_action_label (FlSemanticsTree *self, gint32 id)
+{
+    g_return_val_if_fail (FL_IS_SEMANTICS_TREE (self), NULL);
+
+    return g_hash_table_lookup (self->custom_actions, GINT_TO_POINTER (id));
+}
+
+GArray *
+fl_semantics_tree_take_changes (FlSemanticsTree *self)
+{
+    g_return_val_if_fail (FL_IS_SEMANTICS_TREE (self), NULL);
+
+    GArray *changes = g_array_sized_new (FALSE, FALSE, sizeof (FlSemanticsNodeChange), self->changed->len);
+    for (guint i = 0; i < self->changed->len; i++) {
+        gint32 id = g_array_index (self->changed, gint32, i);
+        FlSemanticsNode *node = get_node (self, id);
+        FlSemanticsNodeChange change = { id, node->changes };
+        node->changes = 0;
+        node->queued = FALSE;
+        if (change.changes != 0)
+            g_array_append_val (changes, change);
+    }
+    g_array_set_size (self->changed, 0);
+
+    return changes;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "embedder.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlSemanticsTree, fl_semantics_tree, FL, SEMANTICS_TREE, GObject)
+
+/* The engine's semantics tree, kept as an array of nodes indexed by node ID.
+ * The children of every node are stored together in one array, each node
+ * holding the span of it that is its children. Updates are applied as they
+ * come from the engine and the nodes they changed are collected until taken
+ * with fl_semantics_tree_take_changes(). */
+
+#define FL_SEMANTICS_TREE_ROOT_ID 0
+
+typedef enum
+{
+    FL_SEMANTICS_CHANGE_ADDED = 1 << 0,
+    FL_SEMANTICS_CHANGE_REMOVED = 1 << 1,
+    // Label, value or hint.
+    FL_SEMANTICS_CHANGE_TEXT = 1 << 2,
+    FL_SEMANTICS_CHANGE_STATE = 1 << 3,
+    FL_SEMANTICS_CHANGE_BOUNDS = 1 << 4,
+    FL_SEMANTICS_CHANGE_CHILDREN = 1 << 5
+} FlSemanticsChange;
+
+typedef struct
+{
+    gboolean present;
+    gint32 parent;
+    FlutterSemanticsFlag flags;
+    FlutterSemanticsAction actions;
+    FlutterRect rect;
+    FlutterTransformation transform;
+    gchar *label;
+    gchar *value;
+    gchar *hint;
+
+    // Span of the tree's children array.
+    guint children_start;
+    guint n_children;
+
+    // Changes not taken yet, and whether the node is in the list of changed nodes.
+    FlSemanticsChange changes;
+    gboolean queued;
+} FlSemanticsNode;
+
+typedef struct
+{
+    gint32 id;
+    FlSemanticsChange changes;
+} FlSemanticsNodeChange;
+
+FlSemanticsTree       *fl_semantics_tree_new                     (void);
+
+void                   fl_semantics_tree_update_node             (FlSemanticsTree *tree, const FlutterSemanticsNode *node);
+
+void                   fl_semantics_tree_update_custom_action    (FlSemanticsTree *tree, const FlutterSemanticsCustomAction *action);
+
+/* Completes a batch of updates, returns TRUE if it changed anything */
+
+gboolean               fl_semantics_tree_end_batch               (FlSemanticsTree *tree);
+
+void                   fl_semantics_tree_clear                   (FlSemanticsTree *tree);
+
+const FlSemanticsNode *fl_semantics_tree_lookup                  (FlSemanticsTree *tree, gint32 id);
+
+gint32                 fl_semantics_tree_get_child               (FlSemanticsTree *tree, const FlSemanticsNode *node, guint index);
+
+gint                   fl_semantics_tree_get_index_in_parent     (FlSemanticsTree *tree, gint32 id);
+
+const gchar           *fl_semantics_tree_get_custom_action_label (FlSemanticsTree *tree, gint32 id);
+
+/* Returns an array of FlSemanticsNodeChange for the nodes changed since the
+ * last call, in the order they were first changed */
+
+GArray                *fl_semantics_tree_take_changes            (FlSemanticsTree *tree);
+
+G_END_DECLS
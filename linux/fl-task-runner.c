@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "fl-task-runner.h"
+
+struct _FlTaskRunner
+{
+    GObject parent_instance;
+
+    FlutterTaskRunnerDescription description;
+
+    // Context tasks are dispatched from, and the thread running it.
+    GMainContext *context;
+    GThread *thread;
+
+    // Set for runners with a thread of their own.
+    GMainLoop *loop;
+    gboolean realtime;
+
+    // Engine to run tasks on, NULL once stopped. Read from any thread.
+    FlutterEngine engine;
+};
+
+typedef struct
+{
+    GSource parent;
+    FlTaskRunner *runner;
+    FlutterTask task;
+} TaskSource;
+
+G_DEFINE_TYPE (FlTaskRunner, fl_task_runner, G_TYPE_OBJECT)
+
+static gboolean
+task_source_dispatch (GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    TaskSource *task_source = (TaskSource *) source;
+
+    // Dropped if the engine has gone.
+    FlutterEngine engine = g_atomic_pointer_get (&task_source->runner->engine);
+    if (engine != NULL)
+        FlutterEngineRunTask (engine, &task_source->task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+task_source_finalize (GSource *source)
+{
+    TaskSource *task_source = (TaskSource *) source;
+
+    g_object_unref (task_source->runner);
+}
+
+// Dispatched at the ready time set on the source.
+static GSourceFuncs task_source_funcs = { NULL, NULL, task_source_dispatch, task_source_finalize };
+
+// FIXME: Called from Flutter thread
+static bool
+fl_task_runner_runs_task_on_current_thread_cb (void *user_data)
+{
+    FlTaskRunner *self = user_data;
+    return g_thread_self () == self->thread;
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_task_runner_post_task_cb (FlutterTask task, uint64_t target_time, void *user_data)
+{
+    FlTaskRunner *self = user_data;
+
+    GSource *source = g_source_new (&task_source_funcs, sizeof (TaskSource));
+    TaskSource *task_source = (TaskSource *) source;
+    task_source->runner = g_object_ref (self);
+    task_source->task = task;
+
+    // The engine's clock may not be the one GLib uses, so only the delay is taken from it.
+    gint64 delay = ((gint64) target_time - (gint64) FlutterEngineGetCurrentTime ()) / 1000;
+    g_source_set_ready_time (source, g_get_monotonic_time () + MAX (delay, 0));
+    g_source_attach (source, self->context);
+    g_source_unref (source);
+}
+
+static gpointer
+task_thread (gpointer user_data)
+{
+    FlTaskRunner *self = user_data;
+
+    // Frames are drawn ahead of everything else on the device.
+    if (self->realtime) {
+        struct sched_param param = { 0 };
+        param.sched_priority = sched_get_priority_min (SCHED_FIFO);
+        int error = pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+        if (error != 0)
+            g_debug ("Failed to make task runner thread real-time: %s", g_strerror (error));
+    }
+
+    g_main_context_push_thread_default (self->context);
+    g_main_loop_run (self->loop);
+    g_main_context_pop_thread_default (self->context);
+
+    return NULL;
+}
+
+static void
+fl_task_runner_dispose (GObject *object)
+{
+    FlTaskRunner *self = FL_TASK_RUNNER (object);
+
+    fl_task_runner_stop (self);
+
+    G_OBJECT_CLASS (fl_task_runner_parent_class)->dispose (object);
+}
+
+static void
+fl_task_runner_class_init (FlTaskRunnerClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_task_runner_dispose;
+}
+
+static void
+fl_task_runner_init (FlTaskRunner *self)
+{
+    self->description.struct_size = sizeof (FlutterTaskRunnerDescription);
+    self->description.user_data = self;
+    self->description.runs_task_on_current_thread_callback = fl_task_runner_runs_task_on_current_thread_cb;
+    self->description.post_task_callback = fl_task_runner_post_task_cb;
+    self->description.identifier = GPOINTER_TO_SIZE (self);
+}
+
+FlTaskRunner *
+fl_task_runner_new_for_main_thread (void)
+{
+    FlTaskRunner *self = g_object_new (fl_task_runner_get_type (), NULL);
+
+    self->context = g_main_context_ref (g_main_context_default ());
+    self->thread = g_thread_self ();
+
+    return self;
+}
+
+FlTaskRunner *
+fl_task_runner_new_thread (const gchar *name, gboolean realtime)
+{
+    FlTaskRunner *self = g_object_new (fl_task_runner_get_type (), NULL);
+
+    self->context = g_main_context_new ();
+    self->loop = g_main_loop_new (self->context, FALSE);
+    self->realtime = realtime;
+    self->thread = g_thread_new (name, task_thread, self);
+
+    return self;
+}
+
+const FlutterTaskRunnerDescription *
+fl_task_runner_get_description (FlTaskRunner *self)
+{
+    g_return_val_if_fail (FL_IS_TASK_RUNNER (self), NULL);
+
+    return &self->description;
+}
+
+void
+fl_task_runner_set_engine (FlTaskRunner *self, FlutterEngine engine)
+{
+    g_return_if_fail (FL_IS_TASK_RUNNER (self));
+
+    g_atomic_pointer_set (&self->engine, engine);
+}
+
+void
+fl_task_runner_stop (FlTaskRunner *self)
+{
+    g_return_if_fail (FL_IS_TASK_RUNNER (self));
+
+    g_atomic_pointer_set (&self->engine, NULL);
+
+    // Tasks left in a context of our own are freed with it, which drops the
+    // references they hold on the runner.
+    if (self->loop != NULL) {
+        g_main_loop_quit (self->loop);
+        g_thread_join (self->thread);
+        self->thread = NULL;
+        g_clear_pointer (&self->loop, g_main_loop_unref);
+    }
+    g_clear_pointer (&self->context, g_main_context_unref);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "embedder.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlTaskRunner, fl_task_runner, FL, TASK_RUNNER, GObject)
+
+/* Runs an engine's tasks on a thread the embedder owns, either the GTK main
+ * thread or a thread of its own. Tasks are only posted once
+ * FlutterEngineInitialize() has returned the engine to pass to
+ * fl_task_runner_set_engine(). */
+
+FlTaskRunner                       *fl_task_runner_new_for_main_thread (void);
+
+/* With @realtime the thread asks for real-time scheduling, which is only
+ * granted with RLIMIT_RTPRIO or CAP_SYS_NICE. */
+
+FlTaskRunner                       *fl_task_runner_new_thread          (const gchar *name, gboolean realtime);
+
+const FlutterTaskRunnerDescription *fl_task_runner_get_description     (FlTaskRunner *runner);
+
+void                                fl_task_runner_set_engine          (FlTaskRunner *runner, FlutterEngine engine);
+
+/* Called once the engine has shut down. Tasks still pending are dropped and
+ * the runner's own thread is stopped. */
+
+void                                fl_task_runner_stop                (FlTaskRunner *runner);
+
+G_END_DECLS
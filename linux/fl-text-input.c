@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include <gdk/gdkkeysyms.h>
+#include <string.h>
+
+#include "fl-gap-buffer.h"
+#include "fl-json.h"
+#include "fl-text-input.h"
+
+#define CHANNEL "flutter/textinput"
+
+// Characters either side of the cursor given to input methods that ask for the surrounding text.
+#define SURROUNDING_CHARS 256
+
+struct _FlTextInput
+{
+    GObject parent_instance;
+
+    // Not referenced, the view owns this.
+    FlView *view;
+
+    GtkIMContext *im_context;
+
+    // Client being edited, or -1 if none.
+    gint64 client_id;
+    gchar *input_action;
+    gboolean multiline;
+    gboolean delta_model;
+
+    FlGapBuffer *text;
+    gsize selection_base;
+    gsize selection_extent;
+
+    // Text being composed by the input method, or -1 if none.
+    gssize composing_base;
+    gssize composing_extent;
+
+    // Where the editable is in the view, as a column-major 4x4 matrix.
+    gdouble transform[16];
+
+    // Message being written, reused for every update.
+    GString *message;
+};
+
+G_DEFINE_TYPE (FlTextInput, fl_text_input, G_TYPE_OBJECT)
+
+static void
+send_message (FlTextInput *self)
+{
+    g_autoptr(GBytes) message = g_bytes_new (self->message->str, self->message->len);
+    fl_view_send_message (self->view, CHANNEL, message, FL_VIEW_MESSAGE_PRIORITY_HIGH, NULL, NULL);
+}
+
+static void
+get_selection (FlTextInput *self, gsize *start, gsize *end)
+{
+    *start = MIN (self->selection_base, self->selection_extent);
+    *end = MAX (self->selection_base, self->selection_extent);
+}
+
+static void
+append_selection (FlTextInput *self, GString *json)
+{
+    g_string_append_printf (json,
+                            "\"selectionBase\":%" G_GSIZE_FORMAT ",\"selectionExtent\":%" G_GSIZE_FORMAT ","
+                            "\"selectionAffinity\":\"TextAffinity.downstream\",\"selectionIsDirectional\":false,"
+                            "\"composingBase\":%" G_GSSIZE_FORMAT ",\"composingExtent\":%" G_GSSIZE_FORMAT,
+                            self->selection_base, self->selection_extent, self->composing_base, self->composing_extent);
+}
+
+// Starts the update for an edit, before the text is changed.
+static void
+begin_update (FlTextInput *self)
+{
+    g_string_truncate (self->message, 0);
+    if (!self->delta_model)
+        return;
+
+    // The framework checks each delta against the text it was made from.
+    g_string_append_printf (self->message,
+                            "{\"method\":\"TextInputClient.updateEditingStateWithDeltas\",\"args\":[%" G_GINT64_FORMAT ",{\"deltas\":[{\"oldText\":\"",
+                            self->client_id);
+    fl_gap_buffer_append_json (self->text, 0, fl_gap_buffer_get_length (self->text), self->message);
+    g_string_append (self->message, "\",");
+}
+
+/* Sends the update, with @delta_text replacing the text from @delta_start to
+ * @delta_end, or a @delta_start of -1 if only the selection changed. */
+static void
+end_update (FlTextInput *self, const gchar *delta_text, gssize delta_start, gssize delta_end)
+{
+    if (self->delta_model) {
+        g_string_append (self->message, "\"deltaText\":");
+        fl_json_append_string (self->message, delta_text);
+        g_string_append_printf (self->message, ",\"deltaStart\":%" G_GSSIZE_FORMAT ",\"deltaEnd\":%" G_GSSIZE_FORMAT ",", delta_start, delta_end);
+        append_selection (self, self->message);
+        g_string_append (self->message, "}]}]}");
+    } else {
+        g_string_append_printf (self->message,
+                                "{\"method\":\"TextInputClient.updateEditingState\",\"args\":[%" G_GINT64_FORMAT ",{\"text\":\"",
+                                self->client_id);
+        fl_gap_buffer_append_json (self->text, 0, fl_gap_buffer_get_length (self->text), self->message);
+        g_string_append (self->message, "\",");
+        append_selection (self, self->message);
+        g_string_append (self->message, "}]}");
+    }
+
+    send_message (self);
+}
+
+/* Replaces the text from @start to @end, composing it if @composing, and puts
+ * the cursor @cursor_chars characters into it or after it if -1. */
+static void
+replace (FlTextInput *self, gsize start, gsize end, const gchar *text, gboolean composing, gint cursor_chars)
+{
+    begin_update (self);
+
+    gsize old_length = fl_gap_buffer_get_length (self->text);
+    fl_gap_buffer_replace (self->text, start, end, text);
+    gsize text_end = end + fl_gap_buffer_get_length (self->text) - old_length;
+    gsize cursor = cursor_chars >= 0 ? MIN (fl_gap_buffer_move_by_chars (self->text, start, cursor_chars), text_end) : text_end;
+    self->selection_base = self->selection_extent = cursor;
+    self->composing_base = composing ? (gssize) start : -1;
+    self->composing_extent = composing ? (gssize) text_end : -1;
+
+    end_update (self, text, start, end);
+}
+
+static void
+set_selection (FlTextInput *self, gsize base, gsize extent)
+{
+    begin_update (self);
+    self->selection_base = base;
+    self->selection_extent = extent;
+    end_update (self, "", -1, -1);
+}
+
+static void
+perform_action (FlTextInput *self)
+{
+    g_string_truncate (self->message, 0);
+    g_string_append_printf (self->message, "{\"method\":\"TextInputClient.performAction\",\"args\":[%" G_GINT64_FORMAT ",", self->client_id);
+    fl_json_append_string (self->message, self->input_action != NULL ? self->input_action : "TextInputAction.done");
+    g_string_append (self->message, "]}");
+    send_message (self);
+}
+
+// Range the input method's text replaces, the text being composed or else the selection.
+static void
+get_composing_range (FlTextInput *self, gsize *start, gsize *end)
+{
+    if (self->composing_base >= 0) {
+        *start = self->composing_base;
+        *end = self->composing_extent;
+    } else {
+        get_selection (self, start, end);
+    }
+}
+
+static void
+fl_text_input_commit_cb (GtkIMContext *context, const gchar *text, FlTextInput *self)
+{
+    gsize start, end;
+    get_composing_range (self, &start, &end);
+    replace (self, start, end, text, FALSE, -1);
+}
+
+static void
+fl_text_input_preedit_changed_cb (GtkIMContext *context, FlTextInput *self)
+{
+    g_autofree gchar *text = NULL;
+    gint cursor_pos;
+    gtk_im_context_get_preedit_string (context, &text, NULL, &cursor_pos);
+
+    gsize start, end;
+    get_composing_range (self, &start, &end);
+    replace (self, start, end, text, TRUE, cursor_pos);
+}
+
+static void
+fl_text_input_preedit_end_cb (GtkIMContext *context, FlTextInput *self)
+{
+    begin_update (self);
+    self->composing_base = self->composing_extent = -1;
+    end_update (self, "", -1, -1);
+}
+
+static gboolean
+fl_text_input_retrieve_surrounding_cb (GtkIMContext *context, FlTextInput *self)
+{
+    // Only text near the cursor, so this costs the same however long the text is.
+    gsize cursor = self->selection_extent;
+    gsize start = fl_gap_buffer_move_by_chars (self->text, cursor, -SURROUNDING_CHARS);
+    gsize end = fl_gap_buffer_move_by_chars (self->text, cursor, SURROUNDING_CHARS);
+    g_autofree gchar *before = fl_gap_buffer_get_text (self->text, start, cursor);
+    g_autofree gchar *text = fl_gap_buffer_get_text (self->text, start, end);
+    gtk_im_context_set_surrounding (context, text, -1, strlen (before));
+
+    return TRUE;
+}
+
+static gboolean
+fl_text_input_delete_surrounding_cb (GtkIMContext *context, gint offset, gint n_chars, FlTextInput *self)
+{
+    gsize start = fl_gap_buffer_move_by_chars (self->text, self->selection_extent, offset);
+    gsize end = fl_gap_buffer_move_by_chars (self->text, start, n_chars);
+    replace (self, start, end, "", FALSE, -1);
+
+    return TRUE;
+}
+
+static void
+fl_text_input_realize_cb (FlTextInput *self)
+{
+    gtk_im_context_set_client_window (self->im_context, gtk_widget_get_window (GTK_WIDGET (self->view)));
+}
+
+static void
+fl_text_input_unrealize_cb (FlTextInput *self)
+{
+    gtk_im_context_set_client_window (self->im_context, NULL);
+}
+
+static gboolean
+fl_text_input_focus_in_cb (FlTextInput *self)
+{
+    if (self->client_id >= 0)
+        gtk_im_context_focus_in (self->im_context);
+    return FALSE;
+}
+
+static gboolean
+fl_text_input_focus_out_cb (FlTextInput *self)
+{
+    gtk_im_context_focus_out (self->im_context);
+    return FALSE;
+}
+
+static void
+set_client (FlTextInput *self, GVariant *args)
+{
+    g_autoptr(GVariant) id = NULL;
+    g_autoptr(GVariant) config = NULL;
+    if (g_variant_is_of_type (args, G_VARIANT_TYPE ("av")) && g_variant_n_children (args) == 2) {
+        g_variant_get_child (args, 0, "v", &id);
+        g_variant_get_child (args, 1, "v", &config);
+    }
+
+    self->client_id = fl_json_get_int (id, -1);
+    g_clear_pointer (&self->input_action, g_free);
+    self->multiline = FALSE;
+    self->delta_model = FALSE;
+    if (config == NULL || !g_variant_is_of_type (config, G_VARIANT_TYPE_VARDICT))
+        return;
+
+    g_variant_lookup (config, "inputAction", "s", &self->input_action);
+    g_variant_lookup (config, "enableDeltaModel", "b", &self->delta_model);
+    g_autoptr(GVariant) input_type = g_variant_lookup_value (config, "inputType", G_VARIANT_TYPE_VARDICT);
+    const gchar *input_type_name = NULL;
+    if (input_type != NULL && g_variant_lookup (input_type, "name", "&s", &input_type_name))
+        self->multiline = g_strcmp0 (input_type_name, "TextInputType.multiline") == 0;
+}
+
+static void
+set_editing_state (FlTextInput *self, GVariant *state)
+{
+    if (!g_variant_is_of_type (state, G_VARIANT_TYPE_VARDICT))
+        return;
+
+    const gchar *text = NULL;
+    if (g_variant_lookup (state, "text", "&s", &text))
+        fl_gap_buffer_set_text (self->text, text);
+
+    gsize length = fl_gap_buffer_get_length (self->text);
+    g_autoptr(GVariant) selection_base = g_variant_lookup_value (state, "selectionBase", NULL);
+    g_autoptr(GVariant) selection_extent = g_variant_lookup_value (state, "selectionExtent", NULL);
+    g_autoptr(GVariant) composing_base = g_variant_lookup_value (state, "composingBase", NULL);
+    g_autoptr(GVariant) composing_extent = g_variant_lookup_value (state, "composingExtent", NULL);
+
+    // No selection is sent as -1, which puts the cursor at the end.
+    gint64 base = fl_json_get_int (selection_base, -1);
+    gint64 extent = fl_json_get_int (selection_extent, base);
+    self->selection_base = base >= 0 ? MIN ((gsize) base, length) : length;
+    self->selection_extent = extent >= 0 ? MIN ((gsize) extent, length) : self->selection_base;
+    self->composing_base = CLAMP (fl_json_get_int (composing_base, -1), -1, (gssize) length);
+    self->composing_extent = CLAMP (fl_json_get_int (composing_extent, -1), -1, (gssize) length);
+    if (self->composing_base < 0 || self->composing_extent < self->composing_base)
+        self->composing_base = self->composing_extent = -1;
+
+    gtk_im_context_reset (self->im_context);
+}
+
+static void
+set_editable_transform (FlTextInput *self, GVariant *args)
+{
+    if (!g_variant_is_of_type (args, G_VARIANT_TYPE_VARDICT))
+        return;
+
+    g_autoptr(GVariant) transform = g_variant_lookup_value (args, "transform", G_VARIANT_TYPE ("av"));
+    if (transform == NULL || g_variant_n_children (transform) != 16)
+        return;
+    for (gsize i = 0; i < 16; i++) {
+        g_autoptr(GVariant) value = NULL;
+        g_variant_get_child (transform, i, "v", &value);
+        self->transform[i] = fl_json_get_double (value, 0);
+    }
+}
+
+static void
+set_marked_text_rect (FlTextInput *self, GVariant *args)
+{
+    if (!g_variant_is_of_type (args, G_VARIANT_TYPE_VARDICT))
+        return;
+
+    g_autoptr(GVariant) x = g_variant_lookup_value (args, "x", NULL);
+    g_autoptr(GVariant) y = g_variant_lookup_value (args, "y", NULL);
+    g_autoptr(GVariant) width = g_variant_lookup_value (args, "width", NULL);
+    g_autoptr(GVariant) height = g_variant_lookup_value (args, "height", NULL);
+
+    // Tells the input method where to put its candidate window.
+    gdouble rect_x = fl_json_get_double (x, 0), rect_y = fl_json_get_double (y, 0);
+    GdkRectangle location;
+    location.x = self->transform[0] * rect_x + self->transform[4] * rect_y + self->transform[12];
+    location.y = self->transform[1] * rect_x + self->transform[5] * rect_y + self->transform[13];
+    location.width = fl_json_get_double (width, 0);
+    location.height = fl_json_get_double (height, 0);
+    gtk_im_context_set_cursor_location (self->im_context, &location);
+}
+
+static void
+fl_text_input_message_cb (FlView *view, const gchar *channel, GBytes *message, FlViewMessageResponse *response, gpointer user_data)
+{
+    FlTextInput *self = user_data;
+    g_autoptr(GError) error = NULL;
+
+    gsize length;
+    const gchar *data = g_bytes_get_data (message, &length);
+    g_autoptr(GVariant) call = fl_json_parse (data, length, &error);
+    const gchar *method = NULL;
+    if (call == NULL || !g_variant_is_of_type (call, G_VARIANT_TYPE_VARDICT) || !g_variant_lookup (call, "method", "&s", &method)) {
+        g_warning ("Invalid text input message: %s", error != NULL ? error->message : "not a method call");
+        fl_view_message_response_send (response, NULL);
+        return;
+    }
+    g_autoptr(GVariant) args = g_variant_lookup_value (call, "args", NULL);
+    if (args == NULL)
+        args = g_variant_ref_sink (g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL));
+
+    if (strcmp (method, "TextInput.setClient") == 0) {
+        set_client (self, args);
+        gtk_im_context_reset (self->im_context);
+    } else if (strcmp (method, "TextInput.clearClient") == 0) {
+        self->client_id = -1;
+        gtk_im_context_focus_out (self->im_context);
+    } else if (strcmp (method, "TextInput.setEditingState") == 0) {
+        set_editing_state (self, args);
+    } else if (strcmp (method, "TextInput.show") == 0) {
+        gtk_im_context_focus_in (self->im_context);
+    } else if (strcmp (method, "TextInput.hide") == 0) {
+        gtk_im_context_focus_out (self->im_context);
+    } else if (strcmp (method, "TextInput.setEditableSizeAndTransform") == 0) {
+        set_editable_transform (self, args);
+    } else if (strcmp (method, "TextInput.setMarkedTextRect") == 0) {
+        set_marked_text_rect (self, args);
+    } else {
+        // Not implemented, which the framework expects an empty response for.
+        fl_view_message_response_send (response, NULL);
+        return;
+    }
+
+    static const gchar success[] = "[null]";
+    g_autoptr(GBytes) result = g_bytes_new_static (success, strlen (success));
+    fl_view_message_response_send (response, result);
+}
+
+static void
+fl_text_input_dispose (GObject *object)
+{
+    FlTextInput *self = FL_TEXT_INPUT (object);
+
+    g_clear_object (&self->im_context);
+    g_clear_object (&self->text);
+    g_clear_pointer (&self->input_action, g_free);
+    if (self->message != NULL) {
+        g_string_free (self->message, TRUE);
+        self->message = NULL;
+    }
+
+    G_OBJECT_CLASS (fl_text_input_parent_class)->dispose (object);
+}
+
+static void
+fl_text_input_class_init (FlTextInputClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_text_input_dispose;
+}
+
+static void
+fl_text_input_init (FlTextInput *self)
+{
+    self->client_id = -1;
+    self->composing_base = self->composing_extent = -1;
+    self->transform[0] = self->transform[5] = self->transform[10] = self->transform[15] = 1;
+    self->text = fl_gap_buffer_new ();
+    self->message = g_string_new (NULL);
+    self->im_context = gtk_im_multicontext_new ();
+    g_signal_connect_object (self->im_context, "commit",
+                             G_CALLBACK (fl_text_input_commit_cb), self, 0);
+    g_signal_connect_object (self->im_context, "preedit-changed",
+                             G_CALLBACK (fl_text_input_preedit_changed_cb), self, 0);
+    g_signal_connect_object (self->im_context, "preedit-end",
+                             G_CALLBACK (fl_text_input_preedit_end_cb), self, 0);
+    g_signal_connect_object (self->im_context, "retrieve-surrounding",
+                             G_CALLBACK (fl_text_input_retrieve_surrounding_cb), self, 0);
+    g_signal_connect_object (self->im_context, "delete-surrounding",
+                             G_CALLBACK (fl_text_input_delete_surrounding_cb), self, 0);
+}
+
+FlTextInput *
+fl_text_input_new (FlView *view)
+{
+    FlTextInput *self = g_object_new (fl_text_input_get_type (), NULL);
+
+    self->view = view;
+    g_signal_connect_object (view, "realize",
+                             G_CALLBACK (fl_text_input_realize_cb), self, G_CONNECT_SWAPPED);
+    g_signal_connect_object (view, "unrealize",
+                             G_CALLBACK (fl_text_input_unrealize_cb), self, G_CONNECT_SWAPPED);
+    g_signal_connect_object (view, "focus-in-event",
+                             G_CALLBACK (fl_text_input_focus_in_cb), self, G_CONNECT_SWAPPED);
+    g_signal_connect_object (view, "focus-out-event",
+                             G_CALLBACK (fl_text_input_focus_out_cb), self, G_CONNECT_SWAPPED);
+    fl_view_set_message_handler (view, CHANNEL, FL_VIEW_MESSAGE_HANDLER_NONE, 0,
+                                 fl_text_input_message_cb, g_object_ref (self), g_object_unref);
+
+    return self;
+}
+
+gboolean
+fl_text_input_filter_keypress (FlTextInput *self, GdkEventKey *event)
+{
+    g_return_val_if_fail (FL_IS_TEXT_INPUT (self), FALSE);
+
+    if (self->client_id < 0)
+        return FALSE;
+    if (gtk_im_context_filter_keypress (self->im_context, event))
+        return TRUE;
+    if (event->type != GDK_KEY_PRESS)
+        return FALSE;
+
+    // Keys input methods leave to the editor.
+    gsize length = fl_gap_buffer_get_length (self->text);
+    gsize start, end;
+    get_selection (self, &start, &end);
+    gboolean shift = (event->state & GDK_SHIFT_MASK) != 0;
+    switch (event->keyval)
+    {
+    case GDK_KEY_BackSpace:
+        if (start == end)
+            start = fl_gap_buffer_move_by_chars (self->text, start, -1);
+        if (start != end)
+            replace (self, start, end, "", FALSE, -1);
+        return TRUE;
+    case GDK_KEY_Delete:
+    case GDK_KEY_KP_Delete:
+        if (start == end)
+            end = fl_gap_buffer_move_by_chars (self->text, end, 1);
+        if (start != end)
+            replace (self, start, end, "", FALSE, -1);
+        return TRUE;
+    case GDK_KEY_Left:
+    case GDK_KEY_KP_Left:
+        if (shift)
+            set_selection (self, self->selection_base, fl_gap_buffer_move_by_chars (self->text, self->selection_extent, -1));
+        else if (start != end)
+            set_selection (self, start, start);
+        else
+            set_selection (self, fl_gap_buffer_move_by_chars (self->text, start, -1), fl_gap_buffer_move_by_chars (self->text, start, -1));
+        return TRUE;
+    case GDK_KEY_Right:
+    case GDK_KEY_KP_Right:
+        if (shift)
+            set_selection (self, self->selection_base, fl_gap_buffer_move_by_chars (self->text, self->selection_extent, 1));
+        else if (start != end)
+            set_selection (self, end, end);
+        else
+            set_selection (self, fl_gap_buffer_move_by_chars (self->text, end, 1), fl_gap_buffer_move_by_chars (self->text, end, 1));
+        return TRUE;
+    case GDK_KEY_Home:
+    case GDK_KEY_KP_Home:
+        set_selection (self, shift ? self->selection_base : 0, 0);
+        return TRUE;
+    case GDK_KEY_End:
+    case GDK_KEY_KP_End:
+        set_selection (self, shift ? self->selection_base : length, length);
+        return TRUE;
+    case GDK_KEY_Return:
+    case GDK_KEY_KP_Enter:
+    case GDK_KEY_ISO_Enter:
+        if (self->multiline)
+            replace (self, start, end, "\n", FALSE, -1);
+        else
+            perform_action (self);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include "fl-view.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlTextInput, fl_text_input, FL, TEXT_INPUT, GObject)
+
+/* Implements the flutter/textinput channel for @view, editing text with a GTK
+ * input method. The text being edited is kept in a gap buffer, and clients that
+ * enable the delta model are sent each edit rather than the whole state. */
+
+FlTextInput *fl_text_input_new             (FlView *view);
+
+/* Returns TRUE if @event edited the text */
+
+gboolean     fl_text_input_filter_keypress (FlTextInput *input, GdkEventKey *event);
+
+G_END_DECLS
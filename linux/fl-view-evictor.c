@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include "fl-view-evictor.h"
+#include "fl-view-private.h"
+
+// Time a view must stay hidden before it can be evicted, so switching tabs doesn't restart engines.
+#define DEFAULT_GRACE_PERIOD 30
+
+typedef struct
+{
+    FlView *view;
+
+    // Time the view was hidden, or 0 if it is visible.
+    gint64 hidden_time;
+
+    gboolean evicting;
+} EvictorEntry;
+
+struct _FlViewEvictor
+{
+    GObject parent_instance;
+
+    // Limits on running engines, 0 if unlimited.
+    guint max_engines;
+    gsize max_memory;
+
+    guint grace_period;
+
+    // Views with running engines, most recently shown first.
+    GQueue entries;
+
+    guint check_source;
+};
+
+G_DEFINE_TYPE (FlViewEvictor, fl_view_evictor, G_TYPE_OBJECT)
+
+static void fl_view_evictor_check (FlViewEvictor *self);
+
+static GList *
+find_entry (FlViewEvictor *self, FlView *view)
+{
+    for (GList *link = self->entries.head; link != NULL; link = link->next) {
+        EvictorEntry *entry = link->data;
+        if (entry->view == view)
+            return link;
+    }
+
+    return NULL;
+}
+
+static gboolean
+check_cb (gpointer user_data)
+{
+    FlViewEvictor *self = user_data;
+
+    self->check_source = 0;
+    fl_view_evictor_check (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+is_over_limit (FlViewEvictor *self, guint n_engines, gsize memory)
+{
+    return (self->max_engines > 0 && n_engines > self->max_engines) ||
+           (self->max_memory > 0 && memory > self->max_memory);
+}
+
+static void
+fl_view_evictor_check (FlViewEvictor *self)
+{
+    guint n_engines = 0;
+    gsize memory = 0;
+    gint64 now = g_get_monotonic_time ();
+    gint64 next_check_time = G_MAXINT64;
+
+    for (GList *link = self->entries.head; link != NULL; link = link->next) {
+        EvictorEntry *entry = link->data;
+        if (entry->evicting)
+            continue;
+        n_engines++;
+        memory += fl_view_get_engine_size (entry->view);
+    }
+
+    // Evict the views that have been out of sight the longest.
+    for (GList *link = self->entries.tail; link != NULL && is_over_limit (self, n_engines, memory); link = link->prev) {
+        EvictorEntry *entry = link->data;
+
+        if (entry->hidden_time == 0 || entry->evicting)
+            continue;
+
+        gint64 evict_time = entry->hidden_time + (gint64) self->grace_period * G_USEC_PER_SEC;
+        if (evict_time > now) {
+            next_check_time = MIN (next_check_time, evict_time);
+            continue;
+        }
+
+        n_engines--;
+        memory -= fl_view_get_engine_size (entry->view);
+        entry->evicting = TRUE;
+        fl_view_evict (entry->view);
+    }
+
+    if (self->check_source != 0) {
+        g_source_remove (self->check_source);
+        self->check_source = 0;
+    }
+    if (is_over_limit (self, n_engines, memory) && next_check_time != G_MAXINT64)
+        self->check_source = g_timeout_add ((next_check_time - now) / 1000 + 1, check_cb, self);
+}
+
+static void
+fl_view_evictor_dispose (GObject *object)
+{
+    FlViewEvictor *self = FL_VIEW_EVICTOR (object);
+
+    if (self->check_source != 0) {
+        g_source_remove (self->check_source);
+        self->check_source = 0;
+    }
+    g_queue_clear_full (&self->entries, g_free);
+
+    G_OBJECT_CLASS (fl_view_evictor_parent_class)->dispose (object);
+}
+
+static void
+fl_view_evictor_class_init (FlViewEvictorClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_view_evictor_dispose;
+}
+
+static void
+fl_view_evictor_init (FlViewEvictor *self)
+{
+    g_queue_init (&self->entries);
+    self->grace_period = DEFAULT_GRACE_PERIOD;
+}
+
+FlViewEvictor *
+fl_view_evictor_get_default (void)
+{
+    static FlViewEvictor *evictor = NULL;
+
+    if (evictor == NULL)
+        evictor = g_object_new (fl_view_evictor_get_type (), NULL);
+
+    return evictor;
+}
+
+void
+fl_view_evictor_set_max_engines (FlViewEvictor *self, guint max_engines)
+{
+    g_return_if_fail (FL_IS_VIEW_EVICTOR (self));
+
+    self->max_engines = max_engines;
+    fl_view_evictor_check (self);
+}
+
+void
+fl_view_evictor_set_max_memory (FlViewEvictor *self, gsize max_memory)
+{
+    g_return_if_fail (FL_IS_VIEW_EVICTOR (self));
+
+    self->max_memory = max_memory;
+    fl_view_evictor_check (self);
+}
+
+void
+fl_view_evictor_set_grace_period (FlViewEvictor *self, guint seconds)
+{
+    g_return_if_fail (FL_IS_VIEW_EVICTOR (self));
+
+    self->grace_period = seconds;
+    fl_view_evictor_check (self);
+}
+
+void
+fl_view_evictor_engine_started (FlViewEvictor *self, FlView *view, gboolean visible)
+{
+    g_return_if_fail (FL_IS_VIEW_EVICTOR (self));
+
+    if (find_entry (self, view) != NULL)
+        return;
+
+    // A view started while hidden counts as hidden from now, or it would never be evicted.
+    EvictorEntry *entry = g_new0 (EvictorEntry, 1);
+    entry->view = view;
+    entry->hidden_time = visible ? 0 : g_get_monotonic_time ();
+    g_queue_push_head (&self->entries, entry);
+
+    fl_view_evictor_check (self);
+}
+
+void
+fl_view_evictor_engine_stopped (FlViewEvictor *self, FlView *view)
+{
+    g_return_if_fail (FL_IS_VIEW_EVICTOR (self));
+
+    GList *link = find_entry (self, view);
+    if (link == NULL)
+        return;
+
+    g_free (link->data);
+    g_queue_delete_link (&self->entries, link);
+}
+
+void
+fl_view_evictor_view_shown (FlViewEvictor *self, FlView *view)
+{
+    g_return_if_fail (FL_IS_VIEW_EVICTOR (self));
+
+    GList *link = find_entry (self, view);
+    if (link == NULL)
+        return;
+
+    EvictorEntry *entry = link->data;
+    entry->hidden_time = 0;
+    entry->evicting = FALSE;
+    g_queue_unlink (&self->entries, link);
+    g_queue_push_head_link (&self->entries, link);
+
+    fl_view_evictor_check (self);
+}
+
+void
+fl_view_evictor_view_hidden (FlViewEvictor *self, FlView *view)
+{
+    g_return_if_fail (FL_IS_VIEW_EVICTOR (self));
+
+    GList *link = find_entry (self, view);
+    if (link == NULL)
+        return;
+
+    EvictorEntry *entry = link->data;
+    entry->hidden_time = g_get_monotonic_time ();
+
+    fl_view_evictor_check (self);
+}
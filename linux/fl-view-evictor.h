@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include "fl-view.h"
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlViewEvictor, fl_view_evictor, FL, VIEW_EVICTOR, GObject)
+
+FlViewEvictor *fl_view_evictor_get_default      (void);
+
+void           fl_view_evictor_set_max_engines  (FlViewEvictor *evictor, guint max_engines);
+
+void           fl_view_evictor_set_max_memory   (FlViewEvictor *evictor, gsize max_memory);
+
+void           fl_view_evictor_set_grace_period (FlViewEvictor *evictor, guint seconds);
+
+/* Called by FlView as its engine and visibility change */
+
+void           fl_view_evictor_engine_started   (FlViewEvictor *evictor, FlView *view, gboolean visible);
+
+void           fl_view_evictor_engine_stopped   (FlViewEvictor *evictor, FlView *view);
+
+void           fl_view_evictor_view_shown       (FlViewEvictor *evictor, FlView *view);
+
+void           fl_view_evictor_view_hidden      (FlViewEvictor *evictor, FlView *view);
+
+G_END_DECLS
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include "embedder.h"
+#include "fl-semantics-tree.h"
+#include "fl-view.h"
+
+G_BEGIN_DECLS
+
+/* Functions used by other parts of the embedder, not for applications */
+
+/* Memory assumed to be used by an engine when there is no memory budget. */
+#define FL_VIEW_DEFAULT_ENGINE_SIZE (64 * 1024 * 1024)
+
+/* Shares of the memory budget given to the Dart heap and raster cache, in percent. */
+#define FL_VIEW_DART_HEAP_BUDGET_SHARE    50
+#define FL_VIEW_RASTER_CACHE_BUDGET_SHARE 30
+
+/* Limits the engine started with @args to @memory_budget, or leaves it
+ * unlimited if 0. @argv must have room for two arguments and outlive @args.
+ * Returns the argument added to @argv, to be freed with it, or NULL. */
+gchar           *fl_view_apply_memory_budget       (FlutterProjectArgs *args, gsize memory_budget, const gchar **argv);
+
+gsize            fl_view_get_engine_size           (FlView *view);
+
+void             fl_view_evict                     (FlView *view);
+
+FlSemanticsTree *fl_view_get_semantics_tree        (FlView *view);
+
+void             fl_view_dispatch_semantics_action (FlView *view, gint32 id, FlutterSemanticsAction action);
+
+G_END_DECLS
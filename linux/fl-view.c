@@ -7,43 +7,288 @@
  * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
  */
 
-#include <EGL/egl.h>
-#include <gdk/gdkx.h>
+#include <string.h>
+
+#include <gdk/gdkwayland.h>
 
 #include "embedder.h"
-#include "fl-view.h"
+#include "fl-accessibility-monitor.h"
+#include "fl-accessible.h"
+#include "fl-asset-archive.h"
+#include "fl-engine-pool.h"
+#include "fl-engine-result.h"
+#include "fl-event-recorder.h"
+#include "fl-frame-capture.h"
+#include "fl-frame-exporter.h"
+#include "fl-frame-recorder.h"
+#include "fl-key-event.h"
+#include "fl-memory-monitor.h"
+#include "fl-message-queue.h"
+#include "fl-prefetcher.h"
+#include "fl-present-thread.h"
+#include "fl-renderer-gdk.h"
+#include "fl-renderer-wayland.h"
+#include "fl-renderer-x11.h"
+#include "fl-semantics-tree.h"
+#include "fl-task-runner.h"
+#include "fl-text-input.h"
+#include "fl-view-evictor.h"
+#include "fl-view-private.h"
+#include "fl-work-pool.h"
+
+// Share of the memory budget given to the embedder's own pools, in percent.
+// The engine's shares are in fl-view-private.h.
+#define TEXTURE_POOL_BUDGET_SHARE  15
+#define BACKING_STORE_BUDGET_SHARE  5
+
+// Distance scrolled by one step of a scroll wheel, in pixels.
+#define SCROLL_STEP 53
+
+// Refresh rate to use when the monitor doesn't report one, in millihertz.
+#define DEFAULT_REFRESH_RATE 60000
+
+// Time between checks for finished readbacks when no frames are being drawn, in milliseconds.
+#define READBACK_POLL_INTERVAL 16
+
+typedef struct _VsyncRequest VsyncRequest;
+typedef struct _SnapshotRequest SnapshotRequest;
+typedef struct _ShutdownRequest ShutdownRequest;
+typedef struct _ReleaseRequest ReleaseRequest;
+typedef struct _MessageHandler MessageHandler;
+typedef struct _Message Message;
 
 typedef struct
 {
-    EGLDisplay *egl_display;
-    EGLSurface *egl_surface;
-    EGLContext *egl_context;
+    FlViewBackend backend;
+    gboolean use_present_thread;
+    FlViewThreadTopology thread_topology;
+    FlRenderer *renderer;
+
+    // Runners for the engine's tasks, if the topology needs any.
+    FlTaskRunner *platform_runner;
+    FlTaskRunner *render_runner;
+
+    // Framebuffer the engine is drawing into, only used from the raster thread.
+    guint32 framebuffer;
+
+    FlFrameCapture *capture;
+    guint readback_poll_source;
+
+    // Recorder being fed presented frames, read from the raster thread.
+    FlFrameRecorder *recorder;
+
+    // Exporter being fed presented frames, read from the raster thread.
+    FlFrameExporter *exporter;
+
+    // Log of the events sent to the engine.
+    FlEventRecorder *event_recorder;
+
+    // State of the mouse as last sent to the engine.
+    gboolean pointer_added;
+    int64_t pointer_buttons;
+
+    FlTextInput *text_input;
+
+    // Hardware keycodes held down, to tell repeats from presses. X11 keycodes
+    // are all below 256, repeats of any others are never dropped.
+    guint8 keys_down[256 / 8];
+
+    // Key events the framework hasn't responded to, updated from an engine thread.
+    gint pending_key_events;
+
+    // Message for the key event being sent, reused for every event.
+    gchar key_event_buffer[FL_KEY_EVENT_MAX_LENGTH];
+
+    // Protects the input, startup and frame statistics. The time of the earliest
+    // key press not followed by a presented frame is read from the raster thread.
+    GMutex stats_mutex;
+    guint64 frames_drawn;
+    gint64 key_press_time;
+    guint64 key_events;
+    guint64 key_events_coalesced;
+    gint64 key_latency;
+
+    // Area exposed since the last frame was presented again.
+    GMutex expose_mutex;
+    cairo_region_t *expose_damage;
 
     gchar *assets_path;
     gchar *icu_data_path;
+    gchar *dart_entrypoint;
+
+    // AOT snapshots from the asset archive, kept for as long as an engine may use them.
+    FlAssetArchive *asset_archive;
+    GBytes *vm_snapshot_data;
+    GBytes *vm_snapshot_instructions;
+    GBytes *isolate_snapshot_data;
+    GBytes *isolate_snapshot_instructions;
+
+    // Memory budget in bytes, or 0 if unlimited.
+    gsize memory_budget;
+
+    // Memory held in snapshots, protected by stats_mutex. The renderer
+    // reports the memory held in its own buffers.
+    gsize texture_pool_size;
+
+    // TRUE if the view can be seen, read from the raster thread.
+    gint visible;
+    // FALSE to keep rendering while hidden, as if the view could be seen.
+    gboolean pause_when_hidden;
+    gboolean mapped;
+    GtkWidget *toplevel;
+    gulong window_state_handler;
+    GdkWindowState toplevel_state;
+    GdkVisibilityState visibility;
+
+    // Vsync baton answered on the next frame clock update, or held back while the view is hidden.
+    gboolean have_pending_vsync;
+    intptr_t pending_vsync_baton;
+    GdkFrameClock *frame_clock;
+    gulong frame_clock_update_handler;
+
+    // Frames not presented since the view was hidden.
+    gint skipped_frames;
+
+    // Last frame presented before the engine was evicted.
+    cairo_surface_t *snapshot;
+    gboolean evicting;
+    gboolean evicted;
+    guint restart_source;
+
+    // TRUE once the current engine has presented a frame.
+    gint frame_presented;
+
+    // TRUE once what the first frame needed has been recorded for the next launch.
+    gboolean prefetch_recorded;
+
+    // Time the view was created, and from then to its first frame, in microseconds.
+    gint64 create_time;
+    gint64 first_frame_time;
+
+    // Engine taken from the pool, kept until it is shut down.
+    FlPooledEngine *pooled_engine;
+    gboolean used_pooled_engine;
+
+    // Messages waiting to be sent to the engine.
+    FlMessageQueue *message_queue;
+
+    // Handlers for messages from the engine, keyed by channel.
+    GMutex message_handlers_mutex;
+    GHashTable *message_handlers;
+
+    // Semantics tree, only built while assistive technologies are running.
+    gboolean semantics_enabled;
+    FlSemanticsTree *semantics_tree;
+
+    // Copies of the semantics updates from the engine, applied to the tree at most once a frame.
+    // Nodes are copied into one array, with their strings and children in one block of data.
+    GMutex semantics_mutex;
+    GArray *semantics_nodes;
+    GByteArray *semantics_data;
+    guint semantics_n_ready;
+    guint semantics_data_ready;
+    // Applied by the last flush, reused by the next.
+    GArray *semantics_spare_nodes;
+    GByteArray *semantics_spare_data;
+    GPtrArray *semantics_actions;
+    gboolean semantics_flush_pending;
+    guint semantics_flush_interval;
+
+    // Held for writing to change the engine, and for reading to use it off the main thread.
+    GRWLock engine_lock;
+
+    // Incremented each time an engine is started.
+    guint engine_generation;
+
+    // TRUE while the engine is being shut down after the view was disposed.
+    gboolean shutting_down;
 
     FlutterEngine engine;
 } FlViewPrivate;
 
-G_DEFINE_TYPE_WITH_PRIVATE (FlView, fl_view, GTK_TYPE_WIDGET)
+struct _VsyncRequest
+{
+    FlView *view;
+    guint engine_generation;
+    intptr_t baton;
+};
 
-static gchar *
-flutter_engine_result_to_string (FlutterEngineResult result)
+struct _SnapshotRequest
 {
-    switch (result)
-    {
-    case kSuccess:
-        return g_strdup ("Success");
-    case kInvalidLibraryVersion:
-        return g_strdup ("Invalid library version");
-    case kInvalidArguments:
-        return g_strdup ("Invalid arguments");
-    case kInternalInconsistency:
-        return g_strdup ("Internal inconsistency");
-    default:
-        return g_strdup_printf ("Unknown Flutter error %d", result);
-    }
-}
+    FlView *view;
+    cairo_surface_t *snapshot;
+};
+
+typedef void (*ReleaseBuffersFunc) (gpointer object);
+
+struct _ReleaseRequest
+{
+    FlView *view;
+    gpointer object;
+    ReleaseBuffersFunc release_buffers;
+};
+
+struct _ShutdownRequest
+{
+    FlView *view;
+    FlutterEngine engine;
+    FlPooledEngine *pooled_engine;
+    FlTaskRunner *platform_runner;
+    FlTaskRunner *render_runner;
+    gint64 start_time;
+
+    // Renderer and window of an unrealized view, which the raster thread draws
+    // into until the engine has shut down.
+    FlRenderer *renderer;
+    GdkWindow *window;
+};
+
+struct _MessageHandler
+{
+    gint ref_count;
+    FlViewMessageHandlerFlags flags;
+    guint max_concurrency;
+    FlViewMessageHandler handler;
+    gpointer user_data;
+    GDestroyNotify destroy_notify;
+
+    // Protects the fields below.
+    GMutex mutex;
+
+    // Background messages waiting for a running one to finish.
+    GQueue backlog;
+    guint running;
+};
+
+struct _Message
+{
+    FlView *view;
+    MessageHandler *handler;
+    gchar *channel;
+    GBytes *message;
+    FlViewMessageResponse *response;
+};
+
+struct _FlViewMessageResponse
+{
+    FlView *view;
+    guint engine_generation;
+    const FlutterPlatformMessageResponseHandle *handle;
+};
+
+enum
+{
+    SIGNAL_MESSAGE_QUEUE_DRAINED,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE_WITH_PRIVATE (FlView, fl_view, GTK_TYPE_WIDGET)
+
+static gboolean fl_view_snapshot_done_cb (gpointer user_data);
+static gboolean fl_view_restart_cb (gpointer user_data);
+static void fl_view_clear_snapshots (FlView *self);
 
 // FIXME: Called from Flutter thread
 static bool
@@ -52,8 +297,7 @@ fl_view_gl_make_current (void *user_data)
     FlView *self = user_data;
     FlViewPrivate *priv = fl_view_get_instance_private (self);
     g_printerr ("fl_view_gl_make_current\n");
-    if (!eglMakeCurrent (priv->egl_display, priv->egl_surface, priv->egl_surface, priv->egl_context))
-       g_critical ("Failed to make EGL context current");
+    fl_renderer_make_current (priv->renderer);
     return true;
 }
 
@@ -64,10 +308,42 @@ fl_view_gl_clear_current (void *user_data)
     FlView *self = user_data;
     FlViewPrivate *priv = fl_view_get_instance_private (self);
     g_printerr ("fl_view_gl_clear_current\n");
-    eglMakeCurrent (priv->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    fl_renderer_clear_current (priv->renderer);
     return false;
 }
 
+static gboolean
+fl_view_first_frame_cb (gpointer user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // Only the first engine's startup is a cold start, later ones are restarts after eviction.
+    if (!priv->prefetch_recorded && priv->assets_path != NULL) {
+        const gchar *paths[4] = { NULL };
+        gint n_paths = 0;
+        paths[n_paths++] = priv->assets_path;
+        if (priv->icu_data_path != NULL)
+            paths[n_paths++] = priv->icu_data_path;
+        if (priv->asset_archive != NULL && fl_asset_archive_get_path (priv->asset_archive) != NULL)
+            paths[n_paths++] = fl_asset_archive_get_path (priv->asset_archive);
+        fl_prefetcher_record (fl_prefetcher_get_default (), priv->assets_path, paths);
+        priv->prefetch_recorded = TRUE;
+    }
+
+    g_mutex_lock (&priv->stats_mutex);
+    if (priv->first_frame_time == 0) {
+        priv->first_frame_time = g_get_monotonic_time () - priv->create_time;
+        g_debug ("First frame %" G_GINT64_FORMAT "us after the view was created, %s pooled engine",
+                 priv->first_frame_time, priv->used_pooled_engine ? "with" : "without");
+    }
+    g_mutex_unlock (&priv->stats_mutex);
+
+    g_object_unref (self);
+
+    return G_SOURCE_REMOVE;
+}
+
 // FIXME: Called from Flutter thread
 static bool
 fl_view_gl_present (void *user_data)
@@ -75,8 +351,41 @@ fl_view_gl_present (void *user_data)
     FlView *self = user_data;
     FlViewPrivate *priv = fl_view_get_instance_private (self);
     g_printerr ("fl_view_gl_present\n");
-    if (!eglSwapBuffers (priv->egl_display, priv->egl_surface))
-        g_critical ("Failed to swap EGL buffers");
+    if (!g_atomic_int_get (&priv->visible)) {
+        g_atomic_int_inc (&priv->skipped_frames);
+        fl_renderer_discard_frame (priv->renderer);
+        return true;
+    }
+    FlFrameRecorder *recorder = g_atomic_pointer_get (&priv->recorder);
+    FlFrameExporter *exporter = g_atomic_pointer_get (&priv->exporter);
+    gboolean capture_pending = fl_frame_capture_is_pending (priv->capture);
+    if (recorder != NULL || exporter != NULL || capture_pending) {
+        // The size the frame was drawn at, even if the widget has been resized since.
+        const FlRendererState *state = fl_renderer_get_frame_state (priv->renderer);
+        gint width = state->width, height = state->height;
+        if (recorder != NULL)
+            fl_frame_recorder_read_framebuffer (recorder, priv->framebuffer, width, height);
+        // The engine doesn't report what changed in a frame, so the exporter reads and compares every tile.
+        if (exporter != NULL)
+            fl_frame_exporter_read_framebuffer (exporter, priv->framebuffer, width, height, NULL);
+        if (capture_pending)
+            fl_frame_capture_read_framebuffer (priv->capture, priv->framebuffer, width, height);
+    }
+    fl_renderer_present (priv->renderer);
+    fl_frame_capture_poll (priv->capture);
+    if (recorder != NULL)
+        fl_frame_recorder_poll (recorder);
+    if (exporter != NULL)
+        fl_frame_exporter_poll (exporter);
+    g_mutex_lock (&priv->stats_mutex);
+    priv->frames_drawn++;
+    if (priv->key_press_time != 0) {
+        priv->key_latency = g_get_monotonic_time () - priv->key_press_time;
+        priv->key_press_time = 0;
+    }
+    g_mutex_unlock (&priv->stats_mutex);
+    if (g_atomic_int_compare_and_exchange (&priv->frame_presented, FALSE, TRUE))
+        g_idle_add (fl_view_first_frame_cb, g_object_ref (self));
     return false;
 }
 
@@ -84,8 +393,11 @@ fl_view_gl_present (void *user_data)
 static uint32_t
 fl_view_gl_fbo_callback (void *user_data)
 {
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
     g_printerr ("fl_view_gl_fbo_callback\n");
-    return 0;
+    priv->framebuffer = fl_renderer_get_fbo (priv->renderer);
+    return priv->framebuffer;
 }
 
 /*static bool
@@ -99,167 +411,2315 @@ fl_view_gl_make_resource_current (void *user_data)
 static void *
 fl_view_gl_proc_resolver (void *user_data, const char *name)
 {
-    return eglGetProcAddress (name);
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    return fl_renderer_get_proc_address (priv->renderer, name);
 }
 
 static void
-fl_view_dispose (GObject *object)
+fl_view_send_platform_message (FlView *self, const gchar *channel, const guint8 *data, gsize data_length)
 {
-    FlViewPrivate *priv = fl_view_get_instance_private (FL_VIEW (object));
-
-    g_clear_pointer (&priv->assets_path, g_free);
-    g_clear_pointer (&priv->icu_data_path, g_free);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    FlutterPlatformMessage message = { 0 };
 
-    G_OBJECT_CLASS (fl_view_parent_class)->dispose (object);
+    message.struct_size = sizeof (FlutterPlatformMessage);
+    message.channel = channel;
+    message.message = data;
+    message.message_size = data_length;
+    if (priv->event_recorder != NULL)
+        fl_event_recorder_record_platform_message (priv->event_recorder, &message);
+    FlutterEngineResult result = FlutterEngineSendPlatformMessage (priv->engine, &message);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to send message on %s: %s", channel, error);
+    }
 }
 
+// FIXME: Called from Flutter thread
 static void
-fl_view_realize (GtkWidget *widget)
+fl_view_key_event_response_cb (const uint8_t *data, size_t data_length, void *user_data)
 {
-    FlView *self = FL_VIEW (widget);
+    FlView *self = user_data;
     FlViewPrivate *priv = fl_view_get_instance_private (self);
-    GtkAllocation allocation;
-    GdkWindow *window;
-    GdkWindowAttr window_attributes;
-    gint window_attributes_mask;
-    EGLint egl_major, egl_minor;
-    EGLConfig egl_config;
-    EGLint n_config;
-    EGLint attributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-                            EGL_RED_SIZE, 8,
-                            EGL_GREEN_SIZE, 8,
-                            EGL_BLUE_SIZE, 8,
-                            EGL_ALPHA_SIZE, 8,
-                            EGL_NONE };
-    FlutterRendererConfig config = { 0 };
-    FlutterProjectArgs args = { 0 };
-
-    g_printerr ("fl_view_realize\n");
-
-    gtk_widget_set_realized (widget, TRUE);
-
-    gtk_widget_get_allocation (widget, &allocation);
 
-    window_attributes.window_type = GDK_WINDOW_CHILD;
-    window_attributes.x = allocation.x;
-    window_attributes.y = allocation.y;
-    window_attributes.width = allocation.width;
-    window_attributes.height = allocation.height;
-    window_attributes.wclass = GDK_INPUT_OUTPUT;
-    window_attributes.visual = gtk_widget_get_visual (widget);
-    window_attributes.event_mask = gtk_widget_get_events (widget) | GDK_EXPOSURE_MASK;
+    g_atomic_int_dec_and_test (&priv->pending_key_events);
+}
 
-    window_attributes_mask = GDK_WA_X | GDK_WA_Y | GDK_WA_VISUAL;
+static gboolean
+fl_view_send_key_event (FlView *self, GdkEventKey *event)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
 
-    window = gdk_window_new (gtk_widget_get_parent_window (widget),
-                             &window_attributes, window_attributes_mask);
-    gtk_widget_register_window (widget, window);
-    gtk_widget_set_window (widget, window);
+    if (priv->engine == NULL)
+        return GDK_EVENT_PROPAGATE;
 
-    priv->egl_display = eglGetDisplay (EGL_DEFAULT_DISPLAY);//(EGLNativeDisplayType) gdk_x11_display_get_xdisplay (gtk_widget_get_display (widget)));
-    if (!eglInitialize (priv->egl_display, &egl_major, &egl_minor))
-        g_critical ("Failed to initialze EGL");
-    g_printerr ("Initialized EGL version %d.%d\n", egl_major, egl_minor);
-    if (!eglChooseConfig (priv->egl_display, attributes, &egl_config, 1, &n_config))
-        g_critical ("Failed to choose EGL config");
-    if (n_config == 0)
-        g_critical ("Failed to find appropriate EGL config");
-    if (!eglBindAPI (EGL_OPENGL_ES_API))
-        g_critical ("Failed to bind EGL OpenGL ES API");
-    priv->egl_surface = eglCreateWindowSurface (priv->egl_display, egl_config, gdk_x11_window_get_xid (gtk_widget_get_window (widget)), NULL);
-    EGLint context_attributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2,
-                                    EGL_NONE };
-    priv->egl_context = eglCreateContext (priv->egl_display, egl_config, EGL_NO_CONTEXT, context_attributes);
-    EGLint value;
-    eglQueryContext (priv->egl_display, priv->egl_context, EGL_CONTEXT_CLIENT_VERSION, &value);
+    if (event->hardware_keycode / 8 < sizeof (priv->keys_down)) {
+        guint8 *keys_down = &priv->keys_down[event->hardware_keycode / 8];
+        guint8 key_bit = 1 << event->hardware_keycode % 8;
+        if (event->type == GDK_KEY_PRESS) {
+            // Auto-repeated presses are dropped while the framework is still handling earlier keys.
+            if ((*keys_down & key_bit) && g_atomic_int_get (&priv->pending_key_events) > 0) {
+                g_mutex_lock (&priv->stats_mutex);
+                priv->key_events_coalesced++;
+                g_mutex_unlock (&priv->stats_mutex);
+                return GDK_EVENT_STOP;
+            }
+            *keys_down |= key_bit;
+        } else {
+            *keys_down &= ~key_bit;
+        }
+    }
 
-    config.type = kOpenGL;
-    config.open_gl.struct_size = sizeof (FlutterOpenGLRendererConfig);
-    config.open_gl.make_current = fl_view_gl_make_current;
-    config.open_gl.clear_current = fl_view_gl_clear_current;
-    config.open_gl.present = fl_view_gl_present;
-    config.open_gl.fbo_callback = fl_view_gl_fbo_callback;
-    config.open_gl.make_resource_current = NULL;//fl_view_gl_make_resource_current;
-    config.open_gl.gl_proc_resolver = fl_view_gl_proc_resolver;
-    args.struct_size = sizeof (FlutterProjectArgs);
-    args.assets_path = priv->assets_path;
-    args.icu_data_path = priv->icu_data_path;
+    gsize length = fl_key_event_encode (event, priv->key_event_buffer, sizeof (priv->key_event_buffer));
+    if (length == 0)
+        return GDK_EVENT_PROPAGATE;
 
-    FlutterEngineResult result = FlutterEngineInitialize (FLUTTER_ENGINE_VERSION, &config, &args, self, &priv->engine);
+    FlutterPlatformMessage message = { 0 };
+    message.struct_size = sizeof (FlutterPlatformMessage);
+    message.channel = "flutter/keyevent";
+    message.message = (const uint8_t *) priv->key_event_buffer;
+    message.message_size = length;
+    FlutterPlatformMessageResponseHandle *handle = NULL;
+    FlutterEngineResult result = FlutterPlatformMessageCreateResponseHandle (priv->engine, fl_view_key_event_response_cb, self, &handle);
     if (result != kSuccess) {
         g_autofree gchar *error = flutter_engine_result_to_string (result);
-        g_warning ("Failed to initialize Flutter: %s", error);
-        return;
+        g_warning ("Failed to create response handle: %s", error);
+        return GDK_EVENT_PROPAGATE;
     }
+    message.response_handle = handle;
 
-    result = FlutterEngineRunInitialized (priv->engine);
+    if (priv->event_recorder != NULL)
+        fl_event_recorder_record_platform_message (priv->event_recorder, &message);
+    g_atomic_int_inc (&priv->pending_key_events);
+    result = FlutterEngineSendPlatformMessage (priv->engine, &message);
     if (result != kSuccess) {
         g_autofree gchar *error = flutter_engine_result_to_string (result);
-        g_warning ("Failed to run Flutter: %s", error);
-        return;
+        g_warning ("Failed to send key event: %s", error);
+        g_atomic_int_dec_and_test (&priv->pending_key_events);
+        FlutterPlatformMessageReleaseResponseHandle (priv->engine, handle);
+        return GDK_EVENT_PROPAGATE;
     }
+
+    g_mutex_lock (&priv->stats_mutex);
+    priv->key_events++;
+    if (event->type == GDK_KEY_PRESS && priv->key_press_time == 0)
+        priv->key_press_time = g_get_monotonic_time ();
+    g_mutex_unlock (&priv->stats_mutex);
+
+    return GDK_EVENT_STOP;
 }
 
-static void
-fl_view_size_allocate (GtkWidget *widget, GtkAllocation *allocation)
+static gsize
+get_budget_share (FlView *self, gint share)
 {
-    FlView *self = FL_VIEW (widget);
     FlViewPrivate *priv = fl_view_get_instance_private (self);
+    return priv->memory_budget / 100 * share;
+}
 
-    g_printerr ("fl_view_size_allocate %d %d\n", allocation->width, allocation->height);
+static void
+fl_view_send_lifecycle_state (FlView *self, const gchar *state)
+{
+    fl_view_send_platform_message (self, "flutter/lifecycle", (const guint8 *) state, strlen (state));
+}
 
-    gtk_widget_set_allocation (widget, allocation);
+static void
+fl_view_send_window_metrics (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    GtkAllocation allocation;
 
-    if (gtk_widget_get_realized (widget) && gtk_widget_get_has_window (widget))
-        gdk_window_move_resize (gtk_widget_get_window (widget),
-                                allocation->x, allocation->y,
-                                allocation->width, allocation->height);
+    gtk_widget_get_allocation (GTK_WIDGET (self), &allocation);
 
     FlutterWindowMetricsEvent event = {};
     event.struct_size = sizeof (FlutterWindowMetricsEvent);
-    event.width = allocation->width;
-    event.height = allocation->height;
+    event.width = allocation.width;
+    event.height = allocation.height;
     event.pixel_ratio = 1; // FIXME
+    if (priv->event_recorder != NULL)
+        fl_event_recorder_record_window_metrics (priv->event_recorder, &event);
     FlutterEngineSendWindowMetricsEvent (priv->engine, &event);
 }
 
 static void
-fl_view_class_init (FlViewClass *klass)
+fl_view_send_pointer_event (FlView *self, FlutterPointerPhase phase, gdouble x, gdouble y, gdouble scroll_delta_x, gdouble scroll_delta_y)
 {
-    G_OBJECT_CLASS (klass)->dispose = fl_view_dispose;
-    GTK_WIDGET_CLASS (klass)->realize = fl_view_realize;
-    GTK_WIDGET_CLASS (klass)->size_allocate = fl_view_size_allocate;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    if (priv->engine == NULL)
+        return;
+
+    // The engine needs to know about the mouse before it can be used.
+    if (!priv->pointer_added && phase != kAdd && phase != kRemove)
+        fl_view_send_pointer_event (self, kAdd, x, y, 0, 0);
+
+    FlutterPointerEvent event = { 0 };
+    event.struct_size = sizeof (FlutterPointerEvent);
+    event.phase = phase;
+    event.timestamp = FlutterEngineGetCurrentTime () / 1000;
+    event.x = x;
+    event.y = y;
+    if (scroll_delta_x != 0 || scroll_delta_y != 0) {
+        event.signal_kind = kFlutterPointerSignalKindScroll;
+        event.scroll_delta_x = scroll_delta_x;
+        event.scroll_delta_y = scroll_delta_y;
+    }
+    event.device_kind = kFlutterPointerDeviceKindMouse;
+    event.buttons = priv->pointer_buttons;
+    if (priv->event_recorder != NULL)
+        fl_event_recorder_record_pointer_event (priv->event_recorder, &event);
+    FlutterEngineResult result = FlutterEngineSendPointerEvent (priv->engine, &event, 1);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to send pointer event: %s", error);
+    }
+
+    if (phase == kAdd)
+        priv->pointer_added = TRUE;
+    else if (phase == kRemove)
+        priv->pointer_added = FALSE;
+}
+
+static int64_t
+get_pointer_button (guint button)
+{
+    switch (button)
+    {
+    case 1:
+        return kFlutterPointerButtonMousePrimary;
+    case 2:
+        return kFlutterPointerButtonMouseMiddle;
+    case 3:
+        return kFlutterPointerButtonMouseSecondary;
+    case 8:
+        return kFlutterPointerButtonMouseBack;
+    case 9:
+        return kFlutterPointerButtonMouseForward;
+    default:
+        return 0;
+    }
+}
+
+// Returns the time between frames on the monitor showing this view, in nanoseconds.
+static uint64_t
+fl_view_get_frame_interval (FlView *self)
+{
+    GtkWidget *widget = GTK_WIDGET (self);
+    GdkWindow *window = gtk_widget_get_window (widget);
+    gint refresh_rate = 0;
+
+    if (window != NULL) {
+        GdkMonitor *monitor = gdk_display_get_monitor_at_window (gtk_widget_get_display (widget), window);
+        if (monitor != NULL)
+            refresh_rate = gdk_monitor_get_refresh_rate (monitor);
+    }
+    if (refresh_rate <= 0)
+        refresh_rate = DEFAULT_REFRESH_RATE;
+
+    return G_GUINT64_CONSTANT (1000000000000) / refresh_rate;
 }
 
+// Return a baton straight away, when the engine has to have it back.
 static void
-fl_view_init (FlView *self)
+fl_view_send_vsync (FlView *self, intptr_t baton)
 {
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    uint64_t now = FlutterEngineGetCurrentTime ();
+    FlutterEngineOnVsync (priv->engine, baton, now, now + fl_view_get_frame_interval (self));
 }
 
-FlView *
-fl_view_new (void)
+// Answer the held baton on the frame clock's next update, so frames are paced to the display.
+static void
+fl_view_schedule_vsync (FlView *self)
 {
-    return g_object_new (fl_view_get_type (), NULL);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    if (priv->frame_clock != NULL) {
+        gdk_frame_clock_request_phase (priv->frame_clock, GDK_FRAME_CLOCK_PHASE_UPDATE);
+    } else {
+        priv->have_pending_vsync = FALSE;
+        fl_view_send_vsync (self, priv->pending_vsync_baton);
+    }
 }
 
-void
-fl_view_set_assets_path (FlView *self, const gchar *assets_path)
+static void
+fl_view_frame_clock_update_cb (GdkFrameClock *clock, FlView *self)
 {
     FlViewPrivate *priv = fl_view_get_instance_private (self);
 
-    g_return_if_fail (FL_IS_VIEW (self));
+    if (!priv->have_pending_vsync || priv->engine == NULL || !g_atomic_int_get (&priv->visible))
+        return;
+    priv->have_pending_vsync = FALSE;
 
-    g_free (priv->assets_path);
-    priv->assets_path = g_strdup (assets_path);
+    gint64 frame_time = gdk_frame_clock_get_frame_time (clock);
+    gint64 refresh_interval = 0, presentation_time = 0;
+    gdk_frame_clock_get_refresh_info (clock, frame_time, &refresh_interval, &presentation_time);
+    uint64_t interval = refresh_interval > 0 ? (uint64_t) refresh_interval * 1000 : fl_view_get_frame_interval (self);
+
+    // The frame clock uses the monotonic clock, which may not be the engine's.
+    gint64 offset = (gint64) (FlutterEngineGetCurrentTime () / 1000) - g_get_monotonic_time ();
+    uint64_t start_time = (uint64_t) (frame_time + offset) * 1000;
+    FlutterEngineOnVsync (priv->engine, priv->pending_vsync_baton, start_time, start_time + interval);
 }
 
-void
-fl_view_set_icu_data_path (FlView *self, const gchar *icu_data_path)
+static gsize
+get_image_size (cairo_surface_t *surface)
+{
+    if (surface == NULL)
+        return 0;
+    return (gsize) cairo_image_surface_get_stride (surface) * cairo_image_surface_get_height (surface);
+}
+
+static void
+fl_view_set_snapshot (FlView *self, cairo_surface_t *snapshot)
 {
     FlViewPrivate *priv = fl_view_get_instance_private (self);
 
-    g_return_if_fail (FL_IS_VIEW (self));
+    g_mutex_lock (&priv->stats_mutex);
+    priv->texture_pool_size += get_image_size (snapshot) - get_image_size (priv->snapshot);
+    g_mutex_unlock (&priv->stats_mutex);
+    g_clear_pointer (&priv->snapshot, cairo_surface_destroy);
+    priv->snapshot = snapshot;
+}
 
-    g_free (priv->icu_data_path);
-    priv->icu_data_path = g_strdup (icu_data_path);
+// FIXME: Called from Flutter thread
+static void
+fl_view_snapshot_task (void *user_data)
+{
+    SnapshotRequest *request = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (request->view);
+
+    request->snapshot = fl_renderer_read_frame (priv->renderer);
+
+    // Release the context so it can be destroyed once the engine has stopped.
+    fl_renderer_clear_current (priv->renderer);
+
+    g_idle_add (fl_view_snapshot_done_cb, request);
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_view_repaint_task (void *user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_mutex_lock (&priv->expose_mutex);
+    cairo_region_t *damage = g_steal_pointer (&priv->expose_damage);
+    g_mutex_unlock (&priv->expose_mutex);
+
+    if (damage != NULL)
+        fl_renderer_repaint (priv->renderer, damage);
+
+    g_clear_pointer (&damage, cairo_region_destroy);
+    g_object_unref (self);
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_view_readback_poll_task (void *user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    if (fl_renderer_make_current (priv->renderer)) {
+        FlFrameRecorder *recorder = g_atomic_pointer_get (&priv->recorder);
+        FlFrameExporter *exporter = g_atomic_pointer_get (&priv->exporter);
+        fl_frame_capture_poll (priv->capture);
+        if (recorder != NULL)
+            fl_frame_recorder_poll (recorder);
+        if (exporter != NULL)
+            fl_frame_exporter_poll (exporter);
+        fl_renderer_clear_current (priv->renderer);
+    }
+
+    g_object_unref (self);
+}
+
+// Collect frames still being read back once the engine stops drawing frames.
+// Kept going while recording or exporting, as each frame is only collected after the next.
+static gboolean
+fl_view_readback_poll_cb (gpointer user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    gboolean capture_pending = fl_frame_capture_is_pending (priv->capture);
+    if ((!capture_pending && priv->recorder == NULL && priv->exporter == NULL) || priv->engine == NULL) {
+        priv->readback_poll_source = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    gboolean pending = capture_pending ||
+                       (priv->recorder != NULL && fl_frame_recorder_is_pending (priv->recorder)) ||
+                       (priv->exporter != NULL && fl_frame_exporter_is_pending (priv->exporter));
+    if (!pending)
+        return G_SOURCE_CONTINUE;
+
+    FlutterEngineResult result = FlutterEnginePostRenderThreadTask (priv->engine, fl_view_readback_poll_task, g_object_ref (self));
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to poll readbacks: %s", error);
+        g_object_unref (self);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+fl_view_start_readback_poll (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    if (priv->readback_poll_source == 0)
+        priv->readback_poll_source = g_timeout_add (READBACK_POLL_INTERVAL, fl_view_readback_poll_cb, self);
+}
+
+static void
+release_request_free (ReleaseRequest *request)
+{
+    g_object_unref (request->view);
+    g_object_unref (request->object);
+    g_free (request);
+}
+
+static gboolean
+fl_view_released_cb (gpointer user_data)
+{
+    release_request_free (user_data);
+    return G_SOURCE_REMOVE;
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_view_release_task (void *user_data)
+{
+    ReleaseRequest *request = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (request->view);
+
+    // GL objects are deleted in the context they were made in.
+    if (request->release_buffers != NULL && fl_renderer_make_current (priv->renderer)) {
+        request->release_buffers (request->object);
+        fl_renderer_clear_current (priv->renderer);
+    }
+
+    // Anything the raster thread was doing with the object has finished, drop it from the main
+    // thread as that waits for its worker thread.
+    g_idle_add (fl_view_released_cb, request);
+}
+
+// Drop an object once the raster thread has stopped using it, after
+// @release_buffers is called on it from the raster thread if given.
+static void
+fl_view_release_from_raster_thread (FlView *self, gpointer object, ReleaseBuffersFunc release_buffers)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    ReleaseRequest *request = g_new0 (ReleaseRequest, 1);
+    request->view = g_object_ref (self);
+    request->object = object;
+    request->release_buffers = release_buffers;
+
+    if (priv->engine != NULL) {
+        FlutterEngineResult result = FlutterEnginePostRenderThreadTask (priv->engine, fl_view_release_task, request);
+        if (result == kSuccess)
+            return;
+
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to release %s: %s", G_OBJECT_TYPE_NAME (object), error);
+    }
+
+    release_request_free (request);
+}
+
+static gboolean
+fl_view_message_handler_free_cb (gpointer user_data)
+{
+    MessageHandler *handler = user_data;
+
+    if (handler->destroy_notify != NULL)
+        handler->destroy_notify (handler->user_data);
+    g_mutex_clear (&handler->mutex);
+    g_free (handler);
+
+    return G_SOURCE_REMOVE;
+}
+
+static MessageHandler *
+message_handler_ref (MessageHandler *handler)
+{
+    g_atomic_int_inc (&handler->ref_count);
+    return handler;
+}
+
+static void
+message_handler_unref (MessageHandler *handler)
+{
+    // The last reference can be dropped on a worker thread, user data is always destroyed on the main thread.
+    if (g_atomic_int_dec_and_test (&handler->ref_count))
+        g_main_context_invoke (NULL, fl_view_message_handler_free_cb, handler);
+}
+
+static void
+message_free (Message *message)
+{
+    message_handler_unref (message->handler);
+    g_free (message->channel);
+    g_bytes_unref (message->message);
+    g_idle_add (fl_view_released_cb, message->view);
+    g_free (message);
+}
+
+static void
+fl_view_message_run (Message *message)
+{
+    FlViewMessageResponse *response = g_steal_pointer (&message->response);
+    message->handler->handler (message->view, message->channel, message->message, response, message->handler->user_data);
+}
+
+static gboolean
+fl_view_message_idle_cb (gpointer user_data)
+{
+    Message *message = user_data;
+
+    fl_view_message_run (message);
+    message_free (message);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void fl_view_message_work (gpointer data);
+
+static void
+fl_view_message_submit (Message *message)
+{
+    MessageHandler *handler = message->handler;
+
+    g_mutex_lock (&handler->mutex);
+    gboolean full = handler->max_concurrency != 0 && handler->running >= handler->max_concurrency;
+    if (full)
+        g_queue_push_tail (&handler->backlog, message);
+    else
+        handler->running++;
+    g_mutex_unlock (&handler->mutex);
+
+    if (!full)
+        fl_work_pool_push (fl_work_pool_get_default (), fl_view_message_work, message);
+}
+
+// FIXME: Called from a worker thread
+static void
+fl_view_message_work (gpointer data)
+{
+    Message *message = data;
+    MessageHandler *handler = message_handler_ref (message->handler);
+
+    fl_view_message_run (message);
+    message_free (message);
+
+    // Hand the slot to the oldest message waiting for one.
+    g_mutex_lock (&handler->mutex);
+    Message *next = g_queue_pop_head (&handler->backlog);
+    if (next == NULL)
+        handler->running--;
+    g_mutex_unlock (&handler->mutex);
+    if (next != NULL)
+        fl_work_pool_push (fl_work_pool_get_default (), fl_view_message_work, next);
+
+    message_handler_unref (handler);
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_view_platform_message_cb (const FlutterPlatformMessage *platform_message, void *user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    FlViewMessageResponse *response = g_new0 (FlViewMessageResponse, 1);
+    response->view = g_object_ref (self);
+    response->engine_generation = priv->engine_generation;
+    response->handle = platform_message->response_handle;
+
+    g_mutex_lock (&priv->message_handlers_mutex);
+    MessageHandler *handler = g_hash_table_lookup (priv->message_handlers, platform_message->channel);
+    if (handler != NULL)
+        message_handler_ref (handler);
+    g_mutex_unlock (&priv->message_handlers_mutex);
+
+    // The engine waits for a response to every message.
+    if (handler == NULL) {
+        fl_view_message_response_send (response, NULL);
+        return;
+    }
+
+    Message *message = g_new0 (Message, 1);
+    message->view = g_object_ref (self);
+    message->handler = handler;
+    message->channel = g_strdup (platform_message->channel);
+    message->message = g_bytes_new (platform_message->message, platform_message->message_size);
+    message->response = response;
+
+    if (handler->flags & FL_VIEW_MESSAGE_HANDLER_BACKGROUND)
+        fl_view_message_submit (message);
+    else
+        g_idle_add (fl_view_message_idle_cb, message);
+}
+
+typedef struct
+{
+    FlutterSemanticsNode node;
+
+    // Where the node's strings and children are in the data, pointed to once
+    // the data is applied and no longer grows.
+    guint label;
+    guint value;
+    guint hint;
+    guint children;
+} SemanticsNodeCopy;
+
+static guint
+semantics_data_append_string (GByteArray *data, const gchar *string)
+{
+    guint offset = data->len;
+    if (string != NULL)
+        g_byte_array_append (data, (const guint8 *) string, strlen (string));
+    g_byte_array_append (data, (const guint8 *) "", 1);
+    return offset;
+}
+
+// Copies @node to the end of @nodes and @data, which is left aligned for the children of the next node.
+static void
+semantics_node_copy (GArray *nodes, GByteArray *data, const FlutterSemanticsNode *node)
+{
+    SemanticsNodeCopy copy = { 0 };
+
+    // Only what the semantics tree keeps.
+    copy.node.struct_size = sizeof (FlutterSemanticsNode);
+    copy.node.id = node->id;
+    copy.node.flags = node->flags;
+    copy.node.actions = node->actions;
+    copy.node.rect = node->rect;
+    copy.node.transform = node->transform;
+    copy.node.child_count = node->child_count;
+    copy.label = semantics_data_append_string (data, node->label);
+    copy.value = semantics_data_append_string (data, node->value);
+    copy.hint = semantics_data_append_string (data, node->hint);
+    g_byte_array_set_size (data, (data->len + sizeof (int32_t) - 1) / sizeof (int32_t) * sizeof (int32_t));
+    copy.children = data->len;
+    g_byte_array_append (data, (const guint8 *) node->children_in_traversal_order, node->child_count * sizeof (int32_t));
+
+    g_array_append_val (nodes, copy);
+}
+
+static FlutterSemanticsCustomAction *
+semantics_custom_action_copy (const FlutterSemanticsCustomAction *action)
+{
+    FlutterSemanticsCustomAction *copy = g_new0 (FlutterSemanticsCustomAction, 1);
+
+    copy->struct_size = sizeof (FlutterSemanticsCustomAction);
+    copy->id = action->id;
+    copy->override_action = action->override_action;
+    copy->label = g_strdup (action->label);
+    copy->hint = g_strdup (action->hint);
+
+    return copy;
+}
+
+static void
+semantics_custom_action_free (FlutterSemanticsCustomAction *action)
+{
+    g_free ((gchar *) action->label);
+    g_free ((gchar *) action->hint);
+    g_free (action);
+}
+
+// Drops semantics updates not yet applied.
+static void
+fl_view_clear_semantics_updates (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_mutex_lock (&priv->semantics_mutex);
+    g_array_set_size (priv->semantics_nodes, 0);
+    g_byte_array_set_size (priv->semantics_data, 0);
+    g_ptr_array_set_size (priv->semantics_actions, 0);
+    priv->semantics_n_ready = 0;
+    priv->semantics_data_ready = 0;
+    g_mutex_unlock (&priv->semantics_mutex);
+}
+
+static void
+fl_view_reset_semantics (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    fl_view_clear_semantics_updates (self);
+    fl_semantics_tree_clear (priv->semantics_tree);
+    if (priv->semantics_enabled)
+        fl_view_accessible_reset (FL_VIEW_ACCESSIBLE (gtk_widget_get_accessible (GTK_WIDGET (self))));
+}
+
+static void
+fl_view_apply_semantics_updates (FlView *self, GPtrArray *actions, GArray *nodes, GByteArray *data)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    for (guint i = 0; i < actions->len; i++)
+        fl_semantics_tree_update_custom_action (priv->semantics_tree, g_ptr_array_index (actions, i));
+    for (guint i = 0; i < nodes->len; i++) {
+        SemanticsNodeCopy *copy = &g_array_index (nodes, SemanticsNodeCopy, i);
+        copy->node.label = (const gchar *) data->data + copy->label;
+        copy->node.value = (const gchar *) data->data + copy->value;
+        copy->node.hint = (const gchar *) data->data + copy->hint;
+        copy->node.children_in_traversal_order = (const int32_t *) (data->data + copy->children);
+        fl_semantics_tree_update_node (priv->semantics_tree, &copy->node);
+    }
+    if (!fl_semantics_tree_end_batch (priv->semantics_tree))
+        return;
+
+    g_autoptr(GArray) changes = fl_semantics_tree_take_changes (priv->semantics_tree);
+    fl_view_accessible_apply_changes (FL_VIEW_ACCESSIBLE (gtk_widget_get_accessible (GTK_WIDGET (self))), changes);
+}
+
+// Applies the complete batches of semantics updates and reports the changed nodes in one go.
+static gboolean
+fl_view_semantics_flush_cb (gpointer user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_mutex_lock (&priv->semantics_mutex);
+    priv->semantics_flush_pending = FALSE;
+    if (priv->semantics_nodes == NULL) {
+        g_mutex_unlock (&priv->semantics_mutex);
+        return G_SOURCE_REMOVE;
+    }
+    GArray *nodes = priv->semantics_nodes;
+    GByteArray *data = priv->semantics_data;
+    priv->semantics_nodes = g_steal_pointer (&priv->semantics_spare_nodes);
+    priv->semantics_data = g_steal_pointer (&priv->semantics_spare_data);
+    if (priv->semantics_nodes == NULL) {
+        priv->semantics_nodes = g_array_new (FALSE, FALSE, sizeof (SemanticsNodeCopy));
+        priv->semantics_data = g_byte_array_new ();
+    }
+    // Updates after the last batch end are kept for the next flush.
+    for (guint i = priv->semantics_n_ready; i < nodes->len; i++) {
+        SemanticsNodeCopy copy = g_array_index (nodes, SemanticsNodeCopy, i);
+        copy.label -= priv->semantics_data_ready;
+        copy.value -= priv->semantics_data_ready;
+        copy.hint -= priv->semantics_data_ready;
+        copy.children -= priv->semantics_data_ready;
+        g_array_append_val (priv->semantics_nodes, copy);
+    }
+    g_byte_array_append (priv->semantics_data, data->data + priv->semantics_data_ready, data->len - priv->semantics_data_ready);
+    g_array_set_size (nodes, priv->semantics_n_ready);
+    g_byte_array_set_size (data, priv->semantics_data_ready);
+    priv->semantics_n_ready = 0;
+    priv->semantics_data_ready = 0;
+    g_autoptr(GPtrArray) actions = priv->semantics_actions;
+    priv->semantics_actions = g_ptr_array_new_with_free_func ((GDestroyNotify) semantics_custom_action_free);
+    g_mutex_unlock (&priv->semantics_mutex);
+
+    if (priv->semantics_enabled)
+        fl_view_apply_semantics_updates (self, actions, nodes, data);
+
+    // Kept for the next flush, unless the view was disposed while applying them.
+    g_array_set_size (nodes, 0);
+    g_byte_array_set_size (data, 0);
+    g_mutex_lock (&priv->semantics_mutex);
+    if (priv->semantics_nodes != NULL && priv->semantics_spare_nodes == NULL) {
+        priv->semantics_spare_nodes = g_steal_pointer (&nodes);
+        priv->semantics_spare_data = g_steal_pointer (&data);
+    }
+    g_mutex_unlock (&priv->semantics_mutex);
+    g_clear_pointer (&nodes, g_array_unref);
+    g_clear_pointer (&data, g_byte_array_unref);
+
+    return G_SOURCE_REMOVE;
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_view_update_semantics_node_cb (const FlutterSemanticsNode *node, void *user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_mutex_lock (&priv->semantics_mutex);
+    gboolean schedule_flush = FALSE;
+    if (node->id == kFlutterSemanticsNodeIdBatchEnd) {
+        priv->semantics_n_ready = priv->semantics_nodes->len;
+        priv->semantics_data_ready = priv->semantics_data->len;
+        schedule_flush = !priv->semantics_flush_pending;
+        priv->semantics_flush_pending = TRUE;
+    } else {
+        semantics_node_copy (priv->semantics_nodes, priv->semantics_data, node);
+    }
+    g_mutex_unlock (&priv->semantics_mutex);
+
+    // Batches arriving within a frame are applied together.
+    if (schedule_flush)
+        g_timeout_add_full (G_PRIORITY_DEFAULT, priv->semantics_flush_interval, fl_view_semantics_flush_cb, g_object_ref (self), g_object_unref);
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_view_update_semantics_custom_action_cb (const FlutterSemanticsCustomAction *action, void *user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // Custom actions always come before the nodes using them, so are applied with them.
+    if (action->id == kFlutterSemanticsCustomActionIdBatchEnd)
+        return;
+
+    g_mutex_lock (&priv->semantics_mutex);
+    g_ptr_array_add (priv->semantics_actions, semantics_custom_action_copy (action));
+    g_mutex_unlock (&priv->semantics_mutex);
+}
+
+static void
+fl_view_update_semantics_enabled (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // The engine only builds semantics while they are enabled, which costs time every frame.
+    gboolean enabled = fl_accessibility_monitor_get_enabled (fl_accessibility_monitor_get_default ());
+    if (priv->engine == NULL || enabled == priv->semantics_enabled)
+        return;
+
+    if (!enabled)
+        fl_view_reset_semantics (self);
+    priv->semantics_enabled = enabled;
+
+    FlutterEngineResult result = FlutterEngineUpdateSemanticsEnabled (priv->engine, enabled);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to update semantics enabled: %s", error);
+    }
+}
+
+static void
+fl_view_accessibility_enabled_changed_cb (FlAccessibilityMonitor *monitor, FlView *self)
+{
+    fl_view_update_semantics_enabled (self);
+}
+
+// Repaint an exposed area from the last frame, without the engine drawing a new one.
+static void
+fl_view_repaint (FlView *self, cairo_t *cr)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    switch (fl_renderer_draw (priv->renderer, cr))
+    {
+    case FL_RENDERER_DRAW_DONE:
+        return;
+    case FL_RENDERER_DRAW_NEEDS_FRAME:
+        // Nothing kept, have to ask for a new frame.
+        fl_view_send_window_metrics (self);
+        return;
+    case FL_RENDERER_DRAW_NEEDS_RASTER_THREAD:
+        break;
+    }
+
+    g_mutex_lock (&priv->expose_mutex);
+    gboolean repaint_pending = priv->expose_damage != NULL;
+    if (!repaint_pending)
+        priv->expose_damage = cairo_region_create ();
+    fl_renderer_add_clip_to_region (cr, priv->expose_damage);
+    g_mutex_unlock (&priv->expose_mutex);
+
+    if (!repaint_pending) {
+        FlutterEngineResult result = FlutterEnginePostRenderThreadTask (priv->engine, fl_view_repaint_task, g_object_ref (self));
+        if (result != kSuccess) {
+            g_autofree gchar *error = flutter_engine_result_to_string (result);
+            g_warning ("Failed to repaint view: %s", error);
+            g_mutex_lock (&priv->expose_mutex);
+            g_clear_pointer (&priv->expose_damage, cairo_region_destroy);
+            g_mutex_unlock (&priv->expose_mutex);
+            g_object_unref (self);
+        }
+    }
+}
+
+static gboolean
+fl_view_vsync_idle_cb (gpointer user_data)
+{
+    VsyncRequest *request = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (request->view);
+
+    if (priv->engine == NULL || request->engine_generation != priv->engine_generation) {
+        // Engine has gone, nothing to return the baton to.
+    } else {
+        // Keep the baton while hidden, so the engine stops producing frames.
+        priv->have_pending_vsync = TRUE;
+        priv->pending_vsync_baton = request->baton;
+        if (g_atomic_int_get (&priv->visible))
+            fl_view_schedule_vsync (request->view);
+    }
+
+    // The restarted engine has replaced the snapshot.
+    if (priv->snapshot != NULL && g_atomic_int_get (&priv->frame_presented))
+        fl_view_set_snapshot (request->view, NULL);
+
+    g_object_unref (request->view);
+    g_free (request);
+
+    return G_SOURCE_REMOVE;
+}
+
+// FIXME: Called from Flutter thread
+static void
+fl_view_vsync_callback (void *user_data, intptr_t baton)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    VsyncRequest *request = g_new0 (VsyncRequest, 1);
+
+    // The engine must be answered on the thread FlutterEngineRun was called on.
+    request->view = g_object_ref (self);
+    request->engine_generation = priv->engine_generation;
+    request->baton = baton;
+    g_idle_add_full (G_PRIORITY_HIGH, fl_view_vsync_idle_cb, request, NULL);
+}
+
+static void
+fl_view_update_visibility (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    gboolean visible = !priv->pause_when_hidden ||
+                       (priv->mapped &&
+                        (priv->toplevel_state & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) == 0 &&
+                        priv->visibility != GDK_VISIBILITY_FULLY_OBSCURED);
+    if (visible == g_atomic_int_get (&priv->visible))
+        return;
+    g_atomic_int_set (&priv->visible, visible);
+
+    if (visible)
+        fl_view_evictor_view_shown (fl_view_evictor_get_default (), self);
+    else
+        fl_view_evictor_view_hidden (fl_view_evictor_get_default (), self);
+
+    // Show the snapshot first and bring the engine back once idle.
+    if (visible && priv->evicted && priv->restart_source == 0)
+        priv->restart_source = g_idle_add (fl_view_restart_cb, self);
+
+    if (priv->engine == NULL)
+        return;
+
+    if (visible) {
+        g_debug ("View shown, %d frames skipped while hidden", g_atomic_int_get (&priv->skipped_frames));
+        g_atomic_int_set (&priv->skipped_frames, 0);
+        fl_view_send_lifecycle_state (self, "AppLifecycleState.resumed");
+        if (priv->have_pending_vsync)
+            fl_view_schedule_vsync (self);
+
+        // Draw a fresh frame straight away rather than showing what was last presented.
+        fl_view_send_window_metrics (self);
+    } else {
+        fl_view_send_lifecycle_state (self, "AppLifecycleState.inactive");
+        fl_view_send_lifecycle_state (self, "AppLifecycleState.paused");
+    }
+}
+
+static gboolean
+fl_view_toplevel_window_state_cb (GtkWidget *toplevel, GdkEventWindowState *event, FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    priv->toplevel_state = event->new_window_state;
+    fl_view_update_visibility (self);
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static void
+fl_view_message_queue_drained_cb (FlMessageQueue *queue, FlView *self)
+{
+    g_signal_emit (self, signals[SIGNAL_MESSAGE_QUEUE_DRAINED], 0);
+}
+
+static guint64
+fl_view_low_memory_cb (FlMemoryMonitor *monitor, FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    if (priv->engine != NULL) {
+        FlutterEngineResult result = FlutterEngineNotifyLowMemoryWarning (priv->engine);
+        if (result != kSuccess) {
+            g_autofree gchar *error = flutter_engine_result_to_string (result);
+            g_warning ("Failed to notify Flutter of low memory: %s", error);
+        }
+    }
+
+    // The engine releases its caches asynchronously on its own threads, so only
+    // memory freed by the embedder is reported here.
+    guint64 reclaimed = 0;
+    if (priv->snapshot != NULL && !g_atomic_int_get (&priv->visible)) {
+        reclaimed += get_image_size (priv->snapshot);
+        fl_view_set_snapshot (self, NULL);
+    }
+
+    return reclaimed;
+}
+
+static gboolean fl_view_stop_engine_async (FlView *self, FlRenderer *renderer, GdkWindow *window);
+
+static void
+fl_view_dispose (GObject *object)
+{
+    FlView *self = FL_VIEW (object);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    fl_view_evictor_engine_stopped (fl_view_evictor_get_default (), self);
+    if (priv->restart_source != 0) {
+        g_source_remove (priv->restart_source);
+        priv->restart_source = 0;
+    }
+    if (priv->readback_poll_source != 0) {
+        g_source_remove (priv->readback_poll_source);
+        priv->readback_poll_source = 0;
+    }
+    fl_view_set_snapshot (self, NULL);
+    g_mutex_lock (&priv->expose_mutex);
+    g_clear_pointer (&priv->expose_damage, cairo_region_destroy);
+    g_mutex_unlock (&priv->expose_mutex);
+
+    // The engine's threads use the rest until it has shut down, which keeps
+    // the view alive and disposes it again once done.
+    fl_view_stop_engine_async (self, NULL, NULL);
+    if (priv->shutting_down) {
+        G_OBJECT_CLASS (fl_view_parent_class)->dispose (object);
+        return;
+    }
+
+    g_clear_pointer (&priv->assets_path, g_free);
+    g_clear_pointer (&priv->icu_data_path, g_free);
+    g_clear_pointer (&priv->dart_entrypoint, g_free);
+    fl_view_clear_snapshots (self);
+    g_clear_object (&priv->asset_archive);
+    // Taken from the pool but never started.
+    g_clear_pointer (&priv->pooled_engine, fl_pooled_engine_release);
+    g_clear_object (&priv->renderer);
+    g_clear_object (&priv->recorder);
+    g_clear_object (&priv->exporter);
+    g_clear_object (&priv->event_recorder);
+    g_clear_object (&priv->message_queue);
+    g_clear_object (&priv->text_input);
+    g_clear_object (&priv->semantics_tree);
+    g_mutex_lock (&priv->semantics_mutex);
+    g_clear_pointer (&priv->semantics_nodes, g_array_unref);
+    g_clear_pointer (&priv->semantics_data, g_byte_array_unref);
+    g_clear_pointer (&priv->semantics_spare_nodes, g_array_unref);
+    g_clear_pointer (&priv->semantics_spare_data, g_byte_array_unref);
+    g_clear_pointer (&priv->semantics_actions, g_ptr_array_unref);
+    g_mutex_unlock (&priv->semantics_mutex);
+    g_mutex_lock (&priv->message_handlers_mutex);
+    g_clear_pointer (&priv->message_handlers, g_hash_table_unref);
+    g_mutex_unlock (&priv->message_handlers_mutex);
+    if (priv->capture != NULL)
+        fl_frame_capture_reset (priv->capture);
+    g_clear_object (&priv->capture);
+
+    G_OBJECT_CLASS (fl_view_parent_class)->dispose (object);
+}
+
+static void
+fl_view_finalize (GObject *object)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (FL_VIEW (object));
+
+    g_mutex_clear (&priv->expose_mutex);
+    g_mutex_clear (&priv->stats_mutex);
+    g_mutex_clear (&priv->message_handlers_mutex);
+    g_mutex_clear (&priv->semantics_mutex);
+    g_rw_lock_clear (&priv->engine_lock);
+
+    G_OBJECT_CLASS (fl_view_parent_class)->finalize (object);
+}
+
+static void
+fl_view_clear_snapshots (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_clear_pointer (&priv->vm_snapshot_data, g_bytes_unref);
+    g_clear_pointer (&priv->vm_snapshot_instructions, g_bytes_unref);
+    g_clear_pointer (&priv->isolate_snapshot_data, g_bytes_unref);
+    g_clear_pointer (&priv->isolate_snapshot_instructions, g_bytes_unref);
+}
+
+// TRUE if the asset archive holds an AOT build's snapshots. JIT builds also
+// have snapshot data, but run from kernel_blob.bin with no instructions.
+static gboolean
+fl_view_has_archive_snapshots (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    return priv->asset_archive != NULL && fl_asset_archive_contains (priv->asset_archive, "vm_snapshot_instr");
+}
+
+// Use AOT snapshots straight from the archive's mapping, if it has them.
+static void
+fl_view_load_snapshots (FlView *self, FlutterProjectArgs *args)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    g_autoptr(GError) error = NULL;
+
+    if (!fl_view_has_archive_snapshots (self))
+        return;
+
+    if (priv->isolate_snapshot_data == NULL) {
+        if ((priv->vm_snapshot_data = fl_asset_archive_lookup (priv->asset_archive, "vm_snapshot_data", &error)) == NULL ||
+            (priv->vm_snapshot_instructions = fl_asset_archive_lookup_executable (priv->asset_archive, "vm_snapshot_instr", &error)) == NULL ||
+            (priv->isolate_snapshot_data = fl_asset_archive_lookup (priv->asset_archive, "isolate_snapshot_data", &error)) == NULL ||
+            (priv->isolate_snapshot_instructions = fl_asset_archive_lookup_executable (priv->asset_archive, "isolate_snapshot_instr", &error)) == NULL) {
+            g_warning ("Failed to load snapshots from asset archive: %s", error->message);
+            fl_view_clear_snapshots (self);
+            return;
+        }
+    }
+
+    args->vm_snapshot_data = g_bytes_get_data (priv->vm_snapshot_data, &args->vm_snapshot_data_size);
+    args->vm_snapshot_instructions = g_bytes_get_data (priv->vm_snapshot_instructions, &args->vm_snapshot_instructions_size);
+    args->isolate_snapshot_data = g_bytes_get_data (priv->isolate_snapshot_data, &args->isolate_snapshot_data_size);
+    args->isolate_snapshot_instructions = g_bytes_get_data (priv->isolate_snapshot_instructions, &args->isolate_snapshot_instructions_size);
+}
+
+// Set up the threads the engine's tasks run on, if not left to the engine.
+static gboolean
+fl_view_create_task_runners (FlView *self, FlutterCustomTaskRunners *task_runners)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    switch (priv->thread_topology)
+    {
+    case FL_VIEW_THREAD_TOPOLOGY_DEFAULT:
+        return FALSE;
+    case FL_VIEW_THREAD_TOPOLOGY_RENDER_THREAD:
+        priv->render_runner = fl_task_runner_new_thread ("fl-view-render", TRUE);
+        break;
+    case FL_VIEW_THREAD_TOPOLOGY_SINGLE_THREAD:
+        // The engine runs tasks for runners with the same identifier on the one thread.
+        priv->platform_runner = fl_task_runner_new_for_main_thread ();
+        priv->render_runner = g_object_ref (priv->platform_runner);
+        break;
+    }
+
+    task_runners->struct_size = sizeof (FlutterCustomTaskRunners);
+    if (priv->platform_runner != NULL)
+        task_runners->platform_task_runner = fl_task_runner_get_description (priv->platform_runner);
+    task_runners->render_task_runner = fl_task_runner_get_description (priv->render_runner);
+
+    return TRUE;
+}
+
+static void
+stop_task_runner (FlTaskRunner *runner)
+{
+    fl_task_runner_stop (runner);
+    g_object_unref (runner);
+}
+
+static void
+fl_view_stop_task_runners (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_clear_pointer (&priv->platform_runner, stop_task_runner);
+    g_clear_pointer (&priv->render_runner, stop_task_runner);
+}
+
+static gboolean
+fl_view_start_engine (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    FlutterRendererConfig config = { 0 };
+    FlutterProjectArgs args = { 0 };
+
+    config.type = kOpenGL;
+    config.open_gl.struct_size = sizeof (FlutterOpenGLRendererConfig);
+    config.open_gl.make_current = fl_view_gl_make_current;
+    config.open_gl.clear_current = fl_view_gl_clear_current;
+    config.open_gl.present = fl_view_gl_present;
+    config.open_gl.fbo_callback = fl_view_gl_fbo_callback;
+    config.open_gl.fbo_reset_after_present = fl_renderer_get_fbo_reset_after_present (priv->renderer);
+    config.open_gl.make_resource_current = NULL;//fl_view_gl_make_resource_current;
+    config.open_gl.gl_proc_resolver = fl_view_gl_proc_resolver;
+    args.struct_size = sizeof (FlutterProjectArgs);
+    args.assets_path = priv->assets_path;
+    args.icu_data_path = priv->icu_data_path;
+    args.custom_dart_entrypoint = priv->dart_entrypoint;
+    args.vsync_callback = fl_view_vsync_callback;
+    args.platform_message_callback = fl_view_platform_message_cb;
+    args.update_semantics_node_callback = fl_view_update_semantics_node_cb;
+    args.update_semantics_custom_action_callback = fl_view_update_semantics_custom_action_cb;
+    // The VM stays resident after the engine shuts down, so the next one starts faster.
+    args.shutdown_dart_vm_when_done = false;
+    fl_view_load_snapshots (self, &args);
+    const gchar *argv[2];
+    g_autofree gchar *cache_switch = fl_view_apply_memory_budget (&args, priv->memory_budget, argv);
+
+    FlutterCustomTaskRunners task_runners = { 0 };
+    if (fl_view_create_task_runners (self, &task_runners))
+        args.custom_task_runners = &task_runners;
+
+    g_atomic_int_set (&priv->frame_presented, FALSE);
+    priv->pointer_added = FALSE;
+
+    FlutterEngine engine = NULL;
+    if (priv->pooled_engine != NULL) {
+        engine = fl_pooled_engine_get_engine (priv->pooled_engine);
+    } else {
+        FlutterEngineResult result = FlutterEngineInitialize (FLUTTER_ENGINE_VERSION, &config, &args, self, &engine);
+        if (result != kSuccess) {
+            g_autofree gchar *error = flutter_engine_result_to_string (result);
+            g_warning ("Failed to initialize Flutter: %s", error);
+            fl_view_stop_task_runners (self);
+            return FALSE;
+        }
+    }
+
+    if (priv->platform_runner != NULL)
+        fl_task_runner_set_engine (priv->platform_runner, engine);
+    if (priv->render_runner != NULL)
+        fl_task_runner_set_engine (priv->render_runner, engine);
+
+    g_rw_lock_writer_lock (&priv->engine_lock);
+    priv->engine = engine;
+    priv->engine_generation++;
+    g_rw_lock_writer_unlock (&priv->engine_lock);
+
+    if (priv->pooled_engine != NULL) {
+        // Already running, it only has to be pointed at this view.
+        fl_pooled_engine_attach (priv->pooled_engine, &config, &args, self);
+    } else {
+        FlutterEngineResult result = FlutterEngineRunInitialized (priv->engine);
+        if (result != kSuccess) {
+            g_autofree gchar *error = flutter_engine_result_to_string (result);
+            g_warning ("Failed to run Flutter: %s", error);
+            return FALSE;
+        }
+    }
+
+    fl_message_queue_set_engine (priv->message_queue, priv->engine, fl_view_get_frame_interval (self));
+
+    priv->semantics_flush_interval = fl_view_get_frame_interval (self) / 1000000;
+    fl_view_update_semantics_enabled (self);
+
+    fl_view_send_window_metrics (self);
+    fl_view_evictor_engine_started (fl_view_evictor_get_default (), self, g_atomic_int_get (&priv->visible));
+    if (priv->recorder != NULL || priv->exporter != NULL)
+        fl_view_start_readback_poll (self);
+
+    return TRUE;
+}
+
+static void
+shutdown_engine (FlutterEngine engine)
+{
+    FlutterEngineResult result = FlutterEngineShutdown (engine);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to shutdown Flutter: %s", error);
+    }
+}
+
+// Takes the engine from the view, leaving it to be shut down.
+static FlutterEngine
+fl_view_detach_engine (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // All batons must be returned before the engine is shut down.
+    if (priv->have_pending_vsync) {
+        priv->have_pending_vsync = FALSE;
+        fl_view_send_vsync (self, priv->pending_vsync_baton);
+    }
+
+    // Queued messages are held for the next engine.
+    fl_message_queue_set_engine (priv->message_queue, NULL, 0);
+
+    // Responses still being worked on are dropped once the engine is gone.
+    g_rw_lock_writer_lock (&priv->engine_lock);
+    FlutterEngine engine = priv->engine;
+    priv->engine = NULL;
+    g_rw_lock_writer_unlock (&priv->engine_lock);
+
+    return engine;
+}
+
+// Delete the present thread's framebuffers in the raster thread's context, which made them.
+static void
+fl_view_release_present_thread (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    FlPresentThread *present_thread = priv->renderer != NULL ? fl_renderer_get_state (priv->renderer)->present_thread : NULL;
+    if (present_thread != NULL)
+        fl_view_release_from_raster_thread (self, g_object_ref (present_thread), (ReleaseBuffersFunc) fl_present_thread_release_framebuffers);
+}
+
+static void
+fl_view_stop_engine (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    if (priv->engine == NULL)
+        return;
+
+    fl_view_release_present_thread (self);
+    shutdown_engine (fl_view_detach_engine (self));
+
+    // Restarts after eviction start a new engine.
+    g_clear_pointer (&priv->pooled_engine, fl_pooled_engine_release);
+    fl_view_stop_task_runners (self);
+
+    // The next engine sends its semantics tree from scratch.
+    fl_view_reset_semantics (self);
+    priv->semantics_enabled = FALSE;
+
+    fl_view_evictor_engine_stopped (fl_view_evictor_get_default (), self);
+}
+
+static gboolean
+fl_view_shutdown_done_cb (gpointer user_data)
+{
+    ShutdownRequest *request = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (request->view);
+
+    g_debug ("Engine shut down in %" G_GINT64_FORMAT "us", g_get_monotonic_time () - request->start_time);
+
+    g_clear_pointer (&request->pooled_engine, fl_pooled_engine_release);
+    g_clear_pointer (&request->platform_runner, stop_task_runner);
+    g_clear_pointer (&request->render_runner, stop_task_runner);
+    if (request->renderer != NULL) {
+        // The EGL surface has to go before the window.
+        fl_renderer_stop (request->renderer);
+        g_clear_object (&request->renderer);
+        // Unless realized again with a new renderer since.
+        if (priv->renderer == NULL) {
+            fl_frame_capture_reset (priv->capture);
+            if (priv->recorder != NULL)
+                fl_frame_recorder_reset (priv->recorder);
+            if (priv->exporter != NULL)
+                fl_frame_exporter_reset (priv->exporter);
+        }
+    }
+    if (request->window != NULL) {
+        gdk_window_destroy (request->window);
+        g_clear_object (&request->window);
+    }
+    priv->shutting_down = FALSE;
+    g_object_unref (request->view);
+    g_free (request);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer
+shutdown_thread (gpointer user_data)
+{
+    ShutdownRequest *request = user_data;
+
+    // Blocks until the engine's threads have stopped.
+    shutdown_engine (request->engine);
+    g_idle_add (fl_view_shutdown_done_cb, request);
+
+    return NULL;
+}
+
+// Shut the engine down without blocking the main thread, keeping the view
+// alive until the engine's threads have stopped using it. The renderer and
+// window are taken, and stopped and destroyed once the engine has shut down.
+// Returns FALSE if there was no engine to stop, leaving them with the caller.
+static gboolean
+fl_view_stop_engine_async (FlView *self, FlRenderer *renderer, GdkWindow *window)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    if (priv->engine == NULL)
+        return FALSE;
+
+    // Frames drawn while shutting down have nowhere to go.
+    g_atomic_int_set (&priv->visible, FALSE);
+    fl_view_release_present_thread (self);
+
+    ShutdownRequest *request = g_new0 (ShutdownRequest, 1);
+    request->view = g_object_ref (self);
+    request->engine = fl_view_detach_engine (self);
+    request->pooled_engine = g_steal_pointer (&priv->pooled_engine);
+    // Shutting down still runs tasks on them.
+    request->platform_runner = g_steal_pointer (&priv->platform_runner);
+    request->render_runner = g_steal_pointer (&priv->render_runner);
+    request->start_time = g_get_monotonic_time ();
+    request->renderer = renderer;
+    request->window = window;
+    priv->shutting_down = TRUE;
+    g_thread_unref (g_thread_new ("fl-view-shutdown", shutdown_thread, request));
+
+    fl_view_evictor_engine_stopped (fl_view_evictor_get_default (), self);
+
+    return TRUE;
+}
+
+// Take the view's window from it so GTK doesn't destroy it on unrealize,
+// leaving GTK a placeholder to destroy in its place.
+static GdkWindow *
+fl_view_detach_window (FlView *self)
+{
+    GtkWidget *widget = GTK_WIDGET (self);
+    GdkWindow *window = g_object_ref (gtk_widget_get_window (widget));
+
+    gtk_widget_unregister_window (widget, window);
+    gdk_window_hide (window);
+    // Out of the toplevel, which may be destroyed with the view.
+    gdk_window_reparent (window, gdk_screen_get_root_window (gdk_window_get_screen (window)), 0, 0);
+
+    GdkWindowAttr attributes = { 0 };
+    attributes.window_type = GDK_WINDOW_CHILD;
+    attributes.wclass = GDK_INPUT_ONLY;
+    attributes.width = 1;
+    attributes.height = 1;
+    GdkWindow *placeholder = gdk_window_new (gtk_widget_get_parent_window (widget), &attributes, 0);
+    gtk_widget_register_window (widget, placeholder);
+    gtk_widget_set_window (widget, placeholder);
+
+    return window;
+}
+
+static gboolean
+fl_view_snapshot_done_cb (gpointer user_data)
+{
+    SnapshotRequest *request = user_data;
+    FlView *self = request->view;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    priv->evicting = FALSE;
+
+    // Shown again while the snapshot was taken.
+    if (g_atomic_int_get (&priv->visible) || priv->engine == NULL) {
+        g_clear_pointer (&request->snapshot, cairo_surface_destroy);
+    } else {
+        fl_view_set_snapshot (self, g_steal_pointer (&request->snapshot));
+        fl_view_stop_engine (self);
+        fl_renderer_stop (priv->renderer);
+        fl_frame_capture_reset (priv->capture);
+        if (priv->recorder != NULL)
+            fl_frame_recorder_reset (priv->recorder);
+        if (priv->exporter != NULL)
+            fl_frame_exporter_reset (priv->exporter);
+        priv->evicted = TRUE;
+        g_debug ("Evicted hidden view");
+    }
+
+    g_object_unref (request->view);
+    g_free (request);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+fl_view_restart_cb (gpointer user_data)
+{
+    FlView *self = user_data;
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    priv->restart_source = 0;
+
+    // Hidden again before we got to it.
+    if (!g_atomic_int_get (&priv->visible))
+        return G_SOURCE_REMOVE;
+
+    priv->evicted = FALSE;
+    if (fl_renderer_start (priv->renderer, GTK_WIDGET (self)))
+        fl_view_start_engine (self);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Use an engine already running from the pool, with the renderer it is drawing with.
+static gboolean
+fl_view_take_pooled_engine (FlView *self, GType renderer_type)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // Pooled engines use the engine's own threads.
+    if (priv->thread_topology != FL_VIEW_THREAD_TOPOLOGY_DEFAULT)
+        return FALSE;
+
+    // Pooled engines use the snapshots in the assets path.
+    if (fl_view_has_archive_snapshots (self))
+        return FALSE;
+
+    gboolean use_present_thread = renderer_type == fl_renderer_x11_get_type () && priv->use_present_thread;
+    priv->pooled_engine = fl_engine_pool_take (fl_engine_pool_get_default (), renderer_type, use_present_thread,
+                                               priv->assets_path, priv->icu_data_path, priv->dart_entrypoint, priv->memory_budget);
+    if (priv->pooled_engine == NULL)
+        return FALSE;
+
+    priv->renderer = g_object_ref (fl_pooled_engine_get_renderer (priv->pooled_engine));
+    g_mutex_lock (&priv->stats_mutex);
+    priv->used_pooled_engine = TRUE;
+    g_mutex_unlock (&priv->stats_mutex);
+
+    return TRUE;
+}
+
+static void
+fl_view_realize (GtkWidget *widget)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    GtkAllocation allocation;
+    GdkWindow *window;
+    GdkWindowAttr window_attributes;
+    gint window_attributes_mask;
+
+    g_printerr ("fl_view_realize\n");
+
+    gtk_widget_set_realized (widget, TRUE);
+
+    gtk_widget_get_allocation (widget, &allocation);
+
+    window_attributes.window_type = GDK_WINDOW_CHILD;
+    window_attributes.x = allocation.x;
+    window_attributes.y = allocation.y;
+    window_attributes.width = allocation.width;
+    window_attributes.height = allocation.height;
+    window_attributes.wclass = GDK_INPUT_OUTPUT;
+    window_attributes.visual = gtk_widget_get_visual (widget);
+    window_attributes.event_mask = gtk_widget_get_events (widget) | GDK_EXPOSURE_MASK | GDK_VISIBILITY_NOTIFY_MASK |
+                                   GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_POINTER_MOTION_MASK |
+                                   GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK | GDK_LEAVE_NOTIFY_MASK |
+                                   GDK_KEY_PRESS_MASK | GDK_KEY_RELEASE_MASK | GDK_FOCUS_CHANGE_MASK;
+
+    window_attributes_mask = GDK_WA_X | GDK_WA_Y | GDK_WA_VISUAL;
+
+    window = gdk_window_new (gtk_widget_get_parent_window (widget),
+                             &window_attributes, window_attributes_mask);
+    gtk_widget_register_window (widget, window);
+    gtk_widget_set_window (widget, window);
+
+    // The toplevel may already be minimized, and only reports changes from here on.
+    GtkWidget *toplevel = gtk_widget_get_toplevel (widget);
+    if (gtk_widget_is_toplevel (toplevel)) {
+        priv->toplevel = g_object_ref (toplevel);
+        priv->window_state_handler = g_signal_connect_object (toplevel, "window-state-event",
+                                                              G_CALLBACK (fl_view_toplevel_window_state_cb), self, 0);
+        GdkWindow *toplevel_window = gtk_widget_get_window (toplevel);
+        priv->toplevel_state = toplevel_window != NULL ? gdk_window_get_state (toplevel_window) : 0;
+    }
+
+    // Shared with the toplevel, which paces its drawing to the display.
+    GdkFrameClock *frame_clock = gtk_widget_get_frame_clock (widget);
+    if (frame_clock != NULL) {
+        priv->frame_clock = g_object_ref (frame_clock);
+        priv->frame_clock_update_handler = g_signal_connect_object (frame_clock, "update",
+                                                                    G_CALLBACK (fl_view_frame_clock_update_cb), self, 0);
+    }
+
+    FlViewBackend backend = priv->backend;
+    if (backend == FL_VIEW_BACKEND_AUTO)
+        backend = GDK_IS_WAYLAND_DISPLAY (gtk_widget_get_display (widget)) ? FL_VIEW_BACKEND_WAYLAND_EGL : FL_VIEW_BACKEND_X11_EGL;
+    switch (backend)
+    {
+    case FL_VIEW_BACKEND_AUTO:
+    case FL_VIEW_BACKEND_X11_EGL:
+        if (!fl_view_take_pooled_engine (self, fl_renderer_x11_get_type ()))
+            priv->renderer = FL_RENDERER (fl_renderer_x11_new ());
+        fl_renderer_egl_set_use_present_thread (FL_RENDERER_EGL (priv->renderer), priv->use_present_thread);
+        break;
+    case FL_VIEW_BACKEND_GDK_GL:
+        priv->renderer = FL_RENDERER (fl_renderer_gdk_new ());
+        break;
+    case FL_VIEW_BACKEND_WAYLAND_EGL:
+        // Resizing is done by the thread that swaps, which has to be the raster thread.
+        if (priv->use_present_thread)
+            g_warning ("Present thread not supported on Wayland, presenting from the raster thread");
+        if (!fl_view_take_pooled_engine (self, fl_renderer_wayland_get_type ()))
+            priv->renderer = FL_RENDERER (fl_renderer_wayland_new ());
+        break;
+    }
+    fl_renderer_set_size (priv->renderer, allocation.width, allocation.height);
+
+    if (!fl_renderer_start (priv->renderer, widget))
+        return;
+
+    fl_view_start_engine (self);
+}
+
+static void
+fl_view_unrealize (GtkWidget *widget)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // Connected again if the view is realized in another window.
+    if (priv->toplevel != NULL) {
+        g_clear_signal_handler (&priv->window_state_handler, priv->toplevel);
+        g_clear_object (&priv->toplevel);
+    }
+    priv->toplevel_state = 0;
+    if (priv->frame_clock != NULL) {
+        g_clear_signal_handler (&priv->frame_clock_update_handler, priv->frame_clock);
+        g_clear_object (&priv->frame_clock);
+    }
+
+    if (priv->restart_source != 0) {
+        g_source_remove (priv->restart_source);
+        priv->restart_source = 0;
+    }
+
+    // The raster thread draws into the window until the engine has shut down,
+    // so the renderer and window are kept until then. A new renderer is made
+    // if realized again.
+    if (priv->engine != NULL && priv->renderer != NULL) {
+        FlRenderer *renderer = g_steal_pointer (&priv->renderer);
+        fl_view_stop_engine_async (self, renderer, fl_view_detach_window (self));
+    } else {
+        fl_view_stop_engine_async (self, NULL, NULL);
+        if (priv->renderer != NULL) {
+            fl_renderer_stop (priv->renderer);
+            fl_frame_capture_reset (priv->capture);
+            if (priv->recorder != NULL)
+                fl_frame_recorder_reset (priv->recorder);
+            if (priv->exporter != NULL)
+                fl_frame_exporter_reset (priv->exporter);
+            g_clear_object (&priv->renderer);
+        }
+    }
+
+    GTK_WIDGET_CLASS (fl_view_parent_class)->unrealize (widget);
+}
+
+static void
+fl_view_size_allocate (GtkWidget *widget, GtkAllocation *allocation)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_printerr ("fl_view_size_allocate %d %d\n", allocation->width, allocation->height);
+
+    gtk_widget_set_allocation (widget, allocation);
+    if (priv->renderer != NULL)
+        fl_renderer_set_size (priv->renderer, allocation->width, allocation->height);
+
+    if (gtk_widget_get_realized (widget) && gtk_widget_get_has_window (widget))
+        gdk_window_move_resize (gtk_widget_get_window (widget),
+                                allocation->x, allocation->y,
+                                allocation->width, allocation->height);
+
+    fl_view_send_window_metrics (self);
+}
+
+static gboolean
+fl_view_draw (GtkWidget *widget, cairo_t *cr)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // Show the last frame until the restarted engine has drawn one.
+    if (priv->snapshot != NULL && !g_atomic_int_get (&priv->frame_presented)) {
+        cairo_set_source_surface (cr, priv->snapshot, 0, 0);
+        cairo_paint (cr);
+    } else if (priv->engine != NULL && !priv->evicting && g_atomic_int_get (&priv->frame_presented)) {
+        fl_view_repaint (self, cr);
+    }
+
+    return FALSE;
+}
+
+static void
+fl_view_map (GtkWidget *widget)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    GTK_WIDGET_CLASS (fl_view_parent_class)->map (widget);
+
+    priv->mapped = TRUE;
+    fl_view_update_visibility (self);
+}
+
+static void
+fl_view_unmap (GtkWidget *widget)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    priv->mapped = FALSE;
+    fl_view_update_visibility (self);
+
+    GTK_WIDGET_CLASS (fl_view_parent_class)->unmap (widget);
+}
+
+static gboolean
+fl_view_visibility_notify_event (GtkWidget *widget, GdkEventVisibility *event)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    priv->visibility = event->state;
+    fl_view_update_visibility (self);
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static gboolean
+fl_view_button_press_event (GtkWidget *widget, GdkEventButton *event)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // Flutter detects double and triple clicks itself.
+    if (event->type != GDK_BUTTON_PRESS)
+        return GDK_EVENT_STOP;
+
+    int64_t button = get_pointer_button (event->button);
+    if (button == 0 || (priv->pointer_buttons & button) != 0)
+        return GDK_EVENT_PROPAGATE;
+
+    gtk_widget_grab_focus (widget);
+
+    FlutterPointerPhase phase = priv->pointer_buttons == 0 ? kDown : kMove;
+    priv->pointer_buttons |= button;
+    fl_view_send_pointer_event (self, phase, event->x, event->y, 0, 0);
+
+    return GDK_EVENT_STOP;
+}
+
+static gboolean
+fl_view_button_release_event (GtkWidget *widget, GdkEventButton *event)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    int64_t button = get_pointer_button (event->button);
+    if (button == 0 || (priv->pointer_buttons & button) == 0)
+        return GDK_EVENT_PROPAGATE;
+
+    priv->pointer_buttons &= ~button;
+    fl_view_send_pointer_event (self, priv->pointer_buttons == 0 ? kUp : kMove, event->x, event->y, 0, 0);
+
+    return GDK_EVENT_STOP;
+}
+
+static gboolean
+fl_view_motion_notify_event (GtkWidget *widget, GdkEventMotion *event)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    fl_view_send_pointer_event (self, priv->pointer_buttons != 0 ? kMove : kHover, event->x, event->y, 0, 0);
+
+    return GDK_EVENT_STOP;
+}
+
+static gboolean
+fl_view_scroll_event (GtkWidget *widget, GdkEventScroll *event)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    gdouble dx = 0, dy = 0;
+
+    switch (event->direction)
+    {
+    case GDK_SCROLL_UP:
+        dy = -1;
+        break;
+    case GDK_SCROLL_DOWN:
+        dy = 1;
+        break;
+    case GDK_SCROLL_LEFT:
+        dx = -1;
+        break;
+    case GDK_SCROLL_RIGHT:
+        dx = 1;
+        break;
+    case GDK_SCROLL_SMOOTH:
+        dx = event->delta_x;
+        dy = event->delta_y;
+        break;
+    }
+
+    fl_view_send_pointer_event (self, priv->pointer_buttons != 0 ? kMove : kHover, event->x, event->y, dx * SCROLL_STEP, dy * SCROLL_STEP);
+
+    return GDK_EVENT_STOP;
+}
+
+static gboolean
+fl_view_leave_notify_event (GtkWidget *widget, GdkEventCrossing *event)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // Keep getting events while dragging outside the view.
+    if (priv->pointer_added && priv->pointer_buttons == 0)
+        fl_view_send_pointer_event (self, kRemove, event->x, event->y, 0, 0);
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static gboolean
+fl_view_key_event (GtkWidget *widget, GdkEventKey *event)
+{
+    FlView *self = FL_VIEW (widget);
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    // The framework is sent every key, text fields are edited here.
+    gboolean edited = fl_text_input_filter_keypress (priv->text_input, event);
+    return fl_view_send_key_event (self, event) || edited;
+}
+
+static gboolean
+fl_view_focus_out_event (GtkWidget *widget, GdkEventFocus *event)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (FL_VIEW (widget));
+
+    // Keys released while unfocused are never seen.
+    memset (priv->keys_down, 0, sizeof (priv->keys_down));
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static void
+fl_view_class_init (FlViewClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_view_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_view_finalize;
+    GTK_WIDGET_CLASS (klass)->realize = fl_view_realize;
+    GTK_WIDGET_CLASS (klass)->unrealize = fl_view_unrealize;
+    GTK_WIDGET_CLASS (klass)->size_allocate = fl_view_size_allocate;
+    GTK_WIDGET_CLASS (klass)->draw = fl_view_draw;
+    GTK_WIDGET_CLASS (klass)->map = fl_view_map;
+    GTK_WIDGET_CLASS (klass)->unmap = fl_view_unmap;
+    GTK_WIDGET_CLASS (klass)->visibility_notify_event = fl_view_visibility_notify_event;
+    GTK_WIDGET_CLASS (klass)->button_press_event = fl_view_button_press_event;
+    GTK_WIDGET_CLASS (klass)->button_release_event = fl_view_button_release_event;
+    GTK_WIDGET_CLASS (klass)->motion_notify_event = fl_view_motion_notify_event;
+    GTK_WIDGET_CLASS (klass)->scroll_event = fl_view_scroll_event;
+    GTK_WIDGET_CLASS (klass)->leave_notify_event = fl_view_leave_notify_event;
+    GTK_WIDGET_CLASS (klass)->key_press_event = fl_view_key_event;
+    GTK_WIDGET_CLASS (klass)->key_release_event = fl_view_key_event;
+    GTK_WIDGET_CLASS (klass)->focus_out_event = fl_view_focus_out_event;
+    gtk_widget_class_set_accessible_type (GTK_WIDGET_CLASS (klass), fl_view_accessible_get_type ());
+
+    signals[SIGNAL_MESSAGE_QUEUE_DRAINED] = g_signal_new ("message-queue-drained",
+                                                          G_TYPE_FROM_CLASS (klass),
+                                                          G_SIGNAL_RUN_LAST,
+                                                          0,
+                                                          NULL, NULL,
+                                                          NULL,
+                                                          G_TYPE_NONE, 0);
+}
+
+static void
+fl_view_init (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    priv->create_time = g_get_monotonic_time ();
+    priv->pause_when_hidden = TRUE;
+    gtk_widget_set_can_focus (GTK_WIDGET (self), TRUE);
+    g_mutex_init (&priv->expose_mutex);
+    g_mutex_init (&priv->stats_mutex);
+    g_mutex_init (&priv->message_handlers_mutex);
+    priv->message_handlers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) message_handler_unref);
+    g_rw_lock_init (&priv->engine_lock);
+    priv->semantics_tree = fl_semantics_tree_new ();
+    g_mutex_init (&priv->semantics_mutex);
+    priv->semantics_nodes = g_array_new (FALSE, FALSE, sizeof (SemanticsNodeCopy));
+    priv->semantics_data = g_byte_array_new ();
+    priv->semantics_actions = g_ptr_array_new_with_free_func ((GDestroyNotify) semantics_custom_action_free);
+    priv->capture = fl_frame_capture_new ();
+    priv->message_queue = fl_message_queue_new ();
+    g_signal_connect_object (priv->message_queue, "drained",
+                             G_CALLBACK (fl_view_message_queue_drained_cb), self, 0);
+    g_signal_connect_object (fl_memory_monitor_get_default (), "low-memory",
+                             G_CALLBACK (fl_view_low_memory_cb), self, 0);
+    g_signal_connect_object (fl_accessibility_monitor_get_default (), "enabled-changed",
+                             G_CALLBACK (fl_view_accessibility_enabled_changed_cb), self, 0);
+    priv->text_input = fl_text_input_new (self);
+}
+
+FlView *
+fl_view_new (void)
+{
+    return g_object_new (fl_view_get_type (), NULL);
+}
+
+void
+fl_view_set_assets_path (FlView *self, const gchar *assets_path)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    g_free (priv->assets_path);
+    priv->assets_path = g_strdup (assets_path);
+}
+
+void
+fl_view_set_icu_data_path (FlView *self, const gchar *icu_data_path)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    g_free (priv->icu_data_path);
+    priv->icu_data_path = g_strdup (icu_data_path);
+}
+
+void
+fl_view_set_dart_entrypoint (FlView *self, const gchar *entrypoint)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    g_free (priv->dart_entrypoint);
+    priv->dart_entrypoint = g_strdup (entrypoint);
+}
+
+void
+fl_view_set_asset_archive (FlView *self, FlAssetArchive *archive)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (archive == NULL || FL_IS_ASSET_ARCHIVE (archive));
+    g_return_if_fail (priv->engine == NULL);
+
+    g_set_object (&priv->asset_archive, archive);
+    fl_view_clear_snapshots (self);
+}
+
+void
+fl_view_set_memory_budget (FlView *self, gsize budget)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    // The engine's limits are fixed once it is running.
+    if (priv->engine != NULL)
+        g_warning ("Memory budget changed after engine started, engine limits not updated until it restarts");
+
+    priv->memory_budget = budget;
+}
+
+void
+fl_view_get_memory_usage (FlView *self, FlViewMemoryUsage *usage)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (usage != NULL);
+
+    usage->dart_heap_budget = get_budget_share (self, FL_VIEW_DART_HEAP_BUDGET_SHARE);
+    usage->raster_cache_budget = get_budget_share (self, FL_VIEW_RASTER_CACHE_BUDGET_SHARE);
+    usage->texture_pool_budget = get_budget_share (self, TEXTURE_POOL_BUDGET_SHARE);
+    g_mutex_lock (&priv->stats_mutex);
+    usage->texture_pool_size = priv->texture_pool_size;
+    g_mutex_unlock (&priv->stats_mutex);
+    usage->backing_store_pool_budget = get_budget_share (self, BACKING_STORE_BUDGET_SHARE);
+    usage->backing_store_pool_size = priv->renderer != NULL ? fl_renderer_get_buffer_size (priv->renderer) : 0;
+}
+
+gsize
+fl_view_get_engine_size (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_VIEW (self), 0);
+
+    return priv->memory_budget > 0 ? priv->memory_budget : FL_VIEW_DEFAULT_ENGINE_SIZE;
+}
+
+gchar *
+fl_view_apply_memory_budget (FlutterProjectArgs *args, gsize memory_budget, const gchar **argv)
+{
+    if (memory_budget == 0) {
+        args->dart_old_gen_heap_size = -1;
+        return NULL;
+    }
+
+    // The Skia resource cache, which holds the raster cache, is only limited by
+    // an engine switch. The first argument is taken as the executable name.
+    gchar *cache_switch = g_strdup_printf ("--resource-cache-max-bytes-threshold=%" G_GSIZE_FORMAT, memory_budget / 100 * FL_VIEW_RASTER_CACHE_BUDGET_SHARE);
+    args->dart_old_gen_heap_size = MAX (memory_budget / 100 * FL_VIEW_DART_HEAP_BUDGET_SHARE / (1024 * 1024), 1);
+    argv[0] = "flutter";
+    argv[1] = cache_switch;
+    args->command_line_argc = 2;
+    args->command_line_argv = argv;
+
+    return cache_switch;
+}
+
+void
+fl_view_evict (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    if (priv->engine == NULL || priv->evicting)
+        return;
+    priv->evicting = TRUE;
+
+    SnapshotRequest *request = g_new0 (SnapshotRequest, 1);
+    request->view = g_object_ref (self);
+
+    if (!fl_renderer_frame_needs_raster_thread (priv->renderer)) {
+        request->snapshot = fl_renderer_read_frame (priv->renderer);
+        g_idle_add (fl_view_snapshot_done_cb, request);
+        return;
+    }
+
+    // Take a snapshot on the raster thread, which owns the context, then stop the engine.
+    FlutterEngineResult result = FlutterEnginePostRenderThreadTask (priv->engine, fl_view_snapshot_task, request);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to snapshot view: %s", error);
+        g_idle_add (fl_view_snapshot_done_cb, request);
+    }
+}
+
+void
+fl_view_set_backend (FlView *self, FlViewBackend backend)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (!gtk_widget_get_realized (GTK_WIDGET (self)));
+
+    priv->backend = backend;
+}
+
+void
+fl_view_set_use_present_thread (FlView *self, gboolean use_present_thread)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (!gtk_widget_get_realized (GTK_WIDGET (self)));
+
+    priv->use_present_thread = use_present_thread;
+}
+
+void
+fl_view_set_pause_when_hidden (FlView *self, gboolean pause_when_hidden)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    priv->pause_when_hidden = pause_when_hidden;
+    fl_view_update_visibility (self);
+}
+
+void
+fl_view_set_thread_topology (FlView *self, FlViewThreadTopology topology)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (!gtk_widget_get_realized (GTK_WIDGET (self)));
+
+    priv->thread_topology = topology;
+}
+
+void
+fl_view_get_present_stats (FlView *self, FlViewPresentStats *stats)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (stats != NULL);
+
+    memset (stats, 0, sizeof (FlViewPresentStats));
+    g_mutex_lock (&priv->stats_mutex);
+    stats->frames_drawn = priv->frames_drawn;
+    g_mutex_unlock (&priv->stats_mutex);
+    if (priv->renderer != NULL && FL_IS_RENDERER_EGL (priv->renderer))
+        fl_renderer_egl_get_present_stats (FL_RENDERER_EGL (priv->renderer), &stats->queue_depth, &stats->frames_presented, &stats->swap_time);
+    fl_frame_capture_get_stats (priv->capture, &stats->frames_captured, &stats->capture_time);
+    if (priv->recorder != NULL)
+        fl_frame_recorder_get_stats (priv->recorder, &stats->frames_recorded, &stats->frames_dropped, &stats->record_time);
+    if (priv->exporter != NULL)
+        fl_frame_exporter_get_stats (priv->exporter, &stats->frames_exported, &stats->export_bytes_per_frame);
+}
+
+void
+fl_view_get_input_stats (FlView *self, FlViewInputStats *stats)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (stats != NULL);
+
+    g_mutex_lock (&priv->stats_mutex);
+    stats->key_events = priv->key_events;
+    stats->key_events_coalesced = priv->key_events_coalesced;
+    stats->key_latency = priv->key_latency;
+    g_mutex_unlock (&priv->stats_mutex);
+}
+
+void
+fl_view_get_startup_stats (FlView *self, FlViewStartupStats *stats)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (stats != NULL);
+
+    g_mutex_lock (&priv->stats_mutex);
+    stats->first_frame_time = priv->first_frame_time;
+    stats->used_pooled_engine = priv->used_pooled_engine;
+    g_mutex_unlock (&priv->stats_mutex);
+}
+
+void
+fl_view_capture_frame_async (FlView *self, FlViewCaptureFormat format, FlViewCaptureCallback callback, gpointer user_data)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (callback != NULL);
+
+    fl_frame_capture_request (priv->capture, format, callback, user_data);
+    if (priv->engine == NULL) {
+        fl_frame_capture_reset (priv->capture);
+        return;
+    }
+
+    // Have the engine draw a frame to read back.
+    fl_view_send_window_metrics (self);
+
+    fl_view_start_readback_poll (self);
+}
+
+gboolean
+fl_view_start_recording (FlView *self, const gchar *path, GError **error)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+    GtkAllocation allocation;
+
+    g_return_val_if_fail (FL_IS_VIEW (self), FALSE);
+    g_return_val_if_fail (path != NULL, FALSE);
+    g_return_val_if_fail (priv->recorder == NULL, FALSE);
+
+    gtk_widget_get_allocation (GTK_WIDGET (self), &allocation);
+    gint refresh_rate = G_GUINT64_CONSTANT (1000000000000) / fl_view_get_frame_interval (self);
+    FlFrameRecorder *recorder = fl_frame_recorder_new (path, MAX (allocation.width, 1), MAX (allocation.height, 1), refresh_rate, error);
+    if (recorder == NULL)
+        return FALSE;
+
+    g_atomic_pointer_set (&priv->recorder, recorder);
+    fl_view_start_readback_poll (self);
+
+    return TRUE;
+}
+
+void
+fl_view_stop_recording (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    FlFrameRecorder *recorder = g_atomic_pointer_get (&priv->recorder);
+    if (recorder == NULL)
+        return;
+    g_atomic_pointer_set (&priv->recorder, NULL);
+
+    // The raster thread may still be reading a frame into the recorder.
+    fl_view_release_from_raster_thread (self, recorder, (ReleaseBuffersFunc) fl_frame_recorder_release_buffers);
+}
+
+gboolean
+fl_view_start_export (FlView *self, const gchar *socket_path, GError **error)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_VIEW (self), FALSE);
+    g_return_val_if_fail (socket_path != NULL, FALSE);
+    g_return_val_if_fail (priv->exporter == NULL, FALSE);
+
+    FlFrameExporter *exporter = fl_frame_exporter_new (socket_path, error);
+    if (exporter == NULL)
+        return FALSE;
+
+    g_atomic_pointer_set (&priv->exporter, exporter);
+    fl_view_start_readback_poll (self);
+
+    // Send a frame straight away so the receiver has something to show.
+    if (priv->engine != NULL)
+        fl_view_send_window_metrics (self);
+
+    return TRUE;
+}
+
+void
+fl_view_stop_export (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    FlFrameExporter *exporter = g_atomic_pointer_get (&priv->exporter);
+    if (exporter == NULL)
+        return;
+    g_atomic_pointer_set (&priv->exporter, NULL);
+
+    // The raster thread may still be reading a frame into the exporter.
+    fl_view_release_from_raster_thread (self, exporter, (ReleaseBuffersFunc) fl_frame_exporter_release_buffers);
+}
+
+gboolean
+fl_view_start_event_recording (FlView *self, const gchar *path, GError **error)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_VIEW (self), FALSE);
+    g_return_val_if_fail (path != NULL, FALSE);
+    g_return_val_if_fail (priv->event_recorder == NULL, FALSE);
+
+    priv->event_recorder = fl_event_recorder_new (path, error);
+    if (priv->event_recorder == NULL)
+        return FALSE;
+
+    // Start the log with the current size so replays match it.
+    if (priv->engine != NULL)
+        fl_view_send_window_metrics (self);
+
+    return TRUE;
+}
+
+gboolean
+fl_view_stop_event_recording (FlView *self, GError **error)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_VIEW (self), FALSE);
+
+    if (priv->event_recorder == NULL)
+        return TRUE;
+
+    g_autoptr(FlEventRecorder) recorder = g_steal_pointer (&priv->event_recorder);
+    return fl_event_recorder_close (recorder, error);
+}
+
+void
+fl_view_set_message_handler (FlView *self, const gchar *channel, FlViewMessageHandlerFlags flags, guint max_concurrency,
+                             FlViewMessageHandler handler, gpointer user_data, GDestroyNotify destroy_notify)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+    g_return_if_fail (channel != NULL);
+
+    // Messages already sent to the old handler are still handled by it.
+    g_mutex_lock (&priv->message_handlers_mutex);
+    if (handler == NULL) {
+        g_hash_table_remove (priv->message_handlers, channel);
+    } else {
+        MessageHandler *h = g_new0 (MessageHandler, 1);
+        h->ref_count = 1;
+        h->flags = flags;
+        h->max_concurrency = flags & FL_VIEW_MESSAGE_HANDLER_ORDERED ? 1 : max_concurrency;
+        h->handler = handler;
+        h->user_data = user_data;
+        h->destroy_notify = destroy_notify;
+        g_mutex_init (&h->mutex);
+        g_queue_init (&h->backlog);
+        g_hash_table_replace (priv->message_handlers, g_strdup (channel), h);
+    }
+    g_mutex_unlock (&priv->message_handlers_mutex);
+}
+
+void
+fl_view_message_response_send (FlViewMessageResponse *response, GBytes *data)
+{
+    g_return_if_fail (response != NULL);
+
+    FlViewPrivate *priv = fl_view_get_instance_private (response->view);
+    gsize data_length = 0;
+    const guint8 *response_data = data != NULL ? g_bytes_get_data (data, &data_length) : NULL;
+
+    // The message was sent by an engine that has since been shut down.
+    g_rw_lock_reader_lock (&priv->engine_lock);
+    if (priv->engine != NULL && priv->engine_generation == response->engine_generation) {
+        FlutterEngineResult result = FlutterEngineSendPlatformMessageResponse (priv->engine, response->handle, response_data, data_length);
+        if (result != kSuccess) {
+            g_autofree gchar *error = flutter_engine_result_to_string (result);
+            g_warning ("Failed to send message response: %s", error);
+        }
+    }
+    g_rw_lock_reader_unlock (&priv->engine_lock);
+
+    g_idle_add (fl_view_released_cb, response->view);
+    g_free (response);
+}
+
+gboolean
+fl_view_send_message (FlView *self, const gchar *channel, GBytes *message, FlViewMessagePriority priority,
+                      FlViewResponseCallback callback, gpointer user_data)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_VIEW (self), FALSE);
+
+    return fl_message_queue_push (priv->message_queue, channel, message, priority, callback, user_data);
+}
+
+void
+fl_view_set_message_batching (FlView *self, const gchar *channel, gboolean batching)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    fl_message_queue_set_batched (priv->message_queue, channel, batching);
+}
+
+void
+fl_view_set_message_queue_limits (FlView *self, gsize max_bytes, guint max_messages)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    fl_message_queue_set_limits (priv->message_queue, max_bytes, max_messages);
+}
+
+FlSemanticsTree *
+fl_view_get_semantics_tree (FlView *self)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_val_if_fail (FL_IS_VIEW (self), NULL);
+
+    return priv->semantics_tree;
+}
+
+void
+fl_view_dispatch_semantics_action (FlView *self, gint32 id, FlutterSemanticsAction action)
+{
+    FlViewPrivate *priv = fl_view_get_instance_private (self);
+
+    g_return_if_fail (FL_IS_VIEW (self));
+
+    if (priv->engine == NULL)
+        return;
+
+    FlutterEngineResult result = FlutterEngineDispatchSemanticsAction (priv->engine, id, action, NULL, 0);
+    if (result != kSuccess) {
+        g_autofree gchar *error = flutter_engine_result_to_string (result);
+        g_warning ("Failed to dispatch semantics action: %s", error);
+    }
 }
@@ -11,6 +11,8 @@
 
 #include <gtk/gtk.h>
 
+#include "fl-asset-archive.h"
+
 G_BEGIN_DECLS
 
 G_DECLARE_DERIVABLE_TYPE (FlView, fl_view, FL, VIEW, GtkWidget)
@@ -20,10 +22,178 @@ struct _FlViewClass
     GtkWidgetClass parent_class;
 };
 
-FlView *fl_view_new              (void);
+typedef enum
+{
+    // Native EGL backend for the display the view is on.
+    FL_VIEW_BACKEND_AUTO,
+    // EGL surface on a native X window of the view's own.
+    FL_VIEW_BACKEND_X11_EGL,
+    // Textures composited by GTK with the rest of the window.
+    FL_VIEW_BACKEND_GDK_GL,
+    // EGL surface on a Wayland subsurface over the view.
+    FL_VIEW_BACKEND_WAYLAND_EGL
+} FlViewBackend;
+
+typedef enum
+{
+    // Threads created and managed by the engine.
+    FL_VIEW_THREAD_TOPOLOGY_DEFAULT,
+    // Frames are drawn on a real-time thread owned by the view.
+    FL_VIEW_THREAD_TOPOLOGY_RENDER_THREAD,
+    // Platform and render tasks share the GTK main thread, to save memory.
+    FL_VIEW_THREAD_TOPOLOGY_SINGLE_THREAD
+} FlViewThreadTopology;
+
+typedef struct
+{
+    gsize dart_heap_budget;
+    gsize raster_cache_budget;
+    gsize texture_pool_budget;
+    gsize texture_pool_size;
+    gsize backing_store_pool_budget;
+    gsize backing_store_pool_size;
+} FlViewMemoryUsage;
+
+typedef struct
+{
+    // Frames the engine has drawn that the view presented, with any renderer.
+    guint64 frames_drawn;
+    guint queue_depth;
+    guint64 frames_presented;
+    gint64 swap_time;
+    guint64 frames_captured;
+    gint64 capture_time;
+    guint64 frames_recorded;
+    guint64 frames_dropped;
+    gint64 record_time;
+    guint64 frames_exported;
+    gsize export_bytes_per_frame;
+} FlViewPresentStats;
+
+typedef struct
+{
+    guint64 key_events;
+    // Auto-repeated presses dropped while the framework was handling earlier keys.
+    guint64 key_events_coalesced;
+    // Time from the last key press to the next frame presented, in microseconds.
+    gint64 key_latency;
+} FlViewInputStats;
+
+typedef struct
+{
+    // Time from the view being created to its first frame, in microseconds, or 0 if not drawn yet.
+    gint64 first_frame_time;
+    gboolean used_pooled_engine;
+} FlViewStartupStats;
+
+typedef enum
+{
+    // Cairo ARGB32, top-down and premultiplied, with 4 bytes per pixel.
+    FL_VIEW_CAPTURE_FORMAT_ARGB32,
+    FL_VIEW_CAPTURE_FORMAT_PNG
+} FlViewCaptureFormat;
+
+/* Called from a worker thread, with @data NULL if the frame couldn't be captured. */
+typedef void (*FlViewCaptureCallback) (GBytes *data, gint width, gint height, gpointer user_data);
+
+typedef struct _FlViewMessageResponse FlViewMessageResponse;
+
+typedef enum
+{
+    FL_VIEW_MESSAGE_HANDLER_NONE = 0,
+    // Run the handler on a worker thread rather than the main thread.
+    FL_VIEW_MESSAGE_HANDLER_BACKGROUND = 1 << 0,
+    // Handle one message at a time, in the order they were sent.
+    FL_VIEW_MESSAGE_HANDLER_ORDERED = 1 << 1
+} FlViewMessageHandlerFlags;
+
+/* Called for each message sent on a channel, on the main thread or on a worker
+ * thread if registered with FL_VIEW_MESSAGE_HANDLER_BACKGROUND. The handler
+ * must pass @response to fl_view_message_response_send() exactly once, either
+ * before returning or later from any thread. */
+typedef void (*FlViewMessageHandler) (FlView *view, const gchar *channel, GBytes *message, FlViewMessageResponse *response, gpointer user_data);
+
+typedef enum
+{
+    // Input and other messages the UI is waiting on.
+    FL_VIEW_MESSAGE_PRIORITY_HIGH,
+    FL_VIEW_MESSAGE_PRIORITY_NORMAL,
+    // Bulk data, sent with what is left of each frame.
+    FL_VIEW_MESSAGE_PRIORITY_LOW
+} FlViewMessagePriority;
+
+/* Called from an engine thread with the response to a message sent with
+ * fl_view_send_message(). */
+typedef void (*FlViewResponseCallback) (GBytes *response, gpointer user_data);
+
+FlView  *fl_view_new                      (void);
+
+void     fl_view_set_assets_path          (FlView *view, const gchar *assets_path);
+
+void     fl_view_set_icu_data_path        (FlView *view, const gchar *icu_data_path);
+
+/* Runs the Dart function @entrypoint in place of main(). Views are started with
+ * an engine from the pool from fl_engine_pool_get_default() if it has one
+ * running the same project. */
+
+void     fl_view_set_dart_entrypoint      (FlView *view, const gchar *entrypoint);
+
+/* AOT snapshots in @archive are used in place of the engine's own. The engine
+ * reads every other asset, and all of a JIT build, from the assets path. */
+
+void     fl_view_set_asset_archive        (FlView *view, FlAssetArchive *archive);
+
+void     fl_view_set_memory_budget        (FlView *view, gsize budget);
+
+void     fl_view_get_memory_usage         (FlView *view, FlViewMemoryUsage *usage);
+
+void     fl_view_set_backend              (FlView *view, FlViewBackend backend);
+
+void     fl_view_set_use_present_thread   (FlView *view, gboolean use_present_thread);
+
+/* Hidden views stop rendering unless @pause_when_hidden is FALSE. */
+
+void     fl_view_set_pause_when_hidden    (FlView *view, gboolean pause_when_hidden);
+
+/* Views that don't use the default topology never take engines from the pool */
+
+void     fl_view_set_thread_topology      (FlView *view, FlViewThreadTopology topology);
+
+void     fl_view_get_present_stats        (FlView *view, FlViewPresentStats *stats);
+
+void     fl_view_get_input_stats          (FlView *view, FlViewInputStats *stats);
+
+void     fl_view_get_startup_stats        (FlView *view, FlViewStartupStats *stats);
+
+void     fl_view_capture_frame_async      (FlView *view, FlViewCaptureFormat format, FlViewCaptureCallback callback, gpointer user_data);
+
+gboolean fl_view_start_recording          (FlView *view, const gchar *path, GError **error);
+
+void     fl_view_stop_recording           (FlView *view);
+
+gboolean fl_view_start_export             (FlView *view, const gchar *socket_path, GError **error);
+
+void     fl_view_stop_export              (FlView *view);
+
+gboolean fl_view_start_event_recording    (FlView *view, const gchar *path, GError **error);
+
+gboolean fl_view_stop_event_recording     (FlView *view, GError **error);
+
+/* @max_concurrency limits how many messages a background handler runs at once,
+ * or 0 for no limit. Setting a NULL @handler removes the channel's handler. */
+
+void     fl_view_set_message_handler      (FlView *view, const gchar *channel, FlViewMessageHandlerFlags flags, guint max_concurrency, FlViewMessageHandler handler, gpointer user_data, GDestroyNotify destroy_notify);
+
+void     fl_view_message_response_send    (FlViewMessageResponse *response, GBytes *data);
+
+/* Queues a message to the engine, from any thread. Returns FALSE if the queue
+ * is over its limits, in which case the message is still sent but the caller
+ * should wait for the "message-queue-drained" signal before sending more. */
+
+gboolean fl_view_send_message             (FlView *view, const gchar *channel, GBytes *message, FlViewMessagePriority priority, FlViewResponseCallback callback, gpointer user_data);
 
-void    fl_view_set_assets_path   (FlView *view, const gchar *assets_path);
+void     fl_view_set_message_batching     (FlView *view, const gchar *channel, gboolean batching);
 
-void    fl_view_set_icu_data_path (FlView *view, const gchar *icu_data_path);
+void     fl_view_set_message_queue_limits (FlView *view, gsize max_bytes, guint max_messages);
 
 G_END_DECLS
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#include "fl-work-pool.h"
+
+typedef struct
+{
+    FlWorkFunc func;
+    gpointer data;
+} Work;
+
+typedef struct
+{
+    FlWorkPool *pool;
+    guint index;
+    GThread *thread;
+
+    // Work pushed by this thread. This thread takes the newest from the tail,
+    // while it is still in cache, and other threads steal the oldest from the head.
+    GMutex mutex;
+    GQueue queue;
+} Worker;
+
+struct _FlWorkPool
+{
+    GObject parent_instance;
+
+    Worker *workers;
+    guint n_workers;
+
+    // Work pushed from outside the pool, taken oldest first by any worker.
+    GMutex injected_mutex;
+    GQueue injected;
+
+    // Work queued and not yet taken, and workers waiting for more. Pushing
+    // only takes the lock to wake a waiting worker.
+    gint n_queued;
+    gint n_idle;
+
+    // Protects the fields below, and is held while workers check for work before waiting.
+    GMutex mutex;
+    GCond cond;
+    gboolean stopping;
+};
+
+G_DEFINE_TYPE (FlWorkPool, fl_work_pool, G_TYPE_OBJECT)
+
+// Worker for the current thread, if it is in a pool.
+static GPrivate current_worker;
+
+static Work *
+take_work (FlWorkPool *self, Worker *worker)
+{
+    // This worker's own work first, then work from outside, then other workers'.
+    g_mutex_lock (&worker->mutex);
+    Work *work = g_queue_pop_tail (&worker->queue);
+    g_mutex_unlock (&worker->mutex);
+
+    if (work == NULL) {
+        g_mutex_lock (&self->injected_mutex);
+        work = g_queue_pop_head (&self->injected);
+        g_mutex_unlock (&self->injected_mutex);
+    }
+
+    for (guint i = 1; i < self->n_workers && work == NULL; i++) {
+        Worker *w = &self->workers[(worker->index + i) % self->n_workers];
+        g_mutex_lock (&w->mutex);
+        work = g_queue_pop_head (&w->queue);
+        g_mutex_unlock (&w->mutex);
+    }
+
+    if (work != NULL)
+        g_atomic_int_add (&self->n_queued, -1);
+
+    return work;
+}
+
+// Wait until work is queued, returns FALSE if the pool is stopping and there is none left.
+static gboolean
+wait_for_work (FlWorkPool *self)
+{
+    g_mutex_lock (&self->mutex);
+    // Counted before checking, so a push either sees this worker waiting or is seen here.
+    g_atomic_int_inc (&self->n_idle);
+    while (g_atomic_int_get (&self->n_queued) <= 0 && !self->stopping)
+        g_cond_wait (&self->cond, &self->mutex);
+    g_atomic_int_add (&self->n_idle, -1);
+    gboolean have_work = g_atomic_int_get (&self->n_queued) > 0;
+    g_mutex_unlock (&self->mutex);
+
+    return have_work;
+}
+
+static gpointer
+worker_thread (gpointer user_data)
+{
+    Worker *worker = user_data;
+    FlWorkPool *self = worker->pool;
+
+    g_private_set (&current_worker, worker);
+
+    while (TRUE) {
+        Work *work = take_work (self, worker);
+        if (work != NULL) {
+            work->func (work->data);
+            g_free (work);
+            continue;
+        }
+
+        if (!wait_for_work (self))
+            break;
+
+        // Another worker may be taking the work counted, let it get there.
+        if (g_atomic_int_get (&self->n_queued) > 0)
+            g_thread_yield ();
+    }
+
+    return NULL;
+}
+
+static void
+fl_work_pool_dispose (GObject *object)
+{
+    FlWorkPool *self = FL_WORK_POOL (object);
+
+    // Queued work is run before the threads exit.
+    if (self->workers != NULL) {
+        g_mutex_lock (&self->mutex);
+        self->stopping = TRUE;
+        g_cond_broadcast (&self->cond);
+        g_mutex_unlock (&self->mutex);
+        for (guint i = 0; i < self->n_workers; i++) {
+            g_thread_join (self->workers[i].thread);
+            g_mutex_clear (&self->workers[i].mutex);
+        }
+        g_clear_pointer (&self->workers, g_free);
+    }
+
+    G_OBJECT_CLASS (fl_work_pool_parent_class)->dispose (object);
+}
+
+static void
+fl_work_pool_finalize (GObject *object)
+{
+    FlWorkPool *self = FL_WORK_POOL (object);
+
+    g_mutex_clear (&self->injected_mutex);
+    g_mutex_clear (&self->mutex);
+    g_cond_clear (&self->cond);
+
+    G_OBJECT_CLASS (fl_work_pool_parent_class)->finalize (object);
+}
+
+static void
+fl_work_pool_class_init (FlWorkPoolClass *klass)
+{
+    G_OBJECT_CLASS (klass)->dispose = fl_work_pool_dispose;
+    G_OBJECT_CLASS (klass)->finalize = fl_work_pool_finalize;
+}
+
+static void
+fl_work_pool_init (FlWorkPool *self)
+{
+    g_mutex_init (&self->injected_mutex);
+    g_queue_init (&self->injected);
+    g_mutex_init (&self->mutex);
+    g_cond_init (&self->cond);
+}
+
+FlWorkPool *
+fl_work_pool_get_default (void)
+{
+    static FlWorkPool *pool = NULL;
+
+    // Leave a core for the main and raster threads.
+    if (pool == NULL)
+        pool = fl_work_pool_new (MAX (g_get_num_processors () - 1, 2));
+
+    return pool;
+}
+
+FlWorkPool *
+fl_work_pool_new (guint n_threads)
+{
+    g_return_val_if_fail (n_threads > 0, NULL);
+
+    FlWorkPool *self = g_object_new (fl_work_pool_get_type (), NULL);
+
+    self->n_workers = n_threads;
+    self->workers = g_new0 (Worker, n_threads);
+    for (guint i = 0; i < n_threads; i++) {
+        Worker *worker = &self->workers[i];
+        worker->pool = self;
+        worker->index = i;
+        g_mutex_init (&worker->mutex);
+        g_queue_init (&worker->queue);
+    }
+    for (guint i = 0; i < n_threads; i++)
+        self->workers[i].thread = g_thread_new ("fl-work-pool", worker_thread, &self->workers[i]);
+
+    return self;
+}
+
+void
+fl_work_pool_push (FlWorkPool *self, FlWorkFunc func, gpointer data)
+{
+    g_return_if_fail (FL_IS_WORK_POOL (self));
+    g_return_if_fail (func != NULL);
+
+    Work *work = g_new0 (Work, 1);
+    work->func = func;
+    work->data = data;
+
+    // Work pushed by a worker stays with it, where its data is likely in cache.
+    // Work from outside is started in the order it was pushed.
+    Worker *worker = g_private_get (&current_worker);
+    if (worker != NULL && worker->pool == self) {
+        g_mutex_lock (&worker->mutex);
+        g_queue_push_tail (&worker->queue, work);
+        g_mutex_unlock (&worker->mutex);
+    } else {
+        g_mutex_lock (&self->injected_mutex);
+        g_queue_push_tail (&self->injected, work);
+        g_mutex_unlock (&self->injected_mutex);
+    }
+
+    // Counted once queued, so a worker that sees the count can find the work.
+    g_atomic_int_inc (&self->n_queued);
+    if (g_atomic_int_get (&self->n_idle) > 0) {
+        g_mutex_lock (&self->mutex);
+        g_cond_signal (&self->cond);
+        g_mutex_unlock (&self->mutex);
+    }
+}
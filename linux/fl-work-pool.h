@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+G_DECLARE_FINAL_TYPE (FlWorkPool, fl_work_pool, FL, WORK_POOL, GObject)
+
+/* Runs work on a set of threads, each with a queue of its own. Threads take work
+ * from other threads' queues when theirs is empty, so a long piece of work
+ * doesn't hold up the work queued behind it. */
+
+typedef void (*FlWorkFunc) (gpointer data);
+
+FlWorkPool *fl_work_pool_get_default (void);
+
+FlWorkPool *fl_work_pool_new         (guint n_threads);
+
+void        fl_work_pool_push        (FlWorkPool *pool, FlWorkFunc func, gpointer data);
+
+G_END_DECLS
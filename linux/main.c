@@ -1,18 +1,48 @@
 #include <gtk/gtk.h>
 
+#include "fl-prefetcher.h"
 #include "fl-view.h"
 
+#define ASSETS_PATH "./build/flutter_assets"
+
+// Assets packed by "make assets", see fl-asset-archive.h.
+#define ASSET_ARCHIVE_PATH "./build/flutter_assets.pak"
+#define ASSET_ARCHIVE_RESOURCE "/io/flutter/flutter_assets.pak"
+
+static FlAssetArchive *
+load_asset_archive (void)
+{
+    g_autoptr(GError) error = NULL;
+
+#ifdef FL_EMBEDDED_ASSETS
+    FlAssetArchive *archive = fl_asset_archive_new_from_resource (ASSET_ARCHIVE_RESOURCE, &error);
+#else
+    if (!g_file_test (ASSET_ARCHIVE_PATH, G_FILE_TEST_EXISTS))
+        return NULL;
+    FlAssetArchive *archive = fl_asset_archive_new (ASSET_ARCHIVE_PATH, &error);
+#endif
+    if (archive == NULL)
+        g_warning ("Failed to load asset archive: %s", error->message);
+
+    return archive;
+}
+
 int
 main (int argc, char **argv)
 {
+    // Read what the last launch needed while GTK and EGL start up.
+    fl_prefetcher_start (fl_prefetcher_get_default (), ASSETS_PATH);
+
     gtk_init (&argc, &argv);
 
     GtkWidget *window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
     gtk_widget_show (window);
 
     FlView *view = fl_view_new ();
-    fl_view_set_assets_path (view, "./build/flutter_assets");
+    fl_view_set_assets_path (view, ASSETS_PATH);
     fl_view_set_icu_data_path (view, "./linux/flutter/ephemeral/icudtl.dat");
+    g_autoptr(FlAssetArchive) archive = load_asset_archive ();
+    fl_view_set_asset_archive (view, archive);
 
     gtk_widget_show (GTK_WIDGET (view));
     gtk_container_add (GTK_CONTAINER (window), GTK_WIDGET (view));
@@ -0,0 +1,947 @@
+/*
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2 or version 3 of the License.
+ * See http://www.gnu.org/copyleft/lgpl.html the full text of the license.
+ */
+
+// A stand-in for libflutter_engine that implements the embedder ABI without
+// running any Dart or rendering anything. It drives the embedder's callbacks
+// with synthetic load so the embedder's own cost per frame and per message can
+// be measured. Load is configured with environment variables:
+//
+//   FL_STUB_ENGINE_FRAME_RATE     Frames per second, 0 to only draw on resize (60)
+//   FL_STUB_ENGINE_RASTER_TIME    Time spent rasterizing each frame, in microseconds (0)
+//   FL_STUB_ENGINE_MESSAGE_RATE   Platform messages sent per second (0)
+//   FL_STUB_ENGINE_MESSAGE_SIZE   Size of each platform message, in bytes (64)
+//   FL_STUB_ENGINE_MESSAGE_CHANNEL  Channel messages are sent on (flutter/stub)
+//   FL_STUB_ENGINE_TEXT_LENGTH    Bytes of text in a field focused on startup, 0 for none (0)
+//   FL_STUB_ENGINE_TEXT_DELTAS    1 if the text field takes editing deltas (1)
+//
+// Frames are drawn on the embedder's render task runner if it provides one, in
+// place of the stub's own raster thread. Statistics, including the number of
+// threads, are printed when the engine is shut down.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "embedder.h"
+
+const int32_t kFlutterSemanticsNodeIdBatchEnd = -1;
+const int32_t kFlutterSemanticsCustomActionIdBatchEnd = -1;
+
+// Time to wait for the embedder to return a vsync baton, in microseconds.
+#define VSYNC_TIMEOUT 1000000
+
+typedef enum
+{
+    RASTER_FRAME,
+    RASTER_TASK,
+    RASTER_STOP
+} RasterCommandType;
+
+typedef struct
+{
+    FLUTTER_API_SYMBOL(FlutterEngine) engine;
+    RasterCommandType type;
+    VoidCallback callback;
+    void *callback_data;
+} RasterCommand;
+
+typedef struct
+{
+    FLUTTER_API_SYMBOL(FlutterEngine) engine;
+    GSourceFunc function;
+    gpointer data;
+} Task;
+
+struct _FlutterPlatformMessageResponseHandle
+{
+    FlutterDataCallback data_callback;
+    void *user_data;
+};
+
+typedef struct
+{
+    guint64 count;
+    gint64 total_time;
+    gint64 max_time;
+    // Every time added, for percentiles.
+    GArray *times;
+} Timing;
+
+struct _FlutterEngine
+{
+    FlutterRendererConfig config;
+    FlutterPlatformMessageCallback platform_message_callback;
+    VsyncCallback vsync_callback;
+    void *user_data;
+
+    gboolean have_platform_task_runner;
+    FlutterTaskRunnerDescription platform_task_runner;
+    gboolean have_render_task_runner;
+    FlutterTaskRunnerDescription render_task_runner;
+
+    gint frame_rate;
+    gint raster_time;
+    gint message_rate;
+    gint message_size;
+    gchar *message_channel;
+    gint text_length;
+    gboolean text_deltas;
+
+    gboolean running;
+    GThread *ui_thread;
+    GThread *raster_thread;
+    GAsyncQueue *raster_queue;
+
+    // Used from the render task runner in place of the raster thread.
+    guint8 *software_buffer;
+    gboolean raster_stopped;
+
+    // Frames waiting for the raster thread, the UI thread doesn't get more
+    // than a frame ahead like the engine's pipeline.
+    gint frames_queued;
+
+    // Protects the fields below.
+    GMutex mutex;
+    GCond cond;
+    gboolean stopping;
+    gint width;
+    gint height;
+    intptr_t next_baton;
+    intptr_t returned_baton;
+    guint64 next_task;
+    GHashTable *tasks;
+    Timing frames;
+    Timing messages;
+    guint64 messages_received;
+    guint64 bytes_received;
+    guint64 frames_without_vsync;
+    guint64 frames_skipped;
+};
+
+static gint
+get_env_int (const gchar *name, gint default_value)
+{
+    const gchar *value = g_getenv (name);
+    return value != NULL ? atoi (value) : default_value;
+}
+
+static void
+timing_add (FlutterEngine engine, Timing *timing, gint64 time)
+{
+    g_mutex_lock (&engine->mutex);
+    timing->count++;
+    timing->total_time += time;
+    timing->max_time = MAX (timing->max_time, time);
+    if (timing->times == NULL)
+        timing->times = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_array_append_val (timing->times, time);
+    g_mutex_unlock (&engine->mutex);
+}
+
+static gint
+compare_times (gconstpointer a, gconstpointer b)
+{
+    gint64 time_a = *(const gint64 *) a, time_b = *(const gint64 *) b;
+    return time_a < time_b ? -1 : time_a > time_b;
+}
+
+// Sorts the times in @timing.
+static void
+print_timing (const gchar *name, Timing *timing)
+{
+    if (timing->count == 0) {
+        g_printerr ("stub-engine: %s: none\n", name);
+        return;
+    }
+
+    g_array_sort (timing->times, compare_times);
+    gint64 *times = (gint64 *) timing->times->data;
+    guint n_times = timing->times->len;
+    g_printerr ("stub-engine: %s: %" G_GUINT64_FORMAT ", embedder mean %" G_GINT64_FORMAT "us p50 %" G_GINT64_FORMAT "us p90 %" G_GINT64_FORMAT "us p99 %" G_GINT64_FORMAT "us max %" G_GINT64_FORMAT "us\n",
+                name, timing->count, timing->total_time / (gint64) timing->count, times[n_times / 2], times[n_times * 9 / 10], times[n_times * 99 / 100], timing->max_time);
+}
+
+// Threads in the whole process, as counted by the kernel.
+static gint
+count_process_threads (void)
+{
+    g_autofree gchar *status = NULL;
+    if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+        return -1;
+
+    const gchar *threads = strstr (status, "\nThreads:");
+    return threads != NULL ? atoi (threads + strlen ("\nThreads:")) : -1;
+}
+
+static gboolean
+run_task_cb (gpointer user_data)
+{
+    Task *task = user_data;
+    task->function (task->data);
+    g_free (task);
+    return G_SOURCE_REMOVE;
+}
+
+// Run @function on the thread of one of the embedder's task runners, which
+// hands it back with FlutterEngineRunTask().
+static void
+post_task (FlutterEngine engine, const FlutterTaskRunnerDescription *runner, GSourceFunc function, gpointer data)
+{
+    Task *task = g_new0 (Task, 1);
+    task->engine = engine;
+    task->function = function;
+    task->data = data;
+
+    g_mutex_lock (&engine->mutex);
+    guint64 id = ++engine->next_task;
+    g_hash_table_insert (engine->tasks, GUINT_TO_POINTER (id), task);
+    g_mutex_unlock (&engine->mutex);
+
+    FlutterTask flutter_task = { (FlutterTaskRunner) engine, id };
+    runner->post_task_callback (flutter_task, FlutterEngineGetCurrentTime (), runner->user_data);
+}
+
+// Run @function on the platform thread, which is the GTK main loop unless the
+// embedder provided a task runner.
+static void
+post_platform_task (FlutterEngine engine, GSourceFunc function, gpointer data)
+{
+    if (engine->have_platform_task_runner) {
+        post_task (engine, &engine->platform_task_runner, function, data);
+        return;
+    }
+
+    Task *task = g_new0 (Task, 1);
+    task->engine = engine;
+    task->function = function;
+    task->data = data;
+    g_idle_add_full (G_PRIORITY_DEFAULT, run_task_cb, task, NULL);
+}
+
+typedef struct
+{
+    FlutterEngine engine;
+    intptr_t baton;
+} VsyncRequest;
+
+static gboolean
+request_vsync_cb (gpointer user_data)
+{
+    VsyncRequest *request = user_data;
+    request->engine->vsync_callback (request->engine->user_data, request->baton);
+    g_free (request);
+    return G_SOURCE_REMOVE;
+}
+
+typedef struct
+{
+    FlutterEngine engine;
+    FlutterPlatformMessage message;
+    guint8 *data;
+} MessageDelivery;
+
+static gboolean
+deliver_message_cb (gpointer user_data)
+{
+    MessageDelivery *delivery = user_data;
+    FlutterEngine engine = delivery->engine;
+
+    if (engine->platform_message_callback != NULL) {
+        // Freed when the embedder responds.
+        delivery->message.response_handle = g_new0 (FlutterPlatformMessageResponseHandle, 1);
+
+        gint64 start_time = g_get_monotonic_time ();
+        engine->platform_message_callback (&delivery->message, engine->user_data);
+        timing_add (engine, &engine->messages, g_get_monotonic_time () - start_time);
+    }
+
+    g_free (delivery->data);
+    g_free (delivery);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Send @data to the embedder on the platform task runner, which takes ownership of it.
+static void
+post_message (FlutterEngine engine, const gchar *channel, guint8 *data, gsize size)
+{
+    MessageDelivery *delivery = g_new0 (MessageDelivery, 1);
+    delivery->engine = engine;
+    delivery->data = data;
+    delivery->message.struct_size = sizeof (FlutterPlatformMessage);
+    delivery->message.channel = channel;
+    delivery->message.message = delivery->data;
+    delivery->message.message_size = size;
+    post_platform_task (engine, deliver_message_cb, delivery);
+}
+
+static void
+post_text_input_call (FlutterEngine engine, GString *call)
+{
+    gsize size = call->len;
+    post_message (engine, "flutter/textinput", (guint8 *) g_string_free (call, FALSE), size);
+}
+
+// Focus a text field holding text_length bytes with the cursor at the end, as the framework does.
+static void
+open_text_field (FlutterEngine engine)
+{
+    GString *call = g_string_new (NULL);
+    g_string_printf (call,
+                     "{\"method\":\"TextInput.setClient\",\"args\":[1,{\"inputAction\":\"TextInputAction.newline\","
+                     "\"enableDeltaModel\":%s,\"inputType\":{\"name\":\"TextInputType.multiline\"}}]}",
+                     engine->text_deltas ? "true" : "false");
+    post_text_input_call (engine, call);
+
+    call = g_string_new ("{\"method\":\"TextInput.setEditingState\",\"args\":{\"text\":\"");
+    for (gint i = 0; i < engine->text_length; i++)
+        g_string_append_c (call, 'a' + i % 26);
+    g_string_append_printf (call, "\",\"selectionBase\":%d,\"selectionExtent\":%d}}", engine->text_length, engine->text_length);
+    post_text_input_call (engine, call);
+
+    post_text_input_call (engine, g_string_new ("{\"method\":\"TextInput.show\",\"args\":null}"));
+}
+
+// Wait for the embedder to return a vsync baton, as the engine's animator does.
+static gboolean
+wait_for_vsync (FlutterEngine engine)
+{
+    VsyncRequest *request = g_new0 (VsyncRequest, 1);
+    request->engine = engine;
+
+    g_mutex_lock (&engine->mutex);
+    request->baton = ++engine->next_baton;
+    g_mutex_unlock (&engine->mutex);
+
+    post_platform_task (engine, request_vsync_cb, request);
+
+    g_mutex_lock (&engine->mutex);
+    gint64 end_time = g_get_monotonic_time () + VSYNC_TIMEOUT;
+    while (!engine->stopping && engine->returned_baton < engine->next_baton) {
+        if (!g_cond_wait_until (&engine->cond, &engine->mutex, end_time)) {
+            engine->frames_without_vsync++;
+            break;
+        }
+    }
+    gboolean stopping = engine->stopping;
+    g_mutex_unlock (&engine->mutex);
+
+    return !stopping;
+}
+
+static gboolean run_raster_command_cb (gpointer user_data);
+
+static void
+queue_raster (FlutterEngine engine, RasterCommandType type, VoidCallback callback, void *callback_data)
+{
+    RasterCommand *command = g_new0 (RasterCommand, 1);
+    if (type == RASTER_FRAME)
+        g_atomic_int_inc (&engine->frames_queued);
+    command->engine = engine;
+    command->type = type;
+    command->callback = callback;
+    command->callback_data = callback_data;
+    if (engine->have_render_task_runner)
+        post_task (engine, &engine->render_task_runner, run_raster_command_cb, command);
+    else
+        g_async_queue_push (engine->raster_queue, command);
+}
+
+// Plays the part of the UI thread, producing frames and messages at the configured rates.
+static gpointer
+ui_thread (gpointer user_data)
+{
+    FlutterEngine engine = user_data;
+    gint64 frame_interval = engine->frame_rate > 0 ? G_USEC_PER_SEC / engine->frame_rate : 0;
+    gint64 message_interval = engine->message_rate > 0 ? G_USEC_PER_SEC / engine->message_rate : 0;
+    gint64 now = g_get_monotonic_time ();
+    gint64 next_frame = now, next_message = now;
+
+    if (frame_interval == 0 && message_interval == 0)
+        return NULL;
+
+    while (TRUE) {
+        gint64 next_time = G_MAXINT64;
+        if (frame_interval > 0)
+            next_time = MIN (next_time, next_frame);
+        if (message_interval > 0)
+            next_time = MIN (next_time, next_message);
+
+        g_mutex_lock (&engine->mutex);
+        while (!engine->stopping && g_cond_wait_until (&engine->cond, &engine->mutex, next_time));
+        gboolean stopping = engine->stopping;
+        g_mutex_unlock (&engine->mutex);
+        if (stopping)
+            break;
+
+        now = g_get_monotonic_time ();
+        if (message_interval > 0 && now >= next_message) {
+            post_message (engine, engine->message_channel, g_malloc0 (engine->message_size), engine->message_size);
+            next_message += message_interval;
+        }
+        if (frame_interval > 0 && now >= next_frame) {
+            if (engine->vsync_callback != NULL && !wait_for_vsync (engine))
+                break;
+            if (g_atomic_int_get (&engine->frames_queued) < 2) {
+                queue_raster (engine, RASTER_FRAME, NULL, NULL);
+            } else {
+                g_mutex_lock (&engine->mutex);
+                engine->frames_skipped++;
+                g_mutex_unlock (&engine->mutex);
+            }
+            next_frame = MAX (next_frame + frame_interval, g_get_monotonic_time ());
+        }
+    }
+
+    return NULL;
+}
+
+static void
+draw_frame (FlutterEngine engine, guint8 **software_buffer)
+{
+    g_mutex_lock (&engine->mutex);
+    gint width = engine->width, height = engine->height;
+    g_mutex_unlock (&engine->mutex);
+
+    if (width <= 0 || height <= 0)
+        return;
+
+    gint64 start_time = g_get_monotonic_time ();
+    gint64 raster_time = 0;
+    if (engine->config.type == kOpenGL) {
+        FlutterOpenGLRendererConfig *config = &engine->config.open_gl;
+        if (!config->make_current (engine->user_data))
+            return;
+        config->fbo_callback (engine->user_data);
+        if (engine->raster_time > 0) {
+            gint64 raster_start = g_get_monotonic_time ();
+            while (g_get_monotonic_time () - raster_start < engine->raster_time);
+            raster_time = g_get_monotonic_time () - raster_start;
+        }
+        config->present (engine->user_data);
+    } else if (engine->config.type == kSoftware) {
+        gsize row_bytes = (gsize) width * 4;
+        *software_buffer = g_realloc (*software_buffer, row_bytes * height);
+        memset (*software_buffer, 0xff, row_bytes * height);
+        engine->config.software.surface_present_callback (engine->user_data, *software_buffer, row_bytes, height);
+    }
+
+    timing_add (engine, &engine->frames, g_get_monotonic_time () - start_time - raster_time);
+}
+
+static void
+run_raster_command (FlutterEngine engine, RasterCommand *command, guint8 **software_buffer)
+{
+    switch (command->type)
+    {
+    case RASTER_FRAME:
+        draw_frame (engine, software_buffer);
+        g_atomic_int_add (&engine->frames_queued, -1);
+        break;
+    case RASTER_TASK:
+        command->callback (command->callback_data);
+        break;
+    case RASTER_STOP:
+        if (engine->config.type == kOpenGL)
+            engine->config.open_gl.clear_current (engine->user_data);
+        break;
+    }
+}
+
+static gpointer
+raster_thread (gpointer user_data)
+{
+    FlutterEngine engine = user_data;
+    g_autofree guint8 *software_buffer = NULL;
+
+    while (TRUE) {
+        RasterCommand *command = g_async_queue_pop (engine->raster_queue);
+        RasterCommandType type = command->type;
+
+        run_raster_command (engine, command, &software_buffer);
+        g_free (command);
+
+        if (type == RASTER_STOP)
+            break;
+    }
+
+    return NULL;
+}
+
+// Plays the part of the raster thread on the embedder's render task runner.
+static gboolean
+run_raster_command_cb (gpointer user_data)
+{
+    RasterCommand *command = user_data;
+    FlutterEngine engine = command->engine;
+
+    // Left over from before the engine was shut down.
+    if (g_atomic_int_get (&engine->raster_stopped)) {
+        g_free (command);
+        return G_SOURCE_REMOVE;
+    }
+
+    run_raster_command (engine, command, &engine->software_buffer);
+
+    if (command->type == RASTER_STOP) {
+        g_clear_pointer (&engine->software_buffer, g_free);
+        g_mutex_lock (&engine->mutex);
+        g_atomic_int_set (&engine->raster_stopped, TRUE);
+        g_cond_broadcast (&engine->cond);
+        g_mutex_unlock (&engine->mutex);
+    }
+    g_free (command);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+stop_raster (FlutterEngine engine)
+{
+    if (!engine->have_render_task_runner) {
+        queue_raster (engine, RASTER_STOP, NULL, NULL);
+        g_thread_join (engine->raster_thread);
+        return;
+    }
+
+    // Waiting would block the thread the task has to run on, so it is run
+    // straight away as the engine does for synchronous tasks.
+    const FlutterTaskRunnerDescription *runner = &engine->render_task_runner;
+    if (runner->runs_task_on_current_thread_callback (runner->user_data)) {
+        RasterCommand *command = g_new0 (RasterCommand, 1);
+        command->engine = engine;
+        command->type = RASTER_STOP;
+        run_raster_command_cb (command);
+        return;
+    }
+
+    queue_raster (engine, RASTER_STOP, NULL, NULL);
+    g_mutex_lock (&engine->mutex);
+    while (!g_atomic_int_get (&engine->raster_stopped))
+        g_cond_wait (&engine->cond, &engine->mutex);
+    g_mutex_unlock (&engine->mutex);
+}
+
+FlutterEngineResult
+FlutterEngineInitialize (size_t version,
+                         const FlutterRendererConfig *config,
+                         const FlutterProjectArgs *args,
+                         void *user_data,
+                         FLUTTER_API_SYMBOL(FlutterEngine) *engine_out)
+{
+    if (version != FLUTTER_ENGINE_VERSION)
+        return kInvalidLibraryVersion;
+    if (config == NULL || args == NULL || engine_out == NULL)
+        return kInvalidArguments;
+    if (config->type == kOpenGL &&
+        (config->open_gl.make_current == NULL || config->open_gl.clear_current == NULL ||
+         config->open_gl.present == NULL || config->open_gl.fbo_callback == NULL))
+        return kInvalidArguments;
+    if (config->type == kSoftware && config->software.surface_present_callback == NULL)
+        return kInvalidArguments;
+
+    FlutterEngine engine = g_new0 (struct _FlutterEngine, 1);
+    engine->config = *config;
+    engine->platform_message_callback = args->platform_message_callback;
+    engine->vsync_callback = args->vsync_callback;
+    engine->user_data = user_data;
+    if (args->custom_task_runners != NULL && args->custom_task_runners->platform_task_runner != NULL) {
+        engine->have_platform_task_runner = TRUE;
+        engine->platform_task_runner = *args->custom_task_runners->platform_task_runner;
+    }
+    if (args->custom_task_runners != NULL && args->custom_task_runners->render_task_runner != NULL) {
+        engine->have_render_task_runner = TRUE;
+        engine->render_task_runner = *args->custom_task_runners->render_task_runner;
+    }
+
+    engine->frame_rate = get_env_int ("FL_STUB_ENGINE_FRAME_RATE", 60);
+    engine->raster_time = get_env_int ("FL_STUB_ENGINE_RASTER_TIME", 0);
+    engine->message_rate = get_env_int ("FL_STUB_ENGINE_MESSAGE_RATE", 0);
+    engine->message_size = get_env_int ("FL_STUB_ENGINE_MESSAGE_SIZE", 64);
+    engine->message_channel = g_strdup (g_getenv ("FL_STUB_ENGINE_MESSAGE_CHANNEL") != NULL ? g_getenv ("FL_STUB_ENGINE_MESSAGE_CHANNEL") : "flutter/stub");
+    engine->text_length = get_env_int ("FL_STUB_ENGINE_TEXT_LENGTH", 0);
+    engine->text_deltas = get_env_int ("FL_STUB_ENGINE_TEXT_DELTAS", 1) != 0;
+
+    g_mutex_init (&engine->mutex);
+    g_cond_init (&engine->cond);
+    engine->raster_queue = g_async_queue_new ();
+    engine->tasks = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+
+    *engine_out = engine;
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineRunInitialized (FLUTTER_API_SYMBOL(FlutterEngine) engine)
+{
+    if (engine == NULL || engine->running)
+        return kInvalidArguments;
+
+    engine->running = TRUE;
+    if (!engine->have_render_task_runner)
+        engine->raster_thread = g_thread_new ("stub-engine-raster", raster_thread, engine);
+    engine->ui_thread = g_thread_new ("stub-engine-ui", ui_thread, engine);
+    if (engine->text_length > 0)
+        open_text_field (engine);
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineRun (size_t version,
+                  const FlutterRendererConfig *config,
+                  const FlutterProjectArgs *args,
+                  void *user_data,
+                  FLUTTER_API_SYMBOL(FlutterEngine) *engine_out)
+{
+    FlutterEngineResult result = FlutterEngineInitialize (version, config, args, user_data, engine_out);
+    if (result != kSuccess)
+        return result;
+
+    return FlutterEngineRunInitialized (*engine_out);
+}
+
+FlutterEngineResult
+FlutterEngineDeinitialize (FLUTTER_API_SYMBOL(FlutterEngine) engine)
+{
+    if (engine == NULL)
+        return kInvalidArguments;
+
+    if (!engine->running)
+        return kSuccess;
+
+    // Counted while the engine's threads are still running.
+    gint engine_threads = engine->have_render_task_runner ? 1 : 2;
+    gint process_threads = count_process_threads ();
+
+    g_mutex_lock (&engine->mutex);
+    engine->stopping = TRUE;
+    g_cond_broadcast (&engine->cond);
+    g_mutex_unlock (&engine->mutex);
+    g_thread_join (engine->ui_thread);
+    stop_raster (engine);
+    engine->running = FALSE;
+
+    print_timing ("frames", &engine->frames);
+    print_timing ("messages", &engine->messages);
+    g_printerr ("stub-engine: messages received: %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " bytes), frames skipped: %" G_GUINT64_FORMAT ", frames without vsync: %" G_GUINT64_FORMAT "\n",
+                engine->messages_received, engine->bytes_received, engine->frames_skipped, engine->frames_without_vsync);
+    g_printerr ("stub-engine: threads: %d of the engine's own, %d in the process, frames drawn on %s\n",
+                engine_threads, process_threads, engine->have_render_task_runner ? "the embedder's render task runner" : "the raster thread");
+
+    return kSuccess;
+}
+
+static gboolean
+free_engine_cb (gpointer user_data)
+{
+    FlutterEngine engine = user_data;
+
+    g_free (engine->message_channel);
+    g_clear_pointer (&engine->frames.times, g_array_unref);
+    g_clear_pointer (&engine->messages.times, g_array_unref);
+    g_async_queue_unref (engine->raster_queue);
+    g_hash_table_unref (engine->tasks);
+    g_mutex_clear (&engine->mutex);
+    g_cond_clear (&engine->cond);
+    g_free (engine);
+
+    return G_SOURCE_REMOVE;
+}
+
+FlutterEngineResult
+FlutterEngineShutdown (FLUTTER_API_SYMBOL(FlutterEngine) engine)
+{
+    FlutterEngineResult result = FlutterEngineDeinitialize (engine);
+    if (result != kSuccess)
+        return result;
+
+    // Tasks may still be queued on the main loop and refer to the engine, so it
+    // is freed once they have run.
+    g_idle_add_full (G_PRIORITY_LOW, free_engine_cb, engine, NULL);
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineSendWindowMetricsEvent (FLUTTER_API_SYMBOL(FlutterEngine) engine, const FlutterWindowMetricsEvent *event)
+{
+    if (engine == NULL || event == NULL)
+        return kInvalidArguments;
+
+    g_mutex_lock (&engine->mutex);
+    engine->width = event->width;
+    engine->height = event->height;
+    g_mutex_unlock (&engine->mutex);
+
+    // The engine always draws a frame at the new size.
+    if (engine->running)
+        queue_raster (engine, RASTER_FRAME, NULL, NULL);
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineSendPointerEvent (FLUTTER_API_SYMBOL(FlutterEngine) engine, const FlutterPointerEvent *events, size_t events_count)
+{
+    return engine != NULL && events != NULL ? kSuccess : kInvalidArguments;
+}
+
+typedef struct
+{
+    const FlutterPlatformMessageResponseHandle *handle;
+} Response;
+
+static gboolean
+respond_cb (gpointer user_data)
+{
+    Response *response = user_data;
+    response->handle->data_callback (NULL, 0, response->handle->user_data);
+    g_free (response);
+    return G_SOURCE_REMOVE;
+}
+
+FlutterEngineResult
+FlutterEngineSendPlatformMessage (FLUTTER_API_SYMBOL(FlutterEngine) engine, const FlutterPlatformMessage *message)
+{
+    if (engine == NULL || message == NULL || message->channel == NULL)
+        return kInvalidArguments;
+
+    g_mutex_lock (&engine->mutex);
+    engine->messages_received++;
+    engine->bytes_received += message->message_size;
+    g_mutex_unlock (&engine->mutex);
+
+    // No handlers, so the framework replies with an empty response.
+    if (message->response_handle != NULL && message->response_handle->data_callback != NULL) {
+        Response *response = g_new0 (Response, 1);
+        response->handle = message->response_handle;
+        post_platform_task (engine, respond_cb, response);
+    }
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterPlatformMessageCreateResponseHandle (FLUTTER_API_SYMBOL(FlutterEngine) engine,
+                                            FlutterDataCallback data_callback,
+                                            void *user_data,
+                                            FlutterPlatformMessageResponseHandle **response_out)
+{
+    if (engine == NULL || data_callback == NULL || response_out == NULL)
+        return kInvalidArguments;
+
+    FlutterPlatformMessageResponseHandle *handle = g_new0 (FlutterPlatformMessageResponseHandle, 1);
+    handle->data_callback = data_callback;
+    handle->user_data = user_data;
+    *response_out = handle;
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterPlatformMessageReleaseResponseHandle (FLUTTER_API_SYMBOL(FlutterEngine) engine, FlutterPlatformMessageResponseHandle *response)
+{
+    if (engine == NULL || response == NULL)
+        return kInvalidArguments;
+
+    g_free (response);
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineSendPlatformMessageResponse (FLUTTER_API_SYMBOL(FlutterEngine) engine,
+                                          const FlutterPlatformMessageResponseHandle *handle,
+                                          const uint8_t *data,
+                                          size_t data_length)
+{
+    if (engine == NULL || handle == NULL)
+        return kInvalidArguments;
+
+    g_free ((FlutterPlatformMessageResponseHandle *) handle);
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+__FlutterEngineFlushPendingTasksNow (void)
+{
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineRegisterExternalTexture (FLUTTER_API_SYMBOL(FlutterEngine) engine, int64_t texture_identifier)
+{
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineUnregisterExternalTexture (FLUTTER_API_SYMBOL(FlutterEngine) engine, int64_t texture_identifier)
+{
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineMarkExternalTextureFrameAvailable (FLUTTER_API_SYMBOL(FlutterEngine) engine, int64_t texture_identifier)
+{
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineUpdateSemanticsEnabled (FLUTTER_API_SYMBOL(FlutterEngine) engine, bool enabled)
+{
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineUpdateAccessibilityFeatures (FLUTTER_API_SYMBOL(FlutterEngine) engine, FlutterAccessibilityFeature features)
+{
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineDispatchSemanticsAction (FLUTTER_API_SYMBOL(FlutterEngine) engine,
+                                      uint64_t id,
+                                      FlutterSemanticsAction action,
+                                      const uint8_t *data,
+                                      size_t data_length)
+{
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineOnVsync (FLUTTER_API_SYMBOL(FlutterEngine) engine,
+                      intptr_t baton,
+                      uint64_t frame_start_time_nanos,
+                      uint64_t frame_target_time_nanos)
+{
+    if (engine == NULL)
+        return kInvalidArguments;
+
+    g_mutex_lock (&engine->mutex);
+    engine->returned_baton = MAX (engine->returned_baton, baton);
+    g_cond_broadcast (&engine->cond);
+    g_mutex_unlock (&engine->mutex);
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineReloadSystemFonts (FLUTTER_API_SYMBOL(FlutterEngine) engine)
+{
+    return kSuccess;
+}
+
+void
+FlutterEngineTraceEventDurationBegin (const char *name)
+{
+}
+
+void
+FlutterEngineTraceEventDurationEnd (const char *name)
+{
+}
+
+void
+FlutterEngineTraceEventInstant (const char *name)
+{
+}
+
+FlutterEngineResult
+FlutterEnginePostRenderThreadTask (FLUTTER_API_SYMBOL(FlutterEngine) engine, VoidCallback callback, void *callback_data)
+{
+    if (engine == NULL || callback == NULL || !engine->running)
+        return kInvalidArguments;
+
+    queue_raster (engine, RASTER_TASK, callback, callback_data);
+
+    return kSuccess;
+}
+
+uint64_t
+FlutterEngineGetCurrentTime (void)
+{
+    return (uint64_t) g_get_monotonic_time () * 1000;
+}
+
+FlutterEngineResult
+FlutterEngineRunTask (FLUTTER_API_SYMBOL(FlutterEngine) engine, const FlutterTask *task)
+{
+    if (engine == NULL || task == NULL)
+        return kInvalidArguments;
+
+    g_mutex_lock (&engine->mutex);
+    Task *found_task = g_hash_table_lookup (engine->tasks, GUINT_TO_POINTER (task->task));
+    g_hash_table_steal (engine->tasks, GUINT_TO_POINTER (task->task));
+    g_mutex_unlock (&engine->mutex);
+    if (found_task == NULL)
+        return kInvalidArguments;
+
+    run_task_cb (found_task);
+
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineUpdateLocales (FLUTTER_API_SYMBOL(FlutterEngine) engine, const FlutterLocale **locales, size_t locales_count)
+{
+    return kSuccess;
+}
+
+bool
+FlutterEngineRunsAOTCompiledDartCode (void)
+{
+    return false;
+}
+
+FlutterEngineResult
+FlutterEnginePostDartObject (FLUTTER_API_SYMBOL(FlutterEngine) engine, FlutterEngineDartPort port, const FlutterEngineDartObject *object)
+{
+    return kSuccess;
+}
+
+FlutterEngineResult
+FlutterEngineNotifyLowMemoryWarning (FLUTTER_API_SYMBOL(FlutterEngine) engine)
+{
+    return kSuccess;
+}
+
+typedef struct
+{
+    FlutterNativeThreadCallback callback;
+    void *user_data;
+} NativeThreadCallback;
+
+static void
+native_thread_task (void *user_data)
+{
+    NativeThreadCallback *data = user_data;
+    data->callback (kFlutterNativeThreadTypeRender, data->user_data);
+    g_free (data);
+}
+
+FlutterEngineResult
+FlutterEnginePostCallbackOnAllNativeThreads (FLUTTER_API_SYMBOL(FlutterEngine) engine,
+                                             FlutterNativeThreadCallback callback,
+                                             void *user_data)
+{
+    if (engine == NULL || callback == NULL || !engine->running)
+        return kInvalidArguments;
+
+    // The stub only has the platform and raster threads of its own.
+    NativeThreadCallback *data = g_new0 (NativeThreadCallback, 1);
+    data->callback = callback;
+    data->user_data = user_data;
+    queue_raster (engine, RASTER_TASK, native_thread_task, data);
+
+    return kSuccess;
+}